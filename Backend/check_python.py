@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Checks of the Python module (mdgen, built by make python).
+
+Each check prints one line, "name : ok (largest error)" or "name : FAILED (largest error)", as mdgen_check does, and the
+script exits with the number of failures. The module is looked for next to this script (where make python moves it)
+and then on the usual path.
+
+views compares the arrays handed out with the engine's memory across timesteps and after the Simulation is deleted; errors
+checks the exceptions raised for a misuse; forces compares the accelerations after initialize() with a NumPy sum over the
+pairs of a lattice written through the position array; energies compares the kinetic energies and the momentum with sums
+over the velocity array, and checks that the energy is conserved.
+
+Example :
+    python3 check_python.py
+    python3 check_python.py forces energies
+"""
+
+import os
+import sys
+
+import numpy as np
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mdgen
+
+# 256 Lennard-Jones particles of mass 1 at density 0.8, with a timestep of 0.001 for 1000 timesteps
+N = 256
+BOX = (N/0.8)**(1/3)
+INPUT = "1,3,%d,0.001,1,1,1,1,1" % N
+CUTOFF = 2.5
+
+
+def build():
+    """A Simulation on a jittered simple cubic lattice with Gaussian velocities (written through the arrays), initialized."""
+    sim = mdgen.Simulation(INPUT, [BOX]*3)
+    sim.set_interaction(0, 0, "lj_periodic", [1, 1, CUTOFF])
+    rng = np.random.default_rng(1)
+    side = int(np.ceil(N**(1/3) - 1e-9))
+    a = BOX/side
+    g = np.arange(N)
+    lattice = np.stack([g % side, (g//side) % side, g//(side*side)], axis=1)
+    sim.position(0)[:] = (lattice + 0.5)*a + rng.uniform(-0.05*a, 0.05*a, (N, 3))
+    sim.velocity(0)[:] = rng.normal(0, 1, (N, 3))
+    sim.initialize()
+    return sim
+
+
+def check_views():
+    sim = build()
+    position = sim.position(0)
+    before = position.ctypes.data
+    sim.step(20)
+    same = np.shares_memory(position, sim.position(0)) and np.array_equal(position, sim.position(0))
+    same = same and position.ctypes.data == before and np.shares_memory(sim.energy_kinetic, sim.energy_kinetic)
+    # A write through one view is seen through another, and the views outlive the Simulation
+    velocity = sim.velocity(0)
+    velocity[3, 1] = 7.0
+    seen = sim.velocity(0)[3, 1] == 7.0
+    del sim
+    alive = np.isfinite(position).all() and velocity[3, 1] == 7.0
+    return same and seen and alive, "same memory %d, writes seen %d, alive after del %d" % (same, seen, alive)
+
+
+def check_errors():
+    raised = []
+    sim = mdgen.Simulation(INPUT, [BOX]*3)
+    for call, error in [(lambda: sim.step(1), RuntimeError), (lambda: sim.position(1), IndexError),
+                        (lambda: sim.initialize(), ValueError), (lambda: sim.sample_energies(0), ValueError),
+                        (lambda: mdgen.Simulation(INPUT, [BOX]*2), ValueError),
+                        (lambda: sim.set_interaction(0, 0, "no_such_interaction", [1]), ValueError)]:
+        try:
+            call()
+            raised.append(False)
+        except error:
+            raised.append(True)
+    return all(raised), "%d of %d misuses raised" % (sum(raised), len(raised))
+
+
+def check_forces():
+    sim = build()
+    r = sim.position(0)
+    d = r[:, None, :] - r[None, :, :]
+    d -= BOX*np.round(d/BOX)
+    r2 = (d*d).sum(axis=2)
+    np.fill_diagonal(r2, np.inf)
+    inv6 = np.where(r2 < CUTOFF*CUTOFF, r2**-3, 0)
+    # F(r)/r of 4(r^-12 - r^-6), and the mass is 1
+    acceleration = ((24*inv6*(2*inv6 - 1)/r2)[:, :, None]*d).sum(axis=1)
+    error = np.abs(sim.acceleration(0) - acceleration).max()/np.abs(acceleration).max()
+    return error < 1e-10, "acceleration %g" % error
+
+
+def check_energies():
+    sim = build()
+    sim.sample_energies(1)
+    error_kinetic = error_momentum = drift = 0.0
+    first = None
+    for step in range(200):
+        sim.step(1)
+        v = sim.velocity(0)
+        kinetic = sim.mass[0]*(v*v).sum()
+        error_kinetic = max(error_kinetic, abs(sim.energy_kinetic[0] - kinetic)/kinetic)
+        error_momentum = max(error_momentum, np.abs(sim.momentum - sim.mass[0]*v.sum(axis=0)).max()/np.abs(v).sum())
+        energy = sim.energy_potential + 0.5*sim.energy_kinetic[0]
+        first = (energy, 0.5*kinetic) if first is None else first
+        drift = max(drift, abs(energy - first[0])/first[1])
+    ok = error_kinetic < 1e-12 and error_momentum < 1e-12 and drift < 1e-3 and sim.state == 200
+    return ok, "kinetic energy %g momentum %g energy drift %g" % (error_kinetic, error_momentum, drift)
+
+
+CHECKS = [("views", check_views), ("errors", check_errors), ("forces", check_forces), ("energies", check_energies)]
+
+
+def main():
+    names = sys.argv[1:]
+    failures = 0
+    for name, run in CHECKS:
+        if names and name not in names:
+            continue
+        ok, detail = run()
+        print("%s : %s (%s)" % (name, "ok" if ok else "FAILED", detail), flush=True)
+        failures += not ok
+    return failures
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,78 @@
+/** @file */
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "algorithm_constants.h"
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief State of the adaptive timestep (see initialize_adaptive_timestep())
+	 *
+	 * simulation::timestep stays the timestep of the clock : sim.time, sim.state, the strides of the observables and the
+	 * thermostats and barostat all still advance by it. Each timestep is integrated as inner_steps Leapfrog steps of
+	 * timestep/inner_steps, the number of inner steps being chosen from the largest velocity and acceleration so that no particle
+	 * moves further than max_displacement in one inner step.
+	 */
+	class timestep_control
+	{
+	public:
+		int active; ///< 1 once initialize_adaptive_timestep() has been called (md_step() then uses integrate_adaptive())
+		int mode; ///< ADAPT_FREE or ADAPT_SYMPLECTIC
+		double dt_min; ///< Shortest inner step allowed
+		double max_displacement; ///< Largest distance a particle may move in one inner step
+		double energy_tolerance; ///< Largest change of the total energy between two checks, relative to the kinetic energy (0 : not checked)
+		int interval; ///< Timesteps between two choices of the inner step (and two checks of the energy)
+		int inner_steps; ///< Inner steps in the current timestep
+		int max_inner_steps; ///< Most inner steps in a timestep (from dt_min)
+		int hold; ///< 1 if the inner step was shortened by the energy check, so is not lengthened at the next choice
+		double energy_reference; ///< Total energy at the last check
+		int energy_reference_valid; ///< 0 until the first check
+		long total_inner_steps; ///< Inner steps taken since initialize_adaptive_timestep()
+		long clamped; ///< Timesteps in which the bounds wanted a shorter inner step than dt_min
+
+		timestep_control() : active(0), mode(ADAPT_FREE), dt_min(0), max_displacement(0), energy_tolerance(0), interval(ADAPT_INTERVAL),
+			inner_steps(1), max_inner_steps(1), hold(0), energy_reference(0), energy_reference_valid(0), total_inner_steps(0), clamped(0) {}
+	};
+}
+
+/*******************************************************************************
+ * \brief Switches the simulation to the adaptive timestep
+ *
+ * With ADAPT_FREE, the number of inner steps may be any integer, and is chosen again every interval timesteps (interval 1 : every timestep).
+ * With ADAPT_SYMPLECTIC, it is a power of 2 and only changes every interval timesteps, and is only doubled back if the longer step is
+ * within ADAPT_HYSTERESIS of the bounds : between two changes, the integrator is the plain (symplectic) Leapfrog. \n
+ * In both modes, a timestep whose inner step would break the displacement bound is made shorter at once. If energy_tolerance > 0,
+ * the energies are computed every interval timesteps (see energy_due()) and the inner steps are doubled if the total energy has changed
+ * by more than energy_tolerance times the kinetic energy since the last check (only without thermostats and barostat). \n
+ * Error 0017 if dt_min <= 0 or dt_min > sim.timestep, max_displacement <= 0, energy_tolerance < 0, interval < 1, the mode is not valid,
+ * or r-RESPA or the event-driven dynamics are in use.
+ *
+ * @param sim Simulation being used
+ * @param mode ADAPT_FREE or ADAPT_SYMPLECTIC
+ * @param dt_min Shortest inner step allowed (the longest is sim.timestep)
+ * @param max_displacement Largest distance a particle may move in one inner step
+ * @param energy_tolerance Largest relative change of the total energy between two checks (0 : not checked)
+ * @param interval Timesteps between two choices of the inner step
+ ******************************************************************************/
+void initialize_adaptive_timestep(System::simulation& sim, int mode, double dt_min, double max_displacement, double energy_tolerance = 0, int interval = ADAPT_INTERVAL);
+
+/*******************************************************************************
+ * \brief Chooses the number of inner steps of the coming timestep (sim.adaptive.inner_steps)
+ *
+ * The inner step dt is the longest for which \f$ v_{max} dt + a_{max} dt^2/2 \f$ <= max_displacement, \f$ v_{max} \f$ and
+ * \f$ a_{max} \f$ being the largest speed and acceleration over all the particles.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void adaptive_choose(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Checks the change of the total energy since the last check, after a timestep in which the energies were computed
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void adaptive_check_energy(System::simulation& sim);
+
+#endif
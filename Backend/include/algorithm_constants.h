@@ -8,5 +8,73 @@
 //Constants for Anderson Thermostat
 #define ANDERSON_NU 0.1
 
+//Constants for the mean squared displacement
+#define MSD_STRIDE 10 //Timesteps between two samples
+#define MSD_LENGTH 100 //Number of lags (in samples) for which the MSD is accumulated
+#define MSD_ORIGINS 20 //Maximum number of time origins stored at once
+#define MSD_ORIGIN_SPACING 5 //Samples between two consecutive time origins
+
+//Constants for the static structure factor
+#define SK_STRIDE 100 //Timesteps between two samples
+#define SK_SHELLS 20 //Number of shells of width 2*pi/L used when no |k|max is given
+#define SK_BLOCK 1024 //Particles for which the exponential factors are stored at once
+
+//Levels of the interactions in the r-RESPA integrator (see interaction_level)
+#define RESPA_ALL -1 //Not a level : every interaction in full, as without r-RESPA
+#define RESPA_INNER 0 //The whole interaction is computed at every inner timestep
+#define RESPA_OUTER 1 //The whole interaction is computed once per (outer) timestep
+#define RESPA_SPLIT 2 //Switched between the two levels : S(r)F(r) at every inner timestep and (1-S(r))F(r) once per timestep
+#define RESPA_SKIN 0.3 //Skin (in units of sigma) of the pair list of the inner part of the split interactions
+
+//Constants for the bond constraints (SHAKE, RATTLE)
+#define CONSTRAINT_TOLERANCE 1e-10 //Relative tolerance on the bond lengths and on the relative velocities along the bonds
+#define CONSTRAINT_MAX_ITERATIONS 1000 //Largest number of iterations over a group before Error 0013
+
+//Constants for the particle-mesh Ewald electrostatics
+#define PME_ORDER 4 //Order (number of grid points along each dimension) of the B-splines spreading the charges
+#define PME_ACCURACY 1e-3 //Default RMS force error, relative to the force between two unit charges at unit distance
+#define PME_TUNING_SEED 12345 //Seed of the random positions on which the error of the grid is measured
+
+//Modes of the adaptive timestep (see initialize_adaptive_timestep())
+#define ADAPT_FREE 0 //Any number of inner steps per timestep, chosen again at every timestep
+#define ADAPT_SYMPLECTIC 1 //A power of 2 inner steps per timestep, only changed every interval timesteps (or at once if the bounds are broken)
+#define ADAPT_INTERVAL 10 //Default number of timesteps between two choices of the inner step (ADAPT_SYMPLECTIC) or checks of the energy
+#define ADAPT_HYSTERESIS 0.8 //ADAPT_SYMPLECTIC only takes twice longer inner steps if they are within this fraction of the bounds
+
+//Constants for the deterministic reductions (MDGEN_DETERMINISTIC, see reduce.h)
+#define DETERMINISTIC_BLOCK 256 //Items summed in order into each partial sum
+
+//Constants for the live stream into shared memory (see open_live_stream())
+#define STREAM_POSITIONS 1 //Fields of the frames : positions of the particles
+#define STREAM_VELOCITIES 2 //Velocities of the particles
+#define STREAM_ENERGIES 4 //Energies, temperatures and virial (computed in the timesteps at which a frame is due)
+#define STREAM_STRIDE 10 //Default number of timesteps between two frames
+#define STREAM_MIN_INTERVAL 0.05 //Default shortest wall-clock time between two frames, in seconds
+#define STREAM_SLOTS 4 //Default number of frames in the ring
+#define STREAM_MAGIC 0x314d52545347444dULL //"MDGSTRM1" in little endian, at the start of the shared memory
+#define STREAM_VERSION 1 //Version of the layout of stream_header and stream_slot
+
+//Constants for the asynchronous observables (see register_async_observable())
+#define PIPELINE_THREADS 1 //Default number of threads taken from the team to sample the asynchronous observables
+
+//Constants for the load balance of the force loops (see initialize_load_balance())
+#define BALANCE_INTERVAL 10 //Default number of calls of a loop between two partitions of its rows
+#define BALANCE_BLOCK 16 //Default number of rows per block (the unit of the partition and of the timings)
+#define BALANCE_SMOOTHING 0.5 //Weight of the last timing of a block in its smoothed cost
+
+//Entries of the orientation of a particle : a unit quaternion (q0, q1, q2, q3)
+#define ORIENTATION_SIZE 4
+
+//Constants for the particle arena
+#define ARENA_ALIGN 64 //Alignment of the arena and of every array of at least this many bytes in it
+#define ARENA_HUGEPAGE_SIZE 2097152 //Size of a huge page
+#ifndef ARENA_HUGEPAGES
+#ifdef MDGEN_NUMA
+#define ARENA_HUGEPAGES 0 //A huge page is placed as a whole on the node of the first thread touching it, which would undo the first-touch placement
+#else
+#define ARENA_HUGEPAGES 1 //0 : normal pages, 1 : transparent huge pages (madvise), 2 : explicit huge pages (MAP_HUGETLB, falls back to 1 if none are reserved)
+#endif
+#endif
+
 
 #endif
\ No newline at end of file
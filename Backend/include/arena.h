@@ -0,0 +1,146 @@
+/** @file */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+#include "algorithm_constants.h"
+
+namespace System{
+	/**
+	 * \brief A single block of memory which hands out consecutive (bump) allocations
+	 *
+	 * The block is ARENA_ALIGN aligned and, depending on ARENA_HUGEPAGES, backed by transparent or explicit huge pages.
+	 * Memory is only given back when the arena is destroyed. Allocations which do not fit anymore are taken from the heap.
+	 */
+	class arena
+	{
+	public:
+		/**
+		 * \brief Maps a block of (at least) bytes bytes
+		 *
+		 * Throws std::bad_alloc if the block cannot be mapped
+		 */
+		arena(size_t bytes);
+		~arena();
+		arena(const arena&) = delete;
+		arena& operator=(const arena&) = delete;
+
+		/**
+		 * \brief Returns bytes bytes aligned to align from the block (or from the heap if the block is full)
+		 */
+		void* allocate(size_t bytes, size_t align);
+
+		/**
+		 * \brief Gives back memory from allocate() (only memory from the heap is actually freed)
+		 */
+		void deallocate(void* p, size_t bytes, size_t align);
+
+		char* begin() { return base; } ///< Start of the block
+		const char* begin() const { return base; }
+		bool owns(const void* p) const { return (const char*)p >= base && (const char*)p < base + capacity; }
+		size_t size() const { return capacity; } ///< Usable size of the block
+		size_t used() const { return offset.load(); } ///< Bytes handed out from the block so far
+		int huge_pages() const { return huge; } ///< Backing of the block (0 : normal pages, 1 : transparent huge pages, 2 : explicit huge pages)
+
+	private:
+		char* base; ///< Start of the block (ARENA_ALIGN aligned)
+		size_t capacity; ///< Usable size of the block
+		std::atomic<size_t> offset; ///< Bytes handed out so far
+		void* mapping; ///< Start of the mapping (may be before base because of the alignment)
+		size_t mapped; ///< Size of the mapping
+		int huge; ///< Backing of the block
+	};
+
+	// Alignment of an allocation of n objects of type T : ARENA_ALIGN for arrays of at least ARENA_ALIGN bytes, else natural (so small rows are packed)
+	template <class T>
+	inline size_t arena_alignment(size_t n)
+	{
+		return (n*sizeof(T) >= ARENA_ALIGN) ? ARENA_ALIGN : alignof(T);
+	}
+
+	/**
+	 * \brief Standard allocator drawing from a shared arena
+	 *
+	 * Copies of a container keep drawing from the same arena. A default constructed allocator (no arena) uses the heap,
+	 * with the same alignment. deallocate() is a no-op for memory from the arena.
+	 */
+	template <class T>
+	class arena_allocator
+	{
+	public:
+		typedef T value_type;
+		typedef std::true_type propagate_on_container_swap;
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::false_type propagate_on_container_copy_assignment;
+		typedef std::false_type is_always_equal;
+
+		std::shared_ptr<arena> source; ///< Arena the allocations are taken from (NULL for the heap)
+
+		arena_allocator() {}
+		arena_allocator(std::shared_ptr<arena> a) : source(a) {}
+		template <class U>
+		arena_allocator(const arena_allocator<U>& other) : source(other.source) {}
+
+		T* allocate(size_t n)
+		{
+			size_t align = arena_alignment<T>(n);
+			if(source)
+			{
+				return (T*)source->allocate(n*sizeof(T), align);
+			}
+			return (T*)::operator new(n*sizeof(T), std::align_val_t(align));
+		}
+
+		void deallocate(T* p, size_t n)
+		{
+			size_t align = arena_alignment<T>(n);
+			if(source)
+			{
+				source->deallocate(p, n*sizeof(T), align);
+			}
+			else
+			{
+				::operator delete(p, std::align_val_t(align));
+			}
+		}
+
+		template <class U>
+		bool operator==(const arena_allocator<U>& other) const { return source == other.source; }
+		template <class U>
+		bool operator!=(const arena_allocator<U>& other) const { return source != other.source; }
+	};
+
+	typedef std::vector<double, arena_allocator<double>> particle_row; ///< n_dimensions values of one particle
+	typedef std::vector<particle_row, arena_allocator<particle_row>> particle_array; ///< Rows of all the particles of one type (contiguous in the arena)
+	typedef std::vector<int, arena_allocator<int>> particle_row_int; ///< n_dimensions integers of one particle
+	typedef std::vector<particle_row_int, arena_allocator<particle_row_int>> particle_array_int; ///< Integer rows of all the particles of one type
+
+	/*******************************************************************************
+	 * \brief Returns an upper bound of the arena bytes used by n_arrays particle_array of T rows for every type
+	 *
+	 * Includes the row headers, the values and the alignment of every allocation.
+	 *
+	 * @param n_types Number of particle types
+	 * @param n_dimensions Number of dimensions (values in a row)
+	 * @param n_particles Number of particles of each type
+	 * @param n_arrays Number of arrays of this kind
+	 ******************************************************************************/
+	template <class T>
+	inline size_t arena_bytes(int n_types, int n_dimensions, const std::vector<int>& n_particles, int n_arrays)
+	{
+		size_t bytes = 0;
+		for (int i = 0; i < n_types; ++i)
+		{
+			//Row headers, one row used as the value to copy, and the rows
+			bytes += n_particles[i]*sizeof(std::vector<T, arena_allocator<T>>) + ARENA_ALIGN;
+			bytes += (n_particles[i] + 1)*(n_dimensions*sizeof(T) + arena_alignment<T>(n_dimensions));
+		}
+		return n_arrays*bytes;
+	}
+}
+
+#endif
@@ -0,0 +1,150 @@
+/** @file */
+#ifndef BALANCE_H
+#define BALANCE_H
+
+#include <algorithm>
+#include <iostream>
+#include <omp.h>
+#include <vector>
+#include "algorithm_constants.h"
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief Partition of the rows of the force loops over the threads, from their measured cost (see initialize_load_balance())
+	 *
+	 * The rows (particles of type1) of the loop of each pair of types are grouped in blocks of block rows. Every call times each block,
+	 * and every interval calls the blocks are cut again into one contiguous range per thread of (nearly) equal measured cost, so that
+	 * dense regions of the box get fewer rows per thread. The entries of the vectors are per pair of types (index type1*n_types + type2).
+	 */
+	class load_balance
+	{
+	public:
+		int active; ///< 1 once initialize_load_balance() has been called (the LJ kernels then use balance_sum())
+		int interval; ///< Calls between two partitions of a loop (0 : only measured, the rows are split evenly)
+		int block; ///< Rows per block
+		std::vector<long> calls; ///< Calls of each loop so far
+		std::vector<std::vector<double>> cost; ///< Smoothed time of each block of each loop, in seconds
+		std::vector<std::vector<int>> bounds; ///< First block of each thread of each loop (threads+1 sized)
+		std::vector<double> time_max; ///< Sum over the calls of each loop of the time of the slowest thread
+		std::vector<double> time_mean; ///< Sum over the calls of each loop of the mean time of the threads
+		long partitions; ///< Number of partitions made
+
+		load_balance() : active(0), interval(BALANCE_INTERVAL), block(BALANCE_BLOCK), partitions(0) {}
+	};
+}
+
+/*******************************************************************************
+ * \brief Switches the LJ force loops to the cost-measured partition of their rows over the threads
+ *
+ * Error 0019 if interval < 0 or block < 1.
+ *
+ * @param sim Simulation being used
+ * @param interval Calls of a loop between two partitions (0 : the rows stay split evenly, only the imbalance is measured)
+ * @param block Rows per block (the unit of the partition and of the timings)
+ ******************************************************************************/
+void initialize_load_balance(System::simulation& sim, int interval = BALANCE_INTERVAL, int block = BALANCE_BLOCK);
+
+/*******************************************************************************
+ * \brief Cuts the blocks of a loop into threads contiguous ranges of equal cost (of equal numbers of blocks if nothing was measured yet or lb.interval is 0)
+ *
+ * @param lb Load balance of the simulation
+ * @param key Loop (type1*n_types + type2)
+ * @param threads Number of threads
+ ******************************************************************************/
+void balance_partition(System::load_balance& lb, int key, int threads);
+
+/*******************************************************************************
+ * \brief Records the times of the blocks and of the threads of a call of a loop, and partitions it again if it is due
+ *
+ * @param lb Load balance of the simulation
+ * @param key Loop (type1*n_types + type2)
+ * @param block_time Time of each block in this call
+ * @param thread_time Time of each thread in this call
+ ******************************************************************************/
+void balance_record(System::load_balance& lb, int key, const std::vector<double>& block_time, const std::vector<double>& thread_time);
+
+/*******************************************************************************
+ * \brief Load imbalance of the force loops since initialize_load_balance() : time of the slowest thread over the mean time of the threads
+ *
+ * 1 is a perfect balance, and the parallel efficiency of the loops is at most the inverse.
+ *
+ * @param sim Simulation being used
+ * @param key Loop (type1*n_types + type2), or -1 for all of them together
+ ******************************************************************************/
+double load_imbalance(System::simulation& sim, int key = -1);
+
+/*******************************************************************************
+ * \brief Prints the load imbalance of each loop, the number of partitions made and the rows of each thread of each loop
+ *
+ * @param sim Simulation being used
+ * @param out Stream to print to
+ ******************************************************************************/
+void load_balance_report(System::simulation& sim, std::ostream& out);
+
+/*******************************************************************************
+ * \brief Sums m quantities over the n rows of a force loop, the rows being split over the threads by their measured cost
+ *
+ * body(i, s) computes row i and adds its terms to s[0 .. m-1], as in reduce_sum(). Each thread takes its contiguous range of blocks
+ * (see load_balance), timing each block. The order of the sums depends on the partition, as that of an OpenMP reduction depends on the schedule.
+ *
+ * @param lb Load balance of the simulation
+ * @param key Loop (type1*n_types + type2)
+ * @param n Number of rows
+ * @param m Number of quantities
+ * @param sum The m sums
+ * @param body Computes a row
+ ******************************************************************************/
+template <typename Body>
+void balance_sum(System::load_balance& lb, int key, long n, int m, double* sum, Body body)
+{
+	const int threads = omp_get_max_threads();
+	const long blocks = (n + lb.block - 1)/lb.block;
+	//The costs measured are kept when only the number of threads changes (e.g. the team of md_steps() while a snapshot is sampled)
+	if((long)lb.cost[key].size() != blocks)
+	{
+		lb.cost[key].assign(blocks, 0);
+		balance_partition(lb, key, threads);
+	}
+	else if((int)lb.bounds[key].size() != threads + 1)
+	{
+		balance_partition(lb, key, threads);
+	}
+	std::vector<double> block_time(blocks, 0), thread_time(threads, 0);
+	const int* bounds = lb.bounds[key].data();
+
+	double s[m];
+	for (int q = 0; q < m; ++q)
+	{
+		s[q] = 0;
+	}
+	#pragma omp parallel num_threads(threads) reduction(+ : s[:m])
+	{
+		//If the team is smaller than asked for (OMP_DYNAMIC), each thread takes several of the ranges
+		for (int r = omp_get_thread_num(); r < threads; r += omp_get_num_threads())
+		{
+			const double start = omp_get_wtime();
+			double last = start;
+			for (long b = bounds[r]; b < bounds[r + 1]; ++b)
+			{
+				const long end = std::min(n, (b + 1)*lb.block);
+				for (long i = b*lb.block; i < end; ++i)
+				{
+					body(i, s);
+				}
+				const double now = omp_get_wtime();
+				block_time[b] = now - last;
+				last = now;
+			}
+			thread_time[r] = last - start;
+		}
+	}
+	for (int q = 0; q < m; ++q)
+	{
+		sum[q] = s[q];
+	}
+	balance_record(lb, key, block_time, thread_time);
+}
+
+#endif
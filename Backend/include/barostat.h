@@ -0,0 +1,79 @@
+/** @file */ 
+#ifndef BAROSTAT_H
+#define BAROSTAT_H
+#include "system.h"
+#include "interaction.h"
+#include "thermo.h"
+#include <cmath>
+
+/*******************************************************************************
+ * \brief Initializes the constant array of the barostat for speed
+ * 
+ * The function initializes the array for more efficient computation by precomputing the required factors 
+ *
+ * @param sim Simulation being initialized
+ ******************************************************************************/
+void initialize_barostat(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief This function calls the barostat (if any)
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void call_barostat(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Scales the box and all the positions by a factor
+ *
+ * The volume dependent interaction constants are updated with update_interactions_volume() instead of
+ * initializing all the interactions again.
+ *
+ * @param sim Simulation being used
+ * @param mu Factor by which every length is scaled
+ ******************************************************************************/
+void rescale_box(System::simulation& sim, double mu);
+
+/*******************************************************************************
+ * \brief Call when no barostat is to be used
+ *
+ * Does nothing
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void no_barostat(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Call when Berendsen barostat is to be used
+ *
+ * On every timestep, the box and positions are scaled by \f$ \mu \f$, where,
+ * \f[ \mu = \left[1 - \frac{\beta\Delta t}{\tau_P}(P_{req} - P)\right]^{1/d} \f]
+ * \n
+ *	Here, the constants vector is as follows: \n
+ *	barostat_const[0] = \f$ P_{req} \f$ \n
+ *	barostat_const[1] = \f$ \tau_P \f$ (the relaxation time parameter) \n
+ *	barostat_const[2] = \f$ \beta \f$ (the isothermal compressibility) \n
+ *	barostat_const[3] = \f$ \beta\Delta t/\tau_P \f$
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void berendsen(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Call when Martyna–Tuckerman–Klein barostat is to be used
+ *
+ * Implemented according to G. J. Martyna, D. J. Tobias and M. L. Klein, J. Chem. Phys. 101, 4177 (1994) with the
+ * barostat applied once at the end of every timestep (half kick of the barostat momentum, scaling of the velocities
+ * and of the box, half kick of the barostat momentum). \n
+ * \f[ \dot{p}_\epsilon = dV(P - P_{req}) + \frac{d}{N_f}\sum_i m_iv_i^2 \f]
+ * The positions and box are scaled by \f$ e^{p_\epsilon\Delta t/W} \f$ and velocities by \f$ e^{-(1+d/N_f)p_\epsilon\Delta t/W} \f$
+ * \n
+ *	Here, the constants vector is as follows: \n
+ *	barostat_const[0] = \f$ P_{req} \f$ \n
+ *	barostat_const[1] = \f$ W \f$ (the mass of the barostat) \n
+ *	barostat_const[2] = \f$ p_\epsilon \f$ (the momentum of the barostat, this changes during the simulation) \n
+ *	barostat_const[3] = \f$ N_f \f$ (number of degrees of freedom)
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void mtk(System::simulation& sim);
+#endif
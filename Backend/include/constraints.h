@@ -0,0 +1,103 @@
+/** @file */
+#ifndef CONSTRAINTS_H
+#define CONSTRAINTS_H
+
+#include <vector>
+#include "algorithm_constants.h"
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief Holonomic bond length constraints, grouped by molecule
+	 *
+	 * Each group (molecule) is a set of atoms (particles of any type) and of bonds between them whose lengths are kept fixed.
+	 * The groups are independent, so they are solved in parallel. A group of three atoms bonded in a triangle, with two equal
+	 * sides and equal masses at their ends (e.g. rigid water), is solved analytically with SETTLE (3 dimensions only);
+	 * the other groups with SHAKE (positions) and RATTLE (velocities).
+	 */
+	class constraint_set
+	{
+	public:
+		std::vector<int> atom; ///< Type and index of each atom of all the groups (format atom[2*a + 0 or 1])
+		std::vector<int> group_atom_start; ///< Atoms of group g are atom_start[g] to atom_start[g+1]-1 (n_groups+1 sized)
+		std::vector<int> bond; ///< Atoms at the ends of each bond, numbered as in atom (format bond[2*b + 0 or 1])
+		std::vector<double> length; ///< Length of each bond
+		std::vector<int> group_bond_start; ///< Bonds of group g are group_bond_start[g] to group_bond_start[g+1]-1 (n_groups+1 sized)
+		std::vector<int> settle; ///< For each group, 1 if it is solved with SETTLE (see initialize_constraints())
+		std::vector<int> settle_atom; ///< For the SETTLE groups, the atom at the apex then the two others (format settle_atom[3*g + 0, 1 or 2])
+		std::vector<double> settle_geometry; /**< For the SETTLE groups, the distances of the canonical triangle from its centre of mass : r_a (to the apex along the axis), r_b (to the base along the axis), r_c (half the base) \n The format is settle_geometry[3*g + 0, 1 or 2]*/
+		std::vector<double> reference; ///< Positions of the atoms at the start of the timestep (format reference[a*n_dimensions + dimension])
+		double tolerance; ///< Relative tolerance on the bond lengths (and on the relative velocities along the bonds)
+		int max_iterations; ///< Largest number of SHAKE or RATTLE iterations over a group
+		double virial; ///< Virial of the constraint forces at the end of the last timestep, from the RATTLE stage only (only found if energy_due is 1, see constrain_velocities())
+
+		constraint_set() : tolerance(CONSTRAINT_TOLERANCE), max_iterations(CONSTRAINT_MAX_ITERATIONS), virial(0)
+		{
+			group_atom_start.push_back(0);
+			group_bond_start.push_back(0);
+		}
+
+		int n_groups() const { return settle.size(); } ///< Number of groups
+		int n_bonds() const { return length.size(); } ///< Number of bonds over all groups
+	};
+}
+
+/*******************************************************************************
+ * \brief Adds a group of constrained atoms (a molecule)
+ *
+ * Error 0020 if there is not one length per bond or a bond joins an atom which is not in the group.
+ *
+ * @param sim Simulation being used
+ * @param atoms Type and index of each atom of the group (format atoms[2*a + 0 or 1])
+ * @param bonds Atoms at the ends of each bond, numbered from 0 in atoms (format bonds[2*b + 0 or 1])
+ * @param lengths Length of each bond
+ ******************************************************************************/
+void add_constraint_group(System::simulation& sim, const std::vector<int>& atoms, const std::vector<int>& bonds, const std::vector<double>& lengths);
+
+/*******************************************************************************
+ * \brief Prepares the constraints after all the groups have been added
+ *
+ * Checks the groups, finds the groups solved with SETTLE, adds the degrees of freedom removed by the bonds to sim.dof_removed
+ * (a bond between two types removes half of one from each) and removes the components of the velocities along the bonds. The positions must already
+ * satisfy the constraints. The atoms of each bond, and the atoms bonded to a common atom, are excluded from the pair kernels (see add_exclusion()).
+ * Not available with the MPI domain decomposition (the atoms of a molecule may be on different ranks). \n
+ * Error 0020 if an atom or bond is not valid, Error 0012 with MDGEN_MPI.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void initialize_constraints(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Stores the positions of the constrained atoms at the start of a timestep (before the drift)
+ ******************************************************************************/
+void constraint_save(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Moves the constrained atoms back onto the constraints after the drift (SHAKE, or SETTLE)
+ *
+ * The corrections are along the bonds at the start of the timestep (from constraint_save()). The velocities are corrected by
+ * the displacements over dt. SHAKE is iterated until every bond length is within the tolerance. \n
+ * Error 0013 if a group does not converge within max_iterations.
+ *
+ * @param sim Simulation being used
+ * @param dt Length of the drift
+ ******************************************************************************/
+void constrain_positions(System::simulation& sim, double dt);
+
+/*******************************************************************************
+ * \brief Removes the components of the relative velocities along the bonds after the second half kick (RATTLE, or SETTLE)
+ *
+ * RATTLE is iterated until every relative velocity along a bond is within the tolerance; for the SETTLE groups, the three
+ * conditions are solved at once. If sim.energy_due is 1 and dt > 0, the virial of the constraint forces is found as well
+ * (in sim.constraints.virial) : from the impulses of this stage only, which act over the half kick, so with the forces 2 k r/dt.
+ * These are the constraint forces at the end of the timestep, where the pressure is found; the SHAKE stage, whose forces are
+ * those at its start, is not counted. With dt = 0 the velocities are only projected onto the constraints (e.g. after a thermostat). \n
+ * Error 0013 if a group does not converge within max_iterations.
+ *
+ * @param sim Simulation being used
+ * @param dt Timestep (the half kick was dt/2), or 0
+ ******************************************************************************/
+void constrain_velocities(System::simulation& sim, double dt);
+
+#endif
@@ -8,7 +8,8 @@
  * \brief This function initializes the correlation arrays by inputing intial values
  *
  * This function fills in the initial values (t=0) of the vectors over which correlation is to be found. \n
- * This should be called only after initializing the initial vectors over which correlation is to be found.
+ * This should be called only after initializing the initial vectors over which correlation is to be found. \n
+ * Error 0021 with MDGEN_MPI.
  *
  * @param sim Simulation being used
 */
@@ -17,9 +18,67 @@ void initialize_correlations(System::simulation& sim);
 /*******************************************************
  * \brief Fills in the correlation vectors for this timestep
  *
+ * Error 0021 with MDGEN_MPI.
+ *
  * @param sim Simulation being used
 */
 void correlate(System::simulation& sim);
 
+/*******************************************************
+ * \brief Returns the unwrapped position of a particle
+ *
+ * The positions in the periodic box are wrapped back into the box by the integrator. This adds back the
+ * number of box lengths the particle has been wrapped by (stored in the image array).
+ *
+ * @param sim Simulation being used
+ * @param type Particle type of the particle
+ * @param n Particle index of the particle in position[type] array
+ * @param k Dimension of the position required
+*/
+double unwrapped_position(System::simulation& sim, int type, int n, int k);
+
+/*******************************************************
+ * \brief Allocates the buffers for the mean squared displacement
+ *
+ * This allocates msd_origins time origins and msd_length lags using the parameters in the correlation class. \n
+ * The memory used is bounded by msd_origins*numpartot*n_dimensions and does not grow with the runtime. \n
+ * Error 0021 with MDGEN_MPI (the particles migrate between the ranks, so their origins would no longer match them).
+ *
+ * @param sim Simulation being used
+*/
+void initialize_msd(System::simulation& sim);
+
+/*******************************************************
+ * \brief Samples the mean squared displacement for this timestep
+ *
+ * This should be registered with a stride of msd_stride (see register_observable()). \n
+ * The unwrapped positions are compared with every stored time origin and the squared displacement is added to
+ * msd_sum at the corresponding lag. Every msd_origin_spacing samples, the current positions replace the oldest origin.
+ * A type without particles keeps a mean squared displacement of 0.
+ *
+ * @param sim Simulation being used
+*/
+void sample_msd(System::simulation& sim);
+
+/*******************************************************
+ * \brief Returns the mean squared displacement at a lag
+ *
+ * @param sim Simulation being used
+ * @param lag Lag in number of samples (the time lag is lag*msd_stride*timestep)
+ * @param type Particle type (n_types gives the average over all particles)
+*/
+double msd(System::simulation& sim, int lag, int type);
+
+/*******************************************************
+ * \brief Returns the diffusion coefficient of a particle type from the mean squared displacement
+ *
+ * Uses the Einstein relation \f$ \langle r^2 \rangle = 2dDt \f$ with a least squares fit of the slope over
+ * the second half of the lags (the first half is left out as it contains the ballistic regime).
+ *
+ * @param sim Simulation being used
+ * @param type Particle type (n_types gives the diffusion coefficient over all particles)
+*/
+double diffusion_coefficient(System::simulation& sim, int type);
+
 
 #endif
\ No newline at end of file
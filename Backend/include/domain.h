@@ -0,0 +1,96 @@
+/** @file */
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <vector>
+#include <mpi.h>
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief State of the spatial domain decomposition of a simulation over MPI ranks (only with MDGEN_MPI)
+	 *
+	 * The box is split into a cartesian grid of subdomains, one per rank. In a simulation decomposed this way,
+	 * n_particles is the number of particles owned by this rank (the particle arrays keep the global size as capacity)
+	 * and n_particles_global is the total over all ranks.
+	 */
+	class domain_decomposition
+	{
+	public:
+		MPI_Comm comm; ///< Cartesian communicator of the ranks (MPI_COMM_NULL before initialize_domain())
+		int rank; ///< Rank in comm
+		int size; ///< Number of ranks
+		std::vector<int> dims; ///< Number of subdomains along each dimension
+		std::vector<int> coords; ///< Position of this subdomain in the grid
+		std::vector<int> neighbor_low; ///< Rank of the neighbouring subdomain below along each dimension (MPI_PROC_NULL at a wall)
+		std::vector<int> neighbor_high; ///< Rank of the neighbouring subdomain above along each dimension (MPI_PROC_NULL at a wall)
+		std::vector<int> n_particles_global; ///< Total number of particles of each type over all ranks
+		double cutoff; ///< Width of the halo (largest cutoff of all the interactions)
+		std::vector<std::vector<double>> ghost_position; /**< Positions of the ghost particles (copies of particles of other subdomains within the cutoff, shifted across periodic boundaries) \n The format is ghost_position[particletype][ghost*n_dimensions + dimension]*/
+		std::vector<int> n_ghosts; ///< Number of ghost particles of each type
+		std::vector<double> send_buffer; ///< Scratch storage for the messages
+		std::vector<double> receive_buffer; ///< Scratch storage for the messages
+
+		domain_decomposition() : comm(MPI_COMM_NULL), rank(0), size(1), cutoff(0) {}
+	};
+}
+
+/*******************************************************************************
+ * \brief Splits the simulation over the MPI ranks
+ *
+ * Must be called on all ranks after the particles have been initialized (the positions and velocities of rank 0 are used)
+ * and after initialize_interactions(). The ranks are arranged in a cartesian grid (MPI_Dims_create), periodic along
+ * every dimension if sim.periodic_boundary is 1. Each rank keeps the particles inside its subdomain, the tail energies are
+ * divided by the number of ranks (so that their sum is the tail energy of the whole system), and the ghosts are exchanged. \n
+ * MPI is initialized (MPI_THREAD_FUNNELED) if it has not been already. \n
+ * Error 0008 if a subdomain is thinner than the largest cutoff.
+ *
+ * @param sim Simulation being split
+ ******************************************************************************/
+void initialize_domain(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Returns the coordinate (along dimension k) of the subdomain owning a position
+ *
+ * @param sim Simulation being used
+ * @param k Dimension
+ * @param x Position along k
+ ******************************************************************************/
+int domain_owner(System::simulation& sim, int k, double x);
+
+/*******************************************************************************
+ * \brief Sends the particles which have left the subdomain to the neighbouring ranks
+ *
+ * Done one dimension after the other, so that particles crossing a corner reach the right rank.
+ * The particle leaving is replaced by the last particle of its type (slot compaction), and the received particles
+ * are appended. The positions, velocities, images and orientations are moved. \n
+ * Error 0009 if a particle has moved further than the neighbouring subdomain.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void domain_migrate(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Rebuilds the ghost particles
+ *
+ * Staged exchange : along each dimension in turn, the particles (local and ghosts received so far) within the cutoff of a face
+ * are sent to the neighbour across it, so that the ghosts of the edges and corners come in two or three hops.
+ * Ghosts crossing a periodic boundary are shifted by the box size. Dimensions with a single subdomain are skipped,
+ * the minimum image is used along them instead.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void domain_exchange_ghosts(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Sums the energies, virial and momentum over all the ranks
+ *
+ * The potential energy, virial, kinetic energies and momentum are summed (one MPI_Allreduce), and the temperatures
+ * and total energy are found again from the global sums. Called from the integrators when sim.energy_due is 1.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void domain_reduce(System::simulation& sim);
+
+#endif
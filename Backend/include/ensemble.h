@@ -0,0 +1,135 @@
+/** @file */
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "system.h"
+
+namespace System{
+	/**
+	 * \brief Many independent simulations (replicas) advanced together by one process
+	 *
+	 * The replicas are stored one after the other in replica (the storage is reserved once, so they never move).
+	 * Each replica has its own seed and, if an output prefix is given, its own output file. The threads are spread
+	 * over the replicas in groups of threads_per_replica (by default one replica per thread, run serially), which suits many small systems
+	 * better than spreading all the threads over the particles of each. \n
+	 * The interactions, thermostats, barostat and observables are set on each replica after construction, as for a single simulation.
+	 * Not meant for MDGEN_MPI builds (the replicas would communicate from several threads at once).
+	 */
+	class ensemble
+	{
+	public:
+		std::vector<simulation> replica; ///< The replicas (contiguous)
+		std::vector<std::ofstream> output; ///< Output file of each replica (empty if the replicas print to std::cout)
+		int threads_per_replica; ///< Size of the group of threads running each replica (1 by default)
+
+		/**
+		 * \brief Builds one replica for each input string
+		 *
+		 * @param inputs Input string of each replica (as for simulation, so the compositions may differ)
+		 * @param sizes Box size of each replica
+		 * @param seed Seed of the first replica (replica r gets seed + r)
+		 * @param output_prefix If not empty, replica r writes to output_prefix_r.csv
+		 */
+		ensemble(std::vector<std::string>& inputs, std::vector<std::vector<double>>& sizes, unsigned long seed, std::string output_prefix)
+		{
+			build(inputs, sizes, seed, output_prefix);
+		}
+
+		/**
+		 * \brief Builds n_replicas copies of the same system (differing only in their seeds)
+		 */
+		ensemble(std::string input, double size[], int n_replicas, unsigned long seed, std::string output_prefix)
+		{
+			std::vector<std::string> inputs(n_replicas, input);
+			std::vector<std::vector<double>> sizes;
+			try{
+				input_params params(input);
+				sizes.resize(n_replicas, std::vector<double>(size, size + params.n_dimensions));
+			}
+			catch(const std::length_error& le){
+				std::cerr<<"Error 0001"<<std::endl;
+				exit(0001);
+			}
+			catch(const std::bad_alloc& ba){
+				std::cerr<<"Error 0002"<<std::endl;
+				exit(0002);
+			}
+			build(inputs, sizes, seed, output_prefix);
+		}
+
+		//The replicas hold pointers into output (and ensemble_advance() runs them in place), so an ensemble is neither copied nor moved
+		ensemble(const ensemble&) = delete;
+		ensemble& operator=(const ensemble&) = delete;
+		ensemble(ensemble&&) = delete;
+		ensemble& operator=(ensemble&&) = delete;
+
+		int size() const { return replica.size(); } ///< Number of replicas
+
+	private:
+		void build(std::vector<std::string>& inputs, std::vector<std::vector<double>>& sizes, unsigned long seed, std::string output_prefix)
+		{
+			int n = inputs.size();
+			threads_per_replica = 1;
+			try{
+				replica.reserve(n);
+				if(!output_prefix.empty())
+				{
+					output.reserve(n);
+				}
+				for (int r = 0; r < n; ++r)
+				{
+					replica.emplace_back(inputs[r], sizes[r].data());
+					replica[r].seed = seed + r;
+					if(!output_prefix.empty())
+					{
+						output.emplace_back(output_prefix + "_" + std::to_string(r) + ".csv");
+						replica[r].output = &output[r];
+					}
+				}
+			}
+			catch(const std::length_error& le){
+				std::cerr<<"Error 0001"<<std::endl;
+				exit(0001);
+			}
+			catch(const std::bad_alloc& ba){
+				std::cerr<<"Error 0002"<<std::endl;
+				exit(0002);
+			}
+		}
+	};
+}
+
+/*******************************************************************************
+ * \brief Advances every replica by a number of timesteps
+ *
+ * The threads are split into groups of ens.threads_per_replica, and the replicas are dealt to the groups dynamically
+ * (one replica per group at a time). The parallel loops inside a replica run on its group only. A group runs its replica
+ * for all the timesteps before taking the next one. Replicas stop at their total_steps.
+ *
+ * @param ens Ensemble being advanced
+ * @param steps Number of timesteps (if < 0, each replica is run to its total_steps)
+ ******************************************************************************/
+void ensemble_advance(System::ensemble& ens, int steps);
+
+/*******************************************************************************
+ * \brief Advances every replica by one timestep (see ensemble_advance())
+ *
+ * @param ens Ensemble being advanced
+ ******************************************************************************/
+void ensemble_step(System::ensemble& ens);
+
+/*******************************************************************************
+ * \brief Runs every replica for all its remaining timesteps
+ *
+ * Same as calling ensemble_step() until all replicas are done, but without waiting for the slowest replica at every timestep :
+ * a group of threads takes a replica, runs it to the end and then takes the next one. With MDGEN_TIMING, the timing report is printed
+ * once at the end, for all the replicas together (the hardware counters of MDGEN_PERF are only read outside parallel regions, so not here).
+ *
+ * @param ens Ensemble being run
+ ******************************************************************************/
+void ensemble_run(System::ensemble& ens);
+
+#endif
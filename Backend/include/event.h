@@ -0,0 +1,97 @@
+/** @file */
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <queue>
+#include <vector>
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief Event of the calendar of the event-driven hard spheres
+	 *
+	 * partner >= 0 : collision with particle partner. partner < 0 : particle leaves its cell along dimension -partner-1
+	 * (or, with rigid walls, hits the wall there).
+	 */
+	struct hard_sphere_event
+	{
+		double time; ///< Time of the event (on the clock of hard_sphere_events)
+		int particle; ///< Particle of the event (numbered as in hard_sphere_events)
+		int partner; ///< Other particle of a collision, or -(dimension+1) for a cell crossing
+		unsigned event_count; ///< hard_sphere_events::event_count of particle when the event was predicted
+		unsigned collision_count; ///< hard_sphere_events::collision_count of partner when the event was predicted (collisions only)
+
+		bool operator>(const hard_sphere_event& e) const { return time > e.time; }
+	};
+
+	/**
+	 * \brief State of the event-driven hard sphere dynamics (see initialize_event_driven())
+	 *
+	 * The particles stream freely between events and are only brought to the current time when one of their events is processed
+	 * (lazy updates). Each particle has exactly one live event in the calendar, its earliest predicted collision or cell crossing.
+	 * Events made stale by a later change of velocity are recognized by the counters and dropped (or predicted again) when popped.
+	 * Particles are numbered over all the types, those of type t being offset[t] to offset[t+1]-1.
+	 */
+	class hard_sphere_events
+	{
+	public:
+		int active; ///< 1 once initialize_event_driven() has been called (md_step() then uses integrate_event_driven())
+		double now; ///< Clock of the events (0 when the calendar was built)
+		double virial; ///< Sum of r.J over the collisions (J the impulse) since the last timestep
+		long collisions; ///< Number of collisions processed
+		std::vector<int> offset; ///< First particle of each type (n_types+1 sized)
+		std::vector<int> type; ///< Type of each particle
+		std::vector<double> last_update; ///< Time each particle was last brought to
+		std::vector<unsigned> event_count; ///< Incremented at every event of a particle (its live event is the one holding the current count)
+		std::vector<unsigned> collision_count; ///< Incremented at every change of velocity of a particle (collisions and walls)
+		std::vector<double> diameter; ///< Contact distance between two types (format [type1*n_types + type2], 0 if they do not collide)
+		int n_cells[3]; ///< Cells along each dimension (1 along the dimensions beyond n_dimensions)
+		double cell_size[3]; ///< Length of the cells along each dimension (at least the largest contact distance)
+		std::vector<int> cell; ///< Cell coordinates of each particle (format [g*3 + dimension])
+		std::vector<int> cell_head; ///< First particle of each cell (-1 if empty)
+		std::vector<int> cell_next; ///< Next particle in the cell of each particle (-1 at the end)
+		std::vector<int> cell_prev; ///< Previous particle in the cell of each particle (-1 at the start)
+		std::priority_queue<hard_sphere_event, std::vector<hard_sphere_event>, std::greater<hard_sphere_event>> calendar; ///< Predicted events, earliest first
+
+		hard_sphere_events() : active(0), now(0), virial(0), collisions(0)
+		{
+			n_cells[0] = n_cells[1] = n_cells[2] = 1;
+			cell_size[0] = cell_size[1] = cell_size[2] = 0;
+		}
+
+		int n_total() const { return type.size(); } ///< Number of particles
+	};
+}
+
+/*******************************************************************************
+ * \brief Switches the simulation to event-driven hard sphere dynamics
+ *
+ * Every pair of types must interact by hard_sphere (contact distance interaction_const[i][j][1]) or free_particles.
+ * The particles are sorted into cells at least as large as the largest contact distance and the first event of each is predicted.
+ * Both periodic boundaries and rigid walls (reflecting the centres, as integrate_verdet_box()) are supported. \n
+ * Not available with r-RESPA, the adaptive timestep, constraints, rigid bodies, PME, barostats or MDGEN_MPI.
+ * Error 0016 if the simulation does not allow it or two spheres overlap.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void initialize_event_driven(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Processes all the events up to dt after the current time, then brings every particle to that time
+ *
+ * The sum of r.J over the collisions is kept in sim.events.virial (see integrate_event_driven()).
+ *
+ * @param sim Simulation being used
+ * @param dt Time to advance by
+ ******************************************************************************/
+void event_advance(System::simulation& sim, double dt);
+
+/*******************************************************************************
+ * \brief Predicts the events of every particle again, after their velocities were changed from outside (e.g. by a thermostat)
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void event_predict_all(System::simulation& sim);
+
+#endif
@@ -8,10 +8,14 @@
 #include "constants.h"
 #include "interaction.h"
 #include "thermostat.h"
+#include "timer.h"
 
 /*******************************************************************************
  * This function integrates the equation of motion for periodic boundary conditions
  * This function integrates using the Leapfrog Algorithm 
+ * Each half is a single pass over the particles. The positions are wrapped back into the box without branches
+ * (the wraps are counted in sim.image). The kinetic energies, temperatures and total momentum are reduced in the
+ * second pass, and only if sim.energy_due is 1.
  *
  * @param sim Simulation being integrated over
  ******************************************************************************/
@@ -20,8 +24,60 @@ void integrate_verdet_periodic(System::simulation& sim);
 /*******************************************************************************
  * This function integrates the equation of motion for rigid box conditions
  * This function integrates using the Leapfrog Algorithm 
+ * Each half is a single pass over the particles. The reflection from the walls is done without branches by folding
+ * the position into [0,2L). The kinetic energies, temperatures and total momentum are reduced in the second pass,
+ * and only if sim.energy_due is 1.
  *
  * @param sim Simulation being integrated over
  ******************************************************************************/
 void integrate_verdet_box(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Sets up the r-RESPA integrator
+ *
+ * Checks the switching constants of the RESPA_SPLIT interactions (0 < \f$ \lambda \f$ <= r_s <= r_cut, Lennard-Jones only),
+ * allocates sim.acceleration_outer and computes the accelerations of both levels at the current positions.
+ * md_step() uses integrate_respa() from then on (if inner_steps > 1). \n
+ * Error 0011 if inner_steps < 1, the switching constants are not valid, or there are rigid bodies, PME or the adaptive timestep.
+ *
+ * @param sim Simulation being integrated over
+ * @param inner_steps Number of inner timesteps per timestep (sim.respa_steps)
+ ******************************************************************************/
+void initialize_respa(System::simulation& sim, int inner_steps);
+
+/*******************************************************************************
+ * This function integrates the equation of motion with the r-RESPA multiple timestep algorithm (either boundary condition)
+ * The outer accelerations (RESPA_OUTER interactions and the outer part of the RESPA_SPLIT ones) kick the velocities
+ * by sim.timestep/2 at the beginning and the end of the timestep. In between, sim.respa_steps Leapfrog steps of
+ * sim.timestep/sim.respa_steps are taken with the inner accelerations (RESPA_INNER interactions and the inner part of
+ * the RESPA_SPLIT ones), so the outer interactions are only computed once per timestep. The energies (if sim.energy_due is 1)
+ * are those of all the interactions at the end of the timestep. initialize_respa() must have been called before.
+ *
+ * @param sim Simulation being integrated over
+ ******************************************************************************/
+void integrate_respa(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief This function advances the simulation by one timestep in inner Leapfrog steps (adaptive timestep)
+ *
+ * The number of inner steps is chosen by adaptive_choose(), then as many Leapfrog steps of sim.timestep/inner_steps as in
+ * integrate_verdet_periodic() or integrate_verdet_box() (depending on the boundaries) are taken. The energies (if sim.energy_due is 1)
+ * are only computed in the last one, and are then checked by adaptive_check_energy(). sim.time advances by sim.timestep.
+ * initialize_adaptive_timestep() must have been called before.
+ *
+ * @param sim Simulation being integrated over
+ ******************************************************************************/
+void integrate_adaptive(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief This function advances the event-driven hard spheres by one timestep
+ *
+ * All the collisions and cell crossings up to sim.time + timestep are processed (see event_advance()), then every particle
+ * is brought to that time. If sim.energy_due is 1, the kinetic energies and temperatures are reduced, the potential energy is 0
+ * and the virial is \f$ \sum r.J \f$ over the collisions of the timestep (J the impulse) divided by the timestep.
+ *
+ * @param sim Simulation being integrated over
+ ******************************************************************************/
+void integrate_event_driven(System::simulation& sim);
+
 #endif
@@ -13,6 +13,17 @@
  ******************************************************************************/
 void initialize_interactions(System::simulation& sim);
 
+/*******************************************************************************
+ * \brief Updates the constant arrays for interactions after the volume of the box changes
+ * 
+ * Only the constants depending on the volume are changed, so this is much cheaper than initialize_interactions()
+ *
+ * @param sim Simulation being used
+ * @param vol_old Volume before the change
+ * @param vol_new Volume after the change
+ ******************************************************************************/
+void update_interactions_volume(System::simulation& sim, double vol_old, double vol_new);
+
 /*******************************************************************************
  * \brief Returns the distance between two particles for periodic boundary conditions
  * 
@@ -27,6 +38,30 @@ void initialize_interactions(System::simulation& sim);
  ******************************************************************************/
 double distance_periodic(System::simulation& sim, int type1, int n1, int type2, int n2);
 
+/*******************************************************************************
+ * \brief Excludes a pair of particles from the pair kernels (e.g. two atoms of a molecule joined by constrained bonds)
+ *
+ * The Lennard-Jones and real space Coulomb terms of the pair are skipped, and the reciprocal space Coulomb term is taken back
+ * out by the particle-mesh Ewald electrostatics. Only takes effect once build_exclusions() has been called. Not with MDGEN_MPI,
+ * where the particles are renumbered as they move between the ranks.
+ *
+ * @param sim Simulation being used
+ * @param type1 Particle type of particle 1
+ * @param n1 Particle index of particle 1
+ * @param type2 Particle type of particle 2
+ * @param n2 Particle index of particle 2
+ ******************************************************************************/
+void add_exclusion(System::simulation& sim, int type1, int n1, int type2, int n2);
+
+/*******************************************************************************
+ * \brief Builds the excluded partners of each particle from the pairs added by add_exclusion() (each pair counted once)
+ *
+ * Called by initialize_constraints() and initialize_rigid_bodies(), and to be called again after adding exclusions by hand.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void build_exclusions(System::simulation& sim);
+
 /*******************************************************************************
  * \brief This function calls all the required interaction functions between the particles
  * 
@@ -48,6 +83,20 @@ void interact(System::simulation& sim);
  ******************************************************************************/
 void free_particles(System::simulation& sim,int type1,int type2);
 
+/*******************************************************************************
+ * \brief Setup the hard sphere interaction between two particle types
+ * 
+ * Marks the pair as hard spheres of contact distance interaction_const[type1][type2][1] (\f$ \sigma \f$). \n
+ * Potential : \f[ U(r) = \infty \f] for \f$ r < \sigma \f$, 0 otherwise. \n
+ * The collisions are not forces : they are predicted and processed by the event-driven dynamics (see initialize_event_driven()),
+ * so this does nothing when called by interact().
+ *
+ * @param sim Simulation being used
+ * @param type1 First type of particle interacting
+ * @param type2 Second type of particle interacting
+ ******************************************************************************/
+void hard_sphere(System::simulation& sim,int type1,int type2);
+
 /*******************************************************************************
  * \brief Setup the Lennard-Jones potential for periodic boundary conditions between two particle types
  * 
@@ -63,7 +112,10 @@ void free_particles(System::simulation& sim,int type1,int type2);
  * interaction_const[i][j][3] = Truncated Potential (etrunc) \n
  * interaction_const[i][j][4] = \f$ \sigma^6 \f$ \n
  * interaction_const[i][j][5] = Tail Energy (assuming constant distribution outside cutoff radius) \n
+ * interaction_const[i][j][6] = Tail Pressure times volume squared \n
  * \n
+ * The potential energy and the virial \f$ \sum r_{ij}.F_{ij} \f$ are only accumulated (in the same pass as the forces) if sim.energy_due is 1.
+ * Otherwise only the accelerations are updated.
  *
  * @param sim Simulation being used
  * @param type1 First type of particle interacting
@@ -85,7 +137,10 @@ void lj_periodic(System::simulation& sim,int type1,int type2);
  * interaction_const[i][j][3] = Truncated Potential (etrunc) \n
  * interaction_const[i][j][4] = \f$ \sigma^6 \f$ \n
  * interaction_const[i][j][5] = Tail Energy (assuming constant distribution outside cutoff radius) \n
+ * interaction_const[i][j][6] = Tail Pressure times volume squared \n
  * \n
+ * The potential energy and the virial \f$ \sum r_{ij}.F_{ij} \f$ are only accumulated (in the same pass as the forces) if sim.energy_due is 1.
+ * Otherwise only the accelerations are updated.
  *
  * @param sim Simulation being used
  * @param type1 First type of particle interacting
@@ -93,4 +148,20 @@ void lj_periodic(System::simulation& sim,int type1,int type2);
  ******************************************************************************/
 void lj_box(System::simulation& sim,int type1,int type2);
 
+#ifdef MDGEN_MPI
+/*******************************************************************************
+ * \brief Lennard-Jones interaction of the local particles with the ghost particles (only with MDGEN_MPI)
+ * 
+ * Computes the forces of the ghosts of type2 on the local particles of type1 (and of the ghosts of type1 on the local particles of type2).
+ * Only the local particles are updated; the other rank of each pair computes the same pair for its own particle, so half of the
+ * potential energy and virial of each pair is added. The minimum image is only used along the dimensions which are not split
+ * (the ghosts across split periodic boundaries are already shifted). Called from interact() after the pairs of local particles.
+ *
+ * @param sim Simulation being used
+ * @param type1 First type of particle interacting
+ * @param type2 Second type of particle interacting
+ ******************************************************************************/
+void lj_domain(System::simulation& sim,int type1,int type2);
+#endif
+
 #endif
\ No newline at end of file
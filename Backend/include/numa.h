@@ -0,0 +1,56 @@
+/** @file */
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <iostream>
+#include <vector>
+#include "arena.h"
+
+/*******************************************************************************
+ * \brief Pins every thread of the OpenMP team to one core and reports the topology
+ *
+ * The cores allowed for the process are ordered by NUMA node, package and core (hyperthreads of a core last),
+ * and thread t is pinned to core t of that order (wrapping around if there are more threads than cores), so that
+ * the static blocks of consecutive threads stay on the same node. Only done once; later calls do nothing.
+ * Linux only (sched_setaffinity and /sys/devices/system/cpu).
+ *
+ * @param out Stream the topology (thread, cpu, node, package, core) is printed to
+ ******************************************************************************/
+void numa_pin_threads(std::ostream& out);
+
+/*******************************************************************************
+ * \brief Pins the calling thread to the cores first to first + count - 1 of the order of numa_pin_threads()
+ *
+ * The threads of a nested team are created by the thread starting it and inherit its cores, so a thread about to start
+ * nested teams of count threads is given count cores (the nested threads then stay on them, though not one per core),
+ * and numa_pin_block(omp_get_thread_num(), 1) puts it back afterwards. Does nothing before numa_pin_threads() has pinned the team.
+ *
+ * @param first First core (wrapping around if there are fewer cores)
+ * @param count Number of cores
+ ******************************************************************************/
+void numa_pin_block(int first, int count);
+
+/*******************************************************************************
+ * \brief Returns the NUMA node of a cpu (0 if unknown)
+ ******************************************************************************/
+int numa_node_of_cpu(int cpu);
+
+/*******************************************************************************
+ * \brief Touches the pages of an arena which will hold the particles of each thread from that thread
+ *
+ * The arrays must have been built in the arena from, and are going to be built again, with the same allocations,
+ * in the untouched arena to. For every type, the row and row header of particle j are touched (at the same offset in to)
+ * by the thread which owns j in a static schedule, so each page lands on the node of the thread using it.
+ *
+ * @param arrays Arrays built in from
+ * @param from Arena the arrays were built in
+ * @param to Arena the arrays will be built in
+ ******************************************************************************/
+void numa_first_touch(const std::vector<System::particle_array>& arrays, const System::arena& from, System::arena& to);
+
+/*******************************************************************************
+ * \brief Same as above for integer arrays
+ ******************************************************************************/
+void numa_first_touch(const std::vector<System::particle_array_int>& arrays, const System::arena& from, System::arena& to);
+
+#endif
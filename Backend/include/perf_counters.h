@@ -0,0 +1,83 @@
+/** @file */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <iostream>
+#include <string>
+#include "system.h"
+
+#define PERF_REPORT_FILE "perf.json" //Name of the report written by md_run()
+
+// Hardware events counted on every thread of the OpenMP team
+enum perf_event
+{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES, // L1 data cache read misses
+	PERF_LLC_MISSES, // Last level cache misses
+	PERF_BRANCH_MISSES,
+	PERF_FLOPS, // Double precision floating point operations (vector instructions weighted by their width)
+	PERF_EVENTS
+};
+
+/**
+ * \brief Values of all the counters summed over the threads of the team (scaled for multiplexing)
+ */
+struct perf_sample
+{
+	double value[PERF_EVENTS];
+};
+
+/*******************************************************************************
+ * \brief Opens the counters on every thread of the OpenMP team
+ *
+ * Uses perf_event_open (Linux only, no external tools). Counters which the processor or the kernel
+ * (see /proc/sys/kernel/perf_event_paranoid) do not allow are left out and reported as unavailable.
+ * The floating point counters use FP_ARITH_INST_RETIRED on Intel and the retired SSE/AVX FLOPs event on AMD.
+ ******************************************************************************/
+void perf_open();
+
+/*******************************************************************************
+ * \brief Closes all the counters
+ ******************************************************************************/
+void perf_close();
+
+/*******************************************************************************
+ * \brief Reads the counters of all the threads of the team
+ *
+ * This must be called from the thread which called perf_open() (the counters of the other threads are read
+ * from it). It is done at the start and end of every timed phase when MDGEN_PERF is defined.
+ *
+ * @param s Sample to fill
+ ******************************************************************************/
+void perf_read(perf_sample& s);
+
+/*******************************************************************************
+ * \brief Adds the counters of one measurement of a phase
+ *
+ * @param phase Phase measured (see timer.h)
+ * @param start Counters at the start of the phase
+ * @param seconds Wall-clock time of the phase
+ ******************************************************************************/
+void perf_record(int phase, const perf_sample& start, double seconds);
+
+/*******************************************************************************
+ * \brief Prints the counters of every phase with derived metrics
+ *
+ * For every phase: IPC, cache and branch misses per pair interaction (for the interaction phases) or per particle
+ * and timestep (for the other phases), and the achieved GFLOP/s.
+ *
+ * @param sim Simulation which was run (for the number of pairs and particles)
+ * @param out Stream to print to
+ ******************************************************************************/
+void perf_report(System::simulation& sim, std::ostream& out);
+
+/*******************************************************************************
+ * \brief Writes the counters of every phase (with the derived metrics) as JSON
+ *
+ * @param sim Simulation which was run
+ * @param filename File to write to
+ ******************************************************************************/
+void perf_write_json(System::simulation& sim, std::string filename);
+
+#endif
@@ -0,0 +1,86 @@
+/** @file */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <memory>
+#include <sstream>
+#include <vector>
+#include "algorithm_constants.h"
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief Observables sampled asynchronously, on a snapshot, while the next timesteps are computed (see register_async_observable())
+	 *
+	 * The asynchronous observables run on shadow, a copy of the simulation made when they are first due. At every timestep at which one
+	 * of them is due, the state of the timestep is copied into shadow and a task samples them there, which the spare threads run while
+	 * the main thread goes on with the following timesteps. The dependencies of the tasks are : snapshot(s) -> sample(s) -> snapshot(s + stride),
+	 * so a snapshot waits for the observables of the previous one. The results of the asynchronous observables (e.g. the MSD, or the
+	 * correlations) are those of shadow (see pipeline_results()).
+	 */
+	class step_pipeline
+	{
+	public:
+		int active; ///< 1 once an observable has been registered with register_async_observable()
+		int threads; ///< Threads taken from the team to run the asynchronous observables (see md_steps())
+		int overlap; ///< 1 inside md_steps() when the observables are sampled in tasks, 0 when they are sampled at once
+		int pending; ///< 1 from a snapshot until its task has sampled it (read by md_steps() to size the team of the timesteps)
+		std::vector<void (*)(simulation&)> observable; ///< The asynchronous observables
+		std::vector<int> observable_stride; ///< Number of timesteps between two samples of each asynchronous observable
+		std::vector<int> observable_energy; ///< If 1, the asynchronous observable needs the energies and temperatures of the timestep
+		std::shared_ptr<simulation> shadow; ///< Copy of the simulation holding the snapshot and the results of the asynchronous observables
+		std::shared_ptr<std::stringstream> buffer; ///< Output of shadow, printed to the output of the simulation when the pipeline is drained
+		long snapshots; ///< Number of snapshots taken
+		double wait; ///< Wall-clock seconds the timesteps waited for the observables of the previous snapshot
+
+		step_pipeline() : active(0), threads(PIPELINE_THREADS), overlap(0), pending(0), snapshots(0), wait(0) {}
+	};
+}
+
+/*******************************************************************************
+ * \brief Registers an observable to be sampled every stride timesteps on a snapshot, concurrently with the following timesteps
+ *
+ * Meant for the observables which only read the state of the timestep they sample and only write their own results (correlate,
+ * sample_msd, sample_structure_factor, write_traj, write_energy, ...). They are sampled in the order they were registered, on a copy
+ * of the simulation made when they are first due, so their setup (e.g. initialize_msd()) must be done before the run. An observable
+ * should be registered either with register_observable() or here, not both. The writers among them print to a buffer, which is
+ * printed to sim.output when the pipeline is drained (before the next snapshot and at the end of md_steps()) : their lines come
+ * in the order of the snapshots, but after those the timesteps wrote meanwhile. \n
+ * The observables only overlap with the timesteps in md_steps() and md_run() (with at least 2 threads, and not with MDGEN_MPI) :
+ * otherwise they are sampled at once, as with register_observable(). \n
+ * Error 0007 if stride < 1.
+ *
+ * @param sim Simulation being used
+ * @param observable Function sampling the observable
+ * @param stride Number of timesteps between two samples (>= 1)
+ * @param needs_energy If 1, the observable reads the energies or temperatures
+ ******************************************************************************/
+void register_async_observable(System::simulation& sim, void (*observable)(System::simulation&), int stride, int needs_energy);
+
+/*******************************************************************************
+ * \brief If an asynchronous observable is due in this timestep, copies the state into the snapshot and samples it in a task
+ *
+ * Called by sample(). Waits first for the task of the previous snapshot.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void pipeline_snapshot(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Waits until the asynchronous observables of all the snapshots taken have been sampled, and prints what they wrote to sim.output
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void pipeline_drain(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Returns the simulation holding the results of the asynchronous observables (sim itself if none has been sampled)
+ *
+ * Only to be read once the pipeline is drained (md_steps() and md_run() return drained).
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+System::simulation& pipeline_results(System::simulation& sim);
+
+#endif
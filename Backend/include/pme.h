@@ -0,0 +1,91 @@
+/** @file */
+#ifndef PME_H
+#define PME_H
+
+#include <complex>
+#include <vector>
+#include "algorithm_constants.h"
+#ifdef MDGEN_FFTW
+#include <memory>
+#include <type_traits>
+#include <fftw3.h>
+#endif
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief State of the smooth particle-mesh Ewald (SPME) electrostatics
+	 *
+	 * The Coulomb interaction of the charges (constants_interaction::charge) is split by the Ewald parameter \f$ \alpha \f$ into
+	 * a real space part \f$ q_i q_j erfc(\alpha r)/r \f$, computed in the Lennard-Jones pair kernels up to cutoff, and a reciprocal
+	 * space part, computed on a grid : the charges are spread with cardinal B-splines of order PME_ORDER, the grid is transformed
+	 * (FFTW with MDGEN_FFTW, else a built-in FFT), multiplied by the influence function and transformed back, and the forces are
+	 * interpolated from it with the same splines.
+	 */
+	class pme_state
+	{
+	public:
+		int active; ///< 1 once initialize_pme() has been called
+		double coulomb; ///< Coulomb constant \f$ 1/(4\pi\epsilon_0) \f$ in the units of the simulation (1 by default)
+		double accuracy; ///< Target RMS force error, relative to the force between two unit charges at unit distance
+		double alpha; ///< Ewald splitting parameter
+		double cutoff; ///< Real space cutoff
+		int grid[3]; ///< Points of the grid along each dimension
+		double energy_self; ///< Self energy and neutralizing background energy (constant while the box does not change)
+		double virial_background; ///< Virial of the neutralizing background (0 for a neutral system)
+		std::vector<int> particle; ///< Type and index of each charged particle (format particle[2*c + 0 or 1])
+		std::vector<int> base; ///< Highest grid point touched by the splines of each charged particle (format base[c*3 + dimension])
+		std::vector<double> theta; ///< Spline weights of each charged particle (format theta[(c*3 + dimension)*PME_ORDER + point])
+		std::vector<double> dtheta; ///< Derivatives of the spline weights (same format as theta)
+		std::vector<int> plane_start; ///< Charged particles sorted by base[c*3] : those of plane x are plane_order[plane_start[x]] to plane_order[plane_start[x+1]-1]
+		std::vector<int> plane_order; ///< Charged particles sorted by their highest grid plane along x
+		std::vector<double> charge_grid; ///< Charges spread on the grid, then the convolved potential (format [(x*grid[1] + y)*grid[2] + z])
+		std::vector<std::complex<double>> transform; ///< Transform of charge_grid, half of the last dimension (format [(x*grid[1] + y)*(grid[2]/2+1) + z])
+		std::vector<double> influence; ///< Influence function (same format as transform)
+		std::vector<double> influence_virial; ///< Factor of each term of the reciprocal energy in the virial, \f$ 1 - 2\pi^2 m^2/\alpha^2 \f$ (same format as transform)
+#ifdef MDGEN_FFTW
+		//The plans are executed on the arrays of each copy of the simulation (new-array execute), and destroyed with the last copy
+		std::shared_ptr<std::remove_pointer<fftw_plan>::type> forward; ///< Plan of the real to complex transform of charge_grid
+		std::shared_ptr<std::remove_pointer<fftw_plan>::type> backward; ///< Plan of the complex to real transform back into charge_grid
+#endif
+
+		pme_state() : active(0), coulomb(1), accuracy(PME_ACCURACY), alpha(0), cutoff(0), energy_self(0), virial_background(0)
+		{
+			grid[0] = grid[1] = grid[2] = 0;
+		}
+	};
+}
+
+/*******************************************************************************
+ * \brief Sets up the particle-mesh Ewald electrostatics for the charges of sim.charge
+ *
+ * From the target accuracy, \f$ \alpha \f$ is chosen so that the real space error at the cutoff is the target, then each
+ * dimension of the grid is the smallest product of 2, 3 and 5 for which the estimated reciprocal space error is within it.
+ * The charged pairs must use lj_periodic (\f$ \epsilon \f$ = 0 for charges without Lennard-Jones), whose kernel adds the real
+ * space part. Needs 3 dimensions and periodic boundaries, and is not available with r-RESPA or MDGEN_MPI. \n
+ * Error 0015 if the simulation does not allow PME or the cutoff is larger than half the box.
+ *
+ * @param sim Simulation being used
+ * @param accuracy Target RMS force error, relative to the force between two unit charges at unit distance (e.g. PME_ACCURACY)
+ * @param cutoff Real space cutoff (if <= 0, the largest Lennard-Jones cutoff between charged types)
+ ******************************************************************************/
+void initialize_pme(System::simulation& sim, double accuracy, double cutoff);
+
+/*******************************************************************************
+ * \brief Computes the influence function and constant energies again after the box changed (called by update_interactions_volume())
+ ******************************************************************************/
+void pme_update_box(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Adds the reciprocal space accelerations (and, if sim.energy_due is 1, the reciprocal, self and background energies and virials)
+ *
+ * The charges are spread on the grid in parallel over planes of the grid (each thread only writes its own planes), and the
+ * forces are interpolated in parallel over the particles. The reciprocal space term \f$ q_i q_j erf(\alpha r)/r \f$ of the
+ * excluded pairs (see build_exclusions()) is then subtracted. Called by interact().
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void pme_reciprocal(System::simulation& sim);
+
+#endif
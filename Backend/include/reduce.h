@@ -0,0 +1,82 @@
+/** @file */
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <algorithm>
+#include <vector>
+#include "algorithm_constants.h"
+
+/*******************************************************************************
+ * \brief Sums m quantities over n items in parallel : body(i, s) adds the terms of item i to s[0 .. m-1]
+ *
+ * Without MDGEN_DETERMINISTIC, this is an OpenMP reduction, whose order depends on the number of threads and the schedule. \n
+ * With MDGEN_DETERMINISTIC, the items are summed in order in blocks of DETERMINISTIC_BLOCK, and the sums of the blocks are then added
+ * pairwise (in a tree fixed by n). The result only depends on n, whatever the number of threads and the schedule of the blocks.
+ *
+ * @param n Number of items
+ * @param m Number of quantities
+ * @param sum The m sums
+ * @param body Adds the terms of an item
+ * @param chunk If > 0, the items are scheduled dynamically, chunk at a time, for uneven items (the blocks of MDGEN_DETERMINISTIC always are)
+ ******************************************************************************/
+template <typename Body>
+void reduce_sum(long n, int m, double* sum, Body body, int chunk = 0)
+{
+#ifdef MDGEN_DETERMINISTIC
+	const long blocks = (n + DETERMINISTIC_BLOCK - 1)/DETERMINISTIC_BLOCK;
+	std::vector<double> partial(std::max(blocks, 1L)*m, 0.0);
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (long b = 0; b < blocks; ++b)
+	{
+		double* s = &partial[b*m];
+		const long end = std::min(n, (b + 1)*DETERMINISTIC_BLOCK);
+		for (long i = b*DETERMINISTIC_BLOCK; i < end; ++i)
+		{
+			body(i, s);
+		}
+	}
+	//Pairwise over the blocks : at width w, block b (a multiple of 2w) takes in block b + w
+	for (long w = 1; w < blocks; w *= 2)
+	{
+		for (long b = 0; b + w < blocks; b += 2*w)
+		{
+			for (int q = 0; q < m; ++q)
+			{
+				partial[b*m + q] += partial[(b + w)*m + q];
+			}
+		}
+	}
+	for (int q = 0; q < m; ++q)
+	{
+		sum[q] = partial[q];
+	}
+#else
+	double s[m];
+	for (int q = 0; q < m; ++q)
+	{
+		s[q] = 0;
+	}
+	if(chunk > 0)
+	{
+		#pragma omp parallel for schedule(dynamic, chunk) reduction(+ : s[:m])
+		for (long i = 0; i < n; ++i)
+		{
+			body(i, s);
+		}
+	}
+	else
+	{
+		#pragma omp parallel for schedule(static) reduction(+ : s[:m])
+		for (long i = 0; i < n; ++i)
+		{
+			body(i, s);
+		}
+	}
+	for (int q = 0; q < m; ++q)
+	{
+		sum[q] = s[q];
+	}
+#endif
+}
+
+#endif
@@ -0,0 +1,98 @@
+/** @file */
+#ifndef RIGID_H
+#define RIGID_H
+
+#include <vector>
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief Rigid bodies made of several sites (particles of any type), integrated with NO_SQUISH
+	 *
+	 * Each body moves as a whole : its centre of mass is integrated with the Leapfrog (velocity Verlet) steps, and its orientation,
+	 * a unit quaternion q, with its conjugate momentum p by the symplectic NO_SQUISH splitting (Miller et al., 2002). The sites are
+	 * placed from them after every drift, and their velocities are set to the rigid motion of the body, so the kinetic energies
+	 * summed over the particles are those of the bodies. The quaternion of each body is copied to the orientation of its sites.
+	 * Per body arrays are stored one body after the other.
+	 */
+	class rigid_body_set
+	{
+	public:
+		std::vector<int> site; ///< Type and index of each site of all the bodies (format site[2*s + 0 or 1])
+		std::vector<int> body_site_start; ///< Sites of body b are body_site_start[b] to body_site_start[b+1]-1 (n_bodies+1 sized)
+		std::vector<double> body_coordinate; ///< Position of each site relative to the centre of mass, in the principal axes of its body (format [s*3 + dimension])
+		std::vector<double> mass; ///< Mass of each body
+		std::vector<double> inertia; ///< Principal moments of inertia of each body, 0 along the axis of a linear body (format [b*3 + axis])
+		std::vector<double> position; ///< Centre of mass of each body, unwrapped (format [b*3 + dimension])
+		std::vector<double> velocity; ///< Velocity of the centre of mass of each body (format [b*3 + dimension])
+		std::vector<double> quaternion; ///< Orientation of each body : rotation from its principal axes to the box axes (format [b*4 + component])
+		std::vector<double> momentum; ///< Momentum conjugate to the quaternion of each body (format [b*4 + component])
+		std::vector<double> force; ///< Total force on each body at the last kick (format [b*3 + dimension])
+		std::vector<double> torque; ///< Total torque on each body about its centre of mass at the last kick (format [b*3 + dimension])
+		double virial; ///< Virial of the forces keeping the bodies rigid, at the last kick (only found if energy_due is 1)
+
+		rigid_body_set() : virial(0)
+		{
+			body_site_start.push_back(0);
+		}
+
+		int n_bodies() const { return mass.size(); } ///< Number of bodies
+	};
+}
+
+/*******************************************************************************
+ * \brief Adds a rigid body
+ *
+ * @param sim Simulation being used
+ * @param sites Type and index of each site of the body (format sites[2*s + 0 or 1])
+ ******************************************************************************/
+void add_rigid_body(System::simulation& sim, const std::vector<int>& sites);
+
+/*******************************************************************************
+ * \brief Prepares the rigid bodies after all of them have been added
+ *
+ * Finds the centre of mass, principal axes and moments of inertia of each body from the current positions of its sites,
+ * and its velocity and angular momentum from their velocities. The sites are then put back on the rigid motion of the body.
+ * The degrees of freedom removed (3 per site, less 6 per body, or 5 for a linear body) are added to sim.dof_removed, and the pairs of
+ * sites of each body are excluded from the pair kernels (see add_exclusion()). \n
+ * Rigid bodies need 3 dimensions and periodic boundaries, and are not available with r-RESPA, barostats or MDGEN_MPI.
+ * Error 0014 if a body has fewer than 2 sites, a site does not exist or is in two bodies (or in a constraint group),
+ * or the simulation does not allow rigid bodies.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void initialize_rigid_bodies(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief First half of the timestep of the rigid bodies : kick by dt/2, drift and free rotation by dt, then placement of the sites
+ *
+ * The force and torque on each body are reduced from the accelerations of its sites. The free rotation is the NO_SQUISH sequence of
+ * rotations about the principal axes 3, 2, 1, 2, 3 (dt/2, dt/2, dt, dt/2, dt/2).
+ *
+ * @param sim Simulation being used
+ * @param dt Timestep
+ ******************************************************************************/
+void rigid_kick_drift(System::simulation& sim, double dt);
+
+/*******************************************************************************
+ * \brief Second half kick of the rigid bodies by dt/2, with the forces and torques from the new accelerations of their sites
+ *
+ * The velocities of the sites are set to the rigid motion of their bodies. If sim.energy_due is 1, the virial of the forces
+ * keeping the bodies rigid is found as well (in sim.rigid.virial).
+ *
+ * @param sim Simulation being used
+ * @param dt Timestep
+ ******************************************************************************/
+void rigid_kick(System::simulation& sim, double dt);
+
+/*******************************************************************************
+ * \brief Finds the velocity and angular momentum of each body from the velocities of its sites, then sets them to the rigid motion
+ *
+ * Used after the thermostats, which change the velocities of the particles.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void rigid_project(System::simulation& sim);
+
+#endif
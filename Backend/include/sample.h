@@ -0,0 +1,42 @@
+/** @file */
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include "system.h"
+
+/*******************************************************************************
+ * \brief Registers an observable to be sampled every stride timesteps
+ *
+ * The observable is called by sample() on every timestep which is a multiple of stride. \n
+ * If needs_energy is 1, the energies and temperatures are computed in the timesteps at which the observable is sampled.
+ * On all other timesteps, the force kernels skip the energies (unless a thermostat needs them, see energy_due()).
+ *
+ * @param sim Simulation being used
+ * @param observable Function sampling the observable (e.g. correlate, sample_msd, write_energy)
+ * @param stride Number of timesteps between two samples (>= 1)
+ * @param needs_energy If 1, the observable reads the energies or temperatures
+ ******************************************************************************/
+void register_observable(System::simulation& sim, void (*observable)(System::simulation&), int stride, int needs_energy);
+
+/*******************************************************************************
+ * \brief Returns 1 if the energies are to be computed in the given timestep
+ *
+ * This is the case if an observable needing energies (registered with register_observable() or register_async_observable()) is sampled in that timestep, or if a thermostat uses the
+ * kinetic energy (the Bussi thermostat) or a barostat needs the pressure on every timestep, or if a frame with energies is published
+ * to the live stream (which decides then whether the frame is published, see stream_due()).
+ *
+ * @param sim Simulation being used
+ * @param state Timestep number being checked
+ ******************************************************************************/
+int energy_due(System::simulation& sim, int state);
+
+/*******************************************************************************
+ * \brief Samples all the observables which are due in this timestep
+ *
+ * Then, if asynchronous observables are due, takes their snapshot (see pipeline_snapshot()).
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void sample(System::simulation& sim);
+
+#endif
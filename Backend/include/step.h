@@ -0,0 +1,41 @@
+/** @file */
+#ifndef STEP_H
+#define STEP_H
+
+#include "system.h"
+
+/*******************************************************************************
+ * \brief Advances the simulation by one timestep
+ *
+ * Decides whether the energies are needed in this timestep (see energy_due()), integrates the equations of motion (with r-RESPA if sim.respa_steps > 1, else in inner steps if the adaptive timestep is active)
+ * (which also computes the interactions), applies the thermostats and barostat and then samples the observables which are due.
+ *
+ * @param sim Simulation being advanced
+ ******************************************************************************/
+void md_step(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Advances the simulation by n timesteps, sampling the asynchronous observables concurrently
+ *
+ * Without asynchronous observables (see register_async_observable()), this is n calls of md_step(). With them, and at least 2 threads
+ * (not with MDGEN_MPI), the timesteps are run by one thread of an outer team of 2, while the other thread samples the snapshots in tasks
+ * with teams of sim.pipeline.threads threads. The kernels of a timestep run on nested teams of omp_get_max_threads() - sim.pipeline.threads
+ * threads while a snapshot is being sampled, and of omp_get_max_threads() - 1 threads otherwise (the other thread waits for tasks).
+ * Returns once all the snapshots have been sampled.
+ *
+ * @param sim Simulation being advanced
+ * @param n Number of timesteps
+ ******************************************************************************/
+void md_steps(System::simulation& sim, int n);
+
+/*******************************************************************************
+ * \brief Runs the simulation for all the remaining timesteps (see md_steps())
+ *
+ * If the timers are compiled in (MDGEN_TIMING), the timing report is printed to std::cerr at the end and
+ * written to TIMER_REPORT_FILE.json and TIMER_REPORT_FILE.csv
+ *
+ * @param sim Simulation being run
+ ******************************************************************************/
+void md_run(System::simulation& sim);
+
+#endif
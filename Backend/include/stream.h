@@ -0,0 +1,124 @@
+/** @file */
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "algorithm_constants.h"
+
+namespace System{
+	class simulation;
+
+	/**
+	 * \brief Header at the start of the shared memory of a live stream (see open_live_stream())
+	 *
+	 * All the fields are 8 bytes wide. The header is followed by three arrays of n_types entries (capacity, offset_position and
+	 * offset_velocity), then by the slots, each slot_bytes long. The offsets are in bytes from the start of a slot.
+	 */
+	struct stream_header
+	{
+		uint64_t magic; ///< STREAM_MAGIC
+		uint64_t version; ///< STREAM_VERSION
+		uint64_t n_types; ///< Number of particle types
+		uint64_t n_dimensions; ///< Number of dimensions
+		uint64_t fields; ///< STREAM_ fields in the frames
+		uint64_t slots; ///< Number of slots of the ring
+		uint64_t header_bytes; ///< Bytes of the header with its arrays (offset of the first slot)
+		uint64_t slot_bytes; ///< Bytes of a slot
+		uint64_t offset_n_particles; ///< Number of particles of each type in the frame (int64)
+		uint64_t offset_energy_kinetic; ///< Kinetic energy of each type (double)
+		uint64_t offset_temperature; ///< Temperature of each type (double)
+		uint64_t offset_box; ///< Box size along each dimension (double)
+		std::atomic<uint64_t> frames; ///< Frames published so far : the latest is frames-1, in slot (frames-1) % slots
+	};
+
+	/**
+	 * \brief Fixed part at the start of every slot of a live stream
+	 *
+	 * sequence is a seqlock : 2*frame + 1 while frame is being written to the slot, 2*frame + 2 once it is complete. A reader
+	 * copies the slot and keeps the copy if sequence was the same even value before and after.
+	 */
+	struct stream_slot
+	{
+		std::atomic<uint64_t> sequence; ///< Seqlock of the slot
+		int64_t state; ///< Timestep of the frame
+		double time; ///< Time of the frame
+		double energy_potential; ///< Potential energy (STREAM_ENERGIES, else 0)
+		double energy_total; ///< Total energy (STREAM_ENERGIES, else 0)
+		double virial; ///< Virial (STREAM_ENERGIES, else 0)
+	};
+
+	/**
+	 * \brief Live stream of a simulation into POSIX shared memory (see open_live_stream())
+	 *
+	 * Copies of the simulation share the mapping, which is unmapped and unlinked with the last of them.
+	 */
+	class live_stream
+	{
+	public:
+		int active; ///< 1 once open_live_stream() has been called
+		std::string name; ///< Name of the shared memory object (without the leading /)
+		int stride; ///< Timesteps between two frames
+		double min_interval; ///< Shortest wall-clock time between two frames, in seconds
+		double last_publish; ///< Wall-clock time of the last frame, in seconds
+		long skipped; ///< Frames due which were skipped because of min_interval
+		long due_state; ///< Timestep for which due was last decided (see stream_due())
+		int due; ///< 1 if the frame of timestep due_state is published
+		std::shared_ptr<char> memory; ///< The mapping (header then slots)
+		size_t bytes; ///< Size of the mapping
+
+		live_stream() : active(0), stride(STREAM_STRIDE), min_interval(0), last_publish(0), skipped(0), due_state(-1), due(0), bytes(0) {}
+
+		stream_header* header() { return (stream_header*)memory.get(); }
+	};
+}
+
+/*******************************************************************************
+ * \brief Publishes frames of the simulation into a POSIX shared memory ring, for a monitor or visualizer to read while it runs
+ *
+ * The shared memory object /name holds a stream_header and slots frames. Every stride timesteps, if at least min_interval seconds
+ * have passed since the last frame, publish_frame() copies the selected fields into the next slot under its seqlock and then
+ * advances header.frames : the simulation never waits for the readers, and a reader never blocks it. \n
+ * With STREAM_ENERGIES, the energies are only computed for the frames actually published (see stream_due()), except with MDGEN_MPI,
+ * where they are computed every stride timesteps so that the ranks agree. With MDGEN_MPI, each rank publishes the particles it owns to /name.rank. \n
+ * Error 0018 if stride < 1, slots < 2, min_interval < 0, no position or scalar field is selected or the shared memory cannot be created.
+ *
+ * @param sim Simulation being used
+ * @param name Name of the shared memory object (e.g. "mdgen", read from /dev/shm/mdgen on Linux)
+ * @param stride Timesteps between two frames
+ * @param min_interval Shortest wall-clock time between two frames, in seconds (0 : every stride timesteps)
+ * @param fields STREAM_ fields to publish (STREAM_POSITIONS, STREAM_VELOCITIES, STREAM_ENERGIES)
+ * @param slots Number of frames in the ring
+ ******************************************************************************/
+void open_live_stream(System::simulation& sim, std::string name, int stride = STREAM_STRIDE, double min_interval = STREAM_MIN_INTERVAL, int fields = STREAM_POSITIONS | STREAM_ENERGIES, int slots = STREAM_SLOTS);
+
+/*******************************************************************************
+ * \brief Returns 1 if the frame of a timestep is to be published, i.e. if min_interval seconds have passed since the last frame
+ *
+ * Decided once per timestep, when first asked (by energy_due() at the start of the timestep, or by publish_frame() at its end),
+ * so that the energies are computed for exactly the frames published.
+ *
+ * @param sim Simulation being used
+ * @param state Timestep of the frame
+ ******************************************************************************/
+int stream_due(System::simulation& sim, int state);
+
+/*******************************************************************************
+ * \brief Copies the current frame into the next slot of the live stream (the observable registered by open_live_stream())
+ *
+ * Does nothing if min_interval seconds have not passed since the last frame.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void publish_frame(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Stops publishing frames and gives back the shared memory (readers attached keep their mapping)
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void close_live_stream(System::simulation& sim);
+
+#endif
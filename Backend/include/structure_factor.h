@@ -0,0 +1,42 @@
+/** @file */
+#ifndef STRUCTURE_FACTOR_H
+#define STRUCTURE_FACTOR_H
+
+#include "system.h"
+
+/*******************************************************************************
+ * \brief Finds the wave vectors for which the structure factor is computed
+ *
+ * Lists all the wave vectors compatible with box_size_limits (\f$ k_d = 2\pi n_d/L_d \f$) with 0 < |k| <= sk_kmax
+ * and groups them into shells of width \f$ 2\pi/L_{max} \f$. Only one of k and -k is kept as S(k) = S(-k). \n
+ * This also allocates the accumulators, so the parameters in the correlation class should be set before this is called. \n
+ * Error 0021 with MDGEN_MPI.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void initialize_structure_factor(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Samples the partial static structure factors for this timestep
+ *
+ * This should be registered with a stride of sk_stride (see register_observable()). \n
+ * The density modes \f$ \rho_a(k) = \sum_j e^{ik.r_j} \f$ are found for every type a. The factors \f$ e^{in_dk_dx_d} \f$
+ * are built by recurrence from \f$ e^{ik_dx_d} \f$ (one sin and cos per particle and dimension) for blocks of SK_BLOCK
+ * particles, and the sums over particles are vectorized. The wave vectors are split across threads by shells. \n
+ * \f[ S_{ab}(k) = \frac{1}{\sqrt{N_aN_b}} \langle Re(\rho_a(k)\rho_b^*(k)) \rangle \f]
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void sample_structure_factor(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Returns the partial structure factor averaged over a shell and all samples
+ *
+ * @param sim Simulation being used
+ * @param shell Index of the shell (its |k| is sk_shell_k[shell])
+ * @param type1 First particle type
+ * @param type2 Second particle type
+ ******************************************************************************/
+double structure_factor(System::simulation& sim, int shell, int type1, int type2);
+
+#endif
@@ -9,48 +9,88 @@
 #include <vector>
 #include <cmath>
 #include "algorithm_constants.h"
+#include "arena.h"
+#include "constraints.h"
+#include "rigid.h"
+#include "pme.h"
+#include "event.h"
+#include "adaptive.h"
+#include "stream.h"
+#include "pipeline.h"
+#include "balance.h"
+#ifdef MDGEN_NUMA
+#include "numa.h"
+#endif
+#ifdef MDGEN_MPI
+#include "domain.h"
+#endif
 
 namespace System{
 	class system_state
 	{
 	public:
-		std::vector<std::vector<std::vector<double>>> position; /**< Vector of n_types X n_particles[of each type] X n_dimensions size storing positions of particles */
-		std::vector<std::vector<std::vector<double>>> orientation; /**< Vector of n_types X n_particles[of each type] X n_dimensions size storing orientation of particles */
-		std::vector<std::vector<std::vector<double>>> velocity; /**< Vector of n_types X n_particles[of each type] X n_dimensions size storing velocity of particles */
-		std::vector<std::vector<std::vector<double>>> acceleration; /**< Vector of n_types X n_particles[of each type] X n_dimensions size storing accelerations of particles */
+		std::vector<particle_array> position; /**< Vector of n_types X n_particles[of each type] X n_dimensions size storing positions of particles */
+		std::vector<particle_array> orientation; /**< Vector of n_types X n_particles[of each type] X ORIENTATION_SIZE size storing orientation of particles, as unit quaternions (q0, q1, q2, q3), identity by default */
+		std::vector<particle_array> velocity; /**< Vector of n_types X n_particles[of each type] X n_dimensions size storing velocity of particles */
+		std::vector<particle_array> acceleration; /**< Vector of n_types X n_particles[of each type] X n_dimensions size storing accelerations of particles */
+		std::vector<particle_array> acceleration_outer; /**< Accelerations from the outer level of the r-RESPA integrator (same format as acceleration, only allocated by initialize_respa()) */
+		std::vector<particle_array_int> image; /**< Vector of n_types X n_particles[of each type] X n_dimensions size storing the number of times each particle has been wrapped across the periodic box (unwrapped position = position + image*box_size_limits) */
 		std::vector<double> temperature; /**< This defines the temperatures of the n_types particle sets */
 		double energy_total; /**< Defines the total energy at this instant */
 		double energy_potential; /**< Defines the total potential energy of interaction at this instant */
+		double virial; /**< Defines the sum of \f$ r_{ij}.F_{ij} \f$ over all interacting pairs at this instant (found with the potential energy) */
+		double pressure; /**< Defines the pressure at this instant (see compute_pressure()) */
 		std::vector<double> energy_kinetic; /**< Defines the kinetic energy of each particle type */
+		std::vector<double> momentum; /**< Defines the total momentum of all the particles (n_dimensions sized) */
 		double time; /**< This is the amount of time passed since the beginning of the simulation */
 		int state; ///< The timestep number the system is in now
 		int numpartot;///< Total number of particles
+		int energy_due; ///< If 1, the force kernels and integrators compute the energies and temperatures in this timestep. Else, only the forces are computed.
+		unsigned long seed; ///< Seed of the random streams of the initialization and thermostats (0 keeps the default streams). Replicas of an ensemble are given different seeds.
+		std::ostream* output; ///< Stream the writers print to (std::cout by default, a file per replica in an ensemble)
+		std::shared_ptr<arena> particle_arena; ///< Arena holding all the per-particle arrays (of this class and of correlation)
 		system_state(int n_types, int n_dimensions, std::vector<int>& n_particles){
-			//Allocating (reserving) system_state variables
+			//Allocating system_state variables
+			numpartot = 0;
+			state = 0;
+			time = 0;
+			seed = 0;
+			output = &std::cout;
 			try{
-				temperature.reserve(n_types);
-				energy_kinetic.reserve(n_types);
-				position.reserve(n_types);
-				velocity.reserve(n_types);
-				orientation.reserve(n_types);
-				acceleration.reserve(n_types);
+				//One arena for position, orientation, velocity, acceleration, image (and velocity_initial of correlation)
+				size_t bytes = arena_bytes<double>(n_types, n_dimensions, n_particles, 4) + arena_bytes<double>(n_types, ORIENTATION_SIZE, n_particles, 1) + arena_bytes<int>(n_types, n_dimensions, n_particles, 1);
+				particle_arena = std::make_shared<arena>(bytes);
 
-				for (int i = 0; i < n_types; ++i)
-				{
-					position[i].reserve(n_particles[i]);
-					velocity[i].reserve(n_particles[i]);
-					orientation[i].reserve(n_particles[i]);
-					acceleration[i].reserve(n_particles[i]);
-
-					numpartot += n_particles[i];
+				temperature.resize(n_types);
+				energy_kinetic.resize(n_types);
+				momentum.resize(n_dimensions);
 
-					for (int j = 0; j < n_particles[i]; ++j)
+				allocate_particles(n_types, n_dimensions, n_particles);
+#ifdef MDGEN_NUMA
+				//The arrays are built again in a new arena whose pages have been touched by the threads owning them
+				numa_pin_threads(std::cerr);
+				std::shared_ptr<arena> placed = std::make_shared<arena>(bytes);
+				numa_first_touch(position, *particle_arena, *placed);
+				numa_first_touch(velocity, *particle_arena, *placed);
+				numa_first_touch(orientation, *particle_arena, *placed);
+				numa_first_touch(acceleration, *particle_arena, *placed);
+				numa_first_touch(image, *particle_arena, *placed);
+				{
+					//velocity_initial is built next (by correlation) with the same allocations, so its pages are touched as well
+					arena_allocator<double> alloc(particle_arena);
+					std::vector<particle_array> velocity_initial(n_types, particle_array(alloc));
+					for (int i = 0; i < n_types; ++i)
 					{
-						position[i][j].reserve(n_dimensions);
-						velocity[i][j].reserve(n_dimensions);
-						orientation[i][j].reserve(n_dimensions);
-						acceleration[i][j].reserve(n_dimensions);
+						velocity_initial[i].resize(n_particles[i], particle_row(n_dimensions, 0, alloc));
 					}
+					numa_first_touch(velocity_initial, *particle_arena, *placed);
+				}
+				particle_arena = placed;
+				allocate_particles(n_types, n_dimensions, n_particles);
+#endif
+				for (int i = 0; i < n_types; ++i)
+				{
+					numpartot += n_particles[i];
 				}
 			}
 			catch(const std::length_error& le){
@@ -63,6 +103,38 @@ namespace System{
 			}
 			//Done
 		}
+
+		/**
+		 * \brief (Re)builds the per-particle arrays in particle_arena
+		 *
+		 * Each array is filled before the next so that the rows of a type are contiguous.
+		 * The allocations are always done in the same order, so building twice in two arenas gives the same offsets.
+		 */
+		void allocate_particles(int n_types, int n_dimensions, std::vector<int>& n_particles)
+		{
+			arena_allocator<double> alloc(particle_arena);
+			position.clear();
+			velocity.clear();
+			orientation.clear();
+			acceleration.clear();
+			image.clear();
+			position.resize(n_types, particle_array(alloc));
+			velocity.resize(n_types, particle_array(alloc));
+			orientation.resize(n_types, particle_array(alloc));
+			acceleration.resize(n_types, particle_array(alloc));
+			image.resize(n_types, particle_array_int(alloc));
+			particle_row identity(ORIENTATION_SIZE, 0, alloc);
+			identity[0] = 1;
+
+			for (int i = 0; i < n_types; ++i)
+			{
+				position[i].resize(n_particles[i], particle_row(n_dimensions, 0, alloc));
+				velocity[i].resize(n_particles[i], particle_row(n_dimensions, 0, alloc));
+				orientation[i].resize(n_particles[i], identity);
+				acceleration[i].resize(n_particles[i], particle_row(n_dimensions, 0, alloc));
+				image[i].resize(n_particles[i], particle_row_int(n_dimensions, 0, alloc));
+			}
+		}
 	};
 
 	class input_params
@@ -79,7 +151,7 @@ namespace System{
 		int periodic_boundary; ///< Use periodic boundary conditions if 1. If 0, use rigid walls.
 		
 		input_params(std::string input){
-			std::vector<int> input_vector;
+			std::vector<double> input_vector;
 			std::stringstream ss(input);
 			
 			while(ss.good()){			//This packages the input string (comma separated) into the input_vector object
@@ -93,18 +165,18 @@ namespace System{
 			n_dimensions = (int)input_vector[1];
 			n_particles.resize(n_types);
 			for(int i=2; i<n_types+2; i++){
-				n_particles.push_back((int)input_vector[i]);
+				n_particles[i-2] = (int)input_vector[i];
 			}
 			timestep = input_vector[n_types+2];
 			runtime = input_vector[n_types+3];
 			parallelize = (int)input_vector[n_types+4]; 
 			mass.resize(n_types);
 			for(int i=n_types+5; i<2*n_types+5; i++){
-				mass.push_back(input_vector[i]);
+				mass[i-n_types-5] = input_vector[i];
 			}
 			temperature_required.resize(n_types);
 			for(int i=2*n_types+5; i<3*n_types+5; i++){
-				temperature_required.push_back(input_vector[i]);
+				temperature_required[i-2*n_types-5] = input_vector[i];
 			}
 			periodic_boundary = (int)input_vector[3*n_types+5];
 			
@@ -125,8 +197,13 @@ namespace System{
 		   interaction_const[i][j][3] = Truncated Potential (etrunc) \n
 		   interaction_const[i][j][4] = $\sigma^6$ \n
 		   interaction_const[i][j][5] = Tail Energy (assuming constant distribution outside cutoff radius) \n
+		   interaction_const[i][j][6] = Tail Pressure times volume squared (so that it does not change with the volume) \n
+		   interaction_const[i][j][7] = r-RESPA switching distance r_s (if interaction_level[i][j] is RESPA_SPLIT) \n
+		   interaction_const[i][j][8] = r-RESPA switching width \f$ \lambda \f$ (the inner force is switched off between r_s - \f$ \lambda \f$ and r_s) \n
 		*/
 		std::vector<std::vector<std::vector<double>>> interaction_const;
+		std::vector<std::vector<int>> interaction_level; ///< Level of each interaction in the r-RESPA integrator (RESPA_INNER by default, see algorithm_constants.h)
+		std::vector<double> charge; ///< Charge of each particle type (0 by default; used by the particle-mesh Ewald electrostatics, see initialize_pme())
 
 
 		// Parametrized Constructor
@@ -134,15 +211,9 @@ namespace System{
 		constants_interaction(int n_types /** Number of types of particles */)
 		{
 			try{
-				interaction_const.reserve(n_types);
-				for (int i = 0; i < n_types; ++i)
-				{
-					interaction_const[i].reserve(n_types);
-					for (int j = 0; j < n_types; ++j)
-					{
-						interaction_const[i][j].reserve(8);
-					}
-				}
+				interaction_const.resize(n_types, std::vector<std::vector<double>>(n_types, std::vector<double>(9, 0)));
+				interaction_level.resize(n_types, std::vector<int>(n_types, RESPA_INNER));
+				charge.assign(n_types, 0);
 			}
 			catch(const std::length_error& le){
 				std::cerr<<"Error 0001"<<std::endl; 
@@ -165,11 +236,30 @@ namespace System{
 		constants_thermostat(int n_types)
 		{
 			try{
-				thermostat_const.reserve(n_types);
-				for (int i = 0; i < n_types; ++i)
-				{
-					thermostat_const[i].reserve(4);
-				}
+				thermostat_const.resize(n_types, std::vector<double>(4, 0));
+			}
+			catch(const std::length_error& le){
+				std::cerr<<"Error 0001"<<std::endl; 
+				exit(0001);
+			}
+			catch(const std::bad_alloc& ba){
+				std::cerr<<"Error 0002"<<std::endl;
+				exit(0002);
+			}
+		}
+	};
+
+	class constants_barostat
+	{
+	public:
+		std::vector<double> barostat_const; ///< This vector stores constants (and the state) of the barostat
+
+		// Parametrized Constructor
+
+		constants_barostat()
+		{
+			try{
+				barostat_const.resize(4);
 			}
 			catch(const std::length_error& le){
 				std::cerr<<"Error 0001"<<std::endl; 
@@ -185,28 +275,48 @@ namespace System{
 	class correlation
 	{
 	public:
-		std::vector<std::vector<std::vector<double>>> velocity_initial; ///< Stores the velocity of the particles at t=0
+		std::vector<particle_array> velocity_initial; ///< Stores the velocity of the particles at t=0
 		std::vector<std::vector<double>> correlation_velocity; /**< Stores the velocity correlation for each particle type at each timestep (the n_types+1 th entry is the correlation over all types) \n The format is correlation_velocity[step_number][particletype]*/
 
+		int msd_stride; ///< Number of timesteps between two samples of the mean squared displacement
+		int msd_length; ///< Number of lags (in samples) over which the mean squared displacement is accumulated
+		int msd_origins; ///< Maximum number of time origins stored at once (bounds the memory used)
+		int msd_origin_spacing; ///< Number of samples between two consecutive time origins
+		int msd_samples; ///< Number of samples of the mean squared displacement taken so far
+		std::vector<int> msd_origin_sample; ///< Sample number at which each stored origin was taken (-1 if the slot is unused)
+		std::vector<std::vector<std::vector<double>>> msd_origin_position; /**< Unwrapped positions at each stored time origin \n The format is msd_origin_position[origin][particletype][particle*n_dimensions + dimension]*/
+		std::vector<std::vector<double>> msd_current; ///< Scratch storage for the unwrapped positions of the current sample (same format as msd_origin_position[origin])
+		std::vector<std::vector<double>> msd_sum; /**< Sum of the squared displacements over all origins for each lag (the n_types+1 th entry is over all types) \n The format is msd_sum[lag][particletype]*/
+		std::vector<long> msd_count; ///< Number of origins which have contributed to each lag of msd_sum
+
+		int sk_stride; ///< Number of timesteps between two samples of the static structure factor
+		double sk_kmax; ///< Largest |k| for which the structure factor is computed (if <= 0, SK_SHELLS shells are used)
+		int sk_samples; ///< Number of samples of the structure factor taken so far
+		std::vector<int> sk_nmax; ///< Largest integer multiple of \f$ 2\pi/L \f$ used along each dimension
+		std::vector<int> sk_vectors; /**< Wave vectors (in units of \f$ 2\pi/L \f$ along each dimension) sorted by |k|. Only one of k and -k is stored. \n The format is sk_vectors[kvector*n_dimensions + dimension]*/
+		std::vector<int> sk_shell_start; ///< Index of the first wave vector of each shell (n_shells+1 sized, the last entry is the number of wave vectors)
+		std::vector<double> sk_shell_k; ///< Mean |k| of the wave vectors in each shell
+		std::vector<std::vector<double>> sk_sum; /**< Sum of the partial structure factors over all samples and wave vectors of a shell \n The format is sk_sum[shell][type1*n_types + type2]*/
+		std::vector<double> sk_rho_re; ///< Real part of the density modes of the current sample (format [kvector*n_types + type])
+		std::vector<double> sk_rho_im; ///< Imaginary part of the density modes of the current sample (format [kvector*n_types + type])
+		std::vector<double> sk_table_re; ///< Scratch storage for the real part of \f$ e^{ink_0x} \f$ of a block of particles
+		std::vector<double> sk_table_im; ///< Scratch storage for the imaginary part of \f$ e^{ink_0x} \f$ of a block of particles
+
 		/**********************************************
 		 * This constructor reserves space for the correlation arrays and initial conditions
 		 */
-		correlation(int n_types, int n_dimensions, std::vector<int>& n_particles, double runtime, double timestep)
+		correlation(int n_types, int n_dimensions, std::vector<int>& n_particles, double runtime, double timestep, std::shared_ptr<arena> particle_arena)
 		{
 			// Reserving for initial arrays
 
 			try
 			{
-				velocity_initial.reserve(n_types);
+				arena_allocator<double> alloc(particle_arena);
+				velocity_initial.resize(n_types, particle_array(alloc));
 
 				for (int i = 0; i < n_types; ++i)
 				{
-					velocity_initial[i].reserve(n_particles[i]);
-
-					for (int j = 0; j < n_particles[i]; ++j)
-					{
-						velocity_initial[i][j].reserve(n_dimensions);
-					}
+					velocity_initial[i].resize(n_particles[i], particle_row(n_dimensions, 0, alloc));
 				}
 			}
 			catch(const std::length_error& le){
@@ -225,12 +335,7 @@ namespace System{
 
 			try
 			{
-				correlation_velocity.reserve(n_steps);
-
-				for (int i = 0; i < n_steps; ++i)
-				{
-					correlation_velocity[i].reserve(n_types+1);
-				}
+				correlation_velocity.resize(n_steps, std::vector<double>(n_types+1, 0));
 			}
 			catch(const std::length_error& le){
 				std::cerr<<"Error 0001"<<std::endl; 
@@ -241,21 +346,58 @@ namespace System{
 				exit(0002);
 			}
 			//Done
+
+			//The MSD buffers are allocated in initialize_msd() so that these can be changed before
+			msd_stride = MSD_STRIDE;
+			msd_length = MSD_LENGTH;
+			msd_origins = MSD_ORIGINS;
+			msd_origin_spacing = MSD_ORIGIN_SPACING;
+			msd_samples = 0;
+
+			//The structure factor buffers are allocated in initialize_structure_factor() for the same reason
+			sk_stride = SK_STRIDE;
+			sk_kmax = 0;
+			sk_samples = 0;
 		}
-		~correlation();
+		~correlation(){}
 		
 	};
 
-	class simulation : public input_params, public system_state, public constants_interaction, public constants_thermostat, public correlation
+	class simulation : public input_params, public system_state, public constants_interaction, public constants_thermostat, public constants_barostat, public correlation
 	{
 	public:
 		std::vector<void (*)(simulation&, int)> thermostat; /**< This stores thermostats for different particle sets */
+		void (*barostat)(simulation&); /**< This stores the barostat acting on the whole system */
 		std::vector<std::vector<void (*)(simulation&, int, int)>> interaction; /**< This defines the set of functions for interaction between different particle types. Also allows for non-symmetric interaction.*/
 		std::vector<double> box_size_limits; /**< We assume that the initial limits are all (0,0,0,...,0) to whatever the limits define for a box (allocate to n_dimensions size) */
 		int total_steps; ///< Total number of steps to be taken
 		std::vector<int> dof; ///< This stores the number of degrees of freedom for each molecule/particle type.
+		std::vector<double> dof_removed; ///< Degrees of freedom removed from each particle type by the bond constraints and rigid bodies (the temperatures use n_particles*n_dimensions - dof_removed)
+		std::vector<void (*)(simulation&)> observable; /**< This stores the observables to be sampled (see register_observable()) */
+		std::vector<int> observable_stride; ///< Number of timesteps between two samples of each observable
+		std::vector<int> observable_energy; ///< If 1, the observable needs the energies and temperatures of the timestep it is sampled at
+		int respa_steps; ///< Number of inner timesteps per timestep of the r-RESPA integrator (1 : the Leapfrog integrators are used, see md_step())
+		int respa_part; ///< Level computed by interact() (RESPA_ALL, RESPA_INNER or RESPA_OUTER)
+		std::vector<std::vector<int>> respa_list; /**< Pairs within r_s + skin of each RESPA_SPLIT interaction, for its inner part \n The format is respa_list[type1*n_types + type2][2*pair + 0 or 1] (index of the particle of type1, then of type2)*/
+		std::vector<std::vector<double>> respa_list_position; ///< Positions when respa_list was built (format [particletype][particle*n_dimensions + dimension])
+		int respa_list_valid; ///< 0 if respa_list must be built again before it is used (e.g. the particles have been renumbered)
+		std::vector<int> exclusion_pair; ///< Pairs of particles the pair kernels skip, as added by add_exclusion() (format [4*e + 0 to 3] : type and index of each)
+		std::vector<int> exclusion_offset; ///< Index of the first particle of each type when the particles of all types are numbered in order (n_types+1 sized)
+		std::vector<int> exclusion_start; ///< Partners of particle g (numbered as in exclusion_offset) are exclusion[exclusion_start[g]] to exclusion[exclusion_start[g+1]-1] (empty if there are none)
+		std::vector<int> exclusion; ///< Excluded partners of each particle, sorted (see build_exclusions())
+		constraint_set constraints; ///< Bond length constraints (see initialize_constraints())
+		rigid_body_set rigid; ///< Rigid bodies (see initialize_rigid_bodies())
+		pme_state pme; ///< Particle-mesh Ewald electrostatics (see initialize_pme())
+		hard_sphere_events events; ///< Event-driven hard sphere dynamics (see initialize_event_driven())
+		timestep_control adaptive; ///< Adaptive timestep (see initialize_adaptive_timestep())
+		live_stream stream; ///< Frames published to shared memory (see open_live_stream())
+		step_pipeline pipeline; ///< Observables sampled on snapshots, concurrently with the timesteps (see register_async_observable())
+		load_balance balance; ///< Cost-measured partition of the rows of the force loops over the threads (see initialize_load_balance())
+#ifdef MDGEN_MPI
+		domain_decomposition domain; ///< Spatial decomposition over the MPI ranks (see initialize_domain())
+#endif
 
-		simulation(std::string input, double size[]):input_params(input), system_state(n_types,n_dimensions,n_particles), constants_interaction(n_types), constants_thermostat(n_types), correlation(n_types,n_dimensions,n_particles,runtime,timestep)
+		simulation(std::string input, double size[]):input_params(input), system_state(n_types,n_dimensions,n_particles), constants_interaction(n_types), constants_thermostat(n_types), constants_barostat(), correlation(n_types,n_dimensions,n_particles,runtime,timestep,particle_arena)
 		{
 
 			total_steps = (int)(runtime/timestep);
@@ -280,12 +422,8 @@ namespace System{
 
 			//Allocating functions
 			try{
-				thermostat.reserve(n_types);
-				interaction.reserve(n_types);
-				for (int i = 0; i < n_types; ++i)
-				{
-					interaction[i].reserve(n_types);
-				}
+				thermostat.resize(n_types, NULL);
+				interaction.resize(n_types, std::vector<void (*)(simulation&, int, int)>(n_types, NULL));
 			}
 			catch(const std::length_error& le){
 				std::cerr<<"Error 0001"<<std::endl; 
@@ -299,7 +437,8 @@ namespace System{
 
 			//Allocating and defining dof
 			try{
-				dof.reserve(n_types);
+				dof.resize(n_types);
+				dof_removed.assign(n_types, 0);
 			}
 			catch(const std::length_error& le){
 				std::cerr<<"Error 0001"<<std::endl; 
@@ -314,11 +453,17 @@ namespace System{
 				dof[i] = n_dimensions;
 			}
 			//Done
+
+			energy_due = 1;
+			barostat = NULL;
+			respa_steps = 1;
+			respa_part = RESPA_ALL;
+			respa_list_valid = 0;
 		};
 
 
 
-		~simulation();
+		~simulation(){}
 		
 	};
 }
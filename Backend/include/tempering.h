@@ -0,0 +1,77 @@
+/** @file */
+#ifndef TEMPERING_H
+#define TEMPERING_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ensemble.h"
+
+namespace System{
+	/**
+	 * \brief State of a replica exchange (parallel tempering) run over the replicas of an ensemble
+	 *
+	 * Replica r is at temperature ladder[slot[r]]. An exchange swaps the slots of two replicas (with their temperatures
+	 * and thermostat constants); the particle arrays never move.
+	 */
+	class tempering
+	{
+	public:
+		std::vector<double> ladder; ///< Temperature of each slot (ascending)
+		std::vector<int> slot; ///< Slot of each replica
+		std::vector<int> replica_at; ///< Replica in each slot (inverse of slot)
+		int stride; ///< Number of timesteps between two rounds of exchanges
+		int rounds; ///< Number of rounds of exchanges done so far
+		unsigned long seed; ///< Seed of the random stream of the exchanges
+		std::vector<long> attempts; ///< Number of exchanges attempted between slots i and i+1
+		std::vector<long> accepted; ///< Number of exchanges accepted between slots i and i+1
+
+		tempering() : stride(1), rounds(0), seed(0) {}
+	};
+}
+
+/*******************************************************************************
+ * \brief Sets up a replica exchange run
+ *
+ * Replica r is put in slot r of the ladder : its temperature_required (of every type) is set to ladder[r], its thermostats are
+ * initialized again and its velocities are scaled to the new temperature. An observable needing the energies is registered
+ * with stride K on every replica, so the potential energies are up to date at each round of exchanges.
+ * Must be called after the thermostats of the replicas are set. The ensemble must have as many replicas as the ladder has temperatures.
+ *
+ * @param ens Ensemble of the replicas
+ * @param rex Replica exchange state being set up
+ * @param ladder Temperatures (ascending)
+ * @param stride Number of timesteps K between two rounds of exchanges
+ * @param seed Seed of the exchanges
+ ******************************************************************************/
+void initialize_tempering(System::ensemble& ens, System::tempering& rex, std::vector<double> ladder, int stride, unsigned long seed);
+
+/*******************************************************************************
+ * \brief Does one round of exchanges between neighbouring slots
+ *
+ * Even rounds try the pairs of slots (0,1), (2,3), ..., odd rounds (1,2), (3,4), ... Each exchange between slots i and j is
+ * accepted with probability \f$ min(1, e^{(\beta_i - \beta_j)(U_i - U_j)}) \f$, U being the energy_potential of the replica in the slot.
+ * An accepted exchange swaps the slots of the two replicas, sets their temperature_required and thermostat constants and scales their
+ * velocities (and kinetic energies) by \f$ \sqrt{T_{new}/T_{old}} \f$.
+ *
+ * @param ens Ensemble of the replicas
+ * @param rex Replica exchange state
+ ******************************************************************************/
+void tempering_exchange(System::ensemble& ens, System::tempering& rex);
+
+/*******************************************************************************
+ * \brief Runs the replicas to their total_steps, with a round of exchanges every rex.stride timesteps
+ *
+ * The replicas advance concurrently between two rounds (see ensemble_advance()).
+ *
+ * @param ens Ensemble of the replicas
+ * @param rex Replica exchange state
+ ******************************************************************************/
+void tempering_run(System::ensemble& ens, System::tempering& rex);
+
+/*******************************************************************************
+ * \brief Prints the acceptance rate of each pair of neighbouring slots as CSV (pair, T_low, T_high, attempts, accepted, rate)
+ ******************************************************************************/
+void tempering_report(System::tempering& rex, std::ostream& out);
+
+#endif
@@ -3,7 +3,25 @@
 
 #include"system.h"
 #include"constants.h"
+#include"interaction.h"
 #include<cmath>
 
 void trans_ke(System::simulation& sim);
-#endif
\ No newline at end of file
+
+/*******************************************************************************
+ * \brief Returns the volume of the box
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+double box_volume(System::simulation& sim);
+
+/*******************************************************************************
+ * \brief Computes the pressure from the kinetic energies and the virial
+ *
+ * \f[ P = \frac{1}{dV}\left(\sum_i m_iv_i^2 + \sum_{i<j} r_{ij}.F_{ij}\right) + P_{tail} \f]
+ * This needs the energies and virial of the timestep (sim.energy_due must have been 1). The result is stored in sim.pressure.
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+void compute_pressure(System::simulation& sim);
+#endif
@@ -0,0 +1,123 @@
+/** @file */
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <iostream>
+#include <string>
+#include <omp.h>
+
+// The hardware counters are read around every timed phase, so they imply the timers
+#ifdef MDGEN_PERF
+#ifndef MDGEN_TIMING
+#define MDGEN_TIMING
+#endif
+#include "perf_counters.h"
+#endif
+
+// Phases of a timestep which can be timed
+enum timer_phase
+{
+	PHASE_STEP, // Whole timestep (md_step)
+	PHASE_INTEGRATE_FIRST, // First half of the integrator (kick, drift and boundary)
+	PHASE_INTERACT, // All the interactions (interact)
+	PHASE_INTEGRATE_SECOND, // Second half of the integrator (kick and reductions)
+	PHASE_THERMOSTAT, // call_thermostat
+	PHASE_BAROSTAT, // call_barostat
+	PHASE_SAMPLE, // All the observables due in this timestep (sample)
+	PHASE_CORRELATE, // correlate
+	PHASE_WRITE, // write_traj and publish_frame
+	PHASE_COMMUNICATE, // MPI migration, ghost exchange and reductions (only with MDGEN_MPI)
+	PHASE_PME, // Reciprocal space part of the particle-mesh Ewald electrostatics (pme_reciprocal)
+	PHASE_PAIR // First of the TIMER_MAX_TYPES*TIMER_MAX_TYPES phases of sim.interaction[i][j] (see timer_pair_phase())
+};
+
+#define TIMER_MAX_TYPES 8 //Pairs of types beyond this share the last pair phase
+#define TIMER_PHASES (PHASE_PAIR + TIMER_MAX_TYPES*TIMER_MAX_TYPES)
+#define TIMER_BINS 512 //Bins of the histogram used for percentiles (8 per factor of 2, starting at 1 ns)
+#define TIMER_REPORT_FILE "timing" //Name (without extension) of the reports written by md_run()
+
+/*******************************************************************************
+ * \brief Adds one measured duration to a phase
+ *
+ * The statistics are kept per thread (no locks or atomics) and only merged when a report is written.
+ *
+ * @param phase Phase measured
+ * @param seconds Duration measured
+ ******************************************************************************/
+void timer_record(int phase, double seconds);
+
+/*******************************************************************************
+ * \brief Returns the phase of the interaction between two particle types
+ ******************************************************************************/
+int timer_pair_phase(int type1, int type2);
+
+/*******************************************************************************
+ * \brief Returns the name of a phase (as used in the reports)
+ ******************************************************************************/
+std::string timer_phase_name(int phase);
+
+/*******************************************************************************
+ * \brief Clears the statistics of all phases on all threads
+ ******************************************************************************/
+void timer_reset();
+
+/*******************************************************************************
+ * \brief Prints the calls, total, mean and percentiles (50, 90, 99) of the time spent in every phase measured
+ *
+ * @param out Stream to print to
+ ******************************************************************************/
+void timer_report(std::ostream& out);
+
+/*******************************************************************************
+ * \brief Writes the timing report as JSON (with the totals of each thread)
+ *
+ * @param filename File to write to
+ ******************************************************************************/
+void timer_write_json(std::string filename);
+
+/*******************************************************************************
+ * \brief Writes the timing report as CSV (one line per phase)
+ *
+ * @param filename File to write to
+ ******************************************************************************/
+void timer_write_csv(std::string filename);
+
+namespace System{
+	/**
+	 * \brief Measures the wall-clock time from its construction to its destruction and adds it to a phase
+	 */
+	class scoped_timer
+	{
+	public:
+		int phase; ///< Phase being measured
+		double start; ///< Wall-clock time at construction
+#ifdef MDGEN_PERF
+		perf_sample start_counters; ///< Hardware counters at construction
+#endif
+
+		scoped_timer(int p) : phase(p) {
+#ifdef MDGEN_PERF
+			perf_read(start_counters);
+#endif
+			start = omp_get_wtime();
+		}
+		~scoped_timer(){
+			double seconds = omp_get_wtime() - start;
+			timer_record(phase, seconds);
+#ifdef MDGEN_PERF
+			perf_record(phase, start_counters, seconds);
+#endif
+		}
+	};
+}
+
+// The timers are only compiled in if MDGEN_TIMING is defined (make EXTRAFLAGS='-DMDGEN_TIMING')
+#ifdef MDGEN_TIMING
+#define TIMER_CONCAT2(a,b) a##b
+#define TIMER_CONCAT(a,b) TIMER_CONCAT2(a,b)
+#define TIME_PHASE(phase) System::scoped_timer TIMER_CONCAT(scoped_timer_,__LINE__)(phase)
+#else
+#define TIME_PHASE(phase)
+#endif
+
+#endif
@@ -5,5 +5,14 @@
 
 void write_traj(System::simulation& sim);
 
+// Prints the timestep, time, total and potential energies and the kinetic energy of each type (needs the energies of the timestep)
+void write_energy(System::simulation& sim);
 
-#endif
\ No newline at end of file
+// Prints the timestep, time and the temperature of each type (needs the temperatures of the timestep)
+void write_temperature(System::simulation& sim);
+
+// Prints the timestep, time, pressure and volume (needs the energies and virial of the timestep)
+void write_pressure(System::simulation& sim);
+
+
+#endif
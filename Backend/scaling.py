@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Strong and weak scaling of the MD step loop across thread counts and affinity settings.
+
+Runs mdgen_bench (see installationDocumentation.txt) with kernel=step for every thread count and affinity
+setting, and reports the time per step, the parallel efficiency and (if the bench was built with
+MDGEN_TIMING) the share of each phase of the step.
+
+Strong scaling keeps the total number of particles fixed, weak scaling keeps the number of particles per thread fixed.
+The efficiency is the throughput (pair interactions per second) per thread relative to the smallest thread count
+of the sweep. For strong scaling this is T_1/(p T_p). The force loop visits all pairs, so for weak scaling the work
+grows as N^2 and T_1/T_p would not be a fair measure; the throughput per thread is used instead.
+
+With --contrast, half of the particles are squeezed into a slab that much denser than the rest (an interface), and with
+--balance 1 the force loops are partitioned over the threads by their measured cost; the load imbalance of the step
+(slowest thread over mean) is then written to the JSON rows.
+
+Example :
+    python3 scaling.py --threads 1,2,4,8 --affinity close:cores,spread:cores --json scaling.json
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import tempfile
+
+# Phases shown in the breakdown (share of the step time, in %) and their column labels
+PHASES = [("integrate_first", "int_first"), ("interact", "interact"), ("integrate_second", "int_second"),
+          ("thermostat", "thermo"), ("barostat", "baro"), ("sample", "sample")]
+
+
+def run_bench(bench, threads, bind, places, n, args):
+    env = dict(os.environ)
+    env["OMP_NUM_THREADS"] = str(threads)
+    env.pop("OMP_PROC_BIND", None)
+    env.pop("OMP_PLACES", None)
+    if bind:
+        env["OMP_PROC_BIND"] = bind
+    if places:
+        env["OMP_PLACES"] = places
+    if args.nested:
+        env["OMP_MAX_ACTIVE_LEVELS"] = str(args.nested)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        result_file = os.path.join(tmp, "bench.json")
+        timing_file = os.path.join(tmp, "timing.json")
+        cmd = [bench, "kernel=step", "n=%d" % n, "density=%g" % args.density, "types=%d" % args.types,
+               "dim=%d" % args.dim, "warmup=%d" % args.warmup, "reps=%d" % args.reps, "steps=%d" % args.steps,
+               "contrast=%g" % args.contrast, "balance=%d" % args.balance, "json=" + result_file, "timing=" + timing_file]
+        subprocess.run(cmd, env=env, check=True, stdout=subprocess.DEVNULL)
+
+        with open(result_file) as f:
+            step = json.load(f)["kernels"][0]
+        phases = {}
+        if os.path.exists(timing_file):
+            with open(timing_file) as f:
+                timing = json.load(f)["phases"]
+            total = sum(p["total"] for p in timing if p["name"] == "step")
+            for p in timing:
+                if total > 0:
+                    phases[p["name"]] = 100 * p["total"] / total
+    return {"seconds_per_step": step["seconds_per_step"]["median"],
+            "stddev": step["seconds_per_step"]["stddev"],
+            "pairs_per_second": step["pairs_per_second"],
+            "load_imbalance": step.get("load_imbalance", 0),
+            "phases": phases}
+
+
+def sweep(mode, bench, threads, affinities, args):
+    rows = []
+    for affinity in affinities:
+        bind, _, places = affinity.partition(":")
+        base = None
+        for p in threads:
+            n = args.n if mode == "strong" else args.n_per_thread * p
+            r = run_bench(bench, p, bind, places, n, args)
+            if base is None:
+                base = r["pairs_per_second"] / p
+            r["efficiency"] = r["pairs_per_second"] / (p * base)
+            r.update({"mode": mode, "threads": p, "n": n, "proc_bind": bind, "places": places})
+            rows.append(r)
+    return rows
+
+
+def print_table(rows):
+    header = "%-6s %-14s %7s %9s %12s %10s" % ("mode", "affinity", "threads", "n", "s/step", "efficiency")
+    header += "".join(" %10s" % label for _, label in PHASES)
+    print(header)
+    for r in rows:
+        affinity = (r["proc_bind"] or "-") + ":" + (r["places"] or "-")
+        line = "%-6s %-14s %7d %9d %12.4e %10.3f" % (r["mode"], affinity, r["threads"], r["n"],
+                                                      r["seconds_per_step"], r["efficiency"])
+        line += "".join(" %10s" % ("%.1f" % r["phases"][p] if p in r["phases"] else "-") for p, _ in PHASES)
+        print(line)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bench", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "mdgen_bench"))
+    parser.add_argument("--mode", choices=["strong", "weak", "both"], default="both")
+    parser.add_argument("--threads", default=None, help="comma separated thread counts (default: powers of 2 up to the cores)")
+    parser.add_argument("--affinity", default="close:cores,spread:cores",
+                        help="comma separated OMP_PROC_BIND:OMP_PLACES pairs (empty for unset)")
+    parser.add_argument("--n", type=int, default=8192, help="total particles for strong scaling")
+    parser.add_argument("--n-per-thread", type=int, default=1024, help="particles per thread for weak scaling")
+    parser.add_argument("--density", type=float, default=0.8)
+    parser.add_argument("--types", type=int, default=1)
+    parser.add_argument("--dim", type=int, default=3)
+    parser.add_argument("--warmup", type=int, default=3)
+    parser.add_argument("--reps", type=int, default=5)
+    parser.add_argument("--steps", type=int, default=10)
+    parser.add_argument("--contrast", type=float, default=1.0,
+                        help="density of the dense slab over the rest of the box (1 : homogeneous)")
+    parser.add_argument("--balance", type=int, default=0, help="1 to partition the force loops by their measured cost")
+    parser.add_argument("--nested", type=int, default=0, help="OMP_MAX_ACTIVE_LEVELS (0 to leave unset)")
+    parser.add_argument("--json", default=None, help="also write the results to this file")
+    args = parser.parse_args()
+
+    if args.threads:
+        threads = [int(t) for t in args.threads.split(",")]
+    else:
+        threads = [1]
+        while threads[-1] * 2 <= (os.cpu_count() or 1):
+            threads.append(threads[-1] * 2)
+    affinities = args.affinity.split(",")
+    modes = ["strong", "weak"] if args.mode == "both" else [args.mode]
+
+    rows = []
+    for mode in modes:
+        rows += sweep(mode, args.bench, threads, affinities, args)
+    print_table(rows)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"density": args.density, "contrast": args.contrast, "balance": args.balance, "types": args.types, "dim": args.dim, "rows": rows}, f, indent=1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,187 @@
+/** @file */
+#include <cmath>
+#include <algorithm>
+#include "adaptive.h"
+#include "system.h"
+#include "thermostat.h"
+#include "barostat.h"
+
+void initialize_adaptive_timestep(System::simulation& sim, int mode, double dt_min, double max_displacement, double energy_tolerance, int interval)
+{
+	System::timestep_control& ad = sim.adaptive;
+	bool allowed = (mode == ADAPT_FREE || mode == ADAPT_SYMPLECTIC) && dt_min > 0 && dt_min <= sim.timestep;
+	allowed = allowed && max_displacement > 0 && energy_tolerance >= 0 && interval >= 1;
+	allowed = allowed && sim.respa_steps == 1 && !sim.events.active;
+	if(!allowed)
+	{
+		std::cerr<<"Error 0017"<<std::endl;
+		exit(17);
+	}
+
+	ad.mode = mode;
+	ad.dt_min = dt_min;
+	ad.max_displacement = max_displacement;
+	ad.energy_tolerance = energy_tolerance;
+	ad.interval = interval;
+
+	//Most inner steps for which timestep/inner_steps >= dt_min (a power of 2 with ADAPT_SYMPLECTIC)
+	ad.max_inner_steps = std::max(1, (int)std::floor(sim.timestep/dt_min*(1 + 1e-12)));
+	if(mode == ADAPT_SYMPLECTIC)
+	{
+		int n = 1;
+		while(2*n <= ad.max_inner_steps)
+		{
+			n *= 2;
+		}
+		ad.max_inner_steps = n;
+	}
+
+	ad.inner_steps = 1;
+	ad.hold = 0;
+	ad.energy_reference_valid = 0;
+	ad.total_inner_steps = 0;
+	ad.clamped = 0;
+	ad.active = 1;
+
+	//First choice from the current velocities and accelerations, whatever the state
+	int state = sim.state;
+	sim.state = 0;
+	adaptive_choose(sim);
+	sim.state = state;
+}
+
+/*******************************************************************************
+ * Longest inner step for which no particle moves further than max_displacement
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+static double adaptive_bound(System::simulation& sim)
+{
+	const int dim = sim.n_dimensions;
+	double m[2] = {0, 0}; //Largest squared speed and squared acceleration
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		double v2max = m[0], a2max = m[1];
+		#pragma omp parallel for schedule(static) reduction(max : v2max, a2max)
+		for (int j = 0; j < sim.n_particles[i]; ++j)
+		{
+			const double* v = sim.velocity[i][j].data();
+			const double* a = sim.acceleration[i][j].data();
+			double v2 = 0, a2 = 0;
+			for (int k = 0; k < dim; ++k)
+			{
+				v2 += v[k]*v[k];
+				a2 += a[k]*a[k];
+			}
+			v2max = std::max(v2max, v2);
+			a2max = std::max(a2max, a2);
+		}
+		m[0] = v2max;
+		m[1] = a2max;
+	}
+#ifdef MDGEN_MPI
+	MPI_Allreduce(MPI_IN_PLACE, m, 2, MPI_DOUBLE, MPI_MAX, sim.domain.comm);
+#endif
+
+	//Positive root of a dt^2/2 + v dt = dx, in the form which is exact for a = 0
+	double v = std::sqrt(m[0]), a = std::sqrt(m[1]);
+	double dx = sim.adaptive.max_displacement;
+	double denominator = v + std::sqrt(v*v + 2*a*dx);
+	if(denominator <= 0)
+	{
+		return sim.timestep;
+	}
+	return 2*dx/denominator;
+}
+
+void adaptive_choose(System::simulation& sim)
+{
+	System::timestep_control& ad = sim.adaptive;
+	const double dt_bound = adaptive_bound(sim);
+	const bool choice = (sim.state % ad.interval == 0);
+
+	//Fewest inner steps within the bound (ADAPT_FREE : any number, ADAPT_SYMPLECTIC : a power of 2)
+	int wanted;
+	if(ad.mode == ADAPT_FREE)
+	{
+		wanted = (int)std::min<double>(std::ceil(sim.timestep/dt_bound), ad.max_inner_steps + 1.0);
+	}
+	else
+	{
+		wanted = 1;
+		while(wanted <= ad.max_inner_steps && sim.timestep/wanted > dt_bound)
+		{
+			wanted *= 2;
+		}
+	}
+	if(wanted > ad.max_inner_steps)
+	{
+		wanted = ad.max_inner_steps;
+		ad.clamped++;
+	}
+
+	if(wanted > ad.inner_steps)
+	{
+		//The bound is broken : shorter steps at once, in both modes
+		ad.inner_steps = wanted;
+	}
+	else if(choice && ad.hold)
+	{
+		ad.hold = 0;
+	}
+	else if(choice && ad.mode == ADAPT_FREE)
+	{
+		ad.inner_steps = wanted;
+	}
+	else if(choice)
+	{
+		//Doubled back only with some margin, so that the step does not switch back and forth every interval
+		while(ad.inner_steps > 1 && 2*sim.timestep/ad.inner_steps <= ADAPT_HYSTERESIS*dt_bound)
+		{
+			ad.inner_steps /= 2;
+		}
+	}
+}
+
+void adaptive_check_energy(System::simulation& sim)
+{
+	System::timestep_control& ad = sim.adaptive;
+	if(ad.energy_tolerance <= 0)
+	{
+		return;
+	}
+	//The total energy is only conserved without thermostats and barostat
+	if(sim.barostat != NULL && sim.barostat != no_barostat)
+	{
+		return;
+	}
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		if(sim.thermostat[i] != NULL && sim.thermostat[i] != no_thermostat)
+		{
+			return;
+		}
+	}
+
+	//energy_kinetic is m v^2
+	double kinetic = 0;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		kinetic += 0.5*sim.energy_kinetic[i];
+	}
+	double energy = sim.energy_potential + kinetic;
+	if(ad.energy_reference_valid && kinetic > 0 && std::abs(energy - ad.energy_reference) > ad.energy_tolerance*kinetic)
+	{
+		if(ad.inner_steps < ad.max_inner_steps)
+		{
+			ad.inner_steps = std::min(2*ad.inner_steps, ad.max_inner_steps);
+		}
+		else
+		{
+			ad.clamped++;
+		}
+		ad.hold = 1;
+	}
+	ad.energy_reference = energy;
+	ad.energy_reference_valid = 1;
+}
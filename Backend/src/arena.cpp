@@ -0,0 +1,93 @@
+/** @file */
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include "arena.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Rounds x up to a multiple of align (a power of 2)
+static size_t arena_round(size_t x, size_t align)
+{
+	return (x + align - 1) & ~(align - 1);
+}
+
+System::arena::arena(size_t bytes) : offset(0)
+{
+	huge = 0;
+	capacity = arena_round(std::max(bytes, (size_t)ARENA_ALIGN), ARENA_ALIGN);
+#ifdef __linux__
+	//Mapping one more huge page so that the block can start on a huge page boundary
+	mapped = arena_round(capacity, ARENA_HUGEPAGE_SIZE) + ARENA_HUGEPAGE_SIZE;
+	mapping = MAP_FAILED;
+#if ARENA_HUGEPAGES == 2
+	mapping = mmap(NULL, arena_round(capacity, ARENA_HUGEPAGE_SIZE), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(mapping != MAP_FAILED)
+	{
+		mapped = arena_round(capacity, ARENA_HUGEPAGE_SIZE);
+		huge = 2;
+	}
+#endif
+	if(mapping == MAP_FAILED)
+	{
+		mapping = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(mapping == MAP_FAILED)
+		{
+			throw std::bad_alloc();
+		}
+	}
+	base = (char*)mapping;
+	if(huge == 0)
+	{
+		base = (char*)arena_round((uintptr_t)mapping, ARENA_HUGEPAGE_SIZE);
+#if ARENA_HUGEPAGES >= 1
+		if(madvise(base, arena_round(capacity, ARENA_HUGEPAGE_SIZE), MADV_HUGEPAGE) == 0)
+		{
+			huge = 1;
+		}
+#else
+		//Transparent huge pages set to always would still back the block
+		madvise(base, arena_round(capacity, ARENA_HUGEPAGE_SIZE), MADV_NOHUGEPAGE);
+#endif
+	}
+#else
+	mapped = capacity;
+	mapping = ::operator new(capacity, std::align_val_t(ARENA_ALIGN));
+	base = (char*)mapping;
+#endif
+}
+
+System::arena::~arena()
+{
+#ifdef __linux__
+	munmap(mapping, mapped);
+#else
+	::operator delete(mapping, std::align_val_t(ARENA_ALIGN));
+#endif
+}
+
+void* System::arena::allocate(size_t bytes, size_t align)
+{
+	size_t start = offset.load();
+	size_t aligned;
+	do
+	{
+		aligned = arena_round(start, align);
+		if(aligned + bytes > capacity)
+		{
+			//The block is full, the rest comes from the heap
+			return ::operator new(bytes, std::align_val_t(align));
+		}
+	} while(!offset.compare_exchange_weak(start, aligned + bytes));
+	return base + aligned;
+}
+
+void System::arena::deallocate(void* p, size_t bytes, size_t align)
+{
+	if(!owns(p))
+	{
+		::operator delete(p, std::align_val_t(align));
+	}
+}
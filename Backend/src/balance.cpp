@@ -0,0 +1,136 @@
+/** @file */
+#include "balance.h"
+#include "system.h"
+
+void initialize_load_balance(System::simulation& sim, int interval, int block)
+{
+	if(interval < 0 || block < 1)
+	{
+		std::cerr<<"Error 0019"<<std::endl;
+		exit(19);
+	}
+	System::load_balance& lb = sim.balance;
+	const int loops = sim.n_types*sim.n_types;
+	try{
+		lb.calls.assign(loops, 0);
+		lb.cost.assign(loops, std::vector<double>());
+		lb.bounds.assign(loops, std::vector<int>());
+		lb.time_max.assign(loops, 0);
+		lb.time_mean.assign(loops, 0);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	lb.interval = interval;
+	lb.block = block;
+	lb.partitions = 0;
+	lb.active = 1;
+}
+
+void balance_partition(System::load_balance& lb, int key, int threads)
+{
+	std::vector<double>& cost = lb.cost[key];
+	std::vector<int>& bounds = lb.bounds[key];
+	const int blocks = cost.size();
+	bounds.assign(threads + 1, blocks);
+	bounds[0] = 0;
+
+	double total = 0;
+	for (int b = 0; b < blocks; ++b)
+	{
+		total += cost[b];
+	}
+	if(total <= 0 || lb.interval == 0)
+	{
+		//Nothing measured yet (or only measuring) : equal numbers of blocks, as a static schedule
+		for (int t = 1; t < threads; ++t)
+		{
+			bounds[t] = (int)((long)blocks*t/threads);
+		}
+		return;
+	}
+
+	//Thread t starts at the first block whose cost before it reaches t/threads of the total
+	double before = 0;
+	int t = 1;
+	for (int b = 0; b < blocks && t < threads; ++b)
+	{
+		while(t < threads && before >= total*t/threads)
+		{
+			bounds[t++] = b;
+		}
+		before += cost[b];
+	}
+	//Called outside the parallel region of balance_sum() (before it, or after it from balance_record()), so the count is not shared
+	lb.partitions++;
+}
+
+void balance_record(System::load_balance& lb, int key, const std::vector<double>& block_time, const std::vector<double>& thread_time)
+{
+	std::vector<double>& cost = lb.cost[key];
+	const bool first = (lb.calls[key] == 0);
+	for (size_t b = 0; b < cost.size(); ++b)
+	{
+		cost[b] = first ? block_time[b] : BALANCE_SMOOTHING*block_time[b] + (1 - BALANCE_SMOOTHING)*cost[b];
+	}
+
+	double max = 0, mean = 0;
+	for (size_t t = 0; t < thread_time.size(); ++t)
+	{
+		max = std::max(max, thread_time[t]);
+		mean += thread_time[t];
+	}
+	lb.time_max[key] += max;
+	lb.time_mean[key] += mean/thread_time.size();
+
+	lb.calls[key]++;
+	//The first partition follows the first measurement, then one every interval calls
+	if(lb.interval > 0 && (lb.calls[key] == 1 || lb.calls[key] % lb.interval == 0))
+	{
+		balance_partition(lb, key, thread_time.size());
+	}
+}
+
+double load_imbalance(System::simulation& sim, int key)
+{
+	System::load_balance& lb = sim.balance;
+	double max = 0, mean = 0;
+	for (size_t k = 0; k < lb.time_max.size(); ++k)
+	{
+		if(key < 0 || (int)k == key)
+		{
+			max += lb.time_max[k];
+			mean += lb.time_mean[k];
+		}
+	}
+	return (mean > 0) ? max/mean : 1;
+}
+
+void load_balance_report(System::simulation& sim, std::ostream& out)
+{
+	System::load_balance& lb = sim.balance;
+	out<<"Load imbalance (slowest thread / mean) : "<<load_imbalance(sim)<<" over all loops, "<<lb.partitions<<" partitions"<<std::endl;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = 0; j < sim.n_types; ++j)
+		{
+			const int key = i*sim.n_types + j;
+			if(lb.calls.empty() || lb.calls[key] == 0)
+			{
+				continue;
+			}
+			out<<"\ttypes "<<i<<"-"<<j<<" : "<<load_imbalance(sim, key)<<" over "<<lb.calls[key]<<" calls, rows of each thread :";
+			const std::vector<int>& bounds = lb.bounds[key];
+			for (size_t t = 0; t + 1 < bounds.size(); ++t)
+			{
+				out<<" "<<std::min((long)bounds[t + 1]*lb.block, (long)sim.n_particles[i]) - std::min((long)bounds[t]*lb.block, (long)sim.n_particles[i]);
+			}
+			out<<std::endl;
+		}
+	}
+}
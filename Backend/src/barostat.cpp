@@ -0,0 +1,101 @@
+#include "barostat.h"
+#include "timer.h"
+
+void initialize_barostat(System::simulation& sim){
+	if(sim.barostat == NULL || sim.barostat == no_barostat){
+		// Do nothing
+	}
+	else if(sim.barostat == berendsen){
+		//Precomputing values for Berendsen barostat
+		sim.barostat_const[3] = sim.barostat_const[2]*sim.timestep/sim.barostat_const[1];
+	}
+	else if(sim.barostat == mtk){
+		//Precomputing values for MTK barostat
+		sim.barostat_const[2] = 0;
+		sim.barostat_const[3] = 0;
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			sim.barostat_const[3] += sim.n_particles[i]*sim.n_dimensions;
+		}
+	}
+}
+
+void call_barostat(System::simulation& sim){
+	TIME_PHASE(PHASE_BAROSTAT);
+	if(sim.barostat != NULL)
+	{
+		sim.barostat(sim);
+	}
+}
+
+void rescale_box(System::simulation& sim, double mu){
+	double vol_old = box_volume(sim);
+	for (int k = 0; k < sim.n_dimensions; ++k)
+	{
+		sim.box_size_limits[k] *= mu;
+	}
+
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		#pragma omp parallel for schedule(static)
+		for (int j = 0; j < sim.n_particles[i]; ++j)
+		{
+			for (int k = 0; k < sim.n_dimensions; ++k)
+			{
+				sim.position[i][j][k] *= mu;
+			}
+		}
+	}
+
+	update_interactions_volume(sim, vol_old, box_volume(sim));
+}
+
+void no_barostat(System::simulation& sim){
+	//Nothing to be done here
+}
+
+void berendsen(System::simulation& sim){
+	compute_pressure(sim);
+	double mu = std::pow(1 - sim.barostat_const[3]*(sim.barostat_const[0] - sim.pressure), 1.0/sim.n_dimensions);
+	rescale_box(sim, mu);
+}
+
+void mtk(System::simulation& sim){
+	double dt = sim.timestep;
+	double d = sim.n_dimensions;
+	double nf = sim.barostat_const[3];
+
+	//First half kick of the barostat momentum
+	compute_pressure(sim);
+	double ke2 = 0;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		ke2 += sim.energy_kinetic[i];
+	}
+	sim.barostat_const[2] += 0.5*dt*(d*box_volume(sim)*(sim.pressure - sim.barostat_const[0]) + d*ke2/nf);
+	double veps = sim.barostat_const[2]/sim.barostat_const[1];
+
+	//Scaling the velocities
+	double sv = std::exp(-(1 + d/nf)*veps*dt);
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		#pragma omp parallel for schedule(static)
+		for (int j = 0; j < sim.n_particles[i]; ++j)
+		{
+			for (int k = 0; k < sim.n_dimensions; ++k)
+			{
+				sim.velocity[i][j][k] *= sv;
+			}
+		}
+		sim.energy_kinetic[i] *= sv*sv;
+		sim.temperature[i] *= sv*sv;
+	}
+
+	//Scaling the box and positions
+	rescale_box(sim, std::exp(veps*dt));
+
+	//Second half kick of the barostat momentum (the virial is kept from the start of the step)
+	compute_pressure(sim);
+	ke2 *= sv*sv;
+	sim.barostat_const[2] += 0.5*dt*(d*box_volume(sim)*(sim.pressure - sim.barostat_const[0]) + d*ke2/nf);
+}
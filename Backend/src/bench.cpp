@@ -0,0 +1,597 @@
+/** @file */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include "system.h"
+#include "interaction.h"
+#include "integrate.h"
+#include "thermostat.h"
+#include "step.h"
+#include "timer.h"
+#include "ensemble.h"
+#include "pme.h"
+#include "stream.h"
+#include "balance.h"
+#include "sample.h"
+#include "pipeline.h"
+#include "write.h"
+#ifdef MDGEN_MPI
+#include "domain.h"
+#endif
+
+/**
+ * \brief Parameters of the synthetic systems and of the measurement (set with key=value arguments)
+ */
+struct bench_params
+{
+	std::string kernel = "all"; ///< Kernel to time (or all)
+	int n = 4096; ///< Total number of particles
+	double density = 0.8; ///< Number density (particles per unit volume in LJ units)
+	int types = 1; ///< Number of particle types (particles are dealt round robin)
+	int dim = 3; ///< Number of dimensions
+	int warmup = 3; ///< Untimed calls before the measurement
+	int reps = 10; ///< Number of repetitions measured
+	int steps = 10; ///< Calls per repetition
+	int energy = 0; ///< Value of sim.energy_due during the measurement
+	int replicas = 64; ///< Number of replicas (of n particles each) of the ensemble kernel
+	int respa = 4; ///< Inner timesteps per timestep of the integrate_respa kernel
+	unsigned seed = 12345; ///< Seed of the synthetic positions and velocities
+	double contrast = 1; ///< Density of the dense half of the box over that of the other half (1 : homogeneous, see bench_fill())
+	int balance = 0; ///< If 1, the LJ kernels use the cost-measured partition of their rows (see initialize_load_balance())
+	std::string json = ""; ///< If not empty, the results are also written to this file
+	std::string timing = ""; ///< If not empty (and MDGEN_TIMING is defined), the per-phase timers of the step kernel are written to this file
+};
+
+/**
+ * \brief Measurement of one kernel
+ */
+struct bench_result
+{
+	std::string kernel;
+	double pairs; ///< Pair interactions per call (0 if the kernel does not compute interactions)
+	double particles; ///< Particles advanced per call
+	std::vector<double> seconds; ///< Time per call of each repetition
+	double min, median, mean, stddev, max;
+	double imbalance; ///< Load imbalance of the force loops over the timed calls (0 if the load balance is not active)
+};
+
+// Input string (see System::input_params) and box size of the synthetic system
+static std::string bench_input(const bench_params& p, int periodic, std::vector<double>& size)
+{
+	double box = std::pow(p.n/p.density, 1.0/p.dim);
+	double timestep = 0.001;
+
+	std::stringstream input;
+	input<<p.types<<","<<p.dim;
+	for (int t = 0; t < p.types; ++t)
+	{
+		input<<","<<(p.n/p.types + (t < p.n%p.types));
+	}
+	input<<","<<timestep<<","<<timestep<<",1";
+	for (int t = 0; t < p.types; ++t)
+	{
+		input<<",1";
+	}
+	for (int t = 0; t < p.types; ++t)
+	{
+		input<<",1";
+	}
+	input<<","<<periodic;
+
+	size.assign(p.dim, box);
+	return input.str();
+}
+
+/*******************************************************************************
+ * \brief Fills a system built from bench_input() with a synthetic Lennard-Jones system
+ *
+ * The particles are put on a simple cubic (square) lattice filling the box with a small random displacement,
+ * so that no two particles overlap, and are given gaussian velocities. The cutoff is 2.5 sigma (or half the box if smaller). \n
+ * If p.contrast > 1, the lower half of the lattice along the last dimension is squeezed into a slab contrast times denser than the rest
+ * (an interface, with the dense particles numbered first). The slab may then overlap : it is meant for timing the force kernels.
+ *
+ * @param sim System to fill
+ * @param p Parameters of the system
+ * @param periodic 1 for periodic boundary conditions, 0 for rigid walls
+ * @param seed Seed of the displacements and velocities
+ ******************************************************************************/
+static void bench_fill(System::simulation& sim, const bench_params& p, int periodic, unsigned seed)
+{
+	double box = sim.box_size_limits[0];
+	int side = (int)std::ceil(std::pow((double)p.n, 1.0/p.dim) - 1e-9);
+	double a = box/side;
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> jitter(-0.05*a, 0.05*a);
+	std::normal_distribution<double> gauss(0, 1);
+
+	//Width of the dense slab : (box - w)/w = contrast
+	const double w = box/(1 + p.contrast);
+	for (int g = 0; g < p.n; ++g)
+	{
+		int t = g%p.types;
+		int j = g/p.types;
+		int site = g;
+		for (int k = 0; k < p.dim; ++k)
+		{
+			sim.position[t][j][k] = (site%side + 0.5)*a + jitter(rng);
+			sim.velocity[t][j][k] = gauss(rng);
+			site /= side;
+		}
+		if(p.contrast != 1)
+		{
+			double& z = sim.position[t][j][p.dim - 1];
+			z = (z < box/2) ? z*2*w/box : w + (z - box/2)*2*(box - w)/box;
+		}
+	}
+
+	for (int t = 0; t < p.types; ++t)
+	{
+		double ke = 0;
+		for (int j = 0; j < sim.n_particles[t]; ++j)
+		{
+			for (int k = 0; k < p.dim; ++k)
+			{
+				ke += sim.velocity[t][j][k]*sim.velocity[t][j][k];
+			}
+		}
+		sim.energy_kinetic[t] = sim.mass[t]*ke;
+		sim.thermostat[t] = no_thermostat;
+		for (int u = 0; u < p.types; ++u)
+		{
+			sim.interaction[t][u] = periodic ? lj_periodic : lj_box;
+			sim.interaction_const[t][u][0] = 1;
+			sim.interaction_const[t][u][1] = 1;
+			sim.interaction_const[t][u][2] = std::min(2.5, box/2);
+		}
+	}
+	initialize_interactions(sim);
+	sim.energy_due = p.energy;
+}
+
+// Builds a synthetic system (see bench_fill())
+static System::simulation* bench_system(const bench_params& p, int periodic)
+{
+	std::vector<double> size;
+	std::string input = bench_input(p, periodic, size);
+	System::simulation* sim = new System::simulation(input, size.data());
+	bench_fill(*sim, p, periodic, p.seed);
+#ifdef MDGEN_MPI
+	initialize_domain(*sim);
+#endif
+	if(p.balance)
+	{
+		initialize_load_balance(*sim);
+	}
+	return sim;
+}
+
+// Pair interactions visited by interact() on a system (over all ranks with MPI)
+static double bench_pairs(System::simulation& sim)
+{
+#ifdef MDGEN_MPI
+	std::vector<int>& n = sim.domain.n_particles_global;
+#else
+	std::vector<int>& n = sim.n_particles;
+#endif
+	double pairs = 0;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = i; j < sim.n_types; ++j)
+		{
+			pairs += (i == j) ? 0.5*n[i]*(n[i]-1) : (double)n[i]*n[j];
+		}
+	}
+	return pairs;
+}
+
+/*******************************************************************************
+ * \brief Times one kernel on a system
+ *
+ * The kernel is called p.warmup times untimed, then p.reps repetitions of p.steps calls each are timed.
+ * If the timers are compiled in, they are reset after the warmup so that they only hold the timed calls.
+ *
+ * @param sim System the kernel acts on
+ * @param kernel Kernel to time (called once per timestep)
+ ******************************************************************************/
+static bench_result bench_time(System::simulation& sim, const bench_params& p, std::string name, double pairs, void (*kernel)(System::simulation&))
+{
+	bench_result r;
+	r.kernel = name;
+	r.pairs = pairs;
+	r.particles = p.n;
+
+	for (int w = 0; w < p.warmup; ++w)
+	{
+		sim.energy_due = p.energy;
+		kernel(sim);
+	}
+#ifdef MDGEN_TIMING
+	timer_reset();
+#endif
+	//The imbalance is only that of the timed calls (the partition made during the warmup is kept)
+	std::fill(sim.balance.time_max.begin(), sim.balance.time_max.end(), 0);
+	std::fill(sim.balance.time_mean.begin(), sim.balance.time_mean.end(), 0);
+	for (int rep = 0; rep < p.reps; ++rep)
+	{
+		double start = omp_get_wtime();
+		for (int s = 0; s < p.steps; ++s)
+		{
+			sim.energy_due = p.energy;
+			kernel(sim);
+		}
+		r.seconds.push_back((omp_get_wtime() - start)/p.steps);
+	}
+
+	std::vector<double> sorted = r.seconds;
+	std::sort(sorted.begin(), sorted.end());
+	int n = sorted.size();
+	r.min = sorted[0];
+	r.max = sorted[n-1];
+	r.median = (n%2) ? sorted[n/2] : 0.5*(sorted[n/2-1] + sorted[n/2]);
+	r.mean = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		r.mean += sorted[i];
+	}
+	r.mean /= n;
+	r.stddev = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		r.stddev += (sorted[i] - r.mean)*(sorted[i] - r.mean);
+	}
+	r.stddev = (n > 1) ? std::sqrt(r.stddev/(n-1)) : 0;
+	//Nothing is measured with MDGEN_DETERMINISTIC, whose rows are scheduled dynamically
+	double measured = 0;
+	for (double t : sim.balance.time_mean)
+	{
+		measured += t;
+	}
+	r.imbalance = (measured > 0) ? load_imbalance(sim) : 0;
+	return r;
+}
+
+// The kernels, each called once per timestep on all types (or pairs of types)
+static void bench_lj(System::simulation& sim)
+{
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = i; j < sim.n_types; ++j)
+		{
+			sim.interaction[i][j](sim,i,j);
+		}
+	}
+}
+
+static void bench_thermostat(System::simulation& sim)
+{
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		sim.thermostat[i](sim,i);
+	}
+}
+
+// Timesteps per call of bench_pipeline_steps(), so that the observables of a call can overlap with its timesteps
+static const int bench_pipeline_steps = 10;
+
+static void bench_pipeline_steps_call(System::simulation& sim)
+{
+	md_steps(sim, bench_pipeline_steps);
+}
+
+// Stream buffer throwing away what is written (the trajectory of kernel=pipeline is formatted but not kept)
+class bench_null_buffer : public std::streambuf
+{
+protected:
+	int overflow(int c) override { return c; }
+};
+
+#ifndef MDGEN_MPI
+// Ensemble advanced by bench_ensemble_step() (the kernels only take a simulation)
+static System::ensemble* bench_ensemble = NULL;
+
+static void bench_ensemble_step(System::simulation& sim)
+{
+	ensemble_step(*bench_ensemble);
+}
+#endif
+
+static void bench_print(std::ostream& out, const bench_params& p, const bench_result& r)
+{
+	double n = r.particles;
+	out<<r.kernel<<","<<r.median*1e9/n<<","<<((r.pairs > 0) ? r.pairs/r.median : 0)<<","<<r.min*1e9/n<<","<<r.mean*1e9/n<<","<<r.stddev*1e9/n<<","<<r.max*1e9/n<<std::endl;
+}
+
+static void bench_write_json(std::string filename, const bench_params& p, const std::vector<bench_result>& results)
+{
+	std::ofstream out(filename);
+	out<<"{\"n\":"<<p.n<<",\"density\":"<<p.density<<",\"types\":"<<p.types<<",\"dim\":"<<p.dim;
+	out<<",\"warmup\":"<<p.warmup<<",\"reps\":"<<p.reps<<",\"steps\":"<<p.steps<<",\"energy\":"<<p.energy<<",\"replicas\":"<<p.replicas<<",\"respa\":"<<p.respa<<",\"contrast\":"<<p.contrast<<",\"balance\":"<<p.balance;
+	out<<",\"threads\":"<<omp_get_max_threads()<<",\"kernels\":[";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const bench_result& r = results[i];
+		out<<(i ? "," : "")<<"\n{\"name\":\""<<r.kernel<<"\",\"ns_per_particle_step\":"<<r.median*1e9/r.particles;
+		out<<",\"pairs_per_second\":"<<((r.pairs > 0) ? r.pairs/r.median : 0)<<",\"load_imbalance\":"<<r.imbalance;
+		out<<",\"seconds_per_step\":{\"min\":"<<r.min<<",\"median\":"<<r.median<<",\"mean\":"<<r.mean<<",\"stddev\":"<<r.stddev<<",\"max\":"<<r.max<<"}";
+		out<<",\"reps\":[";
+		for (size_t k = 0; k < r.seconds.size(); ++k)
+		{
+			out<<(k ? "," : "")<<r.seconds[k];
+		}
+		out<<"]}";
+	}
+	out<<"\n]}"<<std::endl;
+}
+
+static void bench_usage()
+{
+	std::cerr<<"Usage : mdgen_bench [kernel=all|lj_periodic|lj_box|interact|integrate_verdet_periodic|integrate_verdet_box|integrate_respa|integrate_adaptive|pme|publish_frame|hard_spheres|anderson|bussi|step|pipeline|ensemble]"<<std::endl;
+	std::cerr<<"        [n=4096] [density=0.8] [types=1] [dim=3] [warmup=3] [reps=10] [steps=10] [energy=0] [replicas=64] [respa=4] [seed=12345] [contrast=1] [balance=0] [json=file] [timing=file]"<<std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+#ifdef MDGEN_MPI
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#endif
+	bench_params p;
+	for (int a = 1; a < argc; ++a)
+	{
+		std::string arg(argv[a]);
+		size_t eq = arg.find('=');
+		if(eq == std::string::npos)
+		{
+			bench_usage();
+			return 1;
+		}
+		std::string key = arg.substr(0, eq);
+		std::string value = arg.substr(eq+1);
+		if(key == "kernel") p.kernel = value;
+		else if(key == "n") p.n = std::stoi(value);
+		else if(key == "density") p.density = std::stod(value);
+		else if(key == "types") p.types = std::stoi(value);
+		else if(key == "dim") p.dim = std::stoi(value);
+		else if(key == "warmup") p.warmup = std::stoi(value);
+		else if(key == "reps") p.reps = std::stoi(value);
+		else if(key == "steps") p.steps = std::stoi(value);
+		else if(key == "energy") p.energy = std::stoi(value);
+		else if(key == "replicas") p.replicas = std::stoi(value);
+		else if(key == "respa") p.respa = std::stoi(value);
+		else if(key == "seed") p.seed = std::stoul(value);
+		else if(key == "contrast") p.contrast = std::stod(value);
+		else if(key == "balance") p.balance = std::stoi(value);
+		else if(key == "json") p.json = value;
+		else if(key == "timing") p.timing = value;
+		else
+		{
+			bench_usage();
+			return 1;
+		}
+	}
+	if(p.n < 2 || p.types < 1 || p.types > p.n || p.dim < 1 || p.reps < 1 || p.steps < 1 || p.density <= 0 || p.replicas < 1 || p.respa < 1 || p.contrast < 1)
+	{
+		bench_usage();
+		return 1;
+	}
+
+	System::simulation* periodic = bench_system(p, 1);
+	System::simulation* box = bench_system(p, 0);
+	double pairs = bench_pairs(*periodic);
+	bool all = (p.kernel == "all");
+	std::vector<bench_result> results;
+
+	if(all || p.kernel == "lj_periodic")
+	{
+		results.push_back(bench_time(*periodic, p, "lj_periodic", pairs, bench_lj));
+	}
+	if(all || p.kernel == "lj_box")
+	{
+		results.push_back(bench_time(*box, p, "lj_box", pairs, bench_lj));
+	}
+	if(all || p.kernel == "interact")
+	{
+		results.push_back(bench_time(*periodic, p, "interact", pairs, interact));
+	}
+	if(all || p.kernel == "integrate_verdet_periodic")
+	{
+		results.push_back(bench_time(*periodic, p, "integrate_verdet_periodic", pairs, integrate_verdet_periodic));
+	}
+	if(all || p.kernel == "integrate_verdet_box")
+	{
+		results.push_back(bench_time(*box, p, "integrate_verdet_box", pairs, integrate_verdet_box));
+	}
+	if(all || p.kernel == "integrate_respa")
+	{
+		//The LJ interactions switched from the inner to the outer level between 0.6 and 0.7 r_cut
+		System::simulation* split = bench_system(p, 1);
+		for (int t = 0; t < p.types; ++t)
+		{
+			for (int u = 0; u < p.types; ++u)
+			{
+				split->interaction_level[t][u] = RESPA_SPLIT;
+				split->interaction_const[t][u][7] = 0.7*split->interaction_const[t][u][2];
+				split->interaction_const[t][u][8] = 0.1*split->interaction_const[t][u][2];
+			}
+		}
+		initialize_respa(*split, p.respa);
+		results.push_back(bench_time(*split, p, "integrate_respa", pairs, integrate_respa));
+		delete split;
+	}
+	if(all || p.kernel == "integrate_adaptive")
+	{
+		//Inner steps (a power of 2, down to timestep/8) within which no particle moves further than 0.01 sigma
+		System::simulation* adaptive = bench_system(p, 1);
+		initialize_adaptive_timestep(*adaptive, ADAPT_SYMPLECTIC, adaptive->timestep/8, 0.01);
+		results.push_back(bench_time(*adaptive, p, "integrate_adaptive", pairs, integrate_adaptive));
+		delete adaptive;
+	}
+#ifndef MDGEN_MPI
+	if(p.kernel == "pme")
+	{
+		//Only run when asked for (the grid of unit charges is large). Two types of opposite unit charges, with the real space part in the LJ kernel and the reciprocal part on the grid
+		bench_params q = p;
+		q.types = 2;
+		System::simulation* ionic = bench_system(q, 1);
+		ionic->charge[0] = 1;
+		ionic->charge[1] = -1;
+		initialize_pme(*ionic, PME_ACCURACY, 0);
+		results.push_back(bench_time(*ionic, p, "pme", bench_pairs(*ionic), interact));
+		delete ionic;
+	}
+#endif
+	if(p.kernel == "publish_frame")
+	{
+		//Only run when asked for (it creates the shared memory object /mdgen_bench). Positions, velocities and energies of every frame
+		System::simulation* live = bench_system(p, 1);
+		open_live_stream(*live, "mdgen_bench", 1, 0, STREAM_POSITIONS | STREAM_VELOCITIES | STREAM_ENERGIES);
+		results.push_back(bench_time(*live, p, "publish_frame", 0, publish_frame));
+		close_live_stream(*live);
+		delete live;
+	}
+#ifndef MDGEN_MPI
+	if(all || p.kernel == "hard_spheres")
+	{
+		//Event-driven hard spheres of diameter 0.85 of the lattice spacing (so that the jittered lattice has no overlap)
+		System::simulation* hs = bench_system(p, 1);
+		int side = (int)std::ceil(std::pow((double)p.n, 1.0/p.dim) - 1e-9);
+		for (int t = 0; t < p.types; ++t)
+		{
+			for (int u = 0; u < p.types; ++u)
+			{
+				hs->interaction[t][u] = hard_sphere;
+				hs->interaction_const[t][u][1] = 0.85*hs->box_size_limits[0]/side;
+			}
+		}
+		initialize_event_driven(*hs);
+		results.push_back(bench_time(*hs, p, "hard_spheres", 0, integrate_event_driven));
+		delete hs;
+	}
+#endif
+	if(all || p.kernel == "anderson")
+	{
+		for (int t = 0; t < p.types; ++t)
+		{
+			periodic->thermostat[t] = anderson;
+			periodic->thermostat_const[t][0] = 10; //Collision frequency (0.01 collisions per particle and timestep)
+		}
+		initialize_thermostats(*periodic);
+		results.push_back(bench_time(*periodic, p, "anderson", 0, bench_thermostat));
+	}
+	if(all || p.kernel == "bussi")
+	{
+		for (int t = 0; t < p.types; ++t)
+		{
+			periodic->thermostat[t] = bussi;
+			periodic->thermostat_const[t][0] = 0.1; //Relaxation time
+		}
+		initialize_thermostats(*periodic);
+		results.push_back(bench_time(*periodic, p, "bussi", 0, bench_thermostat));
+	}
+	if(p.kernel == "step")
+	{
+		//The whole timestep (md_step decides energy_due by itself), only run on its own so that the timers hold nothing else
+		for (int t = 0; t < p.types; ++t)
+		{
+			periodic->thermostat[t] = no_thermostat;
+		}
+		periodic->total_steps = periodic->state + p.warmup + p.reps*p.steps;
+		results.push_back(bench_time(*periodic, p, "step", pairs, md_step));
+#ifdef MDGEN_TIMING
+		if(!p.timing.empty())
+		{
+			timer_write_json(p.timing);
+		}
+#endif
+	}
+	if(p.kernel == "pipeline")
+	{
+		//md_steps() with the trajectory written every 5 timesteps, sampled at once (sync) and on snapshots overlapping the timesteps (async)
+		bench_null_buffer null_buffer;
+		std::ostream null_output(&null_buffer);
+		for (int async = 0; async < 2; ++async)
+		{
+			System::simulation* piped = bench_system(p, 1);
+			piped->output = &null_output;
+			if(async)
+			{
+				register_async_observable(*piped, write_traj, 5, 0);
+			}
+			else
+			{
+				register_observable(*piped, write_traj, 5, 0);
+			}
+			piped->total_steps = piped->state + (p.warmup + p.reps*p.steps)*bench_pipeline_steps;
+			bench_result r = bench_time(*piped, p, async ? "pipeline_async" : "pipeline_sync", pairs, bench_pipeline_steps_call);
+			for (double* t : {&r.min, &r.median, &r.mean, &r.stddev, &r.max})
+			{
+				*t /= bench_pipeline_steps;
+			}
+			for (double& t : r.seconds)
+			{
+				t /= bench_pipeline_steps;
+			}
+			results.push_back(r);
+			delete piped;
+		}
+	}
+#ifndef MDGEN_MPI
+	if(p.kernel == "ensemble")
+	{
+		//replicas independent systems of n particles, the threads spread over the replicas instead of the particles
+		std::vector<double> size;
+		std::string input = bench_input(p, 1, size);
+		System::ensemble ens(input, size.data(), p.replicas, p.seed, "");
+		for (int r = 0; r < ens.size(); ++r)
+		{
+			bench_fill(ens.replica[r], p, 1, p.seed + r);
+			ens.replica[r].total_steps = p.warmup + p.reps*p.steps;
+		}
+		bench_ensemble = &ens;
+		bench_result r = bench_time(ens.replica[0], p, "ensemble", pairs*p.replicas, bench_ensemble_step);
+		r.particles = (double)p.n*p.replicas;
+		results.push_back(r);
+		bench_ensemble = NULL;
+	}
+#endif
+	if(results.empty())
+	{
+		bench_usage();
+		return 1;
+	}
+
+	bool report = true;
+#ifdef MDGEN_MPI
+	//Rank 0 reports its own timings (every rank waits for the others in the reductions)
+	report = (periodic->domain.rank == 0);
+#endif
+	if(report)
+	{
+		std::cout<<"# n="<<p.n<<" density="<<p.density<<" types="<<p.types<<" dim="<<p.dim<<" threads="<<omp_get_max_threads()<<" energy="<<p.energy<<" contrast="<<p.contrast<<" balance="<<p.balance<<std::endl;
+		std::cout<<"kernel,ns/particle/step (median),pairs/s,min,mean,stddev,max"<<std::endl;
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			bench_print(std::cout, p, results[i]);
+		}
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			if(results[i].imbalance > 0)
+			{
+				std::cout<<"# load imbalance of "<<results[i].kernel<<" : "<<results[i].imbalance<<std::endl;
+			}
+		}
+		if(!p.json.empty())
+		{
+			bench_write_json(p.json, p, results);
+		}
+	}
+
+	delete periodic;
+	delete box;
+#ifdef MDGEN_MPI
+	MPI_Finalize();
+#endif
+	return 0;
+}
@@ -0,0 +1,1399 @@
+/** @file */
+#include <algorithm>
+#include <complex>
+#include <cstring>
+#include <random>
+#include <set>
+#include "system.h"
+#include "interaction.h"
+#include "thermostat.h"
+#include "sample.h"
+#include "step.h"
+#include "pipeline.h"
+#include "write.h"
+#include "constraints.h"
+#include "pme.h"
+#include "balance.h"
+#include "stream.h"
+#include "integrate.h"
+#include "rigid.h"
+#include "event.h"
+#include "adaptive.h"
+#include "correlations.h"
+#include "structure_factor.h"
+#include "barostat.h"
+#include "ensemble.h"
+#include "tempering.h"
+
+/*******************************************************************************
+ * Checks of the optional paths of the kernels against plain reference implementations (make check)
+ *
+ * Each check builds a small synthetic system, runs a path and compares it with a serial reference (or with another path
+ * which must give the same result), and prints its largest error. mdgen_check runs every check (or those named on the
+ * command line) and exits with the number of failures. The checks hold for both builds (with and without MDGEN_DETERMINISTIC).
+ ******************************************************************************/
+
+/**
+ * \brief A check : its name and the function running it (which writes its largest error to detail and returns true if it passed)
+ */
+struct check_case
+{
+	std::string name;
+	bool (*run)(std::ostream& detail);
+};
+
+/*******************************************************************************
+ * \brief Input string of the system of check_system()
+ *
+ * @param size Set to the box size
+ ******************************************************************************/
+static std::string check_input(int n, int types, int periodic, std::vector<double>& size)
+{
+	const int dim = 3;
+	std::stringstream input;
+	input<<types<<","<<dim;
+	for (int t = 0; t < types; ++t)
+	{
+		input<<","<<(n/types + (t < n%types));
+	}
+	input<<",0.001,0.001,1";
+	for (int t = 0; t < 2*types; ++t)
+	{
+		input<<",1";
+	}
+	input<<","<<periodic;
+	size.assign(dim, std::cbrt(n/0.8));
+	return input.str();
+}
+
+/*******************************************************************************
+ * \brief Places the particles of a system built from check_input() and sets its interactions (see check_system())
+ ******************************************************************************/
+static void check_fill(System::simulation& sim, int periodic, unsigned seed)
+{
+	const int n = sim.numpartot;
+	const int types = sim.n_types;
+	const int dim = sim.n_dimensions;
+	const double box = sim.box_size_limits[0];
+	int side = (int)std::ceil(std::cbrt((double)n) - 1e-9);
+	double a = box/side;
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> jitter(-0.05*a, 0.05*a);
+	std::normal_distribution<double> gauss(0, 1);
+	for (int g = 0; g < n; ++g)
+	{
+		int site = g;
+		for (int k = 0; k < dim; ++k)
+		{
+			sim.position[g%types][g/types][k] = (site%side + 0.5)*a + jitter(rng);
+			sim.velocity[g%types][g/types][k] = gauss(rng);
+			site /= side;
+		}
+	}
+	for (int t = 0; t < types; ++t)
+	{
+		sim.thermostat[t] = no_thermostat;
+		for (int u = 0; u < types; ++u)
+		{
+			sim.interaction[t][u] = periodic ? lj_periodic : lj_box;
+			sim.interaction_const[t][u][0] = 1;
+			sim.interaction_const[t][u][1] = 1;
+			sim.interaction_const[t][u][2] = std::min(2.5, box/2);
+		}
+	}
+	initialize_interactions(sim);
+}
+
+/*******************************************************************************
+ * \brief Builds a Lennard-Jones system of n particles dealt round robin over types, on a jittered simple cubic lattice at density 0.8
+ *
+ * All pairs have epsilon = sigma = 1 and a cutoff of 2.5 (or half the box if smaller), and no thermostat.
+ *
+ * @param n Number of particles
+ * @param types Number of particle types
+ * @param periodic 1 for periodic boundary conditions, 0 for rigid walls
+ * @param seed Seed of the displacements and velocities
+ ******************************************************************************/
+static System::simulation* check_system(int n, int types, int periodic, unsigned seed)
+{
+	std::vector<double> size;
+	std::string input = check_input(n, types, periodic, size);
+	System::simulation* sim = new System::simulation(input, size.data());
+	check_fill(*sim, periodic, seed);
+	return sim;
+}
+
+/*******************************************************************************
+ * \brief Serial reference of the Lennard-Jones accelerations and potential energy (with the tail corrections) of a system
+ *
+ * @param sim System (built by check_system())
+ * @param acceleration Accelerations (format [particletype][particle*3 + dimension])
+ * @param excluded Pairs skipped, as (type1*n + i, type2*n + j) with n = sim.numpartot
+ * @return Potential energy
+ ******************************************************************************/
+static double check_lj_reference(System::simulation& sim, std::vector<std::vector<double>>& acceleration, const std::set<std::pair<long,long>>& excluded = {})
+{
+	const int dim = sim.n_dimensions;
+	acceleration.assign(sim.n_types, std::vector<double>());
+	for (int t = 0; t < sim.n_types; ++t)
+	{
+		acceleration[t].assign(sim.n_particles[t]*dim, 0);
+	}
+	double epot = 0;
+	for (int t1 = 0; t1 < sim.n_types; ++t1)
+	{
+		for (int t2 = t1; t2 < sim.n_types; ++t2)
+		{
+			const double* c = sim.interaction_const[t1][t2].data();
+			for (int i = 0; i < sim.n_particles[t1]; ++i)
+			{
+				for (int j = (t1 == t2) ? i+1 : 0; j < sim.n_particles[t2]; ++j)
+				{
+					double x[dim];
+					double r2 = 0;
+					for (int k = 0; k < dim; ++k)
+					{
+						x[k] = sim.position[t1][i][k] - sim.position[t2][j][k];
+						if(sim.periodic_boundary == 1)
+						{
+							x[k] -= sim.box_size_limits[k]*std::round(x[k]/sim.box_size_limits[k]);
+						}
+						r2 += x[k]*x[k];
+					}
+					if(r2 >= c[2]*c[2] || excluded.count(std::make_pair((long)t1*sim.numpartot + i, (long)t2*sim.numpartot + j)))
+					{
+						continue;
+					}
+					double s6 = c[4]/(r2*r2*r2);
+					epot += 4*c[0]*s6*(s6 - 1) - c[3];
+					double f = 24*c[0]*s6*(2*s6 - 1)/r2;
+					for (int k = 0; k < dim; ++k)
+					{
+						acceleration[t1][i*dim + k] += f*x[k]/sim.mass[t1];
+						acceleration[t2][j*dim + k] -= f*x[k]/sim.mass[t2];
+					}
+				}
+			}
+			epot += c[5];
+		}
+	}
+	return epot;
+}
+
+/*******************************************************************************
+ * \brief Largest difference between the accelerations of a system and reference ones, relative to the largest reference acceleration
+ ******************************************************************************/
+static double check_acceleration_error(System::simulation& sim, const std::vector<std::vector<double>>& acceleration)
+{
+	const int dim = sim.n_dimensions;
+	double diff = 0, scale = 0;
+	for (int t = 0; t < sim.n_types; ++t)
+	{
+		for (int j = 0; j < sim.n_particles[t]; ++j)
+		{
+			for (int k = 0; k < dim; ++k)
+			{
+				diff = std::max(diff, std::fabs(sim.acceleration[t][j][k] - acceleration[t][j*dim + k]));
+				scale = std::max(scale, std::fabs(acceleration[t][j*dim + k]));
+			}
+		}
+	}
+	return diff/scale;
+}
+
+// Observable which only asks for the energies on every timestep it is sampled (see check_energy_drift())
+static void check_sample_energies(System::simulation& sim)
+{
+}
+
+/*******************************************************************************
+ * \brief Largest change of the total energy over steps timesteps, relative to the kinetic energy of the first one
+ *
+ * The energies are computed on every timestep. energy_kinetic holds m v^2, so the total energy is the potential energy
+ * plus half of its sum over the types.
+ ******************************************************************************/
+static double check_energy_drift(System::simulation& sim, int steps)
+{
+	register_observable(sim, check_sample_energies, 1, 1);
+	double first = 0, kinetic = 0, drift = 0;
+	for (int step = 0; step < steps; ++step)
+	{
+		md_step(sim);
+		double energy = sim.energy_potential;
+		for (int t = 0; t < sim.n_types; ++t)
+		{
+			energy += 0.5*sim.energy_kinetic[t];
+			kinetic += (step == 0) ? 0.5*sim.energy_kinetic[t] : 0;
+		}
+		first = (step == 0) ? energy : first;
+		drift = std::max(drift, std::fabs(energy - first));
+	}
+	return drift/kinetic;
+}
+
+// Forces and energy of interact() on one thread against the serial reference
+static bool check_interact(std::ostream& detail)
+{
+	const int threads = omp_get_max_threads();
+	omp_set_num_threads(1);
+	bool ok = true;
+	//A type with itself, two types, and accelerations of the order of those of atoms in SI units
+	const int types[3] = {1, 2, 1};
+	const double mass[3] = {1, 1, 1e-13};
+	for (int c = 0; c < 3; ++c)
+	{
+		System::simulation* sim = check_system(500, types[c], 1, 1);
+		for (int t = 0; t < types[c]; ++t)
+		{
+			sim->mass[t] = mass[c];
+		}
+		sim->energy_due = 1;
+		interact(*sim);
+		std::vector<std::vector<double>> acceleration;
+		double epot = check_lj_reference(*sim, acceleration);
+		double error = check_acceleration_error(*sim, acceleration);
+		double error_energy = std::fabs(sim->energy_potential - epot)/std::fabs(epot);
+		detail<<"types="<<types[c]<<" mass="<<mass[c]<<" acceleration "<<error<<" energy "<<error_energy<<" ";
+		ok = ok && error < 1e-9 && error_energy < 1e-12;
+		delete sim;
+	}
+	omp_set_num_threads(threads);
+	return ok;
+}
+
+// Forces and energy of interact() on one thread and on several : identical with MDGEN_DETERMINISTIC, equal to rounding otherwise
+static bool check_threads(std::ostream& detail)
+{
+	const int threads = omp_get_max_threads();
+	System::simulation* sim = check_system(1000, 2, 1, 2);
+	std::vector<std::vector<double>> acceleration(sim->n_types);
+	double epot[2];
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		omp_set_num_threads(pass ? std::max(4, omp_get_num_procs()) : 1);
+		sim->energy_due = 1;
+		interact(*sim);
+		epot[pass] = sim->energy_potential;
+		for (int t = 0; t < sim->n_types && pass == 0; ++t)
+		{
+			for (int j = 0; j < sim->n_particles[t]; ++j)
+			{
+				acceleration[t].insert(acceleration[t].end(), sim->acceleration[t][j].begin(), sim->acceleration[t][j].end());
+			}
+		}
+	}
+	omp_set_num_threads(threads);
+	double error = check_acceleration_error(*sim, acceleration);
+	double error_energy = std::fabs(epot[1] - epot[0])/std::fabs(epot[0]);
+	detail<<"acceleration "<<error<<" energy "<<error_energy;
+	delete sim;
+#ifdef MDGEN_DETERMINISTIC
+	return error == 0 && error_energy == 0;
+#else
+	return error < 1e-12 && error_energy < 1e-12;
+#endif
+}
+
+// Energies written by an asynchronous observable, overlapping with the timesteps, against the same observable sampled at once
+static bool check_pipeline(std::ostream& detail)
+{
+	const int threads = omp_get_max_threads();
+	omp_set_num_threads(std::max(4, omp_get_num_procs()));
+	std::string written[2];
+	for (int async = 0; async < 2; ++async)
+	{
+		System::simulation* sim = check_system(500, 1, 1, 3);
+		std::stringstream out;
+		sim->output = &out;
+		if(async)
+		{
+			register_async_observable(*sim, write_energy, 5, 1);
+		}
+		else
+		{
+			register_observable(*sim, write_energy, 5, 1);
+		}
+		md_steps(*sim, 100);
+		written[async] = out.str();
+		delete sim;
+	}
+	omp_set_num_threads(threads);
+	const long lines = std::count(written[0].begin(), written[0].end(), '\n');
+	detail<<lines<<" lines, "<<(written[0] == written[1] ? "same" : "different")<<" output";
+	return lines == 20 && written[0] == written[1];
+}
+
+// Inner and outer accelerations of r-RESPA add up to the whole Lennard-Jones ones, and its energy drift is that of the Verlet integrator on the inner step
+static bool check_respa(std::ostream& detail)
+{
+	double drift[2], error = 0;
+	for (int respa = 0; respa < 2; ++respa)
+	{
+		System::simulation* sim = check_system(500, 1, 1, 8);
+		sim->timestep = 0.004;
+		sim->total_steps = 1000;
+		if(respa)
+		{
+			sim->interaction_level[0][0] = RESPA_SPLIT;
+			sim->interaction_const[0][0][7] = 1.6;
+			sim->interaction_const[0][0][8] = 0.4;
+			initialize_respa(*sim, 4);
+			std::vector<std::vector<double>> acceleration;
+			check_lj_reference(*sim, acceleration);
+			//Sums of the two levels, in place of the inner accelerations
+			for (int j = 0; j < sim->n_particles[0]; ++j)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					acceleration[0][3*j + k] -= sim->acceleration_outer[0][j][k];
+				}
+			}
+			error = check_acceleration_error(*sim, acceleration);
+		}
+		else
+		{
+			//The Verlet reference takes the inner step
+			sim->timestep = 0.001;
+			sim->total_steps = 4000;
+			sim->energy_due = 1;
+			interact(*sim);
+		}
+		drift[respa] = check_energy_drift(*sim, respa ? 200 : 800);
+		delete sim;
+	}
+	detail<<"acceleration "<<error<<" energy drift "<<drift[1]<<" (Verlet on the inner step "<<drift[0]<<")";
+	return error < 1e-9 && drift[1] < 10*drift[0] + 1e-4;
+}
+
+// Rigid dimers of neighbouring particles : their pairs are excluded from interact(), and SHAKE and RATTLE keep their lengths
+static bool check_constraints(std::ostream& detail)
+{
+	System::simulation* sim = check_system(500, 1, 1, 4);
+	const int side = (int)std::ceil(std::cbrt(500.0) - 1e-9);
+	std::set<std::pair<long,long>> excluded;
+	std::vector<std::pair<int,int>> dimer;
+	for (int g = 0; g + 1 < 500; g += 2)
+	{
+		if(g%side == side - 1)
+		{
+			continue;
+		}
+		dimer.push_back(std::make_pair(g, g+1));
+		excluded.insert(std::make_pair((long)g, (long)g+1));
+		add_constraint_group(*sim, {0, g, 0, g+1}, {0, 1}, {distance_periodic(*sim, 0, g, 0, g+1)});
+	}
+	initialize_constraints(*sim);
+
+	sim->energy_due = 1;
+	interact(*sim);
+	std::vector<std::vector<double>> acceleration;
+	double epot = check_lj_reference(*sim, acceleration, excluded);
+	double error = check_acceleration_error(*sim, acceleration);
+	double error_energy = std::fabs(sim->energy_potential - epot)/std::fabs(epot);
+
+	std::vector<double> length;
+	for (const std::pair<int,int>& d : dimer)
+	{
+		length.push_back(distance_periodic(*sim, 0, d.first, 0, d.second));
+	}
+	md_steps(*sim, 200);
+	double error_length = 0;
+	for (size_t d = 0; d < dimer.size(); ++d)
+	{
+		error_length = std::max(error_length, std::fabs(distance_periodic(*sim, 0, dimer[d].first, 0, dimer[d].second)/length[d] - 1));
+	}
+	delete sim;
+	detail<<dimer.size()<<" dimers, acceleration "<<error<<" energy "<<error_energy<<" length after 200 steps "<<error_length;
+	return error < 1e-9 && error_energy < 1e-12 && error_length < 1e-8;
+}
+
+// Adaptive timestep in both modes : every timestep is split into inner steps within the bounds (a power of 2 of them with ADAPT_SYMPLECTIC) and the energy is conserved
+static bool check_adaptive(std::ostream& detail)
+{
+	bool ok = true;
+	const double max_displacement = 0.004;
+	for (int mode = ADAPT_FREE; mode <= ADAPT_SYMPLECTIC; ++mode)
+	{
+		System::simulation* sim = check_system(500, 1, 1, 11);
+		sim->timestep = 0.01;
+		initialize_adaptive_timestep(*sim, mode, 1e-4, max_displacement);
+		register_observable(*sim, check_sample_energies, 1, 1);
+		std::vector<double> previous(3*sim->n_particles[0]);
+		double first = 0, kinetic = 0, drift = 0, displacement = 0;
+		bool power_of_2 = true;
+		for (int step = 0; step < 100; ++step)
+		{
+			for (int j = 0; j < sim->n_particles[0]; ++j)
+			{
+				std::copy(sim->position[0][j].begin(), sim->position[0][j].end(), previous.begin() + 3*j);
+			}
+			md_step(*sim);
+			//Largest move of a particle over the timestep, relative to the bound of all its inner steps (which is found from the
+			//velocities and accelerations at its start, so may be passed by as much as they change over the timestep)
+			const int n = sim->adaptive.inner_steps;
+			for (int j = 0; j < sim->n_particles[0]; ++j)
+			{
+				double r2 = 0;
+				for (int k = 0; k < 3; ++k)
+				{
+					double x = sim->position[0][j][k] - previous[3*j + k];
+					x -= sim->box_size_limits[k]*std::round(x/sim->box_size_limits[k]);
+					r2 += x*x;
+				}
+				displacement = std::max(displacement, std::sqrt(r2)/(n*max_displacement));
+			}
+			power_of_2 = power_of_2 && (mode == ADAPT_FREE || (n & (n - 1)) == 0);
+			double energy = sim->energy_potential + 0.5*sim->energy_kinetic[0];
+			kinetic = (step == 0) ? 0.5*sim->energy_kinetic[0] : kinetic;
+			first = (step == 0) ? energy : first;
+			drift = std::max(drift, std::fabs(energy - first));
+		}
+		drift /= kinetic;
+		const double mean_inner = (double)sim->adaptive.total_inner_steps/100;
+		detail<<(mode == ADAPT_FREE ? "free" : "symplectic")<<" : "<<mean_inner<<" inner steps per timestep, displacement "<<displacement
+			<<" of the bound, energy drift "<<drift<<" ";
+		ok = ok && mean_inner > 1 && sim->adaptive.clamped == 0 && displacement < 1.1 && power_of_2 && drift < 1e-3;
+		delete sim;
+	}
+	return ok;
+}
+
+// Rigid triangles of neighbouring particles : their pairs are excluded from interact(), their sides hold and the energy is conserved
+static bool check_rigid(std::ostream& detail)
+{
+	System::simulation* sim = check_system(500, 1, 1, 9);
+	const int side = (int)std::ceil(std::cbrt(500.0) - 1e-9);
+	std::set<std::pair<long,long>> excluded;
+	std::vector<std::vector<int>> body;
+	for (int g = 0; g + side < 500; ++g)
+	{
+		const int x = g%side, y = (g/side)%side;
+		if(x%2 == 1 || y%2 == 1 || x == side - 1 || y == side - 1)
+		{
+			continue;
+		}
+		body.push_back({g, g+1, g+side});
+		for (int a = 0; a < 3; ++a)
+		{
+			for (int b = a+1; b < 3; ++b)
+			{
+				excluded.insert(std::make_pair((long)body.back()[a], (long)body.back()[b]));
+			}
+		}
+		add_rigid_body(*sim, {0, g, 0, g+1, 0, g+side});
+	}
+	initialize_rigid_bodies(*sim);
+
+	sim->energy_due = 1;
+	interact(*sim);
+	std::vector<std::vector<double>> acceleration;
+	double epot = check_lj_reference(*sim, acceleration, excluded);
+	double error = check_acceleration_error(*sim, acceleration);
+	double error_energy = std::fabs(sim->energy_potential - epot)/std::fabs(epot);
+
+	std::vector<double> length;
+	for (const std::vector<int>& b : body)
+	{
+		length.push_back(distance_periodic(*sim, 0, b[0], 0, b[1]));
+		length.push_back(distance_periodic(*sim, 0, b[0], 0, b[2]));
+		length.push_back(distance_periodic(*sim, 0, b[1], 0, b[2]));
+	}
+	double drift = check_energy_drift(*sim, 200);
+	double error_length = 0;
+	for (size_t b = 0; b < body.size(); ++b)
+	{
+		error_length = std::max(error_length, std::fabs(distance_periodic(*sim, 0, body[b][0], 0, body[b][1])/length[3*b] - 1));
+		error_length = std::max(error_length, std::fabs(distance_periodic(*sim, 0, body[b][0], 0, body[b][2])/length[3*b+1] - 1));
+		error_length = std::max(error_length, std::fabs(distance_periodic(*sim, 0, body[b][1], 0, body[b][2])/length[3*b+2] - 1));
+	}
+	delete sim;
+	detail<<body.size()<<" bodies, acceleration "<<error<<" energy "<<error_energy<<" sides after 200 steps "<<error_length<<" energy drift "<<drift;
+	return error < 1e-9 && error_energy < 1e-12 && error_length < 1e-10 && drift < 1e-3;
+}
+
+// Event-driven hard spheres, with periodic boundaries and rigid walls : no two spheres overlap, and the kinetic energy (and the momentum, when periodic) is conserved
+static bool check_hard_spheres(std::ostream& detail)
+{
+	bool ok = true;
+	for (int periodic = 1; periodic >= 0; --periodic)
+	{
+		//Diameter 0.85 of the lattice spacing, so that the jittered lattice has no overlap
+		System::simulation* sim = check_system(500, 2, periodic, 10);
+		const int side = (int)std::ceil(std::cbrt(500.0) - 1e-9);
+		const double diameter = 0.85*sim->box_size_limits[0]/side;
+		for (int t = 0; t < 2; ++t)
+		{
+			for (int u = 0; u < 2; ++u)
+			{
+				sim->interaction[t][u] = hard_sphere;
+				sim->interaction_const[t][u][1] = diameter;
+			}
+		}
+		sim->mass[1] = 2;
+		sim->timestep = 0.01;
+		initialize_event_driven(*sim);
+
+		double kinetic[2] = {0, 0}, momentum[2][3] = {{0, 0, 0}, {0, 0, 0}};
+		double overlap = 0;
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			if(pass)
+			{
+				md_steps(*sim, 100);
+			}
+			for (int t = 0; t < 2; ++t)
+			{
+				for (int j = 0; j < sim->n_particles[t]; ++j)
+				{
+					for (int k = 0; k < 3; ++k)
+					{
+						kinetic[pass] += 0.5*sim->mass[t]*sim->velocity[t][j][k]*sim->velocity[t][j][k];
+						momentum[pass][k] += sim->mass[t]*sim->velocity[t][j][k];
+					}
+				}
+			}
+		}
+		for (int t1 = 0; t1 < 2; ++t1)
+		{
+			for (int t2 = t1; t2 < 2; ++t2)
+			{
+				for (int i = 0; i < sim->n_particles[t1]; ++i)
+				{
+					for (int j = (t1 == t2) ? i+1 : 0; j < sim->n_particles[t2]; ++j)
+					{
+						double r2 = 0;
+						for (int k = 0; k < 3; ++k)
+						{
+							double x = sim->position[t1][i][k] - sim->position[t2][j][k];
+							x -= periodic*sim->box_size_limits[k]*std::round(x/sim->box_size_limits[k]);
+							r2 += x*x;
+						}
+						overlap = std::max(overlap, 1 - std::sqrt(r2)/diameter);
+					}
+				}
+			}
+		}
+		double error_kinetic = std::fabs(kinetic[1] - kinetic[0])/kinetic[0];
+		double error_momentum = 0;
+		for (int k = 0; k < 3 && periodic; ++k)
+		{
+			error_momentum = std::max(error_momentum, std::fabs(momentum[1][k] - momentum[0][k])/std::sqrt(2*kinetic[0]*(sim->mass[0] + sim->mass[1])));
+		}
+		detail<<(periodic ? "periodic" : "walls")<<" : "<<sim->events.collisions<<" collisions, overlap "<<overlap<<" kinetic energy "<<error_kinetic;
+		if(periodic)
+		{
+			detail<<" momentum "<<error_momentum;
+		}
+		detail<<" ";
+		ok = ok && sim->events.collisions > 0 && overlap < 1e-9 && error_kinetic < 1e-12 && error_momentum < 1e-12;
+		delete sim;
+	}
+	return ok;
+}
+
+/*******************************************************************************
+ * \brief Direct Ewald sum of the Coulomb energy, virial and accelerations of the charges of a system, at the alpha of its PME
+ *
+ * The real space sum runs over every image within the cutoff of PME, as in the pair kernels, so the two only differ by the error of
+ * the grid. The reciprocal one runs over every wave vector with \f$ e^{-k^2/4\alpha^2} \f$ above 1e-16. A net charge Q adds the energy
+ * \f$ -\pi Q^2/(2V\alpha^2) \f$ of its neutralizing background, and three times that to the virial.
+ *
+ * @param sim System (built by check_system(), with PME)
+ * @param acceleration Accelerations (format [particletype][particle*3 + dimension])
+ * @param virial Virial (sum of r.F)
+ * @return Potential energy
+ ******************************************************************************/
+static double check_ewald_reference(System::simulation& sim, std::vector<std::vector<double>>& acceleration, double& virial)
+{
+	const double alpha = sim.pme.alpha;
+	const double* L = sim.box_size_limits.data();
+	const double volume = L[0]*L[1]*L[2];
+	std::vector<double> x, q;
+	std::vector<int> type;
+	for (int t = 0; t < sim.n_types; ++t)
+	{
+		for (int j = 0; j < sim.n_particles[t]; ++j)
+		{
+			x.insert(x.end(), sim.position[t][j].begin(), sim.position[t][j].end());
+			q.push_back(sim.charge[t]);
+			type.push_back(t);
+		}
+	}
+	const int n = q.size();
+	std::vector<double> force(3*n, 0);
+	double energy = 0;
+	virial = 0;
+
+	//Real space, over every pair of particles (a particle with its own images too), each taken from both sides
+	const double r_max = sim.pme.cutoff;
+	int images[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		images[k] = (int)std::ceil(r_max/L[k] + 0.5);
+	}
+	for (int i = 0; i < n; ++i)
+	{
+		for (int j = 0; j < n; ++j)
+		{
+			double x0[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				x0[k] = x[3*i + k] - x[3*j + k];
+				x0[k] -= L[k]*std::round(x0[k]/L[k]);
+			}
+			for (int a = -images[0]; a <= images[0]; ++a)
+			{
+				for (int b = -images[1]; b <= images[1]; ++b)
+				{
+					for (int c = -images[2]; c <= images[2]; ++c)
+					{
+						const double d[3] = {x0[0] + a*L[0], x0[1] + b*L[1], x0[2] + c*L[2]};
+						const double r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+						if((i == j && a == 0 && b == 0 && c == 0) || r2 > r_max*r_max)
+						{
+							continue;
+						}
+						const double r = std::sqrt(r2);
+						const double qq = sim.pme.coulomb*q[i]*q[j];
+						const double u = qq*std::erfc(alpha*r)/r;
+						const double f = (u + qq*2*alpha/std::sqrt(M_PI)*std::exp(-alpha*alpha*r2))/r2;
+						energy += 0.5*u;
+						virial += 0.5*f*r2;
+						for (int k = 0; k < 3; ++k)
+						{
+							force[3*i + k] += f*d[k];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//Reciprocal space, over half of the wave vectors (k and -k give the same terms), with e^{ik.r} built from e^{i 2 pi x/L}
+	int m_max[3];
+	std::vector<std::complex<double>> phase[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		m_max[k] = (int)std::ceil(2*alpha*std::sqrt(-std::log(1e-16))*L[k]/(2*M_PI));
+		phase[k].resize((long)n*(2*m_max[k] + 1));
+		for (int i = 0; i < n; ++i)
+		{
+			for (int m = -m_max[k]; m <= m_max[k]; ++m)
+			{
+				phase[k][(long)i*(2*m_max[k] + 1) + m + m_max[k]] = std::polar(1.0, 2*M_PI*m*x[3*i + k]/L[k]);
+			}
+		}
+	}
+	std::vector<std::complex<double>> e(n);
+	for (int a = 0; a <= m_max[0]; ++a)
+	{
+		for (int b = (a == 0) ? 0 : -m_max[1]; b <= m_max[1]; ++b)
+		{
+			for (int c = (a == 0 && b == 0) ? 1 : -m_max[2]; c <= m_max[2]; ++c)
+			{
+				const double kv[3] = {2*M_PI*a/L[0], 2*M_PI*b/L[1], 2*M_PI*c/L[2]};
+				const double k2 = kv[0]*kv[0] + kv[1]*kv[1] + kv[2]*kv[2];
+				const double g = std::exp(-k2/(4*alpha*alpha))/k2;
+				if(g*k2 < 1e-16)
+				{
+					continue;
+				}
+				std::complex<double> rho = 0;
+				for (int i = 0; i < n; ++i)
+				{
+					e[i] = phase[0][(long)i*(2*m_max[0] + 1) + a + m_max[0]]*phase[1][(long)i*(2*m_max[1] + 1) + b + m_max[1]]
+						*phase[2][(long)i*(2*m_max[2] + 1) + c + m_max[2]];
+					rho += q[i]*e[i];
+				}
+				const double term = sim.pme.coulomb*4*M_PI/volume*g*std::norm(rho);
+				energy += term;
+				virial += term*(1 - k2/(2*alpha*alpha));
+				for (int i = 0; i < n; ++i)
+				{
+					const double f = sim.pme.coulomb*8*M_PI/volume*g*q[i]*std::imag(std::conj(rho)*e[i]);
+					for (int k = 0; k < 3; ++k)
+					{
+						force[3*i + k] += f*kv[k];
+					}
+				}
+			}
+		}
+	}
+
+	//Self energy, and that of the background of a net charge
+	double net = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		energy -= sim.pme.coulomb*alpha/std::sqrt(M_PI)*q[i]*q[i];
+		net += q[i];
+	}
+	const double background = -sim.pme.coulomb*M_PI*net*net/(2*volume*alpha*alpha);
+	energy += background;
+	virial += 3*background;
+
+	acceleration.assign(sim.n_types, std::vector<double>());
+	for (int i = 0, t = 0; i < n; ++i)
+	{
+		t = type[i];
+		for (int k = 0; k < 3; ++k)
+		{
+			acceleration[t].push_back(force[3*i + k]/sim.mass[t]);
+		}
+	}
+	return energy;
+}
+
+// Coulomb energy, virial and forces of PME against a direct Ewald sum, neutral and with a net charge, with the FFT of the build (built-in, or FFTW with MDGEN_FFTW)
+static bool check_ewald(std::ostream& detail)
+{
+	bool ok = true;
+	const double charge[2][2] = {{1, -1}, {1, -0.5}};
+	for (int c = 0; c < 2; ++c)
+	{
+		//100 charges of each type without Lennard-Jones
+		System::simulation* sim = check_system(200, 2, 1, 12);
+		for (int t = 0; t < 2; ++t)
+		{
+			for (int u = 0; u < 2; ++u)
+			{
+				sim->interaction_const[t][u][0] = 0;
+			}
+			sim->charge[t] = charge[c][t];
+		}
+		initialize_interactions(*sim);
+		initialize_pme(*sim, 1e-5, 0);
+		sim->energy_due = 1;
+		interact(*sim);
+
+		std::vector<std::vector<double>> acceleration;
+		double virial;
+		double energy = check_ewald_reference(*sim, acceleration, virial);
+		double diff = 0, norm = 0;
+		for (int t = 0; t < sim->n_types; ++t)
+		{
+			for (int j = 0; j < sim->n_particles[t]; ++j)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					double a = acceleration[t][j*3 + k];
+					diff += (sim->acceleration[t][j][k] - a)*(sim->acceleration[t][j][k] - a);
+					norm += a*a;
+				}
+			}
+		}
+		double error = std::sqrt(diff/norm);
+		double error_energy = std::fabs(sim->energy_potential - energy)/std::fabs(energy);
+		double error_virial = std::fabs(sim->virial - virial)/std::fabs(virial);
+		detail<<"charges "<<charge[c][0]<<","<<charge[c][1]<<" : grid "<<sim->pme.grid[0]<<"x"<<sim->pme.grid[1]<<"x"<<sim->pme.grid[2]
+			<<", RMS acceleration "<<error<<" energy "<<error_energy<<" virial "<<error_virial<<" ";
+		ok = ok && error < 1e-4 && error_energy < 1e-5 && error_virial < 1e-5;
+		delete sim;
+	}
+	return ok;
+}
+
+// Excluding pairs of opposite charges under PME takes out exactly their Coulomb (q_i q_j/r) and Lennard-Jones energy and forces
+static bool check_pme(std::ostream& detail)
+{
+	System::simulation* sim = check_system(500, 2, 1, 5);
+	sim->charge[0] = 1;
+	sim->charge[1] = -1;
+	initialize_pme(*sim, PME_ACCURACY, 0);
+	sim->energy_due = 1;
+	interact(*sim);
+	const double epot_full = sim->energy_potential;
+	std::vector<std::vector<double>> acceleration(sim->n_types);
+	for (int t = 0; t < sim->n_types; ++t)
+	{
+		for (int j = 0; j < sim->n_particles[t]; ++j)
+		{
+			acceleration[t].insert(acceleration[t].end(), sim->acceleration[t][j].begin(), sim->acceleration[t][j].end());
+		}
+	}
+
+	//Neighbours 2i and 2i+1 of the lattice are particle i of each type
+	double epair = 0;
+	const double* c = sim->interaction_const[0][1].data();
+	for (int i = 0; i < sim->n_particles[1]; i += 2)
+	{
+		add_exclusion(*sim, 0, i, 1, i);
+		double x[3];
+		double r2 = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			x[k] = sim->position[0][i][k] - sim->position[1][i][k];
+			x[k] -= sim->box_size_limits[k]*std::round(x[k]/sim->box_size_limits[k]);
+			r2 += x[k]*x[k];
+		}
+		const double qq = sim->pme.coulomb*sim->charge[0]*sim->charge[1];
+		const double r = std::sqrt(r2);
+		epair += qq/r;
+		double f = qq/(r*r2);
+		if(r2 < c[2]*c[2])
+		{
+			double s6 = c[4]/(r2*r2*r2);
+			epair += 4*c[0]*s6*(s6 - 1) - c[3];
+			f += 24*c[0]*s6*(2*s6 - 1)/r2;
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			acceleration[0][i*3 + k] -= f*x[k]/sim->mass[0];
+			acceleration[1][i*3 + k] += f*x[k]/sim->mass[1];
+		}
+	}
+	build_exclusions(*sim);
+	interact(*sim);
+	double error = check_acceleration_error(*sim, acceleration);
+	double error_energy = std::fabs(epot_full - sim->energy_potential - epair)/std::fabs(epair);
+	detail<<"acceleration "<<error<<" energy "<<error_energy;
+	delete sim;
+	return error < 1e-9 && error_energy < 1e-9;
+}
+
+// Forces and energy of interact() with the rows partitioned by their measured cost, while the number of threads changes, against the serial reference
+static bool check_balance(std::ostream& detail)
+{
+	const int threads = omp_get_max_threads();
+	System::simulation* sim = check_system(1000, 2, 1, 6);
+	initialize_load_balance(*sim, 2, 8);
+	std::vector<std::vector<double>> acceleration;
+	double epot = check_lj_reference(*sim, acceleration);
+	double error = 0, error_energy = 0;
+	const int team[4] = {4, 4, 3, 5};
+	for (int call = 0; call < 4; ++call)
+	{
+		omp_set_num_threads(team[call]);
+		sim->energy_due = 1;
+		interact(*sim);
+		error = std::max(error, check_acceleration_error(*sim, acceleration));
+		error_energy = std::max(error_energy, std::fabs(sim->energy_potential - epot)/std::fabs(epot));
+	}
+	omp_set_num_threads(threads);
+	detail<<sim->balance.partitions<<" partitions, acceleration "<<error<<" energy "<<error_energy;
+	delete sim;
+	return error < 1e-9 && error_energy < 1e-12;
+}
+
+// Frames of a live stream read back from its shared memory, and the energies only computed for the frames min_interval lets through
+static bool check_stream(std::ostream& detail)
+{
+	System::simulation* sim = check_system(500, 2, 1, 7);
+	open_live_stream(*sim, "mdgen_check", 5, 0, STREAM_POSITIONS | STREAM_VELOCITIES | STREAM_ENERGIES, 4);
+	md_steps(*sim, 20);
+	System::stream_header* h = sim->stream.header();
+	const uint64_t* arrays = (const uint64_t*)(sim->stream.memory.get() + sizeof(System::stream_header));
+	const char* slot = sim->stream.memory.get() + h->header_bytes + ((h->frames - 1) % h->slots)*h->slot_bytes;
+	const System::stream_slot* s = (const System::stream_slot*)slot;
+	bool same = (s->sequence == 2*h->frames) && s->state == sim->state && s->energy_potential == sim->energy_potential;
+	for (int t = 0; t < sim->n_types; ++t)
+	{
+		const double* position = (const double*)(slot + arrays[sim->n_types + t]);
+		const double* velocity = (const double*)(slot + arrays[2*sim->n_types + t]);
+		for (int j = 0; j < sim->n_particles[t]; ++j)
+		{
+			same = same && !std::memcmp(position + 3*j, sim->position[t][j].data(), 3*sizeof(double));
+			same = same && !std::memcmp(velocity + 3*j, sim->velocity[t][j].data(), 3*sizeof(double));
+		}
+	}
+	const long frames = h->frames;
+	close_live_stream(*sim);
+
+	//With a long min_interval, only the first frame is published and the energies of the others are skipped
+	open_live_stream(*sim, "mdgen_check", 5, 1e9, STREAM_POSITIONS | STREAM_ENERGIES, 4);
+	long energies = 0;
+	for (int step = 0; step < 20; ++step)
+	{
+		md_step(*sim);
+		energies += sim->energy_due;
+	}
+	const long published = sim->stream.header()->frames;
+	close_live_stream(*sim);
+	delete sim;
+	detail<<frames<<" frames, "<<(same ? "same" : "different")<<" last frame; with min_interval "<<published<<" frame, energies on "<<energies<<" timesteps";
+	return frames == 4 && same && published == 1 && energies == 1;
+}
+
+// Windowed MSD of free particles, which cross the box, against the ballistic <dr^2> = <v^2> t^2 of each type and of all of them
+static bool check_msd(std::ostream& detail)
+{
+	System::simulation* sim = check_system(500, 2, 1, 13);
+	for (int t = 0; t < 2; ++t)
+	{
+		for (int u = 0; u < 2; ++u)
+		{
+			sim->interaction[t][u] = free_particles;
+		}
+	}
+	sim->timestep = 0.05;
+	sim->msd_stride = 2;
+	sim->msd_length = 40;
+	sim->msd_origins = 4;
+	sim->msd_origin_spacing = 10;
+	initialize_msd(*sim);
+	register_observable(*sim, sample_msd, sim->msd_stride, 0);
+	md_steps(*sim, 400);
+
+	double v2[3] = {0, 0, 0};
+	for (int t = 0; t < 2; ++t)
+	{
+		for (int j = 0; j < sim->n_particles[t]; ++j)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				v2[t] += sim->velocity[t][j][k]*sim->velocity[t][j][k];
+			}
+		}
+		v2[2] += v2[t];
+		v2[t] /= sim->n_particles[t];
+	}
+	v2[2] /= sim->numpartot;
+	double error = 0, crossed = 0;
+	for (int lag = 1; lag < sim->msd_length; ++lag)
+	{
+		const double time = lag*sim->msd_stride*sim->timestep;
+		for (int t = 0; t <= 2; ++t)
+		{
+			error = std::max(error, std::fabs(msd(*sim, lag, t)/(v2[t]*time*time) - 1));
+		}
+	}
+	for (int t = 0; t < 2; ++t)
+	{
+		for (int j = 0; j < sim->n_particles[t]; ++j)
+		{
+			crossed += (sim->image[t][j][0] != 0 || sim->image[t][j][1] != 0 || sim->image[t][j][2] != 0);
+		}
+	}
+	detail<<crossed<<" particles crossed the box, MSD "<<error;
+	delete sim;
+	return crossed > 0 && error < 1e-10;
+}
+
+// Partial structure factors against a direct sum over the particles (two blocks of SK_BLOCK), and S(k) of an ideal gas : 1 within a type, 0 across types
+static bool check_structure_factor(std::ostream& detail)
+{
+	System::simulation* sim = check_system(2*SK_BLOCK + 200, 2, 1, 14);
+	const double* L = sim->box_size_limits.data();
+	sim->sk_kmax = 8*2*M_PI/L[0];
+	initialize_structure_factor(*sim);
+	sample_structure_factor(*sim);
+	const int n_shells = sim->sk_shell_k.size();
+	double error = 0, scale = 0;
+	for (int shell = 0; shell < n_shells; ++shell)
+	{
+		double sum[4] = {0, 0, 0, 0};
+		for (int v = sim->sk_shell_start[shell]; v < sim->sk_shell_start[shell+1]; ++v)
+		{
+			std::complex<double> rho[2] = {0, 0};
+			for (int t = 0; t < 2; ++t)
+			{
+				for (int j = 0; j < sim->n_particles[t]; ++j)
+				{
+					double phase = 0;
+					for (int k = 0; k < 3; ++k)
+					{
+						phase += 2*M_PI*sim->sk_vectors[3*v + k]*sim->position[t][j][k]/L[k];
+					}
+					rho[t] += std::polar(1.0, phase);
+				}
+			}
+			for (int a = 0; a < 2; ++a)
+			{
+				for (int b = 0; b < 2; ++b)
+				{
+					sum[2*a + b] += std::real(rho[a]*std::conj(rho[b]))/std::sqrt((double)sim->n_particles[a]*sim->n_particles[b]);
+				}
+			}
+		}
+		const int count = sim->sk_shell_start[shell+1] - sim->sk_shell_start[shell];
+		for (int a = 0; a < 2; ++a)
+		{
+			for (int b = 0; b < 2; ++b)
+			{
+				error = std::max(error, std::fabs(structure_factor(*sim, shell, a, b) - sum[2*a + b]/count));
+				scale = std::max(scale, std::fabs(sum[2*a + b]/count));
+			}
+		}
+	}
+	delete sim;
+
+	//Ideal gas : independent uniform positions on every sample. The deviations are within 6 standard deviations of the mean over
+	//the samples of a shell (those of S_aa(k) for one k and sample are 1, and those of S_ab(k) 1/sqrt(2))
+	sim = check_system(400, 2, 1, 15);
+	sim->sk_kmax = 8*2*M_PI/sim->box_size_limits[0];
+	initialize_structure_factor(*sim);
+	std::mt19937_64 rng(15);
+	const int samples = 200;
+	for (int sample = 0; sample < samples; ++sample)
+	{
+		for (int t = 0; t < 2; ++t)
+		{
+			for (int j = 0; j < sim->n_particles[t]; ++j)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					sim->position[t][j][k] = std::uniform_real_distribution<double>(0, sim->box_size_limits[k])(rng);
+				}
+			}
+		}
+		sample_structure_factor(*sim);
+	}
+	double deviation = 0;
+	for (int shell = 0; shell < (int)sim->sk_shell_k.size(); ++shell)
+	{
+		const double sigma = 1/std::sqrt((double)samples*(sim->sk_shell_start[shell+1] - sim->sk_shell_start[shell]));
+		for (int a = 0; a < 2; ++a)
+		{
+			for (int b = 0; b < 2; ++b)
+			{
+				double expected = (a == b) ? 1 : 0;
+				deviation = std::max(deviation, std::fabs(structure_factor(*sim, shell, a, b) - expected)/(sigma*((a == b) ? 1 : std::sqrt(0.5))));
+			}
+		}
+	}
+	detail<<n_shells<<" shells, against the direct sum "<<error/scale<<"; ideal gas over "<<sim->sk_shell_k.size()<<" shells, largest deviation "
+		<<deviation<<" standard deviations";
+	delete sim;
+	return error/scale < 1e-10 && deviation < 6;
+}
+
+// Virial pressure against the derivative of the pair energy with the volume; MTK conserves its extended energy and both barostats reach their pressure
+static bool check_pressure(std::ostream& detail)
+{
+	//The configurational pressure W/(dV) is -dU/dV when every length is scaled. The tail terms are left out : their pressure also
+	//holds the impulsive term of the cutoff, so is not the derivative of their energy
+	System::simulation* sim = check_system(500, 2, 1, 16);
+	const double h = 1e-5;
+	double energy[2], volume[2];
+	for (int side = 0; side < 2; ++side)
+	{
+		const double mu = side ? (1 + h) : 1/(1 + h);
+		rescale_box(*sim, mu);
+		sim->energy_due = 1;
+		interact(*sim);
+		energy[side] = sim->energy_potential;
+		for (int t1 = 0; t1 < sim->n_types; ++t1)
+		{
+			for (int t2 = t1; t2 < sim->n_types; ++t2)
+			{
+				energy[side] -= sim->interaction_const[t1][t2][5];
+			}
+		}
+		volume[side] = box_volume(*sim);
+		rescale_box(*sim, 1/mu);
+	}
+	sim->energy_due = 1;
+	interact(*sim);
+	const double error = std::fabs(sim->virial/(3*box_volume(*sim)) + (energy[1] - energy[0])/(volume[1] - volume[0]))/std::fabs(sim->virial/(3*box_volume(*sim)));
+	detail<<"virial pressure against -dU/dV "<<error<<" ";
+	delete sim;
+
+	//Each barostat asks for a pressure 1 below that of the lattice, and the mean over the last 500 of 1000 timesteps must be within 0.1 of it
+	bool ok = error < 1e-6;
+	for (int b = 0; b < 2; ++b)
+	{
+		sim = check_system(500, 1, 1, 17);
+		if(b == 0)
+		{
+			//Without the tail terms, for the same reason as above, so that H = U + K + p_eps^2/2W + P V is conserved
+			sim->interaction_const[0][0][5] = 0;
+			sim->interaction_const[0][0][6] = 0;
+		}
+		register_observable(*sim, check_sample_energies, 1, 1);
+		md_step(*sim);
+		compute_pressure(*sim);
+		const double target = sim->pressure - 1;
+		sim->barostat = b ? berendsen : mtk;
+		sim->barostat_const[0] = target;
+		sim->barostat_const[1] = b ? 0.5 : 100;
+		sim->barostat_const[2] = 0.1;
+		initialize_barostat(*sim);
+		double first = 0, kinetic = 0, drift = 0, pressure = 0;
+		for (int step = 0; step < 1000; ++step)
+		{
+			md_step(*sim);
+			const double p_eps = sim->barostat_const[2];
+			double extended = sim->energy_potential + 0.5*sim->energy_kinetic[0] + p_eps*p_eps/(2*sim->barostat_const[1]) + target*box_volume(*sim);
+			kinetic = (step == 0) ? 0.5*sim->energy_kinetic[0] : kinetic;
+			first = (step == 0) ? extended : first;
+			drift = std::max(drift, std::fabs(extended - first));
+			compute_pressure(*sim);
+			pressure += (step >= 500) ? sim->pressure/500 : 0;
+		}
+		drift /= kinetic;
+		if(b == 0)
+		{
+			detail<<"MTK : mean pressure "<<pressure - target<<" from the target, extended energy drift "<<drift<<" ";
+			ok = ok && drift < 1e-2;
+		}
+		else
+		{
+			detail<<"Berendsen : mean pressure "<<pressure - target<<" from the target";
+		}
+		ok = ok && std::fabs(pressure - target) < 0.1;
+		delete sim;
+	}
+	return ok;
+}
+
+// Kinetic energies and momentum reduced in the integrator passes against sums over the velocities, with both boundaries
+static bool check_integrators(std::ostream& detail)
+{
+	bool ok = true;
+	for (int periodic = 1; periodic >= 0; --periodic)
+	{
+		//A longer timestep so that the particles reach the walls, or wrap across the box
+		System::simulation* sim = check_system(500, 2, periodic, 18);
+		sim->mass[1] = 2;
+		sim->timestep = 0.005;
+		register_observable(*sim, check_sample_energies, 1, 1);
+		double error_kinetic = 0, error_momentum = 0, outside = 0;
+		long reflected = 0;
+		std::vector<std::vector<double>> previous(sim->n_types);
+		for (int step = 0; step < 400; ++step)
+		{
+			for (int t = 0; t < sim->n_types; ++t)
+			{
+				previous[t].clear();
+				for (int i = 0; i < sim->n_particles[t]; ++i)
+				{
+					previous[t].insert(previous[t].end(), sim->velocity[t][i].begin(), sim->velocity[t][i].end());
+				}
+			}
+			md_step(*sim);
+			std::vector<double> momentum(sim->n_dimensions, 0);
+			double scale = 0;
+			for (int t = 0; t < sim->n_types; ++t)
+			{
+				double kinetic = 0;
+				for (int i = 0; i < sim->n_particles[t]; ++i)
+				{
+					for (int k = 0; k < sim->n_dimensions; ++k)
+					{
+						const double v = sim->velocity[t][i][k];
+						kinetic += sim->mass[t]*v*v;
+						momentum[k] += sim->mass[t]*v;
+						scale += sim->mass[t]*std::fabs(v);
+						const double x = sim->position[t][i][k];
+						outside = std::max(outside, std::max(-x, x - sim->box_size_limits[k]));
+						//A velocity reversed within one timestep of travel from a wall
+						const double travel = std::fabs(v)*sim->timestep;
+						reflected += (v*previous[t][i*sim->n_dimensions + k] < 0) && (x < travel || x > sim->box_size_limits[k] - travel);
+					}
+				}
+				error_kinetic = std::max(error_kinetic, std::fabs(sim->energy_kinetic[t] - kinetic)/kinetic);
+			}
+			for (int k = 0; k < sim->n_dimensions; ++k)
+			{
+				error_momentum = std::max(error_momentum, std::fabs(sim->momentum[k] - momentum[k])/scale);
+			}
+		}
+		long wrapped = 0;
+		for (int t = 0; t < sim->n_types; ++t)
+		{
+			for (int i = 0; i < sim->n_particles[t]; ++i)
+			{
+				wrapped += std::any_of(sim->image[t][i].begin(), sim->image[t][i].end(), [](int w){return w != 0;});
+			}
+		}
+		detail<<(periodic ? "periodic : " : "walls : ")<<(periodic ? wrapped : reflected)<<(periodic ? " particles wrapped" : " reflections");
+		detail<<", kinetic energy "<<error_kinetic<<" momentum "<<error_momentum<<" outside the box "<<outside<<" ";
+		ok = ok && error_kinetic < 1e-12 && error_momentum < 1e-12 && outside <= 0 && (periodic ? wrapped : reflected) > 0;
+		delete sim;
+	}
+	return ok;
+}
+
+// Replicas advanced together by ensemble_advance() against the same systems stepped one at a time, with one and two threads per replica
+static bool check_ensemble(std::ostream& detail)
+{
+	const int threads = omp_get_max_threads();
+	const int replicas = 4, steps = 100;
+	//The same systems stepped alone, with all the threads
+	std::vector<System::simulation*> alone(replicas);
+	for (int r = 0; r < replicas; ++r)
+	{
+		alone[r] = check_system(256, 2, 1, 20 + r);
+		for (int step = 0; step < steps; ++step)
+		{
+			md_step(*alone[r]);
+		}
+	}
+	omp_set_num_threads(std::max(4, omp_get_num_procs()));
+	double error = 0;
+	for (int group = 1; group <= 2; ++group)
+	{
+		std::vector<double> size;
+		std::string input = check_input(256, 2, 1, size);
+		System::ensemble ens(input, size.data(), replicas, 0, "");
+		ens.threads_per_replica = group;
+		for (int r = 0; r < replicas; ++r)
+		{
+			check_fill(ens.replica[r], 1, 20 + r);
+			ens.replica[r].total_steps = steps;
+		}
+		//In two calls, so that a replica picks up where it stopped
+		ensemble_advance(ens, steps/2);
+		ensemble_advance(ens, -1);
+		for (int r = 0; r < replicas; ++r)
+		{
+			for (int t = 0; t < alone[r]->n_types; ++t)
+			{
+				for (int i = 0; i < alone[r]->n_particles[t]; ++i)
+				{
+					for (int k = 0; k < alone[r]->n_dimensions; ++k)
+					{
+						error = std::max(error, std::fabs(ens.replica[r].position[t][i][k] - alone[r]->position[t][i][k]));
+						error = std::max(error, std::fabs(ens.replica[r].velocity[t][i][k] - alone[r]->velocity[t][i][k]));
+					}
+				}
+			}
+			error = (ens.replica[r].state == steps) ? error : 1;
+		}
+	}
+	omp_set_num_threads(threads);
+	for (int r = 0; r < replicas; ++r)
+	{
+		delete alone[r];
+	}
+	detail<<replicas<<" replicas, positions and velocities after "<<steps<<" timesteps "<<error;
+#ifdef MDGEN_DETERMINISTIC
+	return error == 0;
+#else
+	return error < 1e-9;
+#endif
+}
+
+// Kinetic energy m v^2 of a replica, summed over the types
+static double check_kinetic(System::simulation& sim)
+{
+	double kinetic = 0;
+	for (int t = 0; t < sim.n_types; ++t)
+	{
+		for (int i = 0; i < sim.n_particles[t]; ++i)
+		{
+			for (int k = 0; k < sim.n_dimensions; ++k)
+			{
+				kinetic += sim.mass[t]*sim.velocity[t][i][k]*sim.velocity[t][i][k];
+			}
+		}
+	}
+	return kinetic;
+}
+
+// Replica exchange with potential energies set by hand : two accepted exchanges undo each other, and two slots are occupied as Boltzmann says
+static bool check_tempering(std::ostream& detail)
+{
+	std::vector<double> size;
+	std::string input = check_input(64, 1, 1, size);
+	System::ensemble ens(input, size.data(), 2, 0, "");
+	for (int r = 0; r < 2; ++r)
+	{
+		check_fill(ens.replica[r], 1, 30 + r);
+		ens.replica[r].total_steps = 1<<20;
+		ens.replica[r].energy_kinetic[0] = check_kinetic(ens.replica[r]);
+	}
+	System::tempering rex;
+	initialize_tempering(ens, rex, {1, 2}, 1, 7);
+	std::vector<double> velocity;
+	for (int i = 0; i < ens.replica[0].n_particles[0]; ++i)
+	{
+		velocity.insert(velocity.end(), ens.replica[0].velocity[0][i].begin(), ens.replica[0].velocity[0][i].end());
+	}
+
+	//Equal energies are always exchanged. The odd round in between has no pair with two slots
+	ens.replica[0].energy_potential = 0;
+	ens.replica[1].energy_potential = 0;
+	tempering_exchange(ens, rex);
+	bool swapped = rex.slot[0] == 1 && rex.replica_at[1] == 0 && ens.replica[0].temperature_required[0] == 2 && ens.replica[1].temperature_required[0] == 1;
+	double error_kinetic = 0;
+	for (int r = 0; r < 2; ++r)
+	{
+		error_kinetic = std::max(error_kinetic, std::fabs(ens.replica[r].energy_kinetic[0] - check_kinetic(ens.replica[r]))/check_kinetic(ens.replica[r]));
+	}
+	tempering_exchange(ens, rex);
+	tempering_exchange(ens, rex);
+	bool back = rex.slot[0] == 0 && rex.replica_at[1] == 1 && ens.replica[0].temperature_required[0] == 1;
+	double error_velocity = 0;
+	for (int i = 0; i < ens.replica[0].n_particles[0]; ++i)
+	{
+		for (int k = 0; k < ens.replica[0].n_dimensions; ++k)
+		{
+			error_velocity = std::max(error_velocity, std::fabs(ens.replica[0].velocity[0][i][k] - velocity[i*ens.replica[0].n_dimensions + k]));
+		}
+	}
+	detail<<"swapped and back "<<(swapped && back)<<", kinetic energy "<<error_kinetic<<" velocities "<<error_velocity<<" ";
+
+	//With (beta_0 - beta_1)(U_1 - U_0) = ln 3, replica 0 is in the cold slot 3/4 of the time and half of the exchanges are accepted.
+	//The state of the first replica is moved on before each round, as the random stream of a round depends on it
+	ens.replica[1].energy_potential = 2*BOLTZ_SI*std::log(3.0);
+	const int rounds = 20000;
+	rex.attempts[0] = 0;
+	rex.accepted[0] = 0;
+	double cold = 0;
+	for (int round = 0; round < rounds; ++round)
+	{
+		ens.replica[0].state++;
+		tempering_exchange(ens, rex);
+		cold += (rex.slot[0] == 0) ? 1.0/rounds : 0;
+	}
+	double rate = (double)rex.accepted[0]/rex.attempts[0];
+	detail<<"replica 0 cold "<<cold<<" of the time, acceptance "<<rate;
+	return swapped && back && error_kinetic < 1e-12 && error_velocity < 1e-12 && std::fabs(cold - 0.75) < 0.03 && std::fabs(rate - 0.5) < 0.03;
+}
+
+/*******************************************************************************
+ * Runs the checks named on the command line (all of them without arguments) and returns the number of failures
+ ******************************************************************************/
+int main(int argc, char* argv[])
+{
+	const std::vector<check_case> checks = {
+		{"interact", check_interact},
+		{"threads", check_threads},
+		{"pipeline", check_pipeline},
+		{"constraints", check_constraints},
+		{"pme", check_pme},
+		{"ewald", check_ewald},
+		{"balance", check_balance},
+		{"stream", check_stream},
+		{"respa", check_respa},
+		{"rigid", check_rigid},
+		{"hard_spheres", check_hard_spheres},
+		{"adaptive", check_adaptive},
+		{"msd", check_msd},
+		{"structure_factor", check_structure_factor},
+		{"pressure", check_pressure},
+		{"integrators", check_integrators},
+		{"ensemble", check_ensemble},
+		{"tempering", check_tempering},
+	};
+
+	int failures = 0, run = 0;
+	for (const check_case& c : checks)
+	{
+		bool wanted = (argc == 1);
+		for (int a = 1; a < argc; ++a)
+		{
+			wanted = wanted || c.name == argv[a];
+		}
+		if(!wanted)
+		{
+			continue;
+		}
+		std::stringstream detail;
+		bool ok = c.run(detail);
+		std::cout<<c.name<<" : "<<(ok ? "ok" : "FAILED")<<" ("<<detail.str()<<")"<<std::endl;
+		failures += !ok;
+		run++;
+	}
+	if(run == 0)
+	{
+		std::cerr<<"Usage : mdgen_check [check ...] (checks :";
+		for (const check_case& c : checks)
+		{
+			std::cerr<<" "<<c.name;
+		}
+		std::cerr<<")"<<std::endl;
+		return 1;
+	}
+	return failures;
+}
@@ -0,0 +1,591 @@
+/** @file */
+#include <cmath>
+#include <algorithm>
+#include "constraints.h"
+#include "system.h"
+#include "reduce.h"
+#include "interaction.h"
+
+// Position of atom a (numbered as in constraint_set::atom)
+static inline double* atom_position(System::simulation& sim, int a)
+{
+	return sim.position[sim.constraints.atom[2*a]][sim.constraints.atom[2*a+1]].data();
+}
+
+// Velocity of atom a
+static inline double* atom_velocity(System::simulation& sim, int a)
+{
+	return sim.velocity[sim.constraints.atom[2*a]][sim.constraints.atom[2*a+1]].data();
+}
+
+// Inverse mass of atom a
+static inline double atom_inv_mass(System::simulation& sim, int a)
+{
+	return 1/sim.mass[sim.constraints.atom[2*a]];
+}
+
+// r = x1 - x2, with the minimum image convention for periodic boundaries
+static inline void bond_vector(System::simulation& sim, const double* x1, const double* x2, double* r)
+{
+	for (int k = 0; k < sim.n_dimensions; ++k)
+	{
+		r[k] = x1[k] - x2[k];
+		if(sim.periodic_boundary == 1)
+		{
+			double box = sim.box_size_limits[k];
+			r[k] -= box*std::round(r[k]/box);
+		}
+	}
+}
+
+// Wraps the (corrected) position of atom a back into the box, as in the integrators
+static inline void atom_wrap(System::simulation& sim, int a)
+{
+	if(sim.periodic_boundary != 1)
+	{
+		return;
+	}
+	const System::constraint_set& c = sim.constraints;
+	double* x = atom_position(sim, a);
+	int* img = sim.image[c.atom[2*a]][c.atom[2*a+1]].data();
+	for (int k = 0; k < sim.n_dimensions; ++k)
+	{
+		double box = sim.box_size_limits[k];
+		double shift = std::floor(x[k]/box);
+		x[k] -= box*shift;
+		img[k] += (int)shift;
+	}
+}
+
+void add_constraint_group(System::simulation& sim, const std::vector<int>& atoms, const std::vector<int>& bonds, const std::vector<double>& lengths)
+{
+	System::constraint_set& c = sim.constraints;
+	int first = c.atom.size()/2;
+	int n_atoms = atoms.size()/2;
+	if(atoms.size()%2 != 0 || bonds.size() != 2*lengths.size())
+	{
+		std::cerr<<"Error 0020"<<std::endl;
+		exit(20);
+	}
+	try{
+		c.atom.insert(c.atom.end(), atoms.begin(), atoms.end());
+		for (size_t b = 0; b < bonds.size(); ++b)
+		{
+			if(bonds[b] < 0 || bonds[b] >= n_atoms)
+			{
+				std::cerr<<"Error 0020"<<std::endl;
+				exit(20);
+			}
+			c.bond.push_back(first + bonds[b]);
+		}
+		c.length.insert(c.length.end(), lengths.begin(), lengths.end());
+		c.group_atom_start.push_back(c.atom.size()/2);
+		c.group_bond_start.push_back(c.length.size());
+		c.settle.push_back(0);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+}
+
+/*******************************************************************************
+ * Checks if group g can be solved with SETTLE, and if so stores its apex and canonical geometry
+ * The group must be three atoms bonded in a triangle (3 dimensions), with two bonds of equal length
+ * from the apex to two atoms of equal mass.
+ ******************************************************************************/
+static void settle_detect(System::simulation& sim, int g)
+{
+	System::constraint_set& c = sim.constraints;
+	int a0 = c.group_atom_start[g];
+	int b0 = c.group_bond_start[g];
+	if(sim.n_dimensions != 3 || c.group_atom_start[g+1] - a0 != 3 || c.group_bond_start[g+1] - b0 != 3)
+	{
+		return;
+	}
+	for (int apex = a0; apex < a0 + 3; ++apex)
+	{
+		//Bonds from the apex, and the one opposite to it
+		int side[2], n_side = 0, base = -1;
+		for (int b = b0; b < b0 + 3; ++b)
+		{
+			if(c.bond[2*b] == apex || c.bond[2*b+1] == apex)
+			{
+				if(n_side < 2)
+				{
+					side[n_side] = b;
+				}
+				n_side++;
+			}
+			else
+			{
+				base = b;
+			}
+		}
+		if(n_side != 2 || base < 0)
+		{
+			continue;
+		}
+		int p = c.bond[2*base], q = c.bond[2*base+1];
+		double d_side = c.length[side[0]];
+		double d_base = c.length[base];
+		if(p == q || std::abs(d_side - c.length[side[1]]) > 1e-12*d_side || atom_inv_mass(sim, p) != atom_inv_mass(sim, q) || d_base >= 2*d_side)
+		{
+			continue;
+		}
+
+		double m_apex = 1/atom_inv_mass(sim, apex);
+		double m_side = 1/atom_inv_mass(sim, p);
+		double height = std::sqrt(d_side*d_side - 0.25*d_base*d_base);
+		c.settle[g] = 1;
+		c.settle_atom[3*g] = apex;
+		c.settle_atom[3*g+1] = p;
+		c.settle_atom[3*g+2] = q;
+		c.settle_geometry[3*g] = 2*m_side/(m_apex + 2*m_side)*height;
+		c.settle_geometry[3*g+1] = height - c.settle_geometry[3*g];
+		c.settle_geometry[3*g+2] = 0.5*d_base;
+		return;
+	}
+}
+
+void initialize_constraints(System::simulation& sim)
+{
+	System::constraint_set& c = sim.constraints;
+#ifdef MDGEN_MPI
+	//The atoms of a molecule could be owned by different ranks
+	if(c.n_groups() > 0)
+	{
+		std::cerr<<"Error 0012"<<std::endl;
+		exit(12);
+	}
+#endif
+	int n_atoms = c.atom.size()/2;
+
+	//Every atom must exist and be in only one group, every bond must join two different atoms
+	std::vector<std::vector<char>> used(sim.n_types);
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		used[i].assign(sim.n_particles[i], 0);
+	}
+	for (int a = 0; a < n_atoms; ++a)
+	{
+		int t = c.atom[2*a], j = c.atom[2*a+1];
+		if(t < 0 || t >= sim.n_types || j < 0 || j >= sim.n_particles[t] || used[t][j])
+		{
+			std::cerr<<"Error 0020"<<std::endl;
+			exit(20);
+		}
+		used[t][j] = 1;
+	}
+	for (int b = 0; b < c.n_bonds(); ++b)
+	{
+		if(c.bond[2*b] == c.bond[2*b+1] || c.length[b] <= 0)
+		{
+			std::cerr<<"Error 0020"<<std::endl;
+			exit(20);
+		}
+	}
+
+	try{
+		c.settle_atom.assign(3*c.n_groups(), -1);
+		c.settle_geometry.assign(3*c.n_groups(), 0);
+		c.reference.assign(n_atoms*sim.n_dimensions, 0);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+
+	for (int g = 0; g < c.n_groups(); ++g)
+	{
+		c.settle[g] = 0;
+		settle_detect(sim, g);
+	}
+
+	//Each bond removes one degree of freedom, shared between the types of its ends
+	for (int b = 0; b < c.n_bonds(); ++b)
+	{
+		sim.dof_removed[c.atom[2*c.bond[2*b]]] += 0.5;
+		sim.dof_removed[c.atom[2*c.bond[2*b+1]]] += 0.5;
+	}
+
+	//The atoms of a bond, and those bonded to a common atom, do not interact by the pair kernels
+	for (int g = 0; g < c.n_groups(); ++g)
+	{
+		for (int b = c.group_bond_start[g]; b < c.group_bond_start[g+1]; ++b)
+		{
+			int p = c.bond[2*b], q = c.bond[2*b+1];
+			add_exclusion(sim, c.atom[2*p], c.atom[2*p+1], c.atom[2*q], c.atom[2*q+1]);
+			for (int b2 = b + 1; b2 < c.group_bond_start[g+1]; ++b2)
+			{
+				int p2 = c.bond[2*b2], q2 = c.bond[2*b2+1];
+				//Ends of the two bonds other than their common atom, if they have one
+				int u = (p == p2 || p == q2) ? q : ((q == p2 || q == q2) ? p : -1);
+				int v = (p2 == p || p2 == q) ? q2 : ((q2 == p || q2 == q) ? p2 : -1);
+				if(u >= 0 && v >= 0 && u != v)
+				{
+					add_exclusion(sim, c.atom[2*u], c.atom[2*u+1], c.atom[2*v], c.atom[2*v+1]);
+				}
+			}
+		}
+	}
+	build_exclusions(sim);
+
+	//The starting velocities must satisfy the constraints as well
+	constrain_velocities(sim, 0);
+}
+
+void constraint_save(System::simulation& sim)
+{
+	System::constraint_set& c = sim.constraints;
+	const int dim = sim.n_dimensions;
+	int n_atoms = c.atom.size()/2;
+	#pragma omp parallel for schedule(static)
+	for (int a = 0; a < n_atoms; ++a)
+	{
+		const double* x = atom_position(sim, a);
+		for (int k = 0; k < dim; ++k)
+		{
+			c.reference[a*dim + k] = x[k];
+		}
+	}
+}
+
+/*******************************************************************************
+ * SHAKE over the bonds of group g
+ * Each bond is corrected in turn along its vector at the start of the timestep, until all of them are within the tolerance.
+ * Returns 0 if the group did not converge.
+ ******************************************************************************/
+static int shake_group(System::simulation& sim, int g, double dt)
+{
+	System::constraint_set& c = sim.constraints;
+	const int dim = sim.n_dimensions;
+	for (int it = 0; it < c.max_iterations; ++it)
+	{
+		bool done = true;
+		for (int b = c.group_bond_start[g]; b < c.group_bond_start[g+1]; ++b)
+		{
+			int p = c.bond[2*b], q = c.bond[2*b+1];
+			double* xp = atom_position(sim, p);
+			double* xq = atom_position(sim, q);
+			double r0[dim], s[dim];
+			bond_vector(sim, &c.reference[p*dim], &c.reference[q*dim], r0);
+			bond_vector(sim, xp, xq, s);
+
+			double d2 = c.length[b]*c.length[b];
+			double s2 = 0, sr0 = 0;
+			for (int k = 0; k < dim; ++k)
+			{
+				s2 += s[k]*s[k];
+				sr0 += s[k]*r0[k];
+			}
+			double diff = d2 - s2;
+			if(std::abs(diff) <= 2*c.tolerance*d2)
+			{
+				continue;
+			}
+			done = false;
+
+			double wp = atom_inv_mass(sim, p), wq = atom_inv_mass(sim, q);
+			double gain = diff/(2*sr0*(wp + wq));
+			double* vp = atom_velocity(sim, p);
+			double* vq = atom_velocity(sim, q);
+			for (int k = 0; k < dim; ++k)
+			{
+				xp[k] += gain*wp*r0[k];
+				xq[k] -= gain*wq*r0[k];
+				vp[k] += gain*wp*r0[k]/dt;
+				vq[k] -= gain*wq*r0[k]/dt;
+			}
+		}
+		if(done)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+ * SETTLE positions of group g (Miyamoto and Kollman)
+ * The new positions are those of the canonical triangle rotated to keep the centre of mass of the unconstrained positions and
+ * to be as close to them as possible, the rotation being found analytically in the frame of the triangle at the start of the timestep.
+ ******************************************************************************/
+static void settle_group(System::simulation& sim, int g, double dt)
+{
+	System::constraint_set& c = sim.constraints;
+	int ia = c.settle_atom[3*g], ib = c.settle_atom[3*g+1], ic = c.settle_atom[3*g+2];
+	const double ra = c.settle_geometry[3*g], rb = c.settle_geometry[3*g+1], rc = c.settle_geometry[3*g+2];
+	double ma = 1/atom_inv_mass(sim, ia), mh = 1/atom_inv_mass(sim, ib);
+	double* xa = atom_position(sim, ia);
+	double* xb = atom_position(sim, ib);
+	double* xc = atom_position(sim, ic);
+
+	//Triangle at the start of the timestep, and the new positions, relative to the apex (unwrapped)
+	double b0[3], c0[3], b1[3], c1[3];
+	bond_vector(sim, &c.reference[ib*3], &c.reference[ia*3], b0);
+	bond_vector(sim, &c.reference[ic*3], &c.reference[ia*3], c0);
+	bond_vector(sim, xb, xa, b1);
+	bond_vector(sim, xc, xa, c1);
+
+	//New positions relative to their centre of mass
+	double com[3], a1[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		com[k] = mh*(b1[k] + c1[k])/(ma + 2*mh);
+		a1[k] = -com[k];
+		b1[k] -= com[k];
+		c1[k] -= com[k];
+	}
+
+	//Frame : Z normal to the old triangle, X normal to Z and to the new apex
+	double ez[3] = {b0[1]*c0[2] - b0[2]*c0[1], b0[2]*c0[0] - b0[0]*c0[2], b0[0]*c0[1] - b0[1]*c0[0]};
+	double ex[3] = {a1[1]*ez[2] - a1[2]*ez[1], a1[2]*ez[0] - a1[0]*ez[2], a1[0]*ez[1] - a1[1]*ez[0]};
+	double ey[3] = {ez[1]*ex[2] - ez[2]*ex[1], ez[2]*ex[0] - ez[0]*ex[2], ez[0]*ex[1] - ez[1]*ex[0]};
+	double nx = std::sqrt(ex[0]*ex[0] + ex[1]*ex[1] + ex[2]*ex[2]);
+	double ny = std::sqrt(ey[0]*ey[0] + ey[1]*ey[1] + ey[2]*ey[2]);
+	double nz = std::sqrt(ez[0]*ez[0] + ez[1]*ez[1] + ez[2]*ez[2]);
+	for (int k = 0; k < 3; ++k)
+	{
+		ex[k] /= nx;
+		ey[k] /= ny;
+		ez[k] /= nz;
+	}
+	auto dot = [](const double* u, const double* v){ return u[0]*v[0] + u[1]*v[1] + u[2]*v[2]; };
+
+	double xb0d = dot(ex, b0), yb0d = dot(ey, b0);
+	double xc0d = dot(ex, c0), yc0d = dot(ey, c0);
+	double za1d = dot(ez, a1);
+	double xb1d = dot(ex, b1), yb1d = dot(ey, b1), zb1d = dot(ez, b1);
+	double xc1d = dot(ex, c1), yc1d = dot(ey, c1), zc1d = dot(ez, c1);
+
+	//Tilts of the canonical triangle out of the old plane
+	double sinphi = za1d/ra;
+	double cosphi = std::sqrt(std::max(0.0, 1 - sinphi*sinphi));
+	double sinpsi = (zb1d - zc1d)/(2*rc*cosphi);
+	double cospsi = std::sqrt(std::max(0.0, 1 - sinpsi*sinpsi));
+
+	double ya2d = ra*cosphi;
+	double xb2d = -rc*cospsi;
+	double yb2d = -rb*cosphi - rc*sinpsi*sinphi;
+	double yc2d = -rb*cosphi + rc*sinpsi*sinphi;
+
+	//Rotation about Z
+	double alpha = xb2d*(xb0d - xc0d) + yb0d*yb2d + yc0d*yc2d;
+	double beta = xb2d*(yc0d - yb0d) + xb0d*yb2d + xc0d*yc2d;
+	double gamma = xb0d*yb1d - xb1d*yb0d + xc0d*yc1d - xc1d*yc0d;
+	double ab2 = alpha*alpha + beta*beta;
+	double sintheta = (alpha*gamma - beta*std::sqrt(std::max(0.0, ab2 - gamma*gamma)))/ab2;
+	double costheta = std::sqrt(std::max(0.0, 1 - sintheta*sintheta));
+
+	double a3d[3] = {-ya2d*sintheta, ya2d*costheta, za1d};
+	double b3d[3] = {xb2d*costheta - yb2d*sintheta, xb2d*sintheta + yb2d*costheta, zb1d};
+	double c3d[3] = {-xb2d*costheta - yc2d*sintheta, -xb2d*sintheta + yc2d*costheta, zc1d};
+
+	//Back to the box frame
+	double* va = atom_velocity(sim, ia);
+	double* vb = atom_velocity(sim, ib);
+	double* vc = atom_velocity(sim, ic);
+	for (int k = 0; k < 3; ++k)
+	{
+		//Displacements, added to the (wrapped) positions so the image counts stay right
+		double da = ex[k]*a3d[0] + ey[k]*a3d[1] + ez[k]*a3d[2] - a1[k];
+		double db = ex[k]*b3d[0] + ey[k]*b3d[1] + ez[k]*b3d[2] - b1[k];
+		double dc = ex[k]*c3d[0] + ey[k]*c3d[1] + ez[k]*c3d[2] - c1[k];
+		xa[k] += da;
+		xb[k] += db;
+		xc[k] += dc;
+		va[k] += da/dt;
+		vb[k] += db/dt;
+		vc[k] += dc/dt;
+	}
+}
+
+void constrain_positions(System::simulation& sim, double dt)
+{
+	System::constraint_set& c = sim.constraints;
+	int failed = 0;
+	#pragma omp parallel for schedule(dynamic,64)
+	for (int g = 0; g < c.n_groups(); ++g)
+	{
+		if(c.settle[g])
+		{
+			settle_group(sim, g, dt);
+		}
+		else if(!shake_group(sim, g, dt))
+		{
+			#pragma omp atomic write
+			failed = 1;
+		}
+		for (int a = c.group_atom_start[g]; a < c.group_atom_start[g+1]; ++a)
+		{
+			atom_wrap(sim, a);
+		}
+	}
+	if(failed)
+	{
+		std::cerr<<"Error 0013"<<std::endl;
+		exit(13);
+	}
+}
+
+/*******************************************************************************
+ * Solves for the impulses along the three bonds of a SETTLE group at once (Cramer's rule)
+ * Returns the virial of the impulses (sum of k d^2).
+ ******************************************************************************/
+static double settle_velocities(System::simulation& sim, int g)
+{
+	System::constraint_set& c = sim.constraints;
+	const int b0 = c.group_bond_start[g];
+	double r[3][3], rhs[3], m[3][3], w[3][2];
+	int end[3][2];
+	for (int p = 0; p < 3; ++p)
+	{
+		int b = b0 + p;
+		end[p][0] = c.bond[2*b];
+		end[p][1] = c.bond[2*b+1];
+		w[p][0] = atom_inv_mass(sim, end[p][0]);
+		w[p][1] = atom_inv_mass(sim, end[p][1]);
+		bond_vector(sim, atom_position(sim, end[p][0]), atom_position(sim, end[p][1]), r[p]);
+		const double* v1 = atom_velocity(sim, end[p][0]);
+		const double* v2 = atom_velocity(sim, end[p][1]);
+		rhs[p] = -(r[p][0]*(v1[0] - v2[0]) + r[p][1]*(v1[1] - v2[1]) + r[p][2]*(v1[2] - v2[2]));
+	}
+	//m[p][q] : change of r_p.v_p per unit impulse along bond q
+	for (int p = 0; p < 3; ++p)
+	{
+		for (int q = 0; q < 3; ++q)
+		{
+			double coupling = 0;
+			for (int e = 0; e < 2; ++e)
+			{
+				double sign = (e == 0) ? 1 : -1;
+				if(end[p][e] == end[q][0])
+				{
+					coupling += sign*w[q][0];
+				}
+				if(end[p][e] == end[q][1])
+				{
+					coupling -= sign*w[q][1];
+				}
+			}
+			m[p][q] = coupling*(r[p][0]*r[q][0] + r[p][1]*r[q][1] + r[p][2]*r[q][2]);
+		}
+	}
+	auto det = [](double a[3][3]){
+		return a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1]) - a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0]) + a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+	};
+	double inv_det = 1/det(m);
+	double k[3], virial = 0;
+	for (int q = 0; q < 3; ++q)
+	{
+		double mq[3][3];
+		for (int p = 0; p < 3; ++p)
+		{
+			for (int s = 0; s < 3; ++s)
+			{
+				mq[p][s] = (s == q) ? rhs[p] : m[p][s];
+			}
+		}
+		k[q] = det(mq)*inv_det;
+	}
+	for (int p = 0; p < 3; ++p)
+	{
+		double* v1 = atom_velocity(sim, end[p][0]);
+		double* v2 = atom_velocity(sim, end[p][1]);
+		for (int s = 0; s < 3; ++s)
+		{
+			v1[s] += k[p]*w[p][0]*r[p][s];
+			v2[s] -= k[p]*w[p][1]*r[p][s];
+		}
+		virial += k[p]*c.length[b0 + p]*c.length[b0 + p];
+	}
+	return virial;
+}
+
+/*******************************************************************************
+ * RATTLE over the bonds of group g
+ * Each bond in turn gets the impulse which cancels the relative velocity along it, until all of them are within the tolerance.
+ * Returns 0 if the group did not converge, and adds the virial of the impulses (sum of k d^2) to virial.
+ ******************************************************************************/
+static int rattle_group(System::simulation& sim, int g, double& virial)
+{
+	System::constraint_set& c = sim.constraints;
+	const int dim = sim.n_dimensions;
+	for (int it = 0; it < c.max_iterations; ++it)
+	{
+		bool done = true;
+		for (int b = c.group_bond_start[g]; b < c.group_bond_start[g+1]; ++b)
+		{
+			int p = c.bond[2*b], q = c.bond[2*b+1];
+			double* vp = atom_velocity(sim, p);
+			double* vq = atom_velocity(sim, q);
+			double r[dim];
+			bond_vector(sim, atom_position(sim, p), atom_position(sim, q), r);
+
+			double d2 = c.length[b]*c.length[b];
+			double rv = 0;
+			for (int k = 0; k < dim; ++k)
+			{
+				rv += r[k]*(vp[k] - vq[k]);
+			}
+			//Relative to the change of the bond length over a timestep
+			if(std::abs(rv)*sim.timestep <= c.tolerance*d2)
+			{
+				continue;
+			}
+			done = false;
+
+			double wp = atom_inv_mass(sim, p), wq = atom_inv_mass(sim, q);
+			double gain = -rv/(d2*(wp + wq));
+			for (int k = 0; k < dim; ++k)
+			{
+				vp[k] += gain*wp*r[k];
+				vq[k] -= gain*wq*r[k];
+			}
+			virial += gain*d2;
+		}
+		if(done)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void constrain_velocities(System::simulation& sim, double dt)
+{
+	System::constraint_set& c = sim.constraints;
+	int failed = 0;
+	double virial;
+	reduce_sum(c.n_groups(), 1, &virial, [&](long g, double* s)
+	{
+		if(c.settle[g])
+		{
+			s[0] += settle_velocities(sim, g);
+		}
+		else if(!rattle_group(sim, g, s[0]))
+		{
+			#pragma omp atomic write
+			failed = 1;
+		}
+	}, 64);
+	if(failed)
+	{
+		std::cerr<<"Error 0013"<<std::endl;
+		exit(13);
+	}
+	//The impulses act over dt/2 : F = 2 k r / dt
+	if(sim.energy_due && dt > 0)
+	{
+		c.virial = 2*virial/dt;
+	}
+}
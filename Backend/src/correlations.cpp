@@ -1,48 +1,222 @@
 /** @file */
 #include "correlations.h"
+#include "timer.h"
 
 void initialize_correlations(System::simulation& sim)
 {
+#ifdef MDGEN_MPI
+	//The particles migrate between the ranks and are renumbered, so the rows kept for them would no longer match
+	std::cerr<<"Error 0021"<<std::endl;
+	exit(21);
+#endif
 	sim.velocity_initial = sim.velocity;
 }
 
 void correlate(System::simulation& sim)
 {
-	int s = sim.step;
+#ifdef MDGEN_MPI
+	//velocity_initial holds the rows of the particles each rank owned at the start
+	std::cerr<<"Error 0021"<<std::endl;
+	exit(21);
+#endif
+	TIME_PHASE(PHASE_CORRELATE);
+	int s = sim.state;
 
 	//Taking local sum
 	#pragma omp target teams distribute parallel for
 	for (int i = 0; i < sim.n_types; ++i)
 	{
-		sim.correlation_velocity[s][i] = 0;
+		double vdot = 0;
 
-		#pragma omp parallel for
+		#pragma omp parallel for reduction(+:vdot)
 		for (int j = 0; j < sim.n_particles[i]; ++j)
 		{
-			double vdot = 0;
-			#pragma omp parallel for
 			for (int k = 0; k < sim.n_dimensions; ++k)
 			{
 				vdot += sim.velocity[i][j][k]*sim.velocity_initial[i][j][k];
 			}
-			sim.correlation_velocity[s][i] += vdot;
 		}
+		sim.correlation_velocity[s][i] = vdot;
 	}
 
 	// Taking global sum
-	#pragma omp parallel for reduction(+:sim.correlation_velocity[s][sim.n_types])
+	double global = 0;
+	#pragma omp parallel for reduction(+:global)
 	for (int i = 0; i < sim.n_types; ++i)
 	{
-		sim.correlation_velocity[s][sim.n_types] += sim.correlation_velocity[s][i];
+		global += sim.correlation_velocity[s][i];
 	}
+	sim.correlation_velocity[s][sim.n_types] = global;
 
 	// Dividing by the number of particles
 	#pragma omp parallel for
-	for (int i = 0; i < n_types; ++i)
+	for (int i = 0; i < sim.n_types; ++i)
 	{
-		sim.correlation_velocity[s][i] /= sim.n_particles[i];
+		if(sim.n_particles[i] > 0)
+		{
+			sim.correlation_velocity[s][i] /= sim.n_particles[i];
+		}
 	}
 
 	//Taking global average
-	sim.correlation_velocity[s][n_types] /= sim.numpartot;
-}
\ No newline at end of file
+	if(sim.numpartot > 0)
+	{
+		sim.correlation_velocity[s][sim.n_types] /= sim.numpartot;
+	}
+}
+
+double unwrapped_position(System::simulation& sim, int type, int n, int k)
+{
+	return sim.position[type][n][k] + sim.image[type][n][k]*sim.box_size_limits[k];
+}
+
+void initialize_msd(System::simulation& sim)
+{
+#ifdef MDGEN_MPI
+	//The origins would be the positions of the particles each rank owned when they were stored
+	std::cerr<<"Error 0021"<<std::endl;
+	exit(21);
+#endif
+	try
+	{
+		sim.msd_origin_sample.assign(sim.msd_origins, -1);
+		sim.msd_origin_position.resize(sim.msd_origins);
+		for (int o = 0; o < sim.msd_origins; ++o)
+		{
+			sim.msd_origin_position[o].resize(sim.n_types);
+			for (int i = 0; i < sim.n_types; ++i)
+			{
+				sim.msd_origin_position[o][i].resize(sim.n_particles[i]*sim.n_dimensions);
+			}
+		}
+
+		sim.msd_current.resize(sim.n_types);
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			sim.msd_current[i].resize(sim.n_particles[i]*sim.n_dimensions);
+		}
+
+		sim.msd_sum.assign(sim.msd_length, std::vector<double>(sim.n_types+1, 0));
+		sim.msd_count.assign(sim.msd_length, 0);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl; 
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	sim.msd_samples = 0;
+}
+
+void sample_msd(System::simulation& sim)
+{
+	int s = sim.msd_samples;
+	int dim = sim.n_dimensions;
+
+	//Unwrapping the positions into a flat array for each type
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		double* current = sim.msd_current[i].data();
+
+		#pragma omp parallel for
+		for (int j = 0; j < sim.n_particles[i]; ++j)
+		{
+			#pragma omp simd
+			for (int k = 0; k < dim; ++k)
+			{
+				current[j*dim + k] = sim.position[i][j][k] + sim.image[i][j][k]*sim.box_size_limits[k];
+			}
+		}
+	}
+
+	//Adding the squared displacement from every origin to its lag
+	for (int o = 0; o < sim.msd_origins; ++o)
+	{
+		int lag = s - sim.msd_origin_sample[o];
+		if(sim.msd_origin_sample[o] < 0 || lag >= sim.msd_length)
+		{
+			continue;
+		}
+
+		double total = 0;
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			const double* current = sim.msd_current[i].data();
+			const double* origin = sim.msd_origin_position[o][i].data();
+			int n = sim.n_particles[i]*dim;
+
+			double dr2 = 0;
+			#pragma omp parallel for simd reduction(+ : dr2)
+			for (int m = 0; m < n; ++m)
+			{
+				double dr = current[m] - origin[m];
+				dr2 += dr*dr;
+			}
+			//An empty type adds nothing
+			if(sim.n_particles[i] > 0)
+			{
+				sim.msd_sum[lag][i] += dr2/sim.n_particles[i];
+			}
+			total += dr2;
+		}
+		if(sim.numpartot > 0)
+		{
+			sim.msd_sum[lag][sim.n_types] += total/sim.numpartot;
+		}
+		sim.msd_count[lag]++;
+	}
+
+	//Replacing the oldest origin by the current positions
+	if(s % sim.msd_origin_spacing == 0)
+	{
+		int o = (s/sim.msd_origin_spacing) % sim.msd_origins;
+		sim.msd_origin_sample[o] = s;
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			sim.msd_origin_position[o][i] = sim.msd_current[i];
+		}
+		//The lag 0 contribution of this origin is 0 by definition
+		sim.msd_count[0]++;
+	}
+
+	sim.msd_samples++;
+}
+
+double msd(System::simulation& sim, int lag, int type)
+{
+	if(sim.msd_count[lag] == 0)
+	{
+		return 0;
+	}
+	return sim.msd_sum[lag][type]/sim.msd_count[lag];
+}
+
+double diffusion_coefficient(System::simulation& sim, int type)
+{
+	//Least squares fit of msd = slope*t + c over the second half of the lags
+	double t_sample = sim.msd_stride*sim.timestep;
+	double st = 0, sm = 0, stt = 0, stm = 0;
+	int n = 0;
+	for (int lag = sim.msd_length/2; lag < sim.msd_length; ++lag)
+	{
+		if(sim.msd_count[lag] == 0)
+		{
+			continue;
+		}
+		double t = lag*t_sample;
+		double m = msd(sim,lag,type);
+		st += t;
+		sm += m;
+		stt += t*t;
+		stm += t*m;
+		n++;
+	}
+	if(n < 2)
+	{
+		return 0;
+	}
+	double slope = (n*stm - st*sm)/(n*stt - st*st);
+	return slope/(2*sim.n_dimensions);
+}
@@ -0,0 +1,354 @@
+/** @file */
+#include <cmath>
+#include <algorithm>
+#include "domain.h"
+#include "system.h"
+#include "constants.h"
+#include "interaction.h"
+#include "timer.h"
+
+// Width of the subdomains along dimension k
+static double domain_width(System::simulation& sim, int k)
+{
+	return sim.box_size_limits[k]/sim.domain.dims[k];
+}
+
+int domain_owner(System::simulation& sim, int k, double x)
+{
+	int c = (int)std::floor(x/domain_width(sim, k));
+	return std::min(std::max(c, 0), sim.domain.dims[k] - 1);
+}
+
+// Exchanges one message with each neighbour along dimension k : send_low goes to the rank below, and what the rank above sent to its rank below is returned (then the same upwards)
+static void domain_sendrecv(System::simulation& sim, int k, std::vector<double>& send_low, std::vector<double>& send_high, std::vector<double>& recv)
+{
+	System::domain_decomposition& d = sim.domain;
+	recv.clear();
+	for (int dir = 0; dir < 2; ++dir)
+	{
+		std::vector<double>& send = (dir == 0) ? send_low : send_high;
+		int to = (dir == 0) ? d.neighbor_low[k] : d.neighbor_high[k];
+		int from = (dir == 0) ? d.neighbor_high[k] : d.neighbor_low[k];
+
+		int n_send = send.size();
+		int n_recv = 0;
+		MPI_Sendrecv(&n_send, 1, MPI_INT, to, 2*k + dir, &n_recv, 1, MPI_INT, from, 2*k + dir, d.comm, MPI_STATUS_IGNORE);
+		size_t start = recv.size();
+		recv.resize(start + n_recv);
+		MPI_Sendrecv(send.data(), n_send, MPI_DOUBLE, to, 2*k + dir, recv.data() + start, n_recv, MPI_DOUBLE, from, 2*k + dir, d.comm, MPI_STATUS_IGNORE);
+	}
+}
+
+void initialize_domain(System::simulation& sim)
+{
+	System::domain_decomposition& d = sim.domain;
+	const int dim = sim.n_dimensions;
+
+	int initialized;
+	MPI_Initialized(&initialized);
+	if(!initialized)
+	{
+		int provided;
+		MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+	}
+
+	//Cartesian grid of the ranks
+	MPI_Comm_size(MPI_COMM_WORLD, &d.size);
+	d.dims.assign(dim, 0);
+	MPI_Dims_create(d.size, dim, d.dims.data());
+	std::vector<int> periods(dim, sim.periodic_boundary ? 1 : 0);
+	MPI_Cart_create(MPI_COMM_WORLD, dim, d.dims.data(), periods.data(), 1, &d.comm);
+	MPI_Comm_rank(d.comm, &d.rank);
+	d.coords.resize(dim);
+	MPI_Cart_coords(d.comm, d.rank, dim, d.coords.data());
+	d.neighbor_low.resize(dim);
+	d.neighbor_high.resize(dim);
+	for (int k = 0; k < dim; ++k)
+	{
+		MPI_Cart_shift(d.comm, k, 1, &d.neighbor_low[k], &d.neighbor_high[k]);
+	}
+
+	//The halo is as wide as the largest cutoff
+	d.cutoff = 0;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = 0; j < sim.n_types; ++j)
+		{
+			if(sim.interaction[i][j] == lj_periodic || sim.interaction[i][j] == lj_box)
+			{
+				d.cutoff = std::max(d.cutoff, sim.interaction_const[i][j][2]);
+			}
+		}
+	}
+	for (int k = 0; k < dim; ++k)
+	{
+		if(d.dims[k] > 1 && domain_width(sim, k) < d.cutoff)
+		{
+			std::cerr<<"Error 0008"<<std::endl;
+			exit(8);
+		}
+	}
+
+	//Every rank keeps its own particles from the state of rank 0
+	d.n_particles_global = sim.n_particles;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		int n = sim.n_particles[i];
+		std::vector<double> state(2*n*dim);
+		for (int j = 0; j < n; ++j)
+		{
+			for (int k = 0; k < dim; ++k)
+			{
+				state[(2*j)*dim + k] = sim.position[i][j][k];
+				state[(2*j+1)*dim + k] = sim.velocity[i][j][k];
+			}
+		}
+		MPI_Bcast(state.data(), 2*n*dim, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+		int count = 0;
+		for (int j = 0; j < n; ++j)
+		{
+			bool mine = true;
+			for (int k = 0; k < dim; ++k)
+			{
+				mine = mine && (domain_owner(sim, k, state[(2*j)*dim + k]) == d.coords[k]);
+			}
+			if(!mine)
+			{
+				continue;
+			}
+			for (int k = 0; k < dim; ++k)
+			{
+				sim.position[i][count][k] = state[(2*j)*dim + k];
+				sim.velocity[i][count][k] = state[(2*j+1)*dim + k];
+				sim.image[i][count][k] = 0;
+			}
+			count++;
+		}
+		sim.n_particles[i] = count;
+	}
+
+	//Each rank adds its share of the tail energy
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = 0; j < sim.n_types; ++j)
+		{
+			if(sim.interaction[i][j] == lj_periodic || sim.interaction[i][j] == lj_box)
+			{
+				sim.interaction_const[i][j][5] /= d.size;
+			}
+		}
+	}
+
+	d.ghost_position.resize(sim.n_types);
+	d.n_ghosts.assign(sim.n_types, 0);
+	domain_exchange_ghosts(sim);
+}
+
+void domain_migrate(System::simulation& sim)
+{
+	System::domain_decomposition& d = sim.domain;
+	if(d.comm == MPI_COMM_NULL)
+	{
+		return;
+	}
+	TIME_PHASE(PHASE_COMMUNICATE);
+	const int dim = sim.n_dimensions;
+	const int record = 1 + 3*dim + ORIENTATION_SIZE; //type, position, velocity, image, orientation
+	std::vector<double> send_low, send_high;
+
+	for (int k = 0; k < dim; ++k)
+	{
+		if(d.dims[k] == 1)
+		{
+			continue;
+		}
+		send_low.clear();
+		send_high.clear();
+		int c = d.coords[k];
+		int last = d.dims[k] - 1;
+
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			int j = 0;
+			while(j < sim.n_particles[i])
+			{
+				int owner = domain_owner(sim, k, sim.position[i][j][k]);
+				if(owner == c)
+				{
+					j++;
+					continue;
+				}
+
+				std::vector<double>* send;
+				if(owner == c + 1 || (sim.periodic_boundary && c == last && owner == 0))
+				{
+					send = &send_high;
+				}
+				else if(owner == c - 1 || (sim.periodic_boundary && c == 0 && owner == last))
+				{
+					send = &send_low;
+				}
+				else
+				{
+					std::cerr<<"Error 0009"<<std::endl;
+					exit(9);
+				}
+
+				send->push_back(i);
+				send->insert(send->end(), sim.position[i][j].begin(), sim.position[i][j].end());
+				send->insert(send->end(), sim.velocity[i][j].begin(), sim.velocity[i][j].end());
+				send->insert(send->end(), sim.image[i][j].begin(), sim.image[i][j].end());
+				send->insert(send->end(), sim.orientation[i][j].begin(), sim.orientation[i][j].end());
+
+				//Moving the last particle into the free slot
+				int n = --sim.n_particles[i];
+				if(j != n)
+				{
+					std::copy(sim.position[i][n].begin(), sim.position[i][n].end(), sim.position[i][j].begin());
+					std::copy(sim.velocity[i][n].begin(), sim.velocity[i][n].end(), sim.velocity[i][j].begin());
+					std::copy(sim.image[i][n].begin(), sim.image[i][n].end(), sim.image[i][j].begin());
+					std::copy(sim.orientation[i][n].begin(), sim.orientation[i][n].end(), sim.orientation[i][j].begin());
+				}
+			}
+		}
+
+		domain_sendrecv(sim, k, send_low, send_high, d.receive_buffer);
+
+		//The particles have been renumbered
+		if(!send_low.empty() || !send_high.empty() || !d.receive_buffer.empty())
+		{
+			sim.respa_list_valid = 0;
+		}
+
+		for (size_t r = 0; r < d.receive_buffer.size(); r += record)
+		{
+			const double* rec = d.receive_buffer.data() + r;
+			int i = (int)rec[0];
+			int n = sim.n_particles[i]++;
+			for (int m = 0; m < dim; ++m)
+			{
+				sim.position[i][n][m] = rec[1 + m];
+				sim.velocity[i][n][m] = rec[1 + dim + m];
+				sim.image[i][n][m] = (int)rec[1 + 2*dim + m];
+			}
+			for (int m = 0; m < ORIENTATION_SIZE; ++m)
+			{
+				sim.orientation[i][n][m] = rec[1 + 3*dim + m];
+			}
+		}
+	}
+}
+
+void domain_exchange_ghosts(System::simulation& sim)
+{
+	System::domain_decomposition& d = sim.domain;
+	if(d.comm == MPI_COMM_NULL)
+	{
+		return;
+	}
+	TIME_PHASE(PHASE_COMMUNICATE);
+	const int dim = sim.n_dimensions;
+	const int record = 1 + dim; //type, position
+	std::vector<double> send_low, send_high;
+
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		d.ghost_position[i].clear();
+		d.n_ghosts[i] = 0;
+	}
+
+	for (int k = 0; k < dim; ++k)
+	{
+		if(d.dims[k] == 1)
+		{
+			continue;
+		}
+		send_low.clear();
+		send_high.clear();
+		double width = domain_width(sim, k);
+		double lo = d.coords[k]*width;
+		double hi = lo + width;
+		//Shift of the ghosts crossing the periodic boundary
+		double shift_low = (sim.periodic_boundary && d.coords[k] == 0) ? sim.box_size_limits[k] : 0;
+		double shift_high = (sim.periodic_boundary && d.coords[k] == d.dims[k] - 1) ? -sim.box_size_limits[k] : 0;
+
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			//Local particles, then the ghosts received along the previous dimensions
+			int n_local = sim.n_particles[i];
+			int n_total = n_local + d.n_ghosts[i];
+			for (int j = 0; j < n_total; ++j)
+			{
+				const double* x = (j < n_local) ? sim.position[i][j].data() : d.ghost_position[i].data() + (j - n_local)*dim;
+				if(x[k] < lo + d.cutoff)
+				{
+					send_low.push_back(i);
+					for (int m = 0; m < dim; ++m)
+					{
+						send_low.push_back(x[m] + ((m == k) ? shift_low : 0));
+					}
+				}
+				if(x[k] >= hi - d.cutoff)
+				{
+					send_high.push_back(i);
+					for (int m = 0; m < dim; ++m)
+					{
+						send_high.push_back(x[m] + ((m == k) ? shift_high : 0));
+					}
+				}
+			}
+		}
+
+		domain_sendrecv(sim, k, send_low, send_high, d.receive_buffer);
+
+		for (size_t r = 0; r < d.receive_buffer.size(); r += record)
+		{
+			const double* rec = d.receive_buffer.data() + r;
+			int i = (int)rec[0];
+			d.ghost_position[i].insert(d.ghost_position[i].end(), rec + 1, rec + 1 + dim);
+			d.n_ghosts[i]++;
+		}
+	}
+}
+
+void domain_reduce(System::simulation& sim)
+{
+	System::domain_decomposition& d = sim.domain;
+	if(d.comm == MPI_COMM_NULL)
+	{
+		return;
+	}
+	TIME_PHASE(PHASE_COMMUNICATE);
+	const int dim = sim.n_dimensions;
+	const int nt = sim.n_types;
+
+	//Potential energy, virial, kinetic energies and momentum in one message
+	double sums[2 + nt + dim];
+	sums[0] = sim.energy_potential;
+	sums[1] = sim.virial;
+	for (int i = 0; i < nt; ++i)
+	{
+		sums[2 + i] = sim.energy_kinetic[i];
+	}
+	for (int k = 0; k < dim; ++k)
+	{
+		sums[2 + nt + k] = sim.momentum[k];
+	}
+	MPI_Allreduce(MPI_IN_PLACE, sums, 2 + nt + dim, MPI_DOUBLE, MPI_SUM, d.comm);
+
+	sim.energy_potential = sums[0];
+	sim.virial = sums[1];
+	sim.energy_total = sim.energy_potential;
+	for (int i = 0; i < nt; ++i)
+	{
+		sim.energy_kinetic[i] = sums[2 + i];
+		const double dof = d.n_particles_global[i]*dim - sim.dof_removed[i];
+		sim.temperature[i] = (dof > 0) ? sim.energy_kinetic[i]/(dof*BOLTZ_SI) : 0;
+		sim.energy_total += sim.energy_kinetic[i];
+	}
+	for (int k = 0; k < dim; ++k)
+	{
+		sim.momentum[k] = sums[2 + nt + k];
+	}
+}
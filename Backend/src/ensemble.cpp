@@ -0,0 +1,59 @@
+/** @file */
+#include <algorithm>
+#include "ensemble.h"
+#include "step.h"
+#include "timer.h"
+
+void ensemble_advance(System::ensemble& ens, int steps)
+{
+	int n = ens.size();
+	int inner = std::max(1, ens.threads_per_replica);
+	int outer = std::max(1, omp_get_max_threads()/inner);
+	//The loop over replicas is the first level, the loops inside each replica the second (if a replica has more than one thread)
+	int levels = omp_get_max_active_levels();
+	omp_set_max_active_levels((inner > 1) ? 2 : 1);
+
+	#pragma omp parallel num_threads(outer)
+	{
+#ifdef MDGEN_NUMA
+		//The nested team of each replica inherits the cores of the thread starting it
+		numa_pin_block(omp_get_thread_num()*inner, inner);
+#endif
+		#pragma omp for schedule(dynamic,1)
+		for (int r = 0; r < n; ++r)
+		{
+			omp_set_num_threads(inner);
+			System::simulation& sim = ens.replica[r];
+			int end = (steps < 0) ? sim.total_steps : std::min(sim.total_steps, sim.state + steps);
+			while(sim.state < end)
+			{
+				md_step(sim);
+			}
+		}
+#ifdef MDGEN_NUMA
+		numa_pin_block(omp_get_thread_num(), 1);
+#endif
+	}
+
+	omp_set_max_active_levels(levels);
+}
+
+void ensemble_step(System::ensemble& ens)
+{
+	ensemble_advance(ens, 1);
+}
+
+void ensemble_run(System::ensemble& ens)
+{
+	ensemble_advance(ens, -1);
+	for (int r = 0; r < ens.size(); ++r)
+	{
+		ens.replica[r].output->flush();
+	}
+
+#ifdef MDGEN_TIMING
+	timer_report(std::cerr);
+	timer_write_json(std::string(TIMER_REPORT_FILE) + ".json");
+	timer_write_csv(std::string(TIMER_REPORT_FILE) + ".csv");
+#endif
+}
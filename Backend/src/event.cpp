@@ -0,0 +1,525 @@
+/** @file */
+#include <cmath>
+#include <algorithm>
+#include "event.h"
+#include "system.h"
+#include "interaction.h"
+#include "barostat.h"
+
+// Position, velocity and image counts of particle g (numbered as in hard_sphere_events)
+static inline double* event_position(System::simulation& sim, int g)
+{
+	int t = sim.events.type[g];
+	return sim.position[t][g - sim.events.offset[t]].data();
+}
+
+static inline double* event_velocity(System::simulation& sim, int g)
+{
+	int t = sim.events.type[g];
+	return sim.velocity[t][g - sim.events.offset[t]].data();
+}
+
+static inline int* event_image(System::simulation& sim, int g)
+{
+	int t = sim.events.type[g];
+	return sim.image[t][g - sim.events.offset[t]].data();
+}
+
+// Index of the cell of coordinates c
+static inline int cell_index(const System::hard_sphere_events& ev, const int* c)
+{
+	return (c[0]*ev.n_cells[1] + c[1])*ev.n_cells[2] + c[2];
+}
+
+static void cell_insert(System::hard_sphere_events& ev, int g)
+{
+	int c = cell_index(ev, &ev.cell[3*g]);
+	ev.cell_prev[g] = -1;
+	ev.cell_next[g] = ev.cell_head[c];
+	if(ev.cell_head[c] >= 0)
+	{
+		ev.cell_prev[ev.cell_head[c]] = g;
+	}
+	ev.cell_head[c] = g;
+}
+
+static void cell_remove(System::hard_sphere_events& ev, int g)
+{
+	int c = cell_index(ev, &ev.cell[3*g]);
+	if(ev.cell_prev[g] >= 0)
+	{
+		ev.cell_next[ev.cell_prev[g]] = ev.cell_next[g];
+	}
+	else
+	{
+		ev.cell_head[c] = ev.cell_next[g];
+	}
+	if(ev.cell_next[g] >= 0)
+	{
+		ev.cell_prev[ev.cell_next[g]] = ev.cell_prev[g];
+	}
+}
+
+// Brings particle g to the current time (free streaming)
+static inline void stream(System::simulation& sim, int g)
+{
+	System::hard_sphere_events& ev = sim.events;
+	double dt = ev.now - ev.last_update[g];
+	double* x = event_position(sim, g);
+	const double* v = event_velocity(sim, g);
+	for (int k = 0; k < sim.n_dimensions; ++k)
+	{
+		x[k] += dt*v[k];
+	}
+	ev.last_update[g] = ev.now;
+}
+
+// Distinct cells along one dimension next to (and including) cell c (periodic : wrapped, walls : within the box)
+static int neighbour_cells(const System::simulation& sim, int d, int c, int* out)
+{
+	const int n = sim.events.n_cells[d];
+	int count = 0;
+	for (int o = -1; o <= 1; ++o)
+	{
+		int cc = c + o;
+		if(sim.periodic_boundary == 1)
+		{
+			cc = (cc + n)%n;
+		}
+		else if(cc < 0 || cc >= n)
+		{
+			continue;
+		}
+		bool seen = false;
+		for (int i = 0; i < count; ++i)
+		{
+			seen = seen || (out[i] == cc);
+		}
+		if(!seen)
+		{
+			out[count++] = cc;
+		}
+	}
+	return count;
+}
+
+/*******************************************************************************
+ * \brief Predicts the earliest event of particle g from the current time and puts it in the calendar
+ *
+ * The candidates are the crossing of a face of its cell (or a wall) and the collisions with the particles of the neighbouring cells,
+ * whose positions are found at the current time without updating them.
+ ******************************************************************************/
+static void predict(System::simulation& sim, int g)
+{
+	System::hard_sphere_events& ev = sim.events;
+	const int dim = sim.n_dimensions;
+	const int nt = sim.n_types;
+	const bool periodic = (sim.periodic_boundary == 1);
+	const double* L = sim.box_size_limits.data();
+	const double* xg0 = event_position(sim, g);
+	const double* vg = event_velocity(sim, g);
+	const int tg = ev.type[g];
+	double xg[3] = {0, 0, 0};
+	for (int k = 0; k < dim; ++k)
+	{
+		xg[k] = xg0[k] + (ev.now - ev.last_update[g])*vg[k];
+	}
+
+	System::hard_sphere_event e;
+	e.time = INFINITY;
+	e.particle = g;
+	e.event_count = ev.event_count[g];
+	e.collision_count = 0;
+	e.partner = -1;
+
+	//Leaving the cell (or hitting a wall) along each dimension
+	for (int k = 0; k < dim; ++k)
+	{
+		double t = INFINITY;
+		if(vg[k] > 0)
+		{
+			t = ((ev.cell[3*g + k] + 1)*ev.cell_size[k] - xg[k])/vg[k];
+		}
+		else if(vg[k] < 0)
+		{
+			t = (ev.cell[3*g + k]*ev.cell_size[k] - xg[k])/vg[k];
+		}
+		t = std::max(t, 0.0);
+		if(t < e.time - ev.now)
+		{
+			e.time = ev.now + t;
+			e.partner = -(k + 1);
+		}
+	}
+
+	//Collisions with the particles of the neighbouring cells
+	int cells[3][3];
+	int count[3] = {1, 1, 1};
+	cells[1][0] = cells[2][0] = 0;
+	for (int k = 0; k < dim; ++k)
+	{
+		count[k] = neighbour_cells(sim, k, ev.cell[3*g + k], cells[k]);
+	}
+	for (int a = 0; a < count[0]; ++a)
+	{
+		for (int b = 0; b < count[1]; ++b)
+		{
+			for (int c = 0; c < count[2]; ++c)
+			{
+				int cc[3] = {cells[0][a], cells[1][b], cells[2][c]};
+				for (int p = ev.cell_head[cell_index(ev, cc)]; p >= 0; p = ev.cell_next[p])
+				{
+					double sigma = ev.diameter[tg*nt + ev.type[p]];
+					if(p == g || sigma <= 0)
+					{
+						continue;
+					}
+					const double* xp = event_position(sim, p);
+					const double* vp = event_velocity(sim, p);
+					double dtp = ev.now - ev.last_update[p];
+					double r2 = 0, v2 = 0, rv = 0;
+					for (int k = 0; k < dim; ++k)
+					{
+						double r = xg[k] - xp[k] - dtp*vp[k];
+						if(periodic)
+						{
+							r -= L[k]*std::round(r/L[k]);
+						}
+						double v = vg[k] - vp[k];
+						r2 += r*r;
+						v2 += v*v;
+						rv += r*v;
+					}
+					//Approaching, and their paths come within sigma
+					if(rv >= 0)
+					{
+						continue;
+					}
+					double disc = rv*rv - v2*(r2 - sigma*sigma);
+					if(disc < 0)
+					{
+						continue;
+					}
+					double t = std::max((r2 - sigma*sigma)/(-rv + std::sqrt(disc)), 0.0);
+					if(t < e.time - ev.now)
+					{
+						e.time = ev.now + t;
+						e.partner = p;
+						e.collision_count = ev.collision_count[p];
+					}
+				}
+			}
+		}
+	}
+
+	if(e.time < INFINITY)
+	{
+		ev.calendar.push(e);
+	}
+}
+
+// Particle g leaves its cell along dimension k (or, at a rigid wall, is reflected)
+static void cross(System::simulation& sim, int g, int k)
+{
+	System::hard_sphere_events& ev = sim.events;
+	double* x = event_position(sim, g);
+	double* v = event_velocity(sim, g);
+	const int n = ev.n_cells[k];
+	const double L = sim.box_size_limits[k];
+	int c = ev.cell[3*g + k];
+	int next = c + ((v[k] > 0) ? 1 : -1);
+
+	if(sim.periodic_boundary != 1 && (next < 0 || next >= n))
+	{
+		x[k] = (next < 0) ? 0 : L;
+		v[k] = -v[k];
+		ev.collision_count[g]++;
+		return;
+	}
+
+	cell_remove(ev, g);
+	if(next < 0 || next >= n)
+	{
+		//Periodic image across the face of the box
+		int shift = (next < 0) ? -1 : 1;
+		event_image(sim, g)[k] += shift;
+		next -= shift*n;
+	}
+	ev.cell[3*g + k] = next;
+	//On the face just crossed, so that the position is always in its cell
+	x[k] = (v[k] > 0) ? next*ev.cell_size[k] : (next + 1)*ev.cell_size[k];
+	cell_insert(ev, g);
+}
+
+// Elastic collision of particles g and p (both at the current time)
+static void collide(System::simulation& sim, int g, int p)
+{
+	System::hard_sphere_events& ev = sim.events;
+	const int dim = sim.n_dimensions;
+	const double* L = sim.box_size_limits.data();
+	double* xg = event_position(sim, g);
+	double* xp = event_position(sim, p);
+	double* vg = event_velocity(sim, g);
+	double* vp = event_velocity(sim, p);
+	double mg = sim.mass[ev.type[g]], mp = sim.mass[ev.type[p]];
+	double r[3] = {0, 0, 0};
+	double r2 = 0, rv = 0;
+	for (int k = 0; k < dim; ++k)
+	{
+		r[k] = xg[k] - xp[k];
+		if(sim.periodic_boundary == 1)
+		{
+			r[k] -= L[k]*std::round(r[k]/L[k]);
+		}
+		r2 += r[k]*r[k];
+		rv += r[k]*(vg[k] - vp[k]);
+	}
+	//Impulse on g along r : J = -2 mu (r.v) r/r^2
+	double j = -2*mg*mp/(mg + mp)*rv/r2;
+	for (int k = 0; k < dim; ++k)
+	{
+		vg[k] += j*r[k]/mg;
+		vp[k] -= j*r[k]/mp;
+	}
+	ev.virial += j*r2;
+	ev.collisions++;
+	ev.collision_count[g]++;
+	ev.collision_count[p]++;
+}
+
+void initialize_event_driven(System::simulation& sim)
+{
+	System::hard_sphere_events& ev = sim.events;
+	const int nt = sim.n_types;
+	const int dim = sim.n_dimensions;
+	const bool periodic = (sim.periodic_boundary == 1);
+	bool allowed = dim <= 3 && sim.respa_steps == 1 && !sim.adaptive.active && sim.constraints.n_groups() == 0 && sim.rigid.n_bodies() == 0 && !sim.pme.active;
+	allowed = allowed && (sim.barostat == NULL || sim.barostat == no_barostat);
+#ifdef MDGEN_MPI
+	allowed = false;
+#endif
+
+	//Contact distances, and cells at least as large as the largest one
+	double sigma_max = 0;
+	try{
+		ev.diameter.assign(nt*nt, 0);
+		ev.offset.assign(nt + 1, 0);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	for (int i = 0; i < nt; ++i)
+	{
+		for (int j = 0; j < nt; ++j)
+		{
+			if(sim.interaction[i][j] == hard_sphere)
+			{
+				ev.diameter[i*nt + j] = sim.interaction_const[i][j][1];
+				sigma_max = std::max(sigma_max, sim.interaction_const[i][j][1]);
+			}
+			else if(sim.interaction[i][j] != free_particles)
+			{
+				allowed = false;
+			}
+		}
+		ev.offset[i+1] = ev.offset[i] + sim.n_particles[i];
+	}
+	const int n = ev.offset[nt];
+	double half_box = 0.5*(*std::min_element(sim.box_size_limits.begin(), sim.box_size_limits.end()));
+	if(!allowed || (periodic && sigma_max >= half_box))
+	{
+		std::cerr<<"Error 0016"<<std::endl;
+		exit(16);
+	}
+
+	//Cells no smaller than sigma_max, but not many more than the particles
+	int max_cells = std::max(1, (int)std::ceil(2*std::pow((double)n, 1.0/dim)));
+	int total = 1;
+	for (int k = 0; k < 3; ++k)
+	{
+		ev.n_cells[k] = 1;
+		if(k < dim)
+		{
+			double L = sim.box_size_limits[k];
+			ev.n_cells[k] = (sigma_max > 0) ? std::max(1, std::min(max_cells, (int)(L/sigma_max))) : 1;
+			ev.cell_size[k] = L/ev.n_cells[k];
+		}
+		total *= ev.n_cells[k];
+	}
+
+	try{
+		ev.type.resize(n);
+		ev.last_update.assign(n, 0);
+		ev.event_count.assign(n, 0);
+		ev.collision_count.assign(n, 0);
+		ev.cell.assign(3*n, 0);
+		ev.cell_head.assign(total, -1);
+		ev.cell_next.assign(n, -1);
+		ev.cell_prev.assign(n, -1);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	ev.calendar = decltype(ev.calendar)();
+	ev.now = 0;
+	ev.virial = 0;
+	ev.collisions = 0;
+
+	for (int t = 0; t < nt; ++t)
+	{
+		for (int g = ev.offset[t]; g < ev.offset[t+1]; ++g)
+		{
+			ev.type[g] = t;
+			const double* x = event_position(sim, g);
+			for (int k = 0; k < dim; ++k)
+			{
+				ev.cell[3*g + k] = std::min(ev.n_cells[k] - 1, std::max(0, (int)std::floor(x[k]/ev.cell_size[k])));
+			}
+			cell_insert(ev, g);
+		}
+	}
+
+	//No two spheres may overlap
+	for (int g = 0; g < n; ++g)
+	{
+		int cells[3][3];
+		int count[3] = {1, 1, 1};
+		cells[1][0] = cells[2][0] = 0;
+		for (int k = 0; k < dim; ++k)
+		{
+			count[k] = neighbour_cells(sim, k, ev.cell[3*g + k], cells[k]);
+		}
+		const double* xg = event_position(sim, g);
+		for (int a = 0; a < count[0]; ++a)
+		{
+			for (int b = 0; b < count[1]; ++b)
+			{
+				for (int c = 0; c < count[2]; ++c)
+				{
+					int cc[3] = {cells[0][a], cells[1][b], cells[2][c]};
+					for (int p = ev.cell_head[cell_index(ev, cc)]; p >= 0; p = ev.cell_next[p])
+					{
+						double sigma = ev.diameter[ev.type[g]*nt + ev.type[p]];
+						if(p == g || sigma <= 0)
+						{
+							continue;
+						}
+						const double* xp = event_position(sim, p);
+						double r2 = 0;
+						for (int k = 0; k < dim; ++k)
+						{
+							double r = xg[k] - xp[k];
+							if(periodic)
+							{
+								r -= sim.box_size_limits[k]*std::round(r/sim.box_size_limits[k]);
+							}
+							r2 += r*r;
+						}
+						if(r2 < sigma*sigma*(1 - 1e-10))
+						{
+							std::cerr<<"Error 0016"<<std::endl;
+							exit(16);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//No forces : the accelerations stay 0 and there is no potential energy
+	for (int t = 0; t < nt; ++t)
+	{
+		for (int j = 0; j < sim.n_particles[t]; ++j)
+		{
+			std::fill(sim.acceleration[t][j].begin(), sim.acceleration[t][j].end(), 0.0);
+		}
+	}
+	sim.energy_potential = 0;
+	ev.active = 1;
+	event_predict_all(sim);
+}
+
+void event_predict_all(System::simulation& sim)
+{
+	System::hard_sphere_events& ev = sim.events;
+	ev.calendar = decltype(ev.calendar)();
+	for (int g = 0; g < ev.n_total(); ++g)
+	{
+		ev.event_count[g]++;
+		ev.collision_count[g]++;
+	}
+	for (int g = 0; g < ev.n_total(); ++g)
+	{
+		predict(sim, g);
+	}
+}
+
+void event_advance(System::simulation& sim, double dt)
+{
+	System::hard_sphere_events& ev = sim.events;
+	const double end = ev.now + dt;
+
+	while(!ev.calendar.empty() && ev.calendar.top().time <= end)
+	{
+		System::hard_sphere_event e = ev.calendar.top();
+		ev.calendar.pop();
+		int g = e.particle;
+
+		//Stale : g has had another event since
+		if(e.event_count != ev.event_count[g])
+		{
+			continue;
+		}
+		ev.now = e.time;
+		ev.event_count[g]++;
+
+		if(e.partner >= 0 && e.collision_count != ev.collision_count[e.partner])
+		{
+			//The partner changed course : this was the live event of g, so g needs a new one
+			predict(sim, g);
+			continue;
+		}
+
+		stream(sim, g);
+		if(e.partner < 0)
+		{
+			cross(sim, g, -e.partner - 1);
+			predict(sim, g);
+		}
+		else
+		{
+			int p = e.partner;
+			stream(sim, p);
+			collide(sim, g, p);
+			ev.event_count[p]++;
+			predict(sim, g);
+			predict(sim, p);
+		}
+	}
+
+	//Every particle is brought to the end of the interval (the positions and velocities are then those of sim.time + dt)
+	ev.now = end;
+	const int dim = sim.n_dimensions;
+	#pragma omp parallel for schedule(static)
+	for (int g = 0; g < ev.n_total(); ++g)
+	{
+		double* x = event_position(sim, g);
+		const double* v = event_velocity(sim, g);
+		double d = end - ev.last_update[g];
+		for (int k = 0; k < dim; ++k)
+		{
+			x[k] += d*v[k];
+		}
+		ev.last_update[g] = end;
+	}
+}
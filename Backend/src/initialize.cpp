@@ -24,15 +24,26 @@ void init_sim(System::simulation& sim)
             for(int k = 0; k < sim.n_dimensions;++k)
             {
                 trng::yarn5s R;
+                if(sim.seed != 0)
+                {
+                    R.seed(sim.seed);
+                }
 
-                int size = omp_get_num_threads();
-                int rank = omp_get_thread_num();
-                R.split(size,rank);
+                //One stream per particle and dimension, so that the draws do not depend on the threads
+                R.split(sim.n_types,i);
+                R.split(sim.n_particles[i]*sim.n_dimensions,j*sim.n_dimensions + k);
 
                 trng::uniform01_dist<> unif;
 
                 sim.position[i][j][k] = unif(R)*sim.box_size_limits[k];
                 sim.velocity[i][j][k] = (unif(R) - 0.5);
+            }
+        }
+        //Summed in order, after the draws
+        for(int j = 0; j < sim.n_particles[i];++j)
+        {
+            for(int k = 0; k < sim.n_dimensions;++k)
+            {
                 velsum[i][k]+=sim.velocity[i][j][k];
                 vel2sum[i]+=pow(sim.velocity[i][j][k],2);
             }
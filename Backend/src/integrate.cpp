@@ -1,56 +1,190 @@
 /** @file */ 
 #include "integrate.h"
+#include "reduce.h"
 
 /*******************************************************************************
- * This function integrates the equation of motion for periodic boundary conditions
- * This function integrates using the Leapfrog Algorithm 
+ * Second half kick of the velocities, shared by all the integrators
+ * If sim.energy_due is 1, the kinetic energies, temperatures and total momentum are
+ * reduced in the same pass as the kick. With bond constraints or rigid bodies, RATTLE and the kick of the bodies
+ * must come between the kick and the reductions, so the reductions take a pass of their own (and add the constraint virial).
  *
  * @param sim Simulation being integrated over
+ * @param dt Timestep (the velocities are kicked by dt/2 times sim.acceleration)
  ******************************************************************************/
-void integrate_verdet_periodic(System::simulation& sim){
-	double dt = sim.timestep;
+static void half_kick_reduce(System::simulation& sim, double dt){
+	TIME_PHASE(PHASE_INTEGRATE_SECOND);
+	double hdt = 0.5*dt;
+	const int dim = sim.n_dimensions;
+	const bool constrained = sim.constraints.n_groups() > 0 || sim.rigid.n_bodies() > 0;
+
+	if(!sim.energy_due || constrained)
+	{
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			#pragma omp parallel for schedule(static)
+			for (int j = 0; j < sim.n_particles[i]; ++j)
+			{
+				double* v = sim.velocity[i][j].data();
+				const double* a = sim.acceleration[i][j].data();
+				#pragma omp simd
+				for (int k = 0; k < dim; ++k)
+				{
+					v[k] += hdt*a[k];
+				}
+			}
+		}
+		if(sim.constraints.n_groups() > 0)
+		{
+			constrain_velocities(sim, dt);
+		}
+		if(sim.rigid.n_bodies() > 0)
+		{
+			rigid_kick(sim, dt);
+		}
+		if(!sim.energy_due)
+		{
+			return;
+		}
+		//Already kicked : the pass below only reduces
+		hdt = 0;
+	}
+
 	sim.energy_total = sim.energy_potential;
-	//Starting first part of thermostat
-	#pragma omp target teams distribute parallel for
+	for (int k = 0; k < dim; ++k)
+	{
+		sim.momentum[k] = 0;
+	}
 	for (int i = 0; i < sim.n_types; ++i)
 	{
-		#pragma omp parallel for
-		for (int j = 0; j < sim.n_particles[i]; ++j)
+		//sums[0] : sum of v^2, sums[1 + k] : sum of v along k
+		double sums[dim + 1];
+		reduce_sum(sim.n_particles[i], dim + 1, sums, [&](long j, double* s)
 		{
-			#pragma omp parallel for
-			for (int k = 0; k < sim.n_dimensions; ++k)
+			double* v = sim.velocity[i][j].data();
+			const double* a = sim.acceleration[i][j].data();
+			for (int k = 0; k < dim; ++k)
 			{
-				sim.position[i][j][k] += dt*sim.velocity[i][j][k] + 0.5*dt*dt*sim.acceleration[i][j][k];
-				sim.position[i][j][k] -= sim.box_size_limits[k]*std::floor(sim.position[i][j][k]/sim.box_size_limits[k]);
-				sim.velocity[i][j][k] += dt*sim.acceleration[i][j][k]/2;
+				v[k] += hdt*a[k];
+				s[0] += v[k]*v[k];
+				s[1 + k] += v[k];
 			}
+		});
+		const double ke = sums[0];
+		const double* mom = sums + 1;
+
+		sim.energy_kinetic[i] = ke*sim.mass[i];
+		const double dof = sim.n_particles[i]*dim - sim.dof_removed[i];
+		sim.temperature[i] = (dof > 0) ? sim.energy_kinetic[i]/(dof*BOLTZ_SI) : 0;
+		sim.energy_total += sim.energy_kinetic[i];
+		for (int k = 0; k < dim; ++k)
+		{
+			sim.momentum[k] += sim.mass[i]*mom[k];
 		}
 	}
-	//Done with first part of thermostat
-	//Calling interaction
-	sim.energy_potential = 0;
-	interact(sim);
-	//Done
-	//Starting second part of thermostat
-	#pragma omp target teams distribute parallel for
+	if(sim.constraints.n_groups() > 0)
+	{
+		sim.virial += sim.constraints.virial;
+	}
+	if(sim.rigid.n_bodies() > 0)
+	{
+		sim.virial += sim.rigid.virial;
+	}
+#ifdef MDGEN_MPI
+	//Sums over all the ranks
+	domain_reduce(sim);
+#endif
+}
+
+/*******************************************************************************
+ * First half of a Leapfrog step : kick by dt/2 times sim.acceleration and drift by dt, in one pass
+ * If periodic is true, the positions are wrapped back into the box (the wraps are counted in sim.image).
+ * Otherwise they are reflected from the walls by folding them into [0,2L) (the velocity changes sign in the half beyond L).
+ * With bond constraints, the constrained atoms are then moved back onto them (SHAKE or SETTLE).
+ * The rigid bodies are kicked, moved and rotated as wholes, and their sites placed again.
+ *
+ * @param sim Simulation being integrated over
+ * @param dt Timestep
+ ******************************************************************************/
+template <bool periodic>
+static void kick_drift(System::simulation& sim, double dt){
+	TIME_PHASE(PHASE_INTEGRATE_FIRST);
+	const int dim = sim.n_dimensions;
+	const double* box = sim.box_size_limits.data();
+	double inv_box[dim];
+	for (int k = 0; k < dim; ++k)
+	{
+		inv_box[k] = periodic ? 1/box[k] : 0.5/box[k];
+	}
+	const bool constrained = sim.constraints.n_groups() > 0;
+	if(constrained)
+	{
+		constraint_save(sim);
+	}
+
 	for (int i = 0; i < sim.n_types; ++i)
 	{
-		sim.energy_kinetic[i] = 0;
-		#pragma omp parallel for
+		#pragma omp parallel for schedule(static)
 		for (int j = 0; j < sim.n_particles[i]; ++j)
 		{
-			#pragma omp parallel for
-			for (int k = 0; k < sim.n_dimensions; ++k)
+			double* x = sim.position[i][j].data();
+			double* v = sim.velocity[i][j].data();
+			const double* a = sim.acceleration[i][j].data();
+			int* img = sim.image[i][j].data();
+			#pragma omp simd
+			for (int k = 0; k < dim; ++k)
 			{
-				sim.velocity[i][j][k] += dt*sim.acceleration[i][j][k]/2;
-				#pragma omp atomic
-				sim.energy_kinetic[i] += sim.velocity[i][j][k]*sim.velocity[i][j][k];
+				v[k] += 0.5*dt*a[k];
+				x[k] += dt*v[k];
+				if(periodic)
+				{
+					double shift = std::floor(x[k]*inv_box[k]);
+					x[k] -= box[k]*shift;
+					img[k] += (int)shift;
+				}
+				else
+				{
+					double y = x[k] - 2*box[k]*std::floor(x[k]*inv_box[k]);
+					x[k] = box[k] - std::abs(box[k] - y);
+					v[k] *= std::copysign(1.0, box[k] - y);
+				}
 			}
 		}
-		sim.energy_kinetic[i] *= sim.mass[i];
-		sim.temperature[i] = sim.energy_kinetic[i]/(sim.n_particles[i]*BOLTZ_SI*sim.n_dimensions);
-		sim.energy_total += sim.energy_kinetic[i];
 	}
+
+	if(constrained)
+	{
+		constrain_positions(sim, dt);
+	}
+	if(sim.rigid.n_bodies() > 0)
+	{
+		rigid_kick_drift(sim, dt);
+	}
+}
+
+/*******************************************************************************
+ * This function integrates the equation of motion for periodic boundary conditions
+ * This function integrates using the Leapfrog Algorithm 
+ *
+ * @param sim Simulation being integrated over
+ ******************************************************************************/
+void integrate_verdet_periodic(System::simulation& sim){
+	const double dt = sim.timestep;
+
+	//First half : kick, drift and wrap back into the box in one pass
+	kick_drift<true>(sim, dt);
+
+#ifdef MDGEN_MPI
+	//Particles which left the subdomain go to their new rank, and the ghosts are rebuilt
+	domain_migrate(sim);
+	domain_exchange_ghosts(sim);
+#endif
+
+	//Calling interaction
+	interact(sim);
+
+	//Second half : kick (and reductions if needed)
+	half_kick_reduce(sim, dt);
+
 	sim.time+= dt;
 	sim.state++;
 }
@@ -62,38 +196,235 @@ void integrate_verdet_periodic(System::simulation& sim){
  * @param sim Simulation being integrated over
  ******************************************************************************/
 void integrate_verdet_box(System::simulation& sim){
-	double dt = sim.timestep;
-	sim.energy_total = sim.energy_potential;
+	const double dt = sim.timestep;
+
+	//First half : kick, drift and reflection from the walls in one pass
+	kick_drift<false>(sim, dt);
+
+#ifdef MDGEN_MPI
+	//Particles which left the subdomain go to their new rank, and the ghosts are rebuilt
+	domain_migrate(sim);
+	domain_exchange_ghosts(sim);
+#endif
+
+	//Calling interaction
+	interact(sim);
+
+	//Second half : kick (and reductions if needed)
+	half_kick_reduce(sim, dt);
+
+	sim.time+=dt;
+	sim.state++;
+}
+
+/*******************************************************************************
+ * Kicks the velocities by dt times the accelerations acc
+ *
+ * @param sim Simulation being integrated over
+ * @param acc Accelerations (sim.acceleration or sim.acceleration_outer)
+ * @param dt Length of the kick
+ ******************************************************************************/
+static void kick(System::simulation& sim, std::vector<System::particle_array>& acc, double dt){
+	const int dim = sim.n_dimensions;
 	for (int i = 0; i < sim.n_types; ++i)
 	{
-		sim.energy_kinetic[i] = 0;
-		#pragma omp target teams distribute parallel for
+		#pragma omp parallel for schedule(static)
 		for (int j = 0; j < sim.n_particles[i]; ++j)
 		{
-			#pragma omp parallel for
-			for (int k = 0; k < sim.n_dimensions; ++k)
+			double* v = sim.velocity[i][j].data();
+			const double* a = acc[i][j].data();
+			#pragma omp simd
+			for (int k = 0; k < dim; ++k)
 			{
-				sim.position[i][j][k] += dt*sim.velocity[i][j][k] + 0.5*dt*dt*sim.acceleration[i][j][k];
-				sim.velocity[i][j][k] += dt*sim.acceleration[i][j][k];
-				if(sim.position[i][j][k]<0 || sim.position[i][j][k] > sim.box_size_limits[k]){
-					int num_bounce = (int)(sim.position[i][j][k]/sim.box_size_limits[k]);
-					double l = std::abs(sim.position[i][j][k] - sim.box_size_limits[k]*num_bounce);
-					//Getting rid of the signs
-					num_bounce *= ((num_bounce < 0)*-1 + (num_bounce>0));
-					//Done
-					//Implementing reflection
-					sim.position[i][j][k] = (num_bounce%2 == 0)*l + (num_bounce%2 == 1)*(sim.box_size_limits[k]-l);
-					sim.velocity[i][j][k] *= ((num_bounce%2==0) + (num_bounce%2 == 1)*(-1));
-					//Done
-				}
-				#pragma omp atomic
-				sim.energy_kinetic[i] += sim.velocity[i][j][k]*sim.velocity[i][j][k];
+				v[k] += dt*a[k];
 			}
 		}
-		sim.energy_kinetic[i] *= sim.mass[i];
-		sim.temperature[i] = sim.energy_kinetic[i]/(sim.n_dimensions*sim.n_particles[i]*BOLTZ_SI);
-		sim.energy_total += sim.energy_kinetic[i];
 	}
-	sim.time+=dt;
+}
+
+/*******************************************************************************
+ * Computes one level of the interactions : RESPA_INNER into sim.acceleration, RESPA_OUTER into sim.acceleration_outer
+ * The energy and virial of the outer level are added to those of the inner level (computed just before, at the same positions).
+ *
+ * @param sim Simulation being integrated over
+ * @param level RESPA_INNER or RESPA_OUTER
+ ******************************************************************************/
+static void interact_level(System::simulation& sim, int level){
+	sim.respa_part = level;
+	if(level == RESPA_OUTER)
+	{
+		//The kernels write to sim.acceleration
+		double epot = sim.energy_potential;
+		double vir = sim.virial;
+		sim.acceleration.swap(sim.acceleration_outer);
+		interact(sim);
+		sim.acceleration.swap(sim.acceleration_outer);
+		sim.energy_potential += epot;
+		sim.virial += vir;
+	}
+	else
+	{
+		interact(sim);
+	}
+	sim.respa_part = RESPA_ALL;
+}
+
+void initialize_respa(System::simulation& sim, int inner_steps){
+	if(inner_steps < 1 || sim.rigid.n_bodies() > 0 || sim.pme.active || sim.adaptive.active)
+	{
+		std::cerr<<"Error 0011"<<std::endl;
+		exit(11);
+	}
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = 0; j < sim.n_types; ++j)
+		{
+			if(sim.interaction_level[i][j] != RESPA_SPLIT)
+			{
+				continue;
+			}
+			const std::vector<double>& c = sim.interaction_const[i][j];
+			bool lj = (sim.interaction[i][j] == lj_periodic || sim.interaction[i][j] == lj_box);
+			//0 < lambda <= r_s <= r_cut
+			if(!lj || c[8] <= 0 || c[8] > c[7] || c[7] > c[2])
+			{
+				std::cerr<<"Error 0011"<<std::endl;
+				exit(11);
+			}
+		}
+	}
+
+	try{
+		System::arena_allocator<double> alloc(sim.particle_arena);
+		sim.acceleration_outer.clear();
+		sim.acceleration_outer.resize(sim.n_types, System::particle_array(alloc));
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			sim.acceleration_outer[i].resize(sim.position[i].size(), System::particle_row(sim.n_dimensions, 0, alloc));
+		}
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl; 
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	sim.respa_steps = inner_steps;
+	sim.respa_list_valid = 0;
+
+	//Accelerations of both levels at the starting positions
+	interact_level(sim, RESPA_INNER);
+	interact_level(sim, RESPA_OUTER);
+}
+
+void integrate_respa(System::simulation& sim){
+	const double dt = sim.timestep;
+	const int n = sim.respa_steps;
+	const double dt_inner = dt/n;
+	const int energy = sim.energy_due;
+
+	//Half kick by the outer accelerations
+	{
+		TIME_PHASE(PHASE_INTEGRATE_FIRST);
+		kick(sim, sim.acceleration_outer, 0.5*dt);
+	}
+
+	//Leapfrog steps of dt/n with the inner accelerations
+	for (int m = 0; m < n; ++m)
+	{
+		if(sim.periodic_boundary == 1)
+		{
+			kick_drift<true>(sim, dt_inner);
+		}
+		else
+		{
+			kick_drift<false>(sim, dt_inner);
+		}
+
+#ifdef MDGEN_MPI
+		domain_migrate(sim);
+		domain_exchange_ghosts(sim);
+#endif
+
+		//The energies are only needed at the end of the timestep
+		sim.energy_due = (m == n-1) ? energy : 0;
+		interact_level(sim, RESPA_INNER);
+
+		TIME_PHASE(PHASE_INTEGRATE_SECOND);
+		kick(sim, sim.acceleration, 0.5*dt_inner);
+		if(sim.constraints.n_groups() > 0)
+		{
+			constrain_velocities(sim, dt_inner);
+		}
+	}
+
+	//Outer accelerations at the end of the timestep, then the outer half kick (and reductions if needed)
+	interact_level(sim, RESPA_OUTER);
+	sim.acceleration.swap(sim.acceleration_outer);
+	half_kick_reduce(sim, dt);
+	sim.acceleration.swap(sim.acceleration_outer);
+
+	sim.time+= dt;
+	sim.state++;
+}
+
+void integrate_adaptive(System::simulation& sim){
+	const int energy = sim.energy_due;
+	adaptive_choose(sim);
+	const int n = sim.adaptive.inner_steps;
+	const double dt = sim.timestep/n;
+
+	for (int m = 0; m < n; ++m)
+	{
+		if(sim.periodic_boundary == 1)
+		{
+			kick_drift<true>(sim, dt);
+		}
+		else
+		{
+			kick_drift<false>(sim, dt);
+		}
+
+#ifdef MDGEN_MPI
+		domain_migrate(sim);
+		domain_exchange_ghosts(sim);
+#endif
+
+		//The energies are only needed at the end of the timestep
+		sim.energy_due = (m == n-1) ? energy : 0;
+		interact(sim);
+		half_kick_reduce(sim, dt);
+	}
+	sim.adaptive.total_inner_steps += n;
+
+	//The clock advances by the timestep, whatever the number of inner steps
+	sim.time+= sim.timestep;
+	sim.state++;
+
+	if(energy)
+	{
+		adaptive_check_energy(sim);
+	}
+}
+
+void integrate_event_driven(System::simulation& sim){
+	const double dt = sim.timestep;
+	{
+		TIME_PHASE(PHASE_INTEGRATE_FIRST);
+		sim.events.virial = 0;
+		event_advance(sim, dt);
+	}
+
+	if(sim.energy_due)
+	{
+		//The accelerations are 0 : this is only the reduction pass
+		sim.energy_potential = 0;
+		sim.virial = sim.events.virial/dt;
+		half_kick_reduce(sim, 0);
+	}
+
+	sim.time+= dt;
 	sim.state++;
-}
\ No newline at end of file
+}
@@ -6,6 +6,10 @@
 #include <algorithm>
 #include "universal_functions.h"
 #include "interaction.h"
+#include "timer.h"
+#include "pme.h"
+#include "reduce.h"
+#include "balance.h"
 
 /*******************************************************************************
  * \brief Initializes the constant arrays for interactions for speed
@@ -35,14 +39,22 @@ void initialize_interactions(System::simulation& sim)
 				interaction_const[i][j][3] = Truncated Potential (etrunc)
 				interaction_const[i][j][4] = \sigma^6
 				interaction_const[i][j][5] = Tail Energy (assuming constant distribution outside cutoff radius)
+				interaction_const[i][j][6] = Tail Pressure times volume squared
 				*/
 				sim.interaction_const[i][j][4] = std::pow(sim.interaction_const[i][j][1],6);
 				double temp = sim.interaction_const[i][j][4]/std::pow(sim.interaction_const[i][j][2],6); //temp = (sigma/r_cut)^6
 				sim.interaction_const[i][j][3] = 4*sim.interaction_const[i][j][0]*temp*(temp-1);
 				sim.interaction_const[i][j][5] = 2*sim.interaction_const[i][j][0]*(sim.n_particles[i]*sim.n_particles[j]/vol)*surface_unit_sphere(dim);
 				sim.interaction_const[i][j][5] *= (sim.interaction_const[i][j][4]*sim.interaction_const[i][j][4]*std::pow(sim.interaction_const[i][j][2],dim-12)/(dim-12) - sim.interaction_const[i][j][4]*std::pow(sim.interaction_const[i][j][2],dim-6)/(dim-6));
+				//Tail pressure times V^2 : pairs of different types are counted both ways
+				sim.interaction_const[i][j][6] = ((i == j) ? 12 : 24)*sim.interaction_const[i][j][0]*((double)sim.n_particles[i]*sim.n_particles[j]/dim)*surface_unit_sphere(dim);
+				sim.interaction_const[i][j][6] *= (2*sim.interaction_const[i][j][4]*sim.interaction_const[i][j][4]*std::pow(sim.interaction_const[i][j][2],dim-12)/(12-dim) - sim.interaction_const[i][j][4]*std::pow(sim.interaction_const[i][j][2],dim-6)/(6-dim));
 
 			}
+			else if(sim.interaction[i][j] == hard_sphere)
+			{
+				//interaction_const[i][j][1] = contact distance \sigma, used by the events (see initialize_event_driven())
+			}
 			else
 			{
 				std::cerr<<"Error 0003"<<std::endl;
@@ -52,6 +64,33 @@ void initialize_interactions(System::simulation& sim)
 	}
 }
 
+/*******************************************************************************
+ * \brief Updates the constant arrays for interactions after the volume of the box changes
+ * 
+ * Only the constants depending on the volume are changed (the tail energy scales as 1/V, the tail pressure is stored times V^2)
+ *
+ * @param sim Simulation being used
+ * @param vol_old Volume before the change
+ * @param vol_new Volume after the change
+ ******************************************************************************/
+void update_interactions_volume(System::simulation& sim, double vol_old, double vol_new)
+{
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = 0; j < sim.n_types; ++j)
+		{
+			if(sim.interaction[i][j] == lj_periodic || sim.interaction[i][j] == lj_box)
+			{
+				sim.interaction_const[i][j][5] *= vol_old/vol_new;
+			}
+		}
+	}
+	if(sim.pme.active)
+	{
+		pme_update_box(sim);
+	}
+}
+
 /*******************************************************************************
  * \brief Returns the distance between two particles for periodic boundary conditions
  * 
@@ -69,7 +108,7 @@ double distance_periodic(System::simulation& sim, int type1, int n1, int type2,
 	double dist = 0;
 	for (int i = 0; i < sim.n_dimensions; ++i)
 	{
-		double temp = abs(sim.position[type1][n1][i] - sim.position[type2][n2][i]);
+		double temp = std::abs(sim.position[type1][n1][i] - sim.position[type2][n2][i]);
 		double temp2 = std::min(sim.box_size_limits[i] - temp,temp);
 		dist+= temp2*temp2;
 	}
@@ -84,13 +123,129 @@ double distance_periodic(System::simulation& sim, int type1, int n1, int type2,
  *
  * @param sim Simulation being used
  ******************************************************************************/
+// Returns true if the interaction between type1 and type2 has a part at the level being computed (sim.respa_part)
+static inline bool respa_computed(System::simulation& sim, int type1, int type2)
+{
+	int level = sim.interaction_level[type1][type2];
+	return sim.respa_part == RESPA_ALL || level == RESPA_SPLIT || level == sim.respa_part;
+}
+
+// Share S(r) of a split interaction at the inner level : 1 below r_in = r_s - lambda, 0 above r_s and 1 + R^2(2R - 3) in between (R = (r - r_in)/lambda)
+static inline double respa_switch(double r2, double rin, double rin2, double rs2, double inv_lambda)
+{
+	if(r2 <= rin2)
+	{
+		return 1;
+	}
+	if(r2 >= rs2)
+	{
+		return 0;
+	}
+	double R = (std::sqrt(r2) - rin)*inv_lambda;
+	return 1 + R*R*(2*R - 3);
+}
+
+static void respa_update_list(System::simulation& sim);
+
+void add_exclusion(System::simulation& sim, int type1, int n1, int type2, int n2)
+{
+	try{
+		sim.exclusion_pair.insert(sim.exclusion_pair.end(), {type1, n1, type2, n2});
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+}
+
+void build_exclusions(System::simulation& sim)
+{
+	const int n_pairs = sim.exclusion_pair.size()/4;
+	std::vector<int>& offset = sim.exclusion_offset;
+	offset.assign(sim.n_types + 1, 0);
+	for (int t = 0; t < sim.n_types; ++t)
+	{
+		offset[t+1] = offset[t] + sim.n_particles[t];
+	}
+	//Both partners of each pair, sorted and without the pairs given twice
+	std::vector<std::pair<int,int>> partner;
+	try{
+		partner.reserve(2*n_pairs);
+		for (int e = 0; e < n_pairs; ++e)
+		{
+			const int* p = &sim.exclusion_pair[4*e];
+			int g1 = offset[p[0]] + p[1], g2 = offset[p[2]] + p[3];
+			if(g1 != g2)
+			{
+				partner.push_back(std::make_pair(g1, g2));
+				partner.push_back(std::make_pair(g2, g1));
+			}
+		}
+		std::sort(partner.begin(), partner.end());
+		partner.erase(std::unique(partner.begin(), partner.end()), partner.end());
+		sim.exclusion_start.assign(partner.empty() ? 0 : offset[sim.n_types] + 1, 0);
+		sim.exclusion.resize(partner.size());
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	for (size_t e = 0; e < partner.size(); ++e)
+	{
+		sim.exclusion_start[partner[e].first + 1]++;
+		sim.exclusion[e] = partner[e].second;
+	}
+	for (size_t g = 1; g < sim.exclusion_start.size(); ++g)
+	{
+		sim.exclusion_start[g] += sim.exclusion_start[g-1];
+	}
+	//The inner r-RESPA pairs are listed without the excluded ones
+	sim.respa_list_valid = 0;
+}
+
+// Returns true if the pair of particle i of type1 and particle j of type2 is excluded (see build_exclusions())
+static inline bool pair_excluded(const System::simulation& sim, int type1, int i, int type2, int j)
+{
+	if(sim.exclusion_start.empty())
+	{
+		return false;
+	}
+	const int g1 = sim.exclusion_offset[type1] + i;
+	const int g2 = sim.exclusion_offset[type2] + j;
+	for (int e = sim.exclusion_start[g1]; e < sim.exclusion_start[g1+1]; ++e)
+	{
+		if(sim.exclusion[e] == g2)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Adds a to the acceleration of particle i of type along dimension k, from a pair kernel
+static inline void add_acceleration(System::simulation& sim, int type, int i, int k, double a)
+{
+	#pragma omp atomic
+	sim.acceleration[type][i][k] += a;
+}
+
 void interact(System::simulation& sim){
+	TIME_PHASE(PHASE_INTERACT);
 	sim.energy_potential = 0;
+	sim.virial = 0;
 
-	#pragma omp parallel for
+	//Static schedule over the particles of each type (the same threads own the same particles in every pass)
 	for (int i = 0; i < sim.n_types; ++i)
 	{
-		#pragma omp target teams distribute parallel for collapse(2)
+		#pragma omp target teams distribute parallel for collapse(2) schedule(static)
 		for (int j = 0; j < sim.n_particles[i]; ++j)
 		{
 			for (int k = 0; k < sim.n_dimensions; ++k)
@@ -101,14 +256,46 @@ void interact(System::simulation& sim){
 	}
 
 
+	//The inner part of the split interactions only visits the pairs of the list
+	if(sim.respa_part == RESPA_INNER)
+	{
+		respa_update_list(sim);
+	}
+
 	//This implementation is for symmetric interactions only (which makes the most sense)
 	for (int i = 0; i < sim.n_types; ++i)
 	{
 		for (int j = i; j < sim.n_types; ++j)
 		{
+			if(!respa_computed(sim,i,j))
+			{
+				continue;
+			}
+			TIME_PHASE(timer_pair_phase(i,j));
 			sim.interaction[i][j](sim,i,j);
 		}		
 	}
+
+#ifdef MDGEN_MPI
+	//Pairs with the ghosts of the neighbouring subdomains
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = i; j < sim.n_types; ++j)
+		{
+			if((sim.interaction[i][j] == lj_periodic || sim.interaction[i][j] == lj_box) && respa_computed(sim,i,j))
+			{
+				TIME_PHASE(timer_pair_phase(i,j));
+				lj_domain(sim,i,j);
+			}
+		}
+	}
+#endif
+
+	if(sim.pme.active)
+	{
+		TIME_PHASE(PHASE_PME);
+		pme_reciprocal(sim);
+	}
 }
 
 /*******************************************************************************
@@ -127,18 +314,37 @@ void free_particles(System::simulation& sim, int type1, int type2)
 }
 
 /*******************************************************************************
- * \brief Setup the Lennard-Jones potential for periodic boundary conditions between two particle types
+ * \brief Setup the hard sphere interaction between two particle types
  * 
- * Setup of Lennard-Jones potential for periodic boundary conditions between particle types type1 and type2.
- * This requires the cutoff <= half the box size because it only checks the nearest images.
+ * Marks the pair as hard spheres of contact distance interaction_const[type1][type2][1]. The collisions are not forces,
+ * they are found and processed by the event-driven dynamics (see initialize_event_driven()), so this does nothing.
  *
  * @param sim Simulation being used
  * @param type1 First type of particle interacting
  * @param type2 Second type of particle interacting
  ******************************************************************************/
-void lj_periodic(System::simulation& sim, int type1, int type2){
-	// As of now, assuming that r_c <= min(box_size)/2
+void hard_sphere(System::simulation& sim, int type1, int type2)
+{
+	//The collisions are events, not forces
+}
 
+/*******************************************************************************
+ * \brief Lennard-Jones kernel shared by lj_periodic and lj_box
+ *
+ * If energy is true, the potential energy (with the tail correction) and the virial are accumulated as well.
+ * Otherwise only the accelerations are updated, without any reduction.
+ * If periodic is true, the minimum image of the displacement is used.
+ * If split is true, only the outer part (1 - S(r))F(r) of the force is added (the energy and virial, if any, are those of the whole pair).
+ * The inner part is computed by lj_list_kernel.
+ * If coulomb is true, the real space part \f$ q_1 q_2 erfc(\alpha r)/r \f$ of the particle-mesh Ewald electrostatics is added up to sim.pme.cutoff.
+ * The excluded pairs (see build_exclusions()) are skipped.
+ * With MDGEN_DETERMINISTIC, each particle sums the forces of its own pairs in order (so every pair is computed twice), and the energy
+ * and virial are summed row by row (see reduce_sum()) : nothing depends on the number of threads.
+ * Else, if the load balance is active, the rows are split over the threads by their measured cost (see balance_sum()).
+ ******************************************************************************/
+template <bool energy, bool periodic, bool split, bool coulomb>
+static void lj_kernel(System::simulation& sim, int type1, int type2)
+{
 	/*
 	interaction_const[i][j][0] = \epsilon
 	interaction_const[i][j][1] = \sigma
@@ -147,130 +353,662 @@ void lj_periodic(System::simulation& sim, int type1, int type2){
 	interaction_const[i][j][4] = \sigma^6
 	interaction_const[i][j][5] = Tail Energy (assuming constant distribution outside cutoff radius)
 	*/
+	const double eps4 = 4*sim.interaction_const[type1][type2][0];
+	const double rc2 = sim.interaction_const[type1][type2][2]*sim.interaction_const[type1][type2][2];
+	const double etrunc = sim.interaction_const[type1][type2][3];
+	const double sigma6 = sim.interaction_const[type1][type2][4];
+	const double inv_m1 = 1/sim.mass[type1];
+	const double inv_m2 = 1/sim.mass[type2];
+	const int dim = sim.n_dimensions;
+
+	//Switching of a split interaction
+	const double rs = sim.interaction_const[type1][type2][7];
+	const double rin = rs - sim.interaction_const[type1][type2][8];
+	const double rin2 = rin*rin;
+	const double rs2 = rs*rs;
+	const double inv_lambda = split ? 1/sim.interaction_const[type1][type2][8] : 0;
+
+	//Real space Ewald sum
+	const double qq = coulomb ? sim.pme.coulomb*sim.charge[type1]*sim.charge[type2] : 0;
+	const double alpha = sim.pme.alpha;
+	const double two_alpha_pi = 2*alpha/std::sqrt(M_PI);
+	const double rq2 = coulomb ? sim.pme.cutoff*sim.pme.cutoff : 0;
+	const double rmax2 = std::max(rc2, rq2);
+
+	//Force of the pair (i, j) over r (0 beyond the cutoffs), x being set to the displacement, its energy and virial added to epot and vir
+	auto force = [&](int i, int j, double* x, double& epot, double& vir)
+	{
+		double r2 = 0;
+		for (int k = 0; k < dim; ++k)
+		{
+			x[k] = sim.position[type1][i][k] - sim.position[type2][j][k];
+			if(periodic)
+			{
+				x[k] -= sim.box_size_limits[k]*std::round(x[k]/sim.box_size_limits[k]);
+			}
+			r2 += x[k]*x[k];
+		}
 
+		double f = 0;
+		if(r2 < rmax2 && !pair_excluded(sim, type1, i, type2, j))
+		{
+			if(!coulomb || r2 < rc2)
+			{
+				double r6 = r2*r2*r2;
+
+				double b1 = eps4*sigma6/r6;
+				double b2 = sigma6/r6;
+
+				if(energy)
+				{
+					epot+= (b1*(b2-1)-etrunc);
+				}
+
+				f = 6*b1*(2*b2-1)/r2;
+			}
+
+			if(coulomb && r2 < rq2)
+			{
+				double r = std::sqrt(r2);
+				double e = qq*std::erfc(alpha*r)/r;
+				if(energy)
+				{
+					epot += e;
+				}
+				f += (e + qq*two_alpha_pi*std::exp(-alpha*alpha*r2))/r2;
+			}
+
+			if(energy)
+			{
+				vir += f*r2;
+			}
+
+			if(split)
+			{
+				f *= 1 - respa_switch(r2, rin, rin2, rs2, inv_lambda);
+			}
+		}
+		return f;
+	};
 
 	double epot =0; //Temp storage of potential energy
-	#pragma omp target teams distribute parallel for collapse(2) reduction(+ : epot)
-	for (int i = 0; i < sim.n_particles[type1]; ++i)
+	double vir =0; //Temp storage of virial
+#ifdef MDGEN_DETERMINISTIC
+	//Each row sums the forces on its own particle over the particles of type2 in order, so each pair is computed from both sides and
+	//no sum is shared between the threads. The energy and virial of each pair are taken once, and summed row by row (see reduce_sum())
+	double sums[2];
+	reduce_sum(sim.n_particles[type1], 2, sums, [&](long i, double* s)
 	{
+		double acc[dim];
+		for (int k = 0; k < dim; ++k)
+		{
+			acc[k] = 0;
+		}
 		for (int j = 0; j < sim.n_particles[type2]; ++j)
 		{
-			double r = distance_periodic(sim,type1,i,type2,j);
-			if(r < sim.interaction_const[type1][type2][2])
+			if(type1 == type2 && j == i)
 			{
-				double f = 0;
-				double r2 = r*r;
-				double r6 = r2*r2*r2;
+				continue;
+			}
+			double x[dim];
+			double e = 0, v = 0;
+			double f = force(i, j, x, e, v);
+			if(type1 != type2 || j > i)
+			{
+				s[0] += e;
+				s[1] += v;
+			}
+			for (int k = 0; k < dim; ++k)
+			{
+				acc[k] += f*x[k];
+			}
+		}
+		for (int k = 0; k < dim; ++k)
+		{
+			sim.acceleration[type1][i][k] += acc[k]*inv_m1;
+		}
+	}, 1);
+	if(type1 != type2)
+	{
+		#pragma omp parallel for schedule(static)
+		for (int j = 0; j < sim.n_particles[type2]; ++j)
+		{
+			double acc[dim];
+			for (int k = 0; k < dim; ++k)
+			{
+				acc[k] = 0;
+			}
+			for (int i = 0; i < sim.n_particles[type1]; ++i)
+			{
+				double x[dim];
+				double e = 0, v = 0;
+				double f = force(i, j, x, e, v);
+				for (int k = 0; k < dim; ++k)
+				{
+					acc[k] -= f*x[k];
+				}
+			}
+			for (int k = 0; k < dim; ++k)
+			{
+				sim.acceleration[type2][j][k] += acc[k]*inv_m2;
+			}
+		}
+	}
+	epot = sums[0];
+	vir = sums[1];
+#else
+	//Interaction of the pair (i, j) added to both particles
+	auto pair = [&](int i, int j, double& epot, double& vir)
+	{
+		double x[dim];
+		double f = force(i, j, x, epot, vir);
+		if(f != 0)
+		{
+			for (int k = 0; k < dim; ++k)
+			{
+				double fx = f*x[k];
+				add_acceleration(sim, type1, i, k, fx*inv_m1);
+				add_acceleration(sim, type2, j, k, -fx*inv_m2);
+			}
+		}
+	};
 
-				double b1 = 4*sim.interaction_const[type1][type2][0]*sim.interaction_const[type1][type2][4]/r6;
-				double b2 = sim.interaction_const[type1][type2][4]/r6;
+	if(sim.balance.active)
+	{
+		//Rows split over the threads by their measured cost (see balance_sum())
+		double sums[2];
+		balance_sum(sim.balance, type1*sim.n_types + type2, sim.n_particles[type1], 2, sums, [&](long i, double* s)
+		{
+			for (int j = (type1 == type2) ? i+1 : 0; j < sim.n_particles[type2]; ++j)
+			{
+				pair(i, j, s[0], s[1]);
+			}
+		});
+		epot = sums[0];
+		vir = sums[1];
+	}
+	else if(energy)
+	{
+		#pragma omp target teams distribute parallel for collapse(2) schedule(static) reduction(+ : epot, vir)
+		for (int i = 0; i < sim.n_particles[type1]; ++i)
+		{
+			for (int j = 0; j < sim.n_particles[type2]; ++j)
+			{
+				//Each pair of the same type is taken once
+				if(type1 == type2 && j <= i)
+				{
+					continue;
+				}
+				pair(i, j, epot, vir);
+			}
+		}
+	}
+	else
+	{
+		//Nothing to sum : force() leaves the energy and virial of each pair untouched
+		#pragma omp target teams distribute parallel for collapse(2) schedule(static)
+		for (int i = 0; i < sim.n_particles[type1]; ++i)
+		{
+			for (int j = 0; j < sim.n_particles[type2]; ++j)
+			{
+				if(type1 == type2 && j <= i)
+				{
+					continue;
+				}
+				double unused_epot, unused_vir;
+				pair(i, j, unused_epot, unused_vir);
+			}
+		}
+	}
+#endif
 
-				epot+= (b1*(b2-1)-sim.interaction_const[type1][type2][3]);
+	if(energy)
+	{
+		epot+=sim.interaction_const[type1][type2][5];
 
-				f = 6*b1*(2*b2-1)/r2;
+		#pragma omp atomic
+		sim.energy_potential+=epot;
+		#pragma omp atomic
+		sim.virial+=vir;
+	}
+}
+
+/*******************************************************************************
+ * \brief Lennard-Jones kernel of the inner part S(r)F(r) of a split interaction, over the pairs of sim.respa_list
+ *
+ * Only the pairs which were within r_s + skin when the list was built are visited (see respa_update_list()).
+ * No energy or virial is accumulated : those of the whole pair are found at the outer level.
+ ******************************************************************************/
+template <bool periodic>
+static void lj_list_kernel(System::simulation& sim, int type1, int type2)
+{
+	const double eps4 = 4*sim.interaction_const[type1][type2][0];
+	const double sigma6 = sim.interaction_const[type1][type2][4];
+	const double rs = sim.interaction_const[type1][type2][7];
+	const double rin = rs - sim.interaction_const[type1][type2][8];
+	const double rin2 = rin*rin;
+	const double rs2 = rs*rs;
+	const double inv_lambda = 1/sim.interaction_const[type1][type2][8];
+	const double inv_m1 = 1/sim.mass[type1];
+	const double inv_m2 = 1/sim.mass[type2];
+	const int dim = sim.n_dimensions;
+	const std::vector<int>& list = sim.respa_list[type1*sim.n_types + type2];
+	const int n_pairs = list.size()/2;
+
+	//Force of pair p over r (0 beyond r_s), x being set to the displacement
+	auto force = [&](int p, double* x)
+	{
+		int i = list[2*p];
+		int j = list[2*p + 1];
+		double r2 = 0;
+		for (int k = 0; k < dim; ++k)
+		{
+			x[k] = sim.position[type1][i][k] - sim.position[type2][j][k];
+			if(periodic)
+			{
+				x[k] -= sim.box_size_limits[k]*std::round(x[k]/sim.box_size_limits[k]);
+			}
+			r2 += x[k]*x[k];
+		}
 
-				double fx;
-				#pragma omp parallel for
-				for (int k = 0; k < sim.n_dimensions; ++k)
+		if(r2 >= rs2)
+		{
+			return 0.0;
+		}
+		double r6 = r2*r2*r2;
+		double b1 = eps4*sigma6/r6;
+		double b2 = sigma6/r6;
+		return 6*b1*(2*b2-1)/r2*respa_switch(r2, rin, rin2, rs2, inv_lambda);
+	};
+
+#ifdef MDGEN_DETERMINISTIC
+	//The forces of the pairs are computed in parallel, then added to the particles in the order of the list (sorted when built)
+	std::vector<double> fx(n_pairs*dim);
+	#pragma omp parallel for schedule(static)
+	for (int p = 0; p < n_pairs; ++p)
+	{
+		double x[dim];
+		double f = force(p, x);
+		for (int k = 0; k < dim; ++k)
+		{
+			fx[p*dim + k] = f*x[k];
+		}
+	}
+	for (int p = 0; p < n_pairs; ++p)
+	{
+		double* a1 = sim.acceleration[type1][list[2*p]].data();
+		double* a2 = sim.acceleration[type2][list[2*p + 1]].data();
+		for (int k = 0; k < dim; ++k)
+		{
+			a1[k] += fx[p*dim + k]*inv_m1;
+			a2[k] -= fx[p*dim + k]*inv_m2;
+		}
+	}
+#else
+	#pragma omp parallel for schedule(static)
+	for (int p = 0; p < n_pairs; ++p)
+	{
+		double x[dim];
+		double f = force(p, x);
+		if(f != 0)
+		{
+			for (int k = 0; k < dim; ++k)
+			{
+				double fx = f*x[k];
+				add_acceleration(sim, type1, list[2*p], k, fx*inv_m1);
+				add_acceleration(sim, type2, list[2*p + 1], k, -fx*inv_m2);
+			}
+		}
+	}
+#endif
+}
+
+// Builds sim.respa_list for every split interaction (all pairs within r_s + skin) and keeps the positions it was built at
+static void respa_build_list(System::simulation& sim)
+{
+	const int nt = sim.n_types;
+	const int dim = sim.n_dimensions;
+	sim.respa_list.resize(nt*nt);
+	sim.respa_list_position.resize(nt);
+
+	for (int t1 = 0; t1 < nt; ++t1)
+	{
+		for (int t2 = t1; t2 < nt; ++t2)
+		{
+			std::vector<int>& list = sim.respa_list[t1*nt + t2];
+			list.clear();
+			if(sim.interaction_level[t1][t2] != RESPA_SPLIT)
+			{
+				continue;
+			}
+			const double rl = sim.interaction_const[t1][t2][7] + RESPA_SKIN*sim.interaction_const[t1][t2][1];
+			const double rl2 = rl*rl;
+			const bool periodic = (sim.periodic_boundary == 1);
+
+			#pragma omp parallel
+			{
+				std::vector<int> mine;
+				#pragma omp for schedule(static) nowait
+				for (int i = 0; i < sim.n_particles[t1]; ++i)
 				{
-					double x = sim.position[type1][i][k] - sim.position[type2][j][k];
-					if(x > sim.box_size_limits[k])
-					{
-						x -= -sim.box_size_limits[k];
-					}
-					else if(x < -sim.box_size_limits[k])
+					for (int j = (t1 == t2) ? i+1 : 0; j < sim.n_particles[t2]; ++j)
 					{
-						x += sim.box_size_limits[k];
+						double r2 = 0;
+						for (int k = 0; k < dim; ++k)
+						{
+							double x = sim.position[t1][i][k] - sim.position[t2][j][k];
+							if(periodic)
+							{
+								x -= sim.box_size_limits[k]*std::round(x/sim.box_size_limits[k]);
+							}
+							r2 += x*x;
+						}
+						if(r2 < rl2 && !pair_excluded(sim, t1, i, t2, j))
+						{
+							mine.push_back(i);
+							mine.push_back(j);
+						}
 					}
-
-					fx = f*x;
-					#pragma omp atomic
-					sim.acceleration[type1][i][k] += fx/sim.mass[type1];
-					#pragma omp atomic
-					sim.acceleration[type2][j][k] -= fx/sim.mass[type2];
 				}
+				#pragma omp critical
+				list.insert(list.end(), mine.begin(), mine.end());
+			}
+#ifdef MDGEN_DETERMINISTIC
+			//The threads append their pairs in any order : sorted, lj_list_kernel() adds them in one fixed order
+			std::vector<std::pair<int,int>> pairs(list.size()/2);
+			for (size_t p = 0; p < pairs.size(); ++p)
+			{
+				pairs[p] = std::make_pair(list[2*p], list[2*p + 1]);
 			}
+			std::sort(pairs.begin(), pairs.end());
+			for (size_t p = 0; p < pairs.size(); ++p)
+			{
+				list[2*p] = pairs[p].first;
+				list[2*p + 1] = pairs[p].second;
+			}
+#endif
 		}
 	}
 
+	for (int t = 0; t < nt; ++t)
+	{
+		std::vector<double>& x0 = sim.respa_list_position[t];
+		x0.resize(sim.n_particles[t]*dim);
+		for (int j = 0; j < sim.n_particles[t]; ++j)
+		{
+			for (int k = 0; k < dim; ++k)
+			{
+				x0[j*dim + k] = sim.position[t][j][k];
+			}
+		}
+	}
+	sim.respa_list_valid = 1;
+}
 
-	if(type1 == type2){
-		epot/=2;
+/*******************************************************************************
+ * \brief Builds sim.respa_list again if it may be missing a pair
+ *
+ * The list holds the pairs within r_s + skin (skin = RESPA_SKIN sigma). It is built again if it is not valid
+ * or if a particle has moved by more than half of the smallest skin since it was built.
+ ******************************************************************************/
+static void respa_update_list(System::simulation& sim)
+{
+	const int nt = sim.n_types;
+	const int dim = sim.n_dimensions;
+	double skin = -1;
+	for (int t1 = 0; t1 < nt; ++t1)
+	{
+		for (int t2 = t1; t2 < nt; ++t2)
+		{
+			if(sim.interaction_level[t1][t2] == RESPA_SPLIT)
+			{
+				double s = RESPA_SKIN*sim.interaction_const[t1][t2][1];
+				skin = (skin < 0) ? s : std::min(skin, s);
+			}
+		}
+	}
+	if(skin < 0)
+	{
+		return;
+	}
+	if(!sim.respa_list_valid)
+	{
+		respa_build_list(sim);
+		return;
 	}
 
-	epot+=sim.interaction_const[type1][type2][5];
+	double max2 = 0;
+	for (int t = 0; t < nt; ++t)
+	{
+		const double* x0 = sim.respa_list_position[t].data();
+		#pragma omp parallel for schedule(static) reduction(max : max2)
+		for (int j = 0; j < sim.n_particles[t]; ++j)
+		{
+			double d2 = 0;
+			for (int k = 0; k < dim; ++k)
+			{
+				double x = sim.position[t][j][k] - x0[j*dim + k];
+				if(sim.periodic_boundary == 1)
+				{
+					x -= sim.box_size_limits[k]*std::round(x/sim.box_size_limits[k]);
+				}
+				d2 += x*x;
+			}
+			max2 = std::max(max2, d2);
+		}
+	}
+	if(4*max2 > skin*skin)
+	{
+		respa_build_list(sim);
+	}
+}
 
-	#pragma omp atomic
-	sim.energy_potential+=epot;
+/*******************************************************************************
+ * \brief Setup the Lennard-Jones potential for periodic boundary conditions between two particle types
+ * 
+ * Setup of Lennard-Jones potential for periodic boundary conditions between particle types type1 and type2.
+ * This requires the cutoff <= half the box size because it only checks the nearest images.
+ * The potential energy and virial are only computed if sim.energy_due is 1.
+ *
+ * @param sim Simulation being used
+ * @param type1 First type of particle interacting
+ * @param type2 Second type of particle interacting
+ ******************************************************************************/
+void lj_periodic(System::simulation& sim, int type1, int type2){
+	// As of now, assuming that r_c <= min(box_size)/2
+	if(sim.respa_part != RESPA_ALL && sim.interaction_level[type1][type2] == RESPA_SPLIT)
+	{
+		//Only the outer part carries the energy and virial of a split pair
+		if(sim.respa_part == RESPA_INNER)
+		{
+			lj_list_kernel<true>(sim,type1,type2);
+		}
+		else if(sim.energy_due)
+		{
+			lj_kernel<true,true,true,false>(sim,type1,type2);
+		}
+		else
+		{
+			lj_kernel<false,true,true,false>(sim,type1,type2);
+		}
+	}
+	else if(sim.pme.active && sim.charge[type1]*sim.charge[type2] != 0)
+	{
+		//Real space part of the particle-mesh Ewald electrostatics
+		if(sim.energy_due)
+		{
+			lj_kernel<true,true,false,true>(sim,type1,type2);
+		}
+		else
+		{
+			lj_kernel<false,true,false,true>(sim,type1,type2);
+		}
+	}
+	else if(sim.energy_due)
+	{
+		lj_kernel<true,true,false,false>(sim,type1,type2);
+	}
+	else
+	{
+		lj_kernel<false,true,false,false>(sim,type1,type2);
+	}
 }
 
 /*******************************************************************************
  * \brief Setup the Lennard-Jones potential for rigid box boundary conditions between two particle types
  * 
  * Setup of Lennard-Jones potential for rigid box boundary conditions between particle types type1 and type2.
+ * The potential energy and virial are only computed if sim.energy_due is 1.
  *
  * @param sim Simulation being used
  * @param type1 First type of particle interacting
  * @param type2 Second type of particle interacting
  ******************************************************************************/
 void lj_box(System::simulation& sim, int type1, int type2){
+	if(sim.respa_part != RESPA_ALL && sim.interaction_level[type1][type2] == RESPA_SPLIT)
+	{
+		//Only the outer part carries the energy and virial of a split pair
+		if(sim.respa_part == RESPA_INNER)
+		{
+			lj_list_kernel<false>(sim,type1,type2);
+		}
+		else if(sim.energy_due)
+		{
+			lj_kernel<true,false,true,false>(sim,type1,type2);
+		}
+		else
+		{
+			lj_kernel<false,false,true,false>(sim,type1,type2);
+		}
+	}
+	else if(sim.energy_due)
+	{
+		lj_kernel<true,false,false,false>(sim,type1,type2);
+	}
+	else
+	{
+		lj_kernel<false,false,false,false>(sim,type1,type2);
+	}
+}
 
-	/*
-	interaction_const[i][j][0] = \epsilon
-	interaction_const[i][j][1] = \sigma
-	interaction_const[i][j][2] = Cutoff radius/distance (r_cut)
-	interaction_const[i][j][3] = Truncated Potential (etrunc)
-	interaction_const[i][j][4] = \sigma^6
-	interaction_const[i][j][5] = Tail Energy (assuming constant distribution outside cutoff radius)
-	*/
+#ifdef MDGEN_MPI
+/*******************************************************************************
+ * \brief Lennard-Jones kernel between the local particles of type1 and the ghosts of type2
+ *
+ * Each local particle is only updated by the thread owning it, so no atomics are needed.
+ * Half of the potential energy and virial of each pair is added (the rank owning the ghost adds the other half).
+ * split is as for lj_kernel.
+ ******************************************************************************/
+template <bool energy, bool split>
+static void lj_ghost_kernel(System::simulation& sim, int type1, int type2)
+{
+	const double eps4 = 4*sim.interaction_const[type1][type2][0];
+	const double rc2 = sim.interaction_const[type1][type2][2]*sim.interaction_const[type1][type2][2];
+	const double etrunc = sim.interaction_const[type1][type2][3];
+	const double sigma6 = sim.interaction_const[type1][type2][4];
+	const double inv_m1 = 1/sim.mass[type1];
+	const int dim = sim.n_dimensions;
+	const int n_ghosts = sim.domain.n_ghosts[type2];
+	const double* ghost = sim.domain.ghost_position[type2].data();
+
+	const bool outer = (sim.respa_part == RESPA_OUTER);
+	const double rs = sim.interaction_const[type1][type2][7];
+	const double rin = rs - sim.interaction_const[type1][type2][8];
+	const double rin2 = rin*rin;
+	const double rs2 = rs*rs;
+	const double inv_lambda = split ? 1/sim.interaction_const[type1][type2][8] : 0;
+	const double rcut2 = (split && !outer) ? rs2 : rc2;
+
+	//Minimum image only along the dimensions which are not split
+	double wrap[dim];
+	for (int k = 0; k < dim; ++k)
+	{
+		wrap[k] = (sim.periodic_boundary && sim.domain.dims[k] == 1) ? sim.box_size_limits[k] : 0;
+	}
 
-	double epot =0; //Temp storage of potential energy
-	#pragma omp target teams distribute parallel for collapse(2) reduction(+ : epot)
-	for (int i = 0; i < sim.n_particles[type1]; ++i)
+	//Potential energy and virial
+	double sums[2];
+	reduce_sum(sim.n_particles[type1], 2, sums, [&](long i, double* s)
 	{
-		for (int j = 0; j < sim.n_particles[type2]; ++j)
+		const double* xi = sim.position[type1][i].data();
+		double acc[dim];
+		for (int k = 0; k < dim; ++k)
 		{
-			double r2 = 0;
+			acc[k] = 0;
+		}
 
-			for (int k = 0; k < sim.n_dimensions; ++k)
+		for (int g = 0; g < n_ghosts; ++g)
+		{
+			double x[dim];
+			double r2 = 0;
+			for (int k = 0; k < dim; ++k)
 			{
-				r2 += std::pow(sim.position[type1][i][k] - sim.position[type2][j][k],2);
+				x[k] = xi[k] - ghost[g*dim + k];
+				if(wrap[k] > 0)
+				{
+					x[k] -= wrap[k]*std::round(x[k]/wrap[k]);
+				}
+				r2 += x[k]*x[k];
 			}
 
-			if(std::sqrt(r2) < sim.interaction_const[type1][type2][2])
+			if(r2 < rcut2)
 			{
-				double f = 0;
 				double r6 = r2*r2*r2;
+				double b1 = eps4*sigma6/r6;
+				double b2 = sigma6/r6;
+				double f = 6*b1*(2*b2-1)/r2;
 
-				double b1 = 4*sim.interaction_const[type1][type2][0]*sim.interaction_const[type1][type2][4]/r6;
-				double b2 = sim.interaction_const[type1][type2][4]/r6;
-
-				epot+= (b1*(b2-1)-sim.interaction_const[type1][type2][3]);
-
-				f = 6*b1*(2*b2-1)/r2;
-
-				double fx;
-				#pragma omp parallel for
-				for (int k = 0; k < sim.n_dimensions; ++k)
+				if(energy)
+				{
+					s[0] += 0.5*(b1*(b2-1)-etrunc);
+					s[1] += 0.5*f*r2;
+				}
+				if(split)
 				{
-					double x = sim.position[type1][i][k] - sim.position[type2][j][k];
-					fx = f*x;
-					#pragma omp atomic
-					sim.acceleration[type1][i][k] += fx/sim.mass[type1];
-					#pragma omp atomic
-					sim.acceleration[type2][j][k] -= fx/sim.mass[type2];
+					double sw = respa_switch(r2, rin, rin2, rs2, inv_lambda);
+					f *= outer ? 1 - sw : sw;
+				}
+				for (int k = 0; k < dim; ++k)
+				{
+					acc[k] += f*x[k];
 				}
 			}
 		}
-	}
 
+		double* a = sim.acceleration[type1][i].data();
+		for (int k = 0; k < dim; ++k)
+		{
+			a[k] += acc[k]*inv_m1;
+		}
+	});
 
-	if(type1 == type2){
-		epot/=2;
+	if(energy)
+	{
+		sim.energy_potential += sums[0];
+		sim.virial += sums[1];
 	}
+}
 
-	epot+=sim.interaction_const[type1][type2][5];
-
-	#pragma omp atomic
-	sim.energy_potential+=epot;
-}
\ No newline at end of file
+void lj_domain(System::simulation& sim, int type1, int type2){
+	if(sim.domain.comm == MPI_COMM_NULL)
+	{
+		return;
+	}
+	bool split = (sim.respa_part != RESPA_ALL && sim.interaction_level[type1][type2] == RESPA_SPLIT);
+	bool energy = sim.energy_due && (!split || sim.respa_part == RESPA_OUTER);
+	void (*kernel)(System::simulation&, int, int);
+	if(split)
+	{
+		kernel = energy ? lj_ghost_kernel<true,true> : lj_ghost_kernel<false,true>;
+	}
+	else
+	{
+		kernel = energy ? lj_ghost_kernel<true,false> : lj_ghost_kernel<false,false>;
+	}
+	kernel(sim,type1,type2);
+	if(type1 != type2)
+	{
+		kernel(sim,type2,type1);
+	}
+}
+#endif
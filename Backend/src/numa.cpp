@@ -0,0 +1,199 @@
+/** @file */
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <string>
+#include <omp.h>
+#include "numa.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+// Location of a cpu in the machine
+struct numa_cpu
+{
+	int cpu, node, package, core, sibling;
+};
+
+// Cpus in the order threads are pinned to them (empty until numa_pin_threads() has pinned the team)
+static std::vector<int> numa_order;
+
+// Reads an integer from a sysfs file (-1 if it cannot be read)
+static int numa_read_int(std::string path)
+{
+	std::ifstream in(path);
+	int value = -1;
+	if(!(in>>value))
+	{
+		return -1;
+	}
+	return value;
+}
+
+int numa_node_of_cpu(int cpu)
+{
+#ifdef __linux__
+	std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+	DIR* dir = opendir(path.c_str());
+	if(dir == NULL)
+	{
+		return 0;
+	}
+	int node = 0;
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL)
+	{
+		std::string name(entry->d_name);
+		if(name.compare(0, 4, "node") == 0 && name.size() > 4 && std::isdigit(name[4]))
+		{
+			node = std::stoi(name.substr(4));
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+#else
+	return 0;
+#endif
+}
+
+void numa_pin_threads(std::ostream& out)
+{
+	static bool pinned = false;
+	if(pinned)
+	{
+		return;
+	}
+	pinned = true;
+#ifdef __linux__
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+	{
+		out<<"Could not read the cpus allowed, threads are not pinned"<<std::endl;
+		return;
+	}
+
+	std::vector<numa_cpu> cpus;
+	for (int c = 0; c < CPU_SETSIZE; ++c)
+	{
+		if(!CPU_ISSET(c, &allowed))
+		{
+			continue;
+		}
+		std::string topo = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+		numa_cpu n;
+		n.cpu = c;
+		n.node = numa_node_of_cpu(c);
+		n.package = std::max(0, numa_read_int(topo + "physical_package_id"));
+		n.core = numa_read_int(topo + "core_id");
+		n.core = (n.core < 0) ? c : n.core;
+		n.sibling = 0;
+		cpus.push_back(n);
+	}
+
+	//Hyperthreads of a core already seen come after all the cores
+	std::sort(cpus.begin(), cpus.end(), [](const numa_cpu& a, const numa_cpu& b){
+		if(a.node != b.node) return a.node < b.node;
+		if(a.package != b.package) return a.package < b.package;
+		if(a.core != b.core) return a.core < b.core;
+		return a.cpu < b.cpu;
+	});
+	for (size_t i = 1; i < cpus.size(); ++i)
+	{
+		if(cpus[i].node == cpus[i-1].node && cpus[i].package == cpus[i-1].package && cpus[i].core == cpus[i-1].core)
+		{
+			cpus[i].sibling = cpus[i-1].sibling + 1;
+		}
+	}
+	std::stable_sort(cpus.begin(), cpus.end(), [](const numa_cpu& a, const numa_cpu& b){
+		return a.sibling < b.sibling;
+	});
+
+	int n_threads = omp_get_max_threads();
+	std::vector<int> placed(n_threads, -1);
+	#pragma omp parallel num_threads(n_threads)
+	{
+		int t = omp_get_thread_num();
+		const numa_cpu& c = cpus[t%cpus.size()];
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(c.cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set) == 0)
+		{
+			placed[t] = t%cpus.size();
+		}
+	}
+
+	for (const numa_cpu& c : cpus)
+	{
+		numa_order.push_back(c.cpu);
+	}
+
+	out<<"thread,cpu,node,package,core"<<std::endl;
+	for (int t = 0; t < n_threads; ++t)
+	{
+		if(placed[t] < 0)
+		{
+			out<<t<<",unpinned"<<std::endl;
+			continue;
+		}
+		const numa_cpu& c = cpus[placed[t]];
+		out<<t<<","<<c.cpu<<","<<c.node<<","<<c.package<<","<<c.core<<std::endl;
+	}
+#endif
+}
+
+void numa_pin_block(int first, int count)
+{
+#ifdef __linux__
+	if(numa_order.empty())
+	{
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int c = 0; c < std::max(count, 1); ++c)
+	{
+		CPU_SET(numa_order[(first + c)%numa_order.size()], &set);
+	}
+	sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
+// Touches the byte at the offset of p in from, in to
+static inline void numa_touch(const void* p, const System::arena& from, System::arena& to)
+{
+	if(p != NULL && from.owns(p))
+	{
+		*(volatile char*)(to.begin() + ((const char*)p - from.begin())) = 0;
+	}
+}
+
+template <class A>
+static void numa_first_touch_arrays(const std::vector<A>& arrays, const System::arena& from, System::arena& to)
+{
+	for (size_t i = 0; i < arrays.size(); ++i)
+	{
+		const A& a = arrays[i];
+		int n = a.size();
+		#pragma omp parallel for schedule(static)
+		for (int j = 0; j < n; ++j)
+		{
+			numa_touch(&a[j], from, to);
+			numa_touch(a[j].data(), from, to);
+		}
+	}
+}
+
+void numa_first_touch(const std::vector<System::particle_array>& arrays, const System::arena& from, System::arena& to)
+{
+	numa_first_touch_arrays(arrays, from, to);
+}
+
+void numa_first_touch(const std::vector<System::particle_array_int>& arrays, const System::arena& from, System::arena& to)
+{
+	numa_first_touch_arrays(arrays, from, to);
+}
@@ -0,0 +1,307 @@
+/** @file */
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <fstream>
+#include <omp.h>
+#include "perf_counters.h"
+#include "timer.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define PERF_GROUPS 2 //Hardware events and floating point events are read as two groups
+#define PERF_GROUP_SIZE 8
+
+struct perf_thread
+{
+	int leader[PERF_GROUPS]; // File descriptor of the leader of each group (-1 if the group could not be opened)
+	int n[PERF_GROUPS]; // Number of events in each group
+	int event[PERF_GROUPS][PERF_GROUP_SIZE]; // perf_event each member of a group counts towards
+	double weight[PERF_GROUPS][PERF_GROUP_SIZE]; // Weight of each member (for the vector floating point instructions)
+	int fd[PERF_GROUPS][PERF_GROUP_SIZE]; // File descriptor of each member
+};
+
+static std::vector<perf_thread> perf_threads;
+static bool perf_available[PERF_EVENTS];
+static double perf_total[TIMER_PHASES][PERF_EVENTS];
+static double perf_seconds[TIMER_PHASES];
+static long perf_calls[TIMER_PHASES];
+
+#ifdef __linux__
+// Opens one counter on the calling thread and adds it to a group (returns the file descriptor, -1 on failure)
+static int perf_open_event(perf_thread& t, int g, uint32_t type, uint64_t config, int event, double weight)
+{
+	if(t.n[g] == PERF_GROUP_SIZE)
+	{
+		return -1;
+	}
+	struct perf_event_attr pe;
+	std::memset(&pe, 0, sizeof(pe));
+	pe.size = sizeof(pe);
+	pe.type = type;
+	pe.config = config;
+	pe.disabled = (t.leader[g] == -1);
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	int fd = syscall(__NR_perf_event_open, &pe, 0, -1, t.leader[g], 0);
+	if(fd == -1)
+	{
+		return -1;
+	}
+	if(t.leader[g] == -1)
+	{
+		t.leader[g] = fd;
+	}
+	t.event[g][t.n[g]] = event;
+	t.weight[g][t.n[g]] = weight;
+	t.fd[g][t.n[g]] = fd;
+	t.n[g]++;
+	return fd;
+}
+
+static bool perf_intel()
+{
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while(std::getline(cpuinfo, line))
+	{
+		if(line.compare(0, 9, "vendor_id") == 0)
+		{
+			return line.find("GenuineIntel") != std::string::npos;
+		}
+	}
+	return false;
+}
+#endif
+
+void perf_open()
+{
+	std::memset(perf_available, 0, sizeof(perf_available));
+	perf_threads.assign(omp_get_max_threads(), perf_thread());
+#ifdef __linux__
+	bool intel = perf_intel();
+	const uint64_t l1d_miss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+	#pragma omp parallel
+	{
+		perf_thread& t = perf_threads[omp_get_thread_num()];
+		for (int g = 0; g < PERF_GROUPS; ++g)
+		{
+			t.leader[g] = -1;
+			t.n[g] = 0;
+		}
+
+		if(perf_open_event(t, 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, PERF_CYCLES, 1) != -1)
+		{
+			perf_open_event(t, 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, PERF_INSTRUCTIONS, 1);
+			perf_open_event(t, 0, PERF_TYPE_HW_CACHE, l1d_miss, PERF_L1D_MISSES, 1);
+			perf_open_event(t, 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, PERF_LLC_MISSES, 1);
+			perf_open_event(t, 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, PERF_BRANCH_MISSES, 1);
+		}
+
+		if(intel)
+		{
+			//FP_ARITH_INST_RETIRED (event 0xC7) : scalar, 128, 256 and 512 bit packed double
+			perf_open_event(t, 1, PERF_TYPE_RAW, 0x01C7, PERF_FLOPS, 1);
+			perf_open_event(t, 1, PERF_TYPE_RAW, 0x04C7, PERF_FLOPS, 2);
+			perf_open_event(t, 1, PERF_TYPE_RAW, 0x10C7, PERF_FLOPS, 4);
+			perf_open_event(t, 1, PERF_TYPE_RAW, 0x40C7, PERF_FLOPS, 8);
+		}
+		else
+		{
+			//Retired SSE/AVX FLOPs (PMCx003, all unit masks)
+			perf_open_event(t, 1, PERF_TYPE_RAW, 0xFF03, PERF_FLOPS, 1);
+		}
+
+		for (int g = 0; g < PERF_GROUPS; ++g)
+		{
+			if(t.leader[g] != -1)
+			{
+				ioctl(t.leader[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+				ioctl(t.leader[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+			}
+		}
+	}
+
+	const perf_thread& t = perf_threads[0];
+	for (int g = 0; g < PERF_GROUPS; ++g)
+	{
+		for (int m = 0; m < t.n[g]; ++m)
+		{
+			perf_available[t.event[g][m]] = true;
+		}
+	}
+#endif
+	for (int e = 0; e < PERF_EVENTS; ++e)
+	{
+		if(!perf_available[e])
+		{
+			std::cerr<<"Hardware counter "<<e<<" is unavailable"<<std::endl;
+		}
+	}
+}
+
+void perf_close()
+{
+#ifdef __linux__
+	for (size_t i = 0; i < perf_threads.size(); ++i)
+	{
+		for (int g = 0; g < PERF_GROUPS; ++g)
+		{
+			for (int m = 0; m < perf_threads[i].n[g]; ++m)
+			{
+				close(perf_threads[i].fd[g][m]);
+			}
+			perf_threads[i].n[g] = 0;
+			perf_threads[i].leader[g] = -1;
+		}
+	}
+#endif
+	perf_threads.clear();
+}
+
+void perf_read(perf_sample& s)
+{
+	std::memset(s.value, 0, sizeof(s.value));
+#ifdef __linux__
+	//The counters of the team can only be attributed to a phase from outside a parallel region
+	if(omp_in_parallel())
+	{
+		return;
+	}
+	uint64_t buf[3 + PERF_GROUP_SIZE];
+	for (size_t i = 0; i < perf_threads.size(); ++i)
+	{
+		const perf_thread& t = perf_threads[i];
+		for (int g = 0; g < PERF_GROUPS; ++g)
+		{
+			if(t.n[g] == 0 || read(t.leader[g], buf, sizeof(buf)) <= 0)
+			{
+				continue;
+			}
+			//buf = {nr, time_enabled, time_running, values[nr]}
+			double scale = (buf[2] > 0) ? (double)buf[1]/buf[2] : 0;
+			for (int m = 0; m < t.n[g] && m < (int)buf[0]; ++m)
+			{
+				s.value[t.event[g][m]] += t.weight[g][m]*buf[3+m]*scale;
+			}
+		}
+	}
+#endif
+}
+
+void perf_record(int phase, const perf_sample& start, double seconds)
+{
+	if(perf_threads.empty() || omp_in_parallel())
+	{
+		return;
+	}
+	perf_sample end;
+	perf_read(end);
+	for (int e = 0; e < PERF_EVENTS; ++e)
+	{
+		perf_total[phase][e] += end.value[e] - start.value[e];
+	}
+	perf_seconds[phase] += seconds;
+	perf_calls[phase]++;
+}
+
+// Number of pair interactions visited per call of a phase (0 for the phases which are not interactions)
+static double perf_pairs(System::simulation& sim, int phase)
+{
+	double pairs = 0;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		for (int j = i; j < sim.n_types; ++j)
+		{
+			if(phase == PHASE_INTERACT || phase == timer_pair_phase(i,j))
+			{
+				pairs += (i == j) ? 0.5*sim.n_particles[i]*(sim.n_particles[i]-1) : (double)sim.n_particles[i]*sim.n_particles[j];
+			}
+		}
+	}
+	return pairs;
+}
+
+// Derived metrics of a phase : IPC, L1D, LLC and branch misses per unit of work, GFLOP/s
+static void perf_metrics(System::simulation& sim, int phase, double metrics[5])
+{
+	const double* c = perf_total[phase];
+	double pairs = perf_pairs(sim, phase);
+	double work = perf_calls[phase]*((pairs > 0) ? pairs : sim.numpartot);
+	metrics[0] = (c[PERF_CYCLES] > 0) ? c[PERF_INSTRUCTIONS]/c[PERF_CYCLES] : 0;
+	metrics[1] = c[PERF_L1D_MISSES]/work;
+	metrics[2] = c[PERF_LLC_MISSES]/work;
+	metrics[3] = c[PERF_BRANCH_MISSES]/work;
+	metrics[4] = (perf_seconds[phase] > 0) ? c[PERF_FLOPS]/perf_seconds[phase]*1e-9 : 0;
+}
+
+void perf_report(System::simulation& sim, std::ostream& out)
+{
+	out<<"phase,calls,IPC,L1D misses/unit,LLC misses/unit,branch misses/unit,GFLOP/s,unit"<<std::endl;
+	for (int phase = 0; phase < TIMER_PHASES; ++phase)
+	{
+		if(perf_calls[phase] == 0)
+		{
+			continue;
+		}
+		double m[5];
+		perf_metrics(sim, phase, m);
+		out<<timer_phase_name(phase)<<","<<perf_calls[phase];
+		for (int k = 0; k < 5; ++k)
+		{
+			out<<",";
+			if(perf_available[(k == 0) ? PERF_INSTRUCTIONS : (k == 4) ? PERF_FLOPS : PERF_L1D_MISSES + k - 1])
+			{
+				out<<m[k];
+			}
+			else
+			{
+				out<<"n/a";
+			}
+		}
+		out<<","<<((perf_pairs(sim, phase) > 0) ? "pair" : "particle")<<std::endl;
+	}
+}
+
+void perf_write_json(System::simulation& sim, std::string filename)
+{
+	const char* names[PERF_EVENTS] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "flops"};
+	std::ofstream out(filename);
+	out<<"{\"phases\":[";
+	bool first = true;
+	for (int phase = 0; phase < TIMER_PHASES; ++phase)
+	{
+		if(perf_calls[phase] == 0)
+		{
+			continue;
+		}
+		double m[5];
+		perf_metrics(sim, phase, m);
+		out<<(first ? "" : ",")<<"\n{\"name\":\""<<timer_phase_name(phase)<<"\",\"calls\":"<<perf_calls[phase]<<",\"seconds\":"<<perf_seconds[phase];
+		for (int e = 0; e < PERF_EVENTS; ++e)
+		{
+			out<<",\""<<names[e]<<"\":";
+			if(perf_available[e])
+			{
+				out<<perf_total[phase][e];
+			}
+			else
+			{
+				out<<"null";
+			}
+		}
+		out<<",\"unit\":\""<<((perf_pairs(sim, phase) > 0) ? "pair" : "particle")<<"\"";
+		out<<",\"ipc\":"<<m[0]<<",\"l1d_misses_per_unit\":"<<m[1]<<",\"llc_misses_per_unit\":"<<m[2];
+		out<<",\"branch_misses_per_unit\":"<<m[3]<<",\"gflops\":"<<m[4]<<"}";
+		first = false;
+	}
+	out<<"\n]}"<<std::endl;
+}
@@ -0,0 +1,174 @@
+/** @file */
+#include <algorithm>
+#include "pipeline.h"
+#include "system.h"
+#include "sample.h"
+#include "timer.h"
+
+void register_async_observable(System::simulation& sim, void (*observable)(System::simulation&), int stride, int needs_energy)
+{
+	if(stride < 1)
+	{
+		std::cerr<<"Error 0007"<<std::endl;
+		exit(0007);
+	}
+	System::step_pipeline& pl = sim.pipeline;
+	pl.observable.push_back(observable);
+	pl.observable_stride.push_back(stride);
+	pl.observable_energy.push_back(needs_energy);
+	pl.active = 1;
+	//A shadow made before this observable was registered does not sample it
+	if(pl.shadow)
+	{
+		pipeline_drain(sim);
+		pl.shadow->observable = pl.observable;
+		pl.shadow->observable_stride = pl.observable_stride;
+		pl.shadow->observable_energy = pl.observable_energy;
+	}
+}
+
+/*******************************************************************************
+ * Copies the rows of n particles of a type into the same rows of the snapshot
+ *
+ * @param to Rows of the snapshot
+ * @param from Rows of the simulation
+ * @param n Number of particles
+ ******************************************************************************/
+template <class Array>
+static void pipeline_copy(Array& to, const Array& from, int n)
+{
+	#pragma omp parallel for schedule(static)
+	for (int j = 0; j < n; ++j)
+	{
+		std::copy(from[j].begin(), from[j].end(), to[j].begin());
+	}
+}
+
+/*******************************************************************************
+ * Makes the shadow of the simulation, the first time an asynchronous observable is due
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+static void pipeline_make_shadow(System::simulation& sim)
+{
+	System::step_pipeline& pl = sim.pipeline;
+	try{
+		pl.shadow = std::make_shared<System::simulation>(sim);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	System::simulation& shadow = *pl.shadow;
+	//The tasks write to their own buffer rather than to sim.output, which the timesteps write to meanwhile
+	pl.buffer = std::make_shared<std::stringstream>();
+	shadow.output = pl.buffer.get();
+	//The shadow only samples the asynchronous observables, and never takes snapshots or publishes frames itself
+	shadow.observable = pl.observable;
+	shadow.observable_stride = pl.observable_stride;
+	shadow.observable_energy = pl.observable_energy;
+	shadow.pipeline = System::step_pipeline();
+	shadow.stream = System::live_stream();
+}
+
+/*******************************************************************************
+ * Copies the state of this timestep (what the observables read) into the shadow
+ *
+ * @param sim Simulation being used
+ ******************************************************************************/
+static void pipeline_copy_state(System::simulation& sim)
+{
+	System::simulation& shadow = *sim.pipeline.shadow;
+	shadow.state = sim.state;
+	shadow.time = sim.time;
+	shadow.energy_due = sim.energy_due;
+	shadow.energy_total = sim.energy_total;
+	shadow.energy_potential = sim.energy_potential;
+	shadow.virial = sim.virial;
+	shadow.pressure = sim.pressure;
+	shadow.energy_kinetic = sim.energy_kinetic;
+	shadow.temperature = sim.temperature;
+	shadow.momentum = sim.momentum;
+	shadow.box_size_limits = sim.box_size_limits;
+	shadow.n_particles = sim.n_particles;
+	shadow.numpartot = sim.numpartot;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		pipeline_copy(shadow.position[i], sim.position[i], sim.n_particles[i]);
+		pipeline_copy(shadow.velocity[i], sim.velocity[i], sim.n_particles[i]);
+		pipeline_copy(shadow.acceleration[i], sim.acceleration[i], sim.n_particles[i]);
+		pipeline_copy(shadow.image[i], sim.image[i], sim.n_particles[i]);
+		if(sim.rigid.n_bodies() > 0)
+		{
+			pipeline_copy(shadow.orientation[i], sim.orientation[i], sim.n_particles[i]);
+		}
+	}
+}
+
+void pipeline_snapshot(System::simulation& sim)
+{
+	System::step_pipeline& pl = sim.pipeline;
+	bool due = 0;
+	for (size_t o = 0; o < pl.observable.size(); ++o)
+	{
+		due = due || (sim.state % pl.observable_stride[o] == 0);
+	}
+	if(!due)
+	{
+		return;
+	}
+
+	//snapshot(s) depends on sample(s - stride), which reads the shadow being overwritten
+	double start = omp_get_wtime();
+	pipeline_drain(sim);
+	pl.wait += omp_get_wtime() - start;
+
+	if(!pl.shadow)
+	{
+		pipeline_make_shadow(sim);
+	}
+	pipeline_copy_state(sim);
+	pl.snapshots++;
+
+	System::simulation* shadow = pl.shadow.get();
+	if(!pl.overlap)
+	{
+		sample(*shadow);
+		pipeline_drain(sim);
+		return;
+	}
+	//Run by the spare thread of the outer team of md_steps(), with a team of pl.threads for the parallel loops of the observables
+	const int threads = pl.threads;
+	int* pending = &pl.pending;
+	#pragma omp atomic write
+	*pending = 1;
+	#pragma omp task firstprivate(shadow, threads, pending)
+	{
+		omp_set_num_threads(threads);
+		sample(*shadow);
+		#pragma omp atomic write
+		*pending = 0;
+	}
+}
+
+void pipeline_drain(System::simulation& sim)
+{
+	//The only tasks created by the timesteps are those of pipeline_snapshot()
+	#pragma omp taskwait
+	System::step_pipeline& pl = sim.pipeline;
+	if(pl.buffer && pl.buffer->tellp() > 0)
+	{
+		(*sim.output)<<pl.buffer->str()<<std::flush;
+		pl.buffer->str("");
+		pl.buffer->clear();
+	}
+}
+
+System::simulation& pipeline_results(System::simulation& sim)
+{
+	return sim.pipeline.shadow ? *sim.pipeline.shadow : sim;
+}
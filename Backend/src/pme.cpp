@@ -0,0 +1,753 @@
+/** @file */
+#include <cmath>
+#include <complex>
+#include <algorithm>
+#include <random>
+#include <mutex>
+#include <omp.h>
+#include "pme.h"
+#include "system.h"
+#include "interaction.h"
+#include "reduce.h"
+
+typedef std::complex<double> cplx;
+
+#ifdef MDGEN_FFTW
+// Guards the FFTW planner, which creates and destroys the plans
+static std::mutex pme_planner_mutex;
+
+static void pme_destroy_plan(fftw_plan plan)
+{
+	std::lock_guard<std::mutex> lock(pme_planner_mutex);
+	fftw_destroy_plan(plan);
+}
+#endif
+
+// Smallest n >= m whose only prime factors are 2, 3 and 5 (the sizes the built-in FFT can transform)
+static int pme_nice_size(int m)
+{
+	for (int n = std::max(m, 1); ; ++n)
+	{
+		int r = n;
+		while(r%2 == 0) r /= 2;
+		while(r%3 == 0) r /= 3;
+		while(r%5 == 0) r /= 5;
+		if(r == 1)
+		{
+			return n;
+		}
+	}
+}
+
+/*******************************************************************************
+ * \brief Estimated RMS force error of the reciprocal space part along one dimension (Deserno and Holm, 1998, as in LAMMPS)
+ *
+ * @param h Spacing of the grid
+ * @param length Length of the box
+ * @param alpha Ewald splitting parameter
+ * @param q2 Sum of the squared charges (times the Coulomb constant)
+ * @param n Number of charged particles
+ ******************************************************************************/
+static double pme_grid_error(double h, double length, double alpha, double q2, int n)
+{
+	static const double acons[4] = {1.0/4320.0, 3.0/1936.0, 7601.0/2271360.0, 143.0/28800.0};
+	double ha = h*alpha;
+	double sum = 0;
+	for (int m = 0; m < 4; ++m)
+	{
+		sum += acons[m]*std::pow(ha, 2*m);
+	}
+	return q2*std::pow(ha, 4)*std::sqrt(alpha*length*std::sqrt(2*M_PI)*sum/n)/(length*length);
+}
+
+/*******************************************************************************
+ * \brief Cardinal B-spline weights of order PME_ORDER of a particle at fractional grid offset w (0 <= w < 1)
+ *
+ * theta[j] = \f$ M_n(w + j) \f$ is the weight of the grid point base - j, and dtheta[j] its derivative with respect to w.
+ ******************************************************************************/
+static void pme_spline(double w, double* theta, double* dtheta)
+{
+	const int n = PME_ORDER;
+	double c[PME_ORDER];
+	for (int j = 0; j < n; ++j)
+	{
+		c[j] = 0;
+	}
+	c[0] = w;
+	c[1] = 1 - w;
+	for (int order = 3; order <= n; ++order)
+	{
+		if(order == n)
+		{
+			//M_n'(x) = M_{n-1}(x) - M_{n-1}(x-1)
+			dtheta[0] = c[0];
+			for (int j = 1; j < n; ++j)
+			{
+				dtheta[j] = c[j] - c[j-1];
+			}
+		}
+		for (int j = order-1; j > 0; --j)
+		{
+			c[j] = ((w + j)*c[j] + (order - w - j)*c[j-1])/(order - 1);
+		}
+		c[0] = w*c[0]/(order - 1);
+	}
+	for (int j = 0; j < n; ++j)
+	{
+		theta[j] = c[j];
+	}
+}
+
+#ifndef MDGEN_FFTW
+/*******************************************************************************
+ * \brief In-place complex FFT of a contiguous line of length n = 2^a 3^b 5^c (recursive, mixed radix, decimation in time)
+ *
+ * Unnormalized, with the sign of FFTW (forward \f$ e^{-2\pi i jk/n} \f$ for sign = -1).
+ * twiddle holds \f$ e^{sign 2\pi i j/N} \f$ for j < N, of which n divides N (step = N/n); work holds n entries.
+ ******************************************************************************/
+static void pme_fft_line(cplx* a, int n, const cplx* twiddle, int step, cplx* work)
+{
+	if(n == 1)
+	{
+		return;
+	}
+	int p = (n%2 == 0) ? 2 : ((n%3 == 0) ? 3 : 5);
+	int m = n/p;
+	const int N = n*step;
+
+	//Decimated sequences r, r + p, ... as consecutive blocks, each transformed in place
+	for (int r = 0; r < p; ++r)
+	{
+		for (int k = 0; k < m; ++k)
+		{
+			work[r*m + k] = a[k*p + r];
+		}
+	}
+	for (int r = 0; r < p; ++r)
+	{
+		pme_fft_line(work + r*m, m, twiddle, step*p, a);
+	}
+
+	//Butterflies of radix p : X[k + q m] = sum_r w_n^{r(k + q m)} Y_r[k]
+	for (int k = 0; k < m; ++k)
+	{
+		cplx t[5];
+		for (int r = 0; r < p; ++r)
+		{
+			t[r] = work[r*m + k]*twiddle[(long)r*k*step%N];
+		}
+		for (int q = 0; q < p; ++q)
+		{
+			cplx s = t[0];
+			for (int r = 1; r < p; ++r)
+			{
+				s += t[r]*twiddle[(long)r*q*m*step%N];
+			}
+			a[k + q*m] = s;
+		}
+	}
+}
+
+// Twiddle factors e^{sign 2 pi i j/n} of pme_fft_line()
+static std::vector<cplx> pme_twiddle(int n, int sign)
+{
+	std::vector<cplx> w(n);
+	for (int j = 0; j < n; ++j)
+	{
+		w[j] = std::polar(1.0, sign*2*M_PI*j/n);
+	}
+	return w;
+}
+
+// Complex FFT of the lines along x or y (dimension d) of the half transform, in parallel over the lines
+static void pme_fft_columns(System::pme_state& pme, int d, int sign)
+{
+	const int n0 = pme.grid[0], n1 = pme.grid[1], nh = pme.grid[2]/2 + 1;
+	const int n = pme.grid[d];
+	const int lines = (d == 0) ? n1*nh : n0*nh;
+	const long stride = (d == 0) ? (long)n1*nh : nh;
+	std::vector<cplx> twiddle = pme_twiddle(n, sign);
+	cplx* data = pme.transform.data();
+
+	#pragma omp parallel
+	{
+		std::vector<cplx> line(n), work(n);
+		#pragma omp for schedule(static)
+		for (int l = 0; l < lines; ++l)
+		{
+			//Lines along x start at (0, y, z), lines along y at (x, 0, z)
+			long start = (d == 0) ? l : (long)(l/nh)*n1*nh + l%nh;
+			for (int i = 0; i < n; ++i)
+			{
+				line[i] = data[start + i*stride];
+			}
+			pme_fft_line(line.data(), n, twiddle.data(), 1, work.data());
+			for (int i = 0; i < n; ++i)
+			{
+				data[start + i*stride] = line[i];
+			}
+		}
+	}
+}
+#endif
+
+// Real to complex transform of charge_grid into transform (as fftw_plan_dft_r2c_3d)
+static void pme_forward(System::pme_state& pme)
+{
+#ifdef MDGEN_FFTW
+	fftw_execute_dft_r2c(pme.forward.get(), pme.charge_grid.data(), reinterpret_cast<fftw_complex*>(pme.transform.data()));
+#else
+	const int n2 = pme.grid[2], nh = n2/2 + 1;
+	const int lines = pme.grid[0]*pme.grid[1];
+	std::vector<cplx> twiddle = pme_twiddle(n2, -1);
+
+	#pragma omp parallel
+	{
+		std::vector<cplx> line(n2), work(n2);
+		#pragma omp for schedule(static)
+		for (int l = 0; l < lines; ++l)
+		{
+			const double* in = pme.charge_grid.data() + (long)l*n2;
+			for (int z = 0; z < n2; ++z)
+			{
+				line[z] = in[z];
+			}
+			pme_fft_line(line.data(), n2, twiddle.data(), 1, work.data());
+			std::copy(line.begin(), line.begin() + nh, pme.transform.begin() + (long)l*nh);
+		}
+	}
+	pme_fft_columns(pme, 1, -1);
+	pme_fft_columns(pme, 0, -1);
+#endif
+}
+
+// Complex to real transform of transform back into charge_grid (as fftw_plan_dft_c2r_3d, unnormalized)
+static void pme_backward(System::pme_state& pme)
+{
+#ifdef MDGEN_FFTW
+	fftw_execute_dft_c2r(pme.backward.get(), reinterpret_cast<fftw_complex*>(pme.transform.data()), pme.charge_grid.data());
+#else
+	pme_fft_columns(pme, 0, 1);
+	pme_fft_columns(pme, 1, 1);
+	const int n2 = pme.grid[2], nh = n2/2 + 1;
+	const int lines = pme.grid[0]*pme.grid[1];
+	std::vector<cplx> twiddle = pme_twiddle(n2, 1);
+
+	#pragma omp parallel
+	{
+		std::vector<cplx> line(n2), work(n2);
+		#pragma omp for schedule(static)
+		for (int l = 0; l < lines; ++l)
+		{
+			//The other half of the line is hermitian to the stored one
+			const cplx* in = pme.transform.data() + (long)l*nh;
+			for (int z = 0; z < nh; ++z)
+			{
+				line[z] = in[z];
+			}
+			for (int z = nh; z < n2; ++z)
+			{
+				line[z] = std::conj(in[n2 - z]);
+			}
+			pme_fft_line(line.data(), n2, twiddle.data(), 1, work.data());
+			double* out = pme.charge_grid.data() + (long)l*n2;
+			for (int z = 0; z < n2; ++z)
+			{
+				out[z] = line[z].real();
+			}
+		}
+	}
+#endif
+}
+
+// |b(m)|^2 of the Euler exponential splines along a dimension of K points (Essmann et al., 1995)
+static std::vector<double> pme_bspline_moduli(int K)
+{
+	double theta[PME_ORDER], dtheta[PME_ORDER];
+	pme_spline(0, theta, dtheta); //theta[j] = M_n(j), of which M_n(k+1) for k = 0 .. n-2 are used
+	std::vector<double> mod(K);
+	for (int m = 0; m < K; ++m)
+	{
+		cplx s = 0;
+		for (int k = 0; k + 1 < PME_ORDER; ++k)
+		{
+			s += theta[k+1]*std::polar(1.0, 2*M_PI*m*k/K);
+		}
+		mod[m] = std::norm(s);
+	}
+	//Odd orders vanish at m = K/2 : the neighbours are averaged instead
+	for (int m = 0; m < K; ++m)
+	{
+		if(mod[m] < 1e-7)
+		{
+			mod[m] = 0.5*(mod[(m-1+K)%K] + mod[(m+1)%K]);
+		}
+	}
+	for (int m = 0; m < K; ++m)
+	{
+		mod[m] = 1/mod[m];
+	}
+	return mod;
+}
+
+// Influence function and virial factors of the half transform for the box of lengths L
+static void pme_influence(System::pme_state& pme, const double* L)
+{
+	const int n0 = pme.grid[0], n1 = pme.grid[1], n2 = pme.grid[2], nh = n2/2 + 1;
+	const double vol = L[0]*L[1]*L[2];
+	const double a2 = pme.alpha*pme.alpha;
+	std::vector<double> b0 = pme_bspline_moduli(n0), b1 = pme_bspline_moduli(n1), b2 = pme_bspline_moduli(n2);
+
+	#pragma omp parallel for schedule(static)
+	for (int x = 0; x < n0; ++x)
+	{
+		double mx = ((x <= n0/2) ? x : x - n0)/L[0];
+		for (int y = 0; y < n1; ++y)
+		{
+			double my = ((y <= n1/2) ? y : y - n1)/L[1];
+			for (int z = 0; z < nh; ++z)
+			{
+				double mz = z/L[2];
+				long g = ((long)x*n1 + y)*nh + z;
+				double m2 = mx*mx + my*my + mz*mz;
+				if(m2 == 0)
+				{
+					pme.influence[g] = 0;
+					pme.influence_virial[g] = 0;
+					continue;
+				}
+				pme.influence[g] = pme.coulomb*b0[x]*b1[y]*b2[z]*std::exp(-M_PI*M_PI*m2/a2)/(M_PI*vol*m2);
+				pme.influence_virial[g] = 1 - 2*M_PI*M_PI*m2/a2;
+			}
+		}
+	}
+}
+
+// Sizes the arrays of pme for n charged particles and its grid (and makes the FFTW plans)
+static void pme_allocate(System::pme_state& pme, int n)
+{
+	const int n0 = pme.grid[0], n1 = pme.grid[1], n2 = pme.grid[2], nh = n2/2 + 1;
+	try{
+		pme.charge_grid.assign((long)n0*n1*n2, 0);
+		pme.transform.assign((long)n0*n1*nh, 0);
+		pme.influence.assign((long)n0*n1*nh, 0);
+		pme.influence_virial.assign((long)n0*n1*nh, 0);
+		pme.base.resize(3*n);
+		pme.theta.resize(3*n*PME_ORDER);
+		pme.dtheta.resize(3*n*PME_ORDER);
+		pme.plane_start.resize(n0 + 1);
+		pme.plane_order.resize(n);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+
+#ifdef MDGEN_FFTW
+	//Only the execution of a plan is thread safe in FFTW, so the planner is shared by simulations built on several threads (e.g. the replicas of an ensemble)
+	static std::once_flag threads_ready;
+	std::call_once(threads_ready, fftw_init_threads);
+	std::lock_guard<std::mutex> lock(pme_planner_mutex);
+	fftw_plan_with_nthreads(omp_get_max_threads());
+	fftw_complex* transform = reinterpret_cast<fftw_complex*>(pme.transform.data());
+	pme.forward.reset(fftw_plan_dft_r2c_3d(n0, n1, n2, pme.charge_grid.data(), transform, FFTW_ESTIMATE | FFTW_UNALIGNED), pme_destroy_plan);
+	pme.backward.reset(fftw_plan_dft_c2r_3d(n0, n1, n2, transform, pme.charge_grid.data(), FFTW_ESTIMATE | FFTW_UNALIGNED), pme_destroy_plan);
+#endif
+}
+
+/*******************************************************************************
+ * \brief Reciprocal space part on the grid of pme : spreading, convolution and interpolation
+ *
+ * @param sim Simulation being used
+ * @param pme Grid used (sim.pme, or a trial grid while tuning)
+ * @param x Positions of the charged particles (format [c*3 + dimension]), or NULL for their positions in sim
+ * @param force Reciprocal space forces on the charged particles (format [c*3 + dimension]), or NULL to add them to the accelerations
+ * @param energy If true, the reciprocal energy and virial are found as well
+ * @param erec Reciprocal energy (if energy is true)
+ * @param vir Reciprocal virial (if energy is true)
+ ******************************************************************************/
+static void pme_mesh(System::simulation& sim, System::pme_state& pme, const double* x, double* force, bool energy, double& erec, double& vir)
+{
+	const int n = pme.particle.size()/2;
+	const int n0 = pme.grid[0], n1 = pme.grid[1], n2 = pme.grid[2], nh = n2/2 + 1;
+	const double* L = sim.box_size_limits.data();
+	const int order = PME_ORDER;
+
+	//Spline weights of every charged particle
+	#pragma omp parallel for schedule(static)
+	for (int c = 0; c < n; ++c)
+	{
+		const double* xc = x ? x + 3*c : sim.position[pme.particle[2*c]][pme.particle[2*c+1]].data();
+		for (int d = 0; d < 3; ++d)
+		{
+			double u = pme.grid[d]*xc[d]/L[d];
+			double fl = std::floor(u);
+			pme.base[3*c + d] = ((long)fl%pme.grid[d] + pme.grid[d])%pme.grid[d];
+			pme_spline(u - fl, &pme.theta[(3*c + d)*order], &pme.dtheta[(3*c + d)*order]);
+		}
+	}
+
+	//Counting sort of the particles by the highest plane along x they touch
+	std::fill(pme.plane_start.begin(), pme.plane_start.end(), 0);
+	for (int c = 0; c < n; ++c)
+	{
+		++pme.plane_start[pme.base[3*c] + 1];
+	}
+	for (int p = 0; p < n0; ++p)
+	{
+		pme.plane_start[p+1] += pme.plane_start[p];
+	}
+	{
+		std::vector<int> next(pme.plane_start.begin(), pme.plane_start.end() - 1);
+		for (int c = 0; c < n; ++c)
+		{
+			pme.plane_order[next[pme.base[3*c]]++] = c;
+		}
+	}
+
+	//Spreading : each thread owns planes [p0, p1) along x and only visits the particles reaching them.
+	//Plane p0 + g takes in the particles of plane p0 + g + i at visit bb = g + i, so every grid point adds its terms in the
+	//same order (i, then plane_order) whatever the number of threads
+	#pragma omp parallel
+	{
+		int nt = omp_get_num_threads(), tid = omp_get_thread_num();
+		int p0 = (long)n0*tid/nt, p1 = (long)n0*(tid+1)/nt;
+		double* grid = pme.charge_grid.data();
+		std::fill(grid + (long)p0*n1*n2, grid + (long)p1*n1*n2, 0.0);
+		int planes = (p1 > p0) ? p1 - p0 + order - 1 : 0;
+		for (int bb = 0; bb < planes; ++bb)
+		{
+			int b = (p0 + bb)%n0;
+			for (int s = pme.plane_start[b]; s < pme.plane_start[b+1]; ++s)
+			{
+				int c = pme.plane_order[s];
+				double q = sim.charge[pme.particle[2*c]];
+				const double* tx = &pme.theta[(3*c)*order];
+				const double* ty = &pme.theta[(3*c + 1)*order];
+				const double* tz = &pme.theta[(3*c + 2)*order];
+				for (int i = 0; i < order; ++i)
+				{
+					if(bb - i < 0 || bb - i >= p1 - p0)
+					{
+						continue;
+					}
+					int gx = p0 + bb - i;
+					for (int j = 0; j < order; ++j)
+					{
+						int gy = (pme.base[3*c + 1] - j + n1)%n1;
+						double qxy = q*tx[i]*ty[j];
+						double* row = grid + ((long)gx*n1 + gy)*n2;
+						for (int k = 0; k < order; ++k)
+						{
+							row[(pme.base[3*c + 2] - k + n2)%n2] += qxy*tz[k];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//Convolution with the influence function (and the energy and virial, from the half transform)
+	pme_forward(pme);
+	const long size = (long)n0*n1*nh;
+	double sums[2];
+	reduce_sum(size, 2, sums, [&](long g, double* s)
+	{
+		if(energy)
+		{
+			int z = g%nh;
+			//The terms of the other half, m -> -m, are the same
+			double weight = (z == 0 || 2*z == n2) ? 0.5 : 1;
+			double e = weight*pme.influence[g]*std::norm(pme.transform[g]);
+			s[0] += e;
+			s[1] += e*pme.influence_virial[g];
+		}
+		pme.transform[g] *= pme.influence[g];
+	});
+	pme_backward(pme);
+	erec = sums[0];
+	vir = sums[1];
+
+	//Interpolation of the forces from the potential on the grid
+	#pragma omp parallel for schedule(static)
+	for (int c = 0; c < n; ++c)
+	{
+		int t = pme.particle[2*c], i = pme.particle[2*c+1];
+		const double* tx = &pme.theta[(3*c)*order];
+		const double* ty = &pme.theta[(3*c + 1)*order];
+		const double* tz = &pme.theta[(3*c + 2)*order];
+		const double* dx = &pme.dtheta[(3*c)*order];
+		const double* dy = &pme.dtheta[(3*c + 1)*order];
+		const double* dz = &pme.dtheta[(3*c + 2)*order];
+		double f[3] = {0, 0, 0};
+		for (int a = 0; a < order; ++a)
+		{
+			int gx = (pme.base[3*c] - a + n0)%n0;
+			for (int j = 0; j < order; ++j)
+			{
+				int gy = (pme.base[3*c + 1] - j + n1)%n1;
+				const double* row = pme.charge_grid.data() + ((long)gx*n1 + gy)*n2;
+				for (int k = 0; k < order; ++k)
+				{
+					double phi = row[(pme.base[3*c + 2] - k + n2)%n2];
+					f[0] += phi*dx[a]*ty[j]*tz[k];
+					f[1] += phi*tx[a]*dy[j]*tz[k];
+					f[2] += phi*tx[a]*ty[j]*dz[k];
+				}
+			}
+		}
+		for (int d = 0; d < 3; ++d)
+		{
+			f[d] *= -sim.charge[t]*pme.grid[d]/L[d];
+		}
+		if(force)
+		{
+			for (int d = 0; d < 3; ++d)
+			{
+				force[3*c + d] = f[d];
+			}
+		}
+		else
+		{
+			double* acc = sim.acceleration[t][i].data();
+			for (int d = 0; d < 3; ++d)
+			{
+				acc[d] += f[d]/sim.mass[t];
+			}
+		}
+	}
+}
+
+void pme_update_box(System::simulation& sim)
+{
+	System::pme_state& pme = sim.pme;
+	const double* L = sim.box_size_limits.data();
+	const double vol = L[0]*L[1]*L[2];
+	pme_influence(pme, L);
+
+	//Self energy of the charges and energy of the uniform background neutralizing a net charge
+	double q2 = 0, qnet = 0;
+	for (size_t c = 0; c < pme.particle.size()/2; ++c)
+	{
+		double q = sim.charge[pme.particle[2*c]];
+		q2 += q*q;
+		qnet += q;
+	}
+	double background = -pme.coulomb*M_PI*qnet*qnet/(2*vol*pme.alpha*pme.alpha);
+	pme.energy_self = -pme.coulomb*pme.alpha/std::sqrt(M_PI)*q2 + background;
+	pme.virial_background = 3*background;
+}
+
+void initialize_pme(System::simulation& sim, double accuracy, double cutoff)
+{
+	System::pme_state& pme = sim.pme;
+	bool allowed = sim.n_dimensions == 3 && sim.periodic_boundary == 1 && sim.respa_steps == 1 && accuracy > 0;
+#ifdef MDGEN_MPI
+	allowed = false;
+#endif
+
+	//Charged particles, and the cutoff of the real space part
+	double q2 = 0;
+	double max_cutoff = 0;
+	pme.particle.clear();
+	for (int t = 0; t < sim.n_types; ++t)
+	{
+		if(sim.charge[t] == 0)
+		{
+			continue;
+		}
+		for (int j = 0; j < sim.n_particles[t]; ++j)
+		{
+			pme.particle.push_back(t);
+			pme.particle.push_back(j);
+		}
+		q2 += sim.n_particles[t]*sim.charge[t]*sim.charge[t];
+		for (int u = 0; u < sim.n_types; ++u)
+		{
+			if(sim.charge[u] == 0)
+			{
+				continue;
+			}
+			//The real space part is added by the kernel of lj_periodic
+			if(sim.interaction[t][u] != lj_periodic)
+			{
+				allowed = false;
+			}
+			max_cutoff = std::max(max_cutoff, sim.interaction_const[t][u][2]);
+		}
+	}
+	if(cutoff <= 0)
+	{
+		cutoff = max_cutoff;
+	}
+	double half_box = 0.5*(*std::min_element(sim.box_size_limits.begin(), sim.box_size_limits.end()));
+	int n = pme.particle.size()/2;
+	if(!allowed || n == 0 || cutoff <= 0 || cutoff > half_box)
+	{
+		std::cerr<<"Error 0015"<<std::endl;
+		exit(15);
+	}
+
+	//alpha from the real space error at the cutoff, then a first grid from the estimated reciprocal space error
+	const double* L = sim.box_size_limits.data();
+	double target = accuracy*pme.coulomb;
+	q2 *= pme.coulomb;
+	double a = target*std::sqrt(n*cutoff*L[0]*L[1]*L[2])/(2*q2);
+	pme.alpha = (a >= 1) ? (1.35 - 0.15*std::log(accuracy))/cutoff : std::sqrt(-std::log(a))/cutoff;
+	pme.accuracy = accuracy;
+	pme.cutoff = cutoff;
+	for (int d = 0; d < 3; ++d)
+	{
+		int K = pme_nice_size(std::max(PME_ORDER, (int)(L[d]*pme.alpha)));
+		while(pme_grid_error(L[d]/K, L[d], pme.alpha, q2, n) > target)
+		{
+			K = pme_nice_size(K + 1);
+		}
+		pme.grid[d] = K;
+	}
+
+	/*
+	The estimate is that of the ik-differentiated P3M, whose forces converge as h^PME_ORDER. The forces of the analytically
+	differentiated splines only converge as h^(PME_ORDER-1), so the error of this grid is measured on random positions
+	of the same charges (against a grid 3/2 finer) and the grid is refined accordingly.
+	*/
+	{
+		std::vector<double> x(3*n), f(3*n), f_fine(3*n);
+		std::mt19937_64 rng(PME_TUNING_SEED);
+		for (int c = 0; c < n; ++c)
+		{
+			for (int d = 0; d < 3; ++d)
+			{
+				x[3*c + d] = std::uniform_real_distribution<double>(0, L[d])(rng);
+			}
+		}
+		System::pme_state trial = pme;
+		System::pme_state fine = pme;
+		double ratio = 0;
+		for (int d = 0; d < 3; ++d)
+		{
+			fine.grid[d] = pme_nice_size((3*pme.grid[d] + 1)/2);
+			ratio = std::max(ratio, (double)pme.grid[d]/fine.grid[d]);
+		}
+		double erec, vir;
+		pme_allocate(trial, n);
+		pme_influence(trial, L);
+		pme_mesh(sim, trial, x.data(), f.data(), false, erec, vir);
+		pme_allocate(fine, n);
+		pme_influence(fine, L);
+		pme_mesh(sim, fine, x.data(), f_fine.data(), false, erec, vir);
+
+		double err = 0;
+		for (int i = 0; i < 3*n; ++i)
+		{
+			err += (f[i] - f_fine[i])*(f[i] - f_fine[i]);
+		}
+		err = std::sqrt(err/n)/(1 - ratio*ratio*ratio);
+		if(err > target)
+		{
+			double scale = std::cbrt(err/target);
+			for (int d = 0; d < 3; ++d)
+			{
+				pme.grid[d] = pme_nice_size((int)std::ceil(pme.grid[d]*scale));
+			}
+		}
+	}
+
+	pme_allocate(pme, n);
+	pme.active = 1;
+	pme_update_box(sim);
+}
+
+/*******************************************************************************
+ * \brief Takes the reciprocal space term of the excluded pairs (see build_exclusions()) back out
+ *
+ * The grid holds the term \f$ q_i q_j erf(\alpha r)/r \f$ of every pair of charges (for their nearest images), so that of each
+ * excluded pair is subtracted, its real space term being skipped by the kernel. Each particle adds the forces of all its
+ * excluded pairs to its own acceleration, and the energy and virial of each pair are taken once.
+ *
+ * @param sim Simulation being used
+ * @param epot Energy of the excluded pairs, subtracted
+ * @param vir Virial of the excluded pairs, subtracted
+ ******************************************************************************/
+static void pme_exclusions(System::simulation& sim, double& epot, double& vir)
+{
+	const std::vector<int>& offset = sim.exclusion_offset;
+	const int* start = sim.exclusion_start.data();
+	const double alpha = sim.pme.alpha;
+	const double two_alpha_pi = 2*alpha/std::sqrt(M_PI);
+	const double* L = sim.box_size_limits.data();
+	double sums[2];
+	reduce_sum(offset[sim.n_types], 2, sums, [&](long g, double* s)
+	{
+		if(start[g] == start[g+1])
+		{
+			return;
+		}
+		const int t1 = std::upper_bound(offset.begin(), offset.end(), (int)g) - offset.begin() - 1;
+		const int i = g - offset[t1];
+		if(sim.charge[t1] == 0)
+		{
+			return;
+		}
+		double acc[3] = {0, 0, 0};
+		for (int e = start[g]; e < start[g+1]; ++e)
+		{
+			const int g2 = sim.exclusion[e];
+			const int t2 = std::upper_bound(offset.begin(), offset.end(), g2) - offset.begin() - 1;
+			const int j = g2 - offset[t2];
+			const double qq = sim.pme.coulomb*sim.charge[t1]*sim.charge[t2];
+			if(qq == 0)
+			{
+				continue;
+			}
+			double x[3];
+			double r2 = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				x[k] = sim.position[t1][i][k] - sim.position[t2][j][k];
+				x[k] -= L[k]*std::round(x[k]/L[k]);
+				r2 += x[k]*x[k];
+			}
+			const double r = std::sqrt(r2);
+			const double u = qq*std::erf(alpha*r)/r;
+			//Force over r of the term -u
+			const double f = (qq*two_alpha_pi*std::exp(-alpha*alpha*r2) - u)/r2;
+			if(g2 > g)
+			{
+				s[0] += u;
+				s[1] -= f*r2;
+			}
+			for (int k = 0; k < 3; ++k)
+			{
+				acc[k] += f*x[k];
+			}
+		}
+		double* a = sim.acceleration[t1][i].data();
+		for (int k = 0; k < 3; ++k)
+		{
+			a[k] += acc[k]/sim.mass[t1];
+		}
+	}, 64);
+	epot = sums[0];
+	vir = sums[1];
+}
+
+void pme_reciprocal(System::simulation& sim)
+{
+	double erec, vir;
+	pme_mesh(sim, sim.pme, NULL, NULL, sim.energy_due, erec, vir);
+	double eexcl = 0, virexcl = 0;
+	if(!sim.exclusion_start.empty())
+	{
+		pme_exclusions(sim, eexcl, virexcl);
+	}
+	if(sim.energy_due)
+	{
+		sim.energy_potential += erec - eexcl + sim.pme.energy_self;
+		sim.virial += vir - virexcl + sim.pme.virial_background;
+	}
+}
@@ -0,0 +1,761 @@
+/** @file */
+// Python extension module mdgen (built by make python). The per-particle arrays and the vectors of the observables are handed
+// to Python through the buffer protocol and wrapped by NumPy without copies, so they alias the memory of the engine.
+// Errors of the engine (Error 00NN) are not turned into exceptions : they still print the code and exit the process.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "system.h"
+#include "initialize.h"
+#include "interaction.h"
+#include "thermostat.h"
+#include "barostat.h"
+#include "thermo.h"
+#include "sample.h"
+#include "step.h"
+#include "correlations.h"
+#include "stream.h"
+
+static PyObject* numpy_asarray = NULL; ///< numpy.asarray, which wraps a buffer without copying it
+
+/*******************************************************************************
+ * \brief Buffer over memory of a simulation (mdgen._Array)
+ *
+ * Holds a reference to the mdgen.Simulation owning the memory, so NumPy arrays made from it keep the simulation alive.
+ ******************************************************************************/
+struct py_array
+{
+	PyObject_HEAD
+	PyObject* owner; ///< mdgen.Simulation the memory belongs to
+	void* data; ///< First element
+	const char* format; ///< Struct format of the elements ("d" or "i")
+	Py_ssize_t itemsize; ///< Size of an element
+	int ndim; ///< 1 or 2
+	Py_ssize_t shape[2]; ///< Elements along each axis
+	Py_ssize_t strides[2]; ///< Bytes between two elements along each axis
+};
+
+/*******************************************************************************
+ * \brief Python object of a simulation (mdgen.Simulation)
+ ******************************************************************************/
+struct py_simulation
+{
+	PyObject_HEAD
+	System::simulation* sim; ///< The engine (owned)
+	int running; ///< 1 while a step() or run() without the GIL is under way
+	int initialized; ///< 1 once initialize() has set up the interactions, thermostats and forces (reset when they are changed)
+};
+
+static void py_array_dealloc(py_array* self)
+{
+	Py_XDECREF(self->owner);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int py_array_getbuffer(py_array* self, Py_buffer* view, int flags)
+{
+	bool contiguous = (self->strides[self->ndim - 1] == self->itemsize) && (self->ndim == 1 || self->strides[0] == self->shape[1]*self->itemsize);
+	if(!contiguous && (flags & PyBUF_STRIDES) != PyBUF_STRIDES)
+	{
+		PyErr_SetString(PyExc_BufferError, "mdgen: the rows are not contiguous, strides are needed");
+		return -1;
+	}
+	view->buf = self->data;
+	view->obj = (PyObject*)self;
+	Py_INCREF(self);
+	view->len = self->itemsize;
+	for (int a = 0; a < self->ndim; ++a)
+	{
+		view->len *= self->shape[a];
+	}
+	view->readonly = 0;
+	view->itemsize = self->itemsize;
+	view->format = (flags & PyBUF_FORMAT) ? (char*)self->format : NULL;
+	view->ndim = self->ndim;
+	view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+	view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	return 0;
+}
+
+static PyBufferProcs py_array_buffer = {(getbufferproc)py_array_getbuffer, NULL};
+
+static PyTypeObject py_array_type = {PyVarObject_HEAD_INIT(NULL, 0) "mdgen._Array"};
+
+/*******************************************************************************
+ * \brief Returns a NumPy array aliasing n x width elements of size itemsize, with rows stride bytes apart
+ *
+ * @param owner mdgen.Simulation the memory belongs to
+ * @param data First element
+ * @param format Struct format of the elements
+ * @param itemsize Size of an element
+ * @param n Rows (or elements if width is 0)
+ * @param width Elements in a row (0 : one dimensional array)
+ * @param stride Bytes between two rows
+ ******************************************************************************/
+static PyObject* py_alias(PyObject* owner, void* data, const char* format, Py_ssize_t itemsize, Py_ssize_t n, Py_ssize_t width, Py_ssize_t stride)
+{
+	static double empty[1];
+	py_array* a = PyObject_New(py_array, &py_array_type);
+	if(a == NULL)
+	{
+		return NULL;
+	}
+	Py_INCREF(owner);
+	a->owner = owner;
+	a->data = (data != NULL) ? data : empty;
+	a->format = format;
+	a->itemsize = itemsize;
+	a->ndim = (width > 0) ? 2 : 1;
+	a->shape[0] = n;
+	a->shape[1] = width;
+	a->strides[0] = (width > 0) ? stride : itemsize;
+	a->strides[1] = itemsize;
+	PyObject* array = PyObject_CallFunctionObjArgs(numpy_asarray, (PyObject*)a, NULL);
+	Py_DECREF(a);
+	return array;
+}
+
+/*******************************************************************************
+ * \brief Returns a NumPy array (n_particles x width) aliasing the rows of one type of a per-particle array
+ *
+ * The rows are allocated one after the other in the particle arena, so they are evenly spaced. If they are not
+ * (e.g. the arena was full and some came from the heap), no view is possible and BufferError is raised.
+ ******************************************************************************/
+template <class Rows>
+static PyObject* py_rows(PyObject* owner, Rows& rows, const char* format, Py_ssize_t width)
+{
+	typedef typename Rows::value_type::value_type T;
+	static T empty[1];
+	const Py_ssize_t n = rows.size();
+	T* first = (n > 0) ? rows[0].data() : empty;
+	const Py_ssize_t stride = (n > 1) ? (char*)rows[1].data() - (char*)first : width*(Py_ssize_t)sizeof(T);
+	for (Py_ssize_t j = 0; j < n; ++j)
+	{
+		if((char*)rows[j].data() != (char*)first + j*stride || (Py_ssize_t)rows[j].size() < width)
+		{
+			PyErr_SetString(PyExc_BufferError, "mdgen: the rows of this array are not evenly spaced in memory");
+			return NULL;
+		}
+	}
+	return py_alias(owner, first, format, sizeof(T), n, width, stride);
+}
+
+// Returns the simulation of self, or NULL (with RuntimeError) if it was not built or while it is being stepped without the GIL
+static System::simulation* py_sim(py_simulation* self)
+{
+	if(self->sim == NULL)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "mdgen: the simulation was not built");
+		return NULL;
+	}
+	if(self->running)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "mdgen: the simulation is being stepped in another thread");
+		return NULL;
+	}
+	return self->sim;
+}
+
+// Returns the simulation of self as py_sim(), or NULL (with RuntimeError) if initialize() has not been called since the last change
+static System::simulation* py_sim_initialized(py_simulation* self)
+{
+	System::simulation* sim = py_sim(self);
+	if(sim != NULL && !self->initialized)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "mdgen: initialize() must be called first");
+		return NULL;
+	}
+	return sim;
+}
+
+// Checks a particle type
+static bool py_type_valid(System::simulation* sim, int type)
+{
+	if(type < 0 || type >= sim->n_types)
+	{
+		PyErr_SetString(PyExc_IndexError, "mdgen: no such particle type");
+		return false;
+	}
+	return true;
+}
+
+static void py_simulation_dealloc(py_simulation* self)
+{
+	delete self->sim;
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* py_simulation_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+{
+	py_simulation* self = (py_simulation*)type->tp_alloc(type, 0);
+	if(self != NULL)
+	{
+		self->sim = NULL;
+		self->running = 0;
+		self->initialized = 0;
+	}
+	return (PyObject*)self;
+}
+
+/*******************************************************************************
+ * Simulation(input, box) : input is the comma separated input string of System::input_params, box the size of the box along each dimension
+ ******************************************************************************/
+static int py_simulation_init(py_simulation* self, PyObject* args, PyObject* kwds)
+{
+	static const char* keywords[] = {"input", "box", NULL};
+	const char* input;
+	PyObject* box;
+	if(!PyArg_ParseTupleAndKeywords(args, kwds, "sO", (char**)keywords, &input, &box))
+	{
+		return -1;
+	}
+	//The arrays handed out alias the memory of the simulation, so it is never replaced
+	if(self->sim != NULL)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "mdgen: the simulation is already built");
+		return -1;
+	}
+	PyObject* seq = PySequence_Fast(box, "mdgen: box must be a sequence of numbers");
+	if(seq == NULL)
+	{
+		return -1;
+	}
+	std::vector<double> size(PySequence_Fast_GET_SIZE(seq));
+	for (size_t k = 0; k < size.size(); ++k)
+	{
+		size[k] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, k));
+	}
+	Py_DECREF(seq);
+	if(PyErr_Occurred())
+	{
+		return -1;
+	}
+
+	try{
+		System::input_params params(input);
+		if(params.n_types < 1 || params.n_dimensions < 1 || (int)size.size() != params.n_dimensions)
+		{
+			PyErr_SetString(PyExc_ValueError, "mdgen: the box needs one size per dimension");
+			return -1;
+		}
+	}
+	catch(const std::exception& e){
+		PyErr_SetString(PyExc_ValueError, "mdgen: the input string is not valid");
+		return -1;
+	}
+	self->sim = new System::simulation(input, size.data());
+	return 0;
+}
+
+/*******************************************************************************
+ * set_interaction(type1, type2, name, constants) : name is free_particles, lj_periodic, lj_box or hard_sphere,
+ * constants the first entries of interaction_const (for Lennard-Jones epsilon, sigma, r_cut). Both orders of the pair are set.
+ ******************************************************************************/
+static PyObject* py_set_interaction(py_simulation* self, PyObject* args)
+{
+	int t1, t2;
+	const char* name;
+	PyObject* constants = NULL;
+	if(!PyArg_ParseTuple(args, "iis|O", &t1, &t2, &name, &constants))
+	{
+		return NULL;
+	}
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL || !py_type_valid(sim, t1) || !py_type_valid(sim, t2))
+	{
+		return NULL;
+	}
+
+	void (*f)(System::simulation&, int, int);
+	if(!std::strcmp(name, "free_particles")) f = free_particles;
+	else if(!std::strcmp(name, "lj_periodic")) f = lj_periodic;
+	else if(!std::strcmp(name, "lj_box")) f = lj_box;
+	else if(!std::strcmp(name, "hard_sphere")) f = hard_sphere;
+	else
+	{
+		PyErr_SetString(PyExc_ValueError, "mdgen: unknown interaction");
+		return NULL;
+	}
+
+	std::vector<double> c;
+	if(constants != NULL)
+	{
+		PyObject* seq = PySequence_Fast(constants, "mdgen: constants must be a sequence of numbers");
+		if(seq == NULL)
+		{
+			return NULL;
+		}
+		for (Py_ssize_t q = 0; q < PySequence_Fast_GET_SIZE(seq); ++q)
+		{
+			c.push_back(PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, q)));
+		}
+		Py_DECREF(seq);
+		if(PyErr_Occurred())
+		{
+			return NULL;
+		}
+	}
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		int a = pass ? t2 : t1, b = pass ? t1 : t2;
+		sim->interaction[a][b] = f;
+		std::vector<double>& dest = sim->interaction_const[a][b];
+		if(dest.size() < c.size())
+		{
+			dest.resize(c.size(), 0);
+		}
+		std::copy(c.begin(), c.end(), dest.begin());
+	}
+	self->initialized = 0;
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * set_thermostat(type, name, constant=0) : name is no_thermostat, anderson (constant nu) or bussi (constant tau)
+ ******************************************************************************/
+static PyObject* py_set_thermostat(py_simulation* self, PyObject* args)
+{
+	int type;
+	const char* name;
+	double constant = 0;
+	if(!PyArg_ParseTuple(args, "is|d", &type, &name, &constant))
+	{
+		return NULL;
+	}
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL || !py_type_valid(sim, type))
+	{
+		return NULL;
+	}
+	if(!std::strcmp(name, "no_thermostat")) sim->thermostat[type] = no_thermostat;
+	else if(!std::strcmp(name, "anderson")) sim->thermostat[type] = anderson;
+	else if(!std::strcmp(name, "bussi")) sim->thermostat[type] = bussi;
+	else
+	{
+		PyErr_SetString(PyExc_ValueError, "mdgen: unknown thermostat");
+		return NULL;
+	}
+	sim->thermostat_const[type][0] = constant;
+	self->initialized = 0;
+	Py_RETURN_NONE;
+}
+
+// randomize() : random positions and velocities at the required temperatures (init_sim())
+static PyObject* py_randomize(py_simulation* self, PyObject* args)
+{
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	init_sim(*sim);
+	Py_RETURN_NONE;
+}
+
+/*******************************************************************************
+ * initialize() : sets up the interactions and thermostats once they are all given, then computes the accelerations,
+ * energies and virial at the current positions (so the first step starts from valid forces)
+ ******************************************************************************/
+static PyObject* py_initialize(py_simulation* self, PyObject* args)
+{
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	for (int i = 0; i < sim->n_types; ++i)
+	{
+		if(sim->thermostat[i] == NULL)
+		{
+			sim->thermostat[i] = no_thermostat;
+		}
+		for (int j = 0; j < sim->n_types; ++j)
+		{
+			if(sim->interaction[i][j] == NULL)
+			{
+				PyErr_SetString(PyExc_ValueError, "mdgen: not all interactions have been given");
+				return NULL;
+			}
+		}
+	}
+	initialize_interactions(*sim);
+	initialize_thermostats(*sim);
+	self->running = 1;
+	Py_BEGIN_ALLOW_THREADS
+	sim->energy_due = 1;
+	interact(*sim);
+	Py_END_ALLOW_THREADS
+	self->running = 0;
+	self->initialized = 1;
+	Py_RETURN_NONE;
+}
+
+// step(n=1) : advances by n timesteps (md_steps()), without the GIL, once initialize() has been called
+static PyObject* py_step(py_simulation* self, PyObject* args)
+{
+	int n = 1;
+	if(!PyArg_ParseTuple(args, "|i", &n))
+	{
+		return NULL;
+	}
+	System::simulation* sim = py_sim_initialized(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	self->running = 1;
+	Py_BEGIN_ALLOW_THREADS
+	md_steps(*sim, n);
+	Py_END_ALLOW_THREADS
+	self->running = 0;
+	Py_RETURN_NONE;
+}
+
+// run() : runs all the remaining timesteps (md_run()), without the GIL, once initialize() has been called
+static PyObject* py_run(py_simulation* self, PyObject* args)
+{
+	System::simulation* sim = py_sim_initialized(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	self->running = 1;
+	Py_BEGIN_ALLOW_THREADS
+	md_run(*sim);
+	Py_END_ALLOW_THREADS
+	self->running = 0;
+	Py_RETURN_NONE;
+}
+
+// Observable which only asks for the energies (see sample_energies())
+static void py_energies(System::simulation& sim)
+{
+}
+
+// sample_energies(stride) : the energies, temperatures and virial are computed every stride timesteps (see register_observable())
+static PyObject* py_sample_energies(py_simulation* self, PyObject* args)
+{
+	int stride;
+	if(!PyArg_ParseTuple(args, "i", &stride))
+	{
+		return NULL;
+	}
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	if(stride < 1)
+	{
+		PyErr_SetString(PyExc_ValueError, "mdgen: the stride must be >= 1");
+		return NULL;
+	}
+	register_observable(*sim, py_energies, stride, 1);
+	Py_RETURN_NONE;
+}
+
+// sample_msd() : the mean squared displacement is sampled every msd_stride timesteps (see initialize_msd())
+static PyObject* py_sample_msd(py_simulation* self, PyObject* args)
+{
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	initialize_msd(*sim);
+	register_observable(*sim, sample_msd, sim->msd_stride, 0);
+	Py_RETURN_NONE;
+}
+
+// open_live_stream(name, stride, min_interval, fields, slots) : publishes frames to the shared memory object /name (see open_live_stream())
+static PyObject* py_open_live_stream(py_simulation* self, PyObject* args)
+{
+	const char* name;
+	int stride = STREAM_STRIDE, fields = STREAM_POSITIONS | STREAM_ENERGIES, slots = STREAM_SLOTS;
+	double min_interval = STREAM_MIN_INTERVAL;
+	if(!PyArg_ParseTuple(args, "s|idii", &name, &stride, &min_interval, &fields, &slots))
+	{
+		return NULL;
+	}
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	//Checked here so that a bad argument is an exception rather than Error 0018
+	if(stride < 1 || slots < 2 || min_interval < 0 || (fields & (STREAM_POSITIONS | STREAM_VELOCITIES | STREAM_ENERGIES)) == 0 || *name == 0 || std::strchr(name, '/') != NULL || sim->stream.active)
+	{
+		PyErr_SetString(PyExc_ValueError, "mdgen: invalid live stream (or one is already open)");
+		return NULL;
+	}
+	open_live_stream(*sim, name, stride, min_interval, fields, slots);
+	Py_RETURN_NONE;
+}
+
+// close_live_stream() : stops publishing and unlinks the shared memory
+static PyObject* py_close_live_stream(py_simulation* self, PyObject* args)
+{
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	close_live_stream(*sim);
+	Py_RETURN_NONE;
+}
+
+// msd(type) : copy of the mean squared displacement of a type (n_types : all particles) at every lag
+static PyObject* py_msd(py_simulation* self, PyObject* args)
+{
+	int type;
+	if(!PyArg_ParseTuple(args, "i", &type))
+	{
+		return NULL;
+	}
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	if(sim->msd_count.empty() || type < 0 || type > sim->n_types)
+	{
+		PyErr_SetString(PyExc_IndexError, "mdgen: no such type, or the MSD is not sampled");
+		return NULL;
+	}
+	PyObject* list = PyList_New(sim->msd_length);
+	for (int lag = 0; list != NULL && lag < sim->msd_length; ++lag)
+	{
+		PyList_SET_ITEM(list, lag, PyFloat_FromDouble(msd(*sim, lag, type)));
+	}
+	return list;
+}
+
+// diffusion_coefficient(type) : see diffusion_coefficient()
+static PyObject* py_diffusion_coefficient(py_simulation* self, PyObject* args)
+{
+	int type;
+	if(!PyArg_ParseTuple(args, "i", &type))
+	{
+		return NULL;
+	}
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	if(sim->msd_count.empty() || type < 0 || type > sim->n_types)
+	{
+		PyErr_SetString(PyExc_IndexError, "mdgen: no such type, or the MSD is not sampled");
+		return NULL;
+	}
+	return PyFloat_FromDouble(diffusion_coefficient(*sim, type));
+}
+
+// pressure() : pressure of the last timestep in which the energies were computed (see compute_pressure())
+static PyObject* py_pressure(py_simulation* self, PyObject* args)
+{
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	compute_pressure(*sim);
+	return PyFloat_FromDouble(sim->pressure);
+}
+
+// Per-particle arrays of a type : position(type), velocity(type), acceleration(type), image(type)
+#define PY_PARTICLE_ARRAY(name, member, format) \
+static PyObject* py_##name(py_simulation* self, PyObject* args) \
+{ \
+	int type; \
+	if(!PyArg_ParseTuple(args, "i", &type)) \
+	{ \
+		return NULL; \
+	} \
+	System::simulation* sim = py_sim(self); \
+	if(sim == NULL || !py_type_valid(sim, type)) \
+	{ \
+		return NULL; \
+	} \
+	return py_rows((PyObject*)self, sim->member[type], format, sim->n_dimensions); \
+}
+
+PY_PARTICLE_ARRAY(position, position, "d")
+PY_PARTICLE_ARRAY(velocity, velocity, "d")
+PY_PARTICLE_ARRAY(acceleration, acceleration, "d")
+PY_PARTICLE_ARRAY(image, image, "i")
+
+// Vectors of the simulation, aliased as one dimensional arrays
+#define PY_VECTOR(name, member) \
+static PyObject* py_get_##name(py_simulation* self, void* closure) \
+{ \
+	System::simulation* sim = py_sim(self); \
+	if(sim == NULL) \
+	{ \
+		return NULL; \
+	} \
+	return py_alias((PyObject*)self, sim->member.data(), "d", sizeof(double), sim->member.size(), 0, 0); \
+}
+
+PY_VECTOR(energy_kinetic, energy_kinetic)
+PY_VECTOR(temperature, temperature)
+PY_VECTOR(momentum, momentum)
+PY_VECTOR(box, box_size_limits)
+PY_VECTOR(mass, mass)
+PY_VECTOR(charge, charge)
+PY_VECTOR(temperature_required, temperature_required)
+
+// Scalars of the simulation
+#define PY_SCALAR(name, convert) \
+static PyObject* py_get_##name(py_simulation* self, void* closure) \
+{ \
+	System::simulation* sim = py_sim(self); \
+	if(sim == NULL) \
+	{ \
+		return NULL; \
+	} \
+	return convert(sim->name); \
+}
+
+PY_SCALAR(n_types, PyLong_FromLong)
+PY_SCALAR(n_dimensions, PyLong_FromLong)
+PY_SCALAR(state, PyLong_FromLong)
+PY_SCALAR(total_steps, PyLong_FromLong)
+PY_SCALAR(time, PyFloat_FromDouble)
+PY_SCALAR(timestep, PyFloat_FromDouble)
+PY_SCALAR(runtime, PyFloat_FromDouble)
+PY_SCALAR(energy_potential, PyFloat_FromDouble)
+PY_SCALAR(energy_total, PyFloat_FromDouble)
+PY_SCALAR(virial, PyFloat_FromDouble)
+PY_SCALAR(seed, PyLong_FromUnsignedLong)
+
+static PyObject* py_get_n_particles(py_simulation* self, void* closure)
+{
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return NULL;
+	}
+	PyObject* t = PyTuple_New(sim->n_types);
+	for (int i = 0; t != NULL && i < sim->n_types; ++i)
+	{
+		PyTuple_SET_ITEM(t, i, PyLong_FromLong(sim->n_particles[i]));
+	}
+	return t;
+}
+
+static int py_set_seed(py_simulation* self, PyObject* value, void* closure)
+{
+	System::simulation* sim = py_sim(self);
+	if(sim == NULL)
+	{
+		return -1;
+	}
+	unsigned long seed = PyLong_AsUnsignedLong(value);
+	if(PyErr_Occurred())
+	{
+		return -1;
+	}
+	sim->seed = seed;
+	return 0;
+}
+
+static PyMethodDef py_simulation_methods[] = {
+	{"set_interaction", (PyCFunction)py_set_interaction, METH_VARARGS, "set_interaction(type1, type2, name, constants) : free_particles, lj_periodic, lj_box or hard_sphere between two types"},
+	{"set_thermostat", (PyCFunction)py_set_thermostat, METH_VARARGS, "set_thermostat(type, name, constant=0) : no_thermostat, anderson (nu) or bussi (tau)"},
+	{"randomize", (PyCFunction)py_randomize, METH_NOARGS, "Random positions and velocities at the required temperatures"},
+	{"initialize", (PyCFunction)py_initialize, METH_NOARGS, "Sets up the interactions and thermostats and computes the forces and energies"},
+	{"step", (PyCFunction)py_step, METH_VARARGS, "step(n=1) : advances by n timesteps (the GIL is released)"},
+	{"run", (PyCFunction)py_run, METH_NOARGS, "Runs all the remaining timesteps (the GIL is released)"},
+	{"sample_energies", (PyCFunction)py_sample_energies, METH_VARARGS, "sample_energies(stride) : computes the energies every stride timesteps"},
+	{"sample_msd", (PyCFunction)py_sample_msd, METH_NOARGS, "Samples the mean squared displacement every msd_stride timesteps"},
+	{"open_live_stream", (PyCFunction)py_open_live_stream, METH_VARARGS, "open_live_stream(name, stride=10, min_interval=0.05, fields=STREAM_POSITIONS|STREAM_ENERGIES, slots=4) : publishes frames to shared memory (read with GUI/live_stream.py)"},
+	{"close_live_stream", (PyCFunction)py_close_live_stream, METH_NOARGS, "Stops publishing frames and unlinks the shared memory"},
+	{"msd", (PyCFunction)py_msd, METH_VARARGS, "msd(type) : mean squared displacement at every lag (a copy)"},
+	{"diffusion_coefficient", (PyCFunction)py_diffusion_coefficient, METH_VARARGS, "diffusion_coefficient(type) : from the mean squared displacement"},
+	{"pressure", (PyCFunction)py_pressure, METH_NOARGS, "Pressure of the last timestep in which the energies were computed"},
+	{"position", (PyCFunction)py_position, METH_VARARGS, "position(type) : (n_particles, n_dimensions) array aliasing the positions"},
+	{"velocity", (PyCFunction)py_velocity, METH_VARARGS, "velocity(type) : (n_particles, n_dimensions) array aliasing the velocities"},
+	{"acceleration", (PyCFunction)py_acceleration, METH_VARARGS, "acceleration(type) : (n_particles, n_dimensions) array aliasing the accelerations"},
+	{"image", (PyCFunction)py_image, METH_VARARGS, "image(type) : (n_particles, n_dimensions) int32 array aliasing the periodic image counts"},
+	{NULL}
+};
+
+static PyGetSetDef py_simulation_getset[] = {
+	{"energy_kinetic", (getter)py_get_energy_kinetic, NULL, "Kinetic energy (m v^2) of each type (aliased)", NULL},
+	{"temperature", (getter)py_get_temperature, NULL, "Temperature of each type (aliased)", NULL},
+	{"momentum", (getter)py_get_momentum, NULL, "Total momentum (aliased)", NULL},
+	{"box", (getter)py_get_box, NULL, "Size of the box (aliased)", NULL},
+	{"mass", (getter)py_get_mass, NULL, "Mass of each type (aliased)", NULL},
+	{"charge", (getter)py_get_charge, NULL, "Charge of each type (aliased)", NULL},
+	{"temperature_required", (getter)py_get_temperature_required, NULL, "Temperature of the thermostat of each type (aliased)", NULL},
+	{"n_types", (getter)py_get_n_types, NULL, "Number of particle types", NULL},
+	{"n_dimensions", (getter)py_get_n_dimensions, NULL, "Number of dimensions", NULL},
+	{"n_particles", (getter)py_get_n_particles, NULL, "Number of particles of each type", NULL},
+	{"state", (getter)py_get_state, NULL, "Timesteps taken", NULL},
+	{"total_steps", (getter)py_get_total_steps, NULL, "Timesteps of the whole run", NULL},
+	{"time", (getter)py_get_time, NULL, "Simulated time", NULL},
+	{"timestep", (getter)py_get_timestep, NULL, "Timestep", NULL},
+	{"runtime", (getter)py_get_runtime, NULL, "Length of the run", NULL},
+	{"energy_potential", (getter)py_get_energy_potential, NULL, "Potential energy", NULL},
+	{"energy_total", (getter)py_get_energy_total, NULL, "Total energy", NULL},
+	{"virial", (getter)py_get_virial, NULL, "Virial", NULL},
+	{"seed", (getter)py_get_seed, (setter)py_set_seed, "Seed of the random streams (0 : default streams)", NULL},
+	{NULL}
+};
+
+static PyTypeObject py_simulation_type = {PyVarObject_HEAD_INIT(NULL, 0) "mdgen.Simulation"};
+
+static PyModuleDef py_module = {PyModuleDef_HEAD_INIT, "mdgen", "Python bindings of the MDGeneral engine", -1, NULL};
+
+PyMODINIT_FUNC PyInit_mdgen(void)
+{
+	py_array_type.tp_basicsize = sizeof(py_array);
+	py_array_type.tp_dealloc = (destructor)py_array_dealloc;
+	py_array_type.tp_as_buffer = &py_array_buffer;
+	py_array_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	py_array_type.tp_doc = "Buffer over the memory of a simulation (wrapped by NumPy)";
+
+	py_simulation_type.tp_basicsize = sizeof(py_simulation);
+	py_simulation_type.tp_dealloc = (destructor)py_simulation_dealloc;
+	py_simulation_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	py_simulation_type.tp_doc = "Simulation(input, box) : a simulation built from the input string of System::input_params and the size of the box. "
+		"Call initialize() before step() or run(). Errors of the engine print their code (see errorDocumentation.txt) and exit the process";
+	py_simulation_type.tp_methods = py_simulation_methods;
+	py_simulation_type.tp_getset = py_simulation_getset;
+	py_simulation_type.tp_new = py_simulation_new;
+	py_simulation_type.tp_init = (initproc)py_simulation_init;
+
+	if(PyType_Ready(&py_array_type) < 0 || PyType_Ready(&py_simulation_type) < 0)
+	{
+		return NULL;
+	}
+	PyObject* numpy = PyImport_ImportModule("numpy");
+	if(numpy == NULL)
+	{
+		return NULL;
+	}
+	numpy_asarray = PyObject_GetAttrString(numpy, "asarray");
+	Py_DECREF(numpy);
+	if(numpy_asarray == NULL)
+	{
+		return NULL;
+	}
+
+	PyObject* m = PyModule_Create(&py_module);
+	if(m == NULL)
+	{
+		return NULL;
+	}
+	Py_INCREF(&py_simulation_type);
+	PyModule_AddObject(m, "Simulation", (PyObject*)&py_simulation_type);
+	PyModule_AddIntConstant(m, "STREAM_POSITIONS", STREAM_POSITIONS);
+	PyModule_AddIntConstant(m, "STREAM_VELOCITIES", STREAM_VELOCITIES);
+	PyModule_AddIntConstant(m, "STREAM_ENERGIES", STREAM_ENERGIES);
+	return m;
+}
@@ -0,0 +1,577 @@
+/** @file */
+#include <cmath>
+#include <algorithm>
+#include "rigid.h"
+#include "system.h"
+#include "barostat.h"
+#include "reduce.h"
+#include "interaction.h"
+
+// Rotation matrix A of the unit quaternion q (box vector = A * body vector)
+static inline void quaternion_matrix(const double* q, double A[3][3])
+{
+	A[0][0] = q[0]*q[0] + q[1]*q[1] - q[2]*q[2] - q[3]*q[3];
+	A[0][1] = 2*(q[1]*q[2] - q[0]*q[3]);
+	A[0][2] = 2*(q[1]*q[3] + q[0]*q[2]);
+	A[1][0] = 2*(q[1]*q[2] + q[0]*q[3]);
+	A[1][1] = q[0]*q[0] - q[1]*q[1] + q[2]*q[2] - q[3]*q[3];
+	A[1][2] = 2*(q[2]*q[3] - q[0]*q[1]);
+	A[2][0] = 2*(q[1]*q[3] - q[0]*q[2]);
+	A[2][1] = 2*(q[2]*q[3] + q[0]*q[1]);
+	A[2][2] = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
+}
+
+// out = P_k q, the permutations of NO_SQUISH (P_k q = q * e_k, e_k being the unit quaternion of principal axis k)
+static inline void quaternion_permute(int k, const double* q, double* out)
+{
+	switch(k)
+	{
+		case 0:
+			out[0] = -q[1]; out[1] = q[0]; out[2] = q[3]; out[3] = -q[2];
+			break;
+		case 1:
+			out[0] = -q[2]; out[1] = -q[3]; out[2] = q[0]; out[3] = q[1];
+			break;
+		default:
+			out[0] = -q[3]; out[1] = q[2]; out[2] = -q[1]; out[3] = q[0];
+			break;
+	}
+}
+
+// Angular momentum of a body in its principal axes, j_k = (P_k q).p/2
+static inline void body_angular_momentum(const double* q, const double* p, double* j)
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		double pq[4];
+		quaternion_permute(k, q, pq);
+		j[k] = 0.5*(pq[0]*p[0] + pq[1]*p[1] + pq[2]*p[2] + pq[3]*p[3]);
+	}
+}
+
+// Adds dt * sum_k tau_k P_k q to p (tau in the principal axes), which is p = 2 S(q) (0, j) for dt = 1/2 and tau = j
+static inline void momentum_add(const double* q, const double* tau, double dt, double* p)
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		double pq[4];
+		quaternion_permute(k, q, pq);
+		for (int m = 0; m < 4; ++m)
+		{
+			p[m] += dt*tau[k]*pq[m];
+		}
+	}
+}
+
+/*******************************************************************************
+ * Free rotation of a body by dt (NO_SQUISH)
+ * Rotations about the principal axes 3, 2, 1, 2, 3 for dt/2, dt/2, dt, dt/2, dt/2, each of them exact.
+ * The axis of a linear body (zero moment of inertia) is skipped.
+ ******************************************************************************/
+static void no_squish(double* q, double* p, const double* inertia, double dt)
+{
+	const int axis[5] = {2, 1, 0, 1, 2};
+	const double fraction[5] = {0.5, 0.5, 1, 0.5, 0.5};
+	for (int m = 0; m < 5; ++m)
+	{
+		int k = axis[m];
+		if(inertia[k] <= 0)
+		{
+			continue;
+		}
+		double pq[4], pp[4];
+		quaternion_permute(k, q, pq);
+		quaternion_permute(k, p, pp);
+		double zeta = fraction[m]*dt*(p[0]*pq[0] + p[1]*pq[1] + p[2]*pq[2] + p[3]*pq[3])/(4*inertia[k]);
+		double c = std::cos(zeta), s = std::sin(zeta);
+		for (int n = 0; n < 4; ++n)
+		{
+			q[n] = c*q[n] + s*pq[n];
+			p[n] = c*p[n] + s*pp[n];
+		}
+	}
+}
+
+/*******************************************************************************
+ * Places the sites of body b from its centre of mass and orientation (if positions is true), and sets their velocities
+ * to its rigid motion v = V + \omega x r. The quaternion is copied to their orientations.
+ ******************************************************************************/
+static void place_sites(System::simulation& sim, int b, bool positions)
+{
+	System::rigid_body_set& r = sim.rigid;
+	const double* q = &r.quaternion[4*b];
+	double A[3][3], j[3], w_body[3], w[3];
+	quaternion_matrix(q, A);
+	body_angular_momentum(q, &r.momentum[4*b], j);
+	for (int k = 0; k < 3; ++k)
+	{
+		w_body[k] = (r.inertia[3*b + k] > 0) ? j[k]/r.inertia[3*b + k] : 0;
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		w[k] = A[k][0]*w_body[0] + A[k][1]*w_body[1] + A[k][2]*w_body[2];
+	}
+
+	for (int s = r.body_site_start[b]; s < r.body_site_start[b+1]; ++s)
+	{
+		int t = r.site[2*s], i = r.site[2*s+1];
+		const double* bc = &r.body_coordinate[3*s];
+		double d[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			d[k] = A[k][0]*bc[0] + A[k][1]*bc[1] + A[k][2]*bc[2];
+		}
+		double* x = sim.position[t][i].data();
+		double* v = sim.velocity[t][i].data();
+		int* img = sim.image[t][i].data();
+		if(positions)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				double box = sim.box_size_limits[k];
+				double u = r.position[3*b + k] + d[k];
+				double shift = std::floor(u/box);
+				x[k] = u - box*shift;
+				img[k] = (int)shift;
+			}
+			for (int m = 0; m < ORIENTATION_SIZE; ++m)
+			{
+				sim.orientation[t][i][m] = q[m];
+			}
+		}
+		v[0] = r.velocity[3*b] + w[1]*d[2] - w[2]*d[1];
+		v[1] = r.velocity[3*b + 1] + w[2]*d[0] - w[0]*d[2];
+		v[2] = r.velocity[3*b + 2] + w[0]*d[1] - w[1]*d[0];
+	}
+}
+
+/*******************************************************************************
+ * Reduces the accelerations of the sites of body b to its force and torque (about the centre of mass, box axes)
+ * Returns the sum of r.F over the sites (r from the centre of mass), for the virial.
+ ******************************************************************************/
+static double body_forces(System::simulation& sim, int b, double A[3][3])
+{
+	System::rigid_body_set& r = sim.rigid;
+	double f[3] = {0, 0, 0}, tau[3] = {0, 0, 0}, rf = 0;
+	for (int s = r.body_site_start[b]; s < r.body_site_start[b+1]; ++s)
+	{
+		int t = r.site[2*s], i = r.site[2*s+1];
+		const double* bc = &r.body_coordinate[3*s];
+		const double* a = sim.acceleration[t][i].data();
+		double m = sim.mass[t];
+		double d[3], fs[3];
+		#pragma omp simd
+		for (int k = 0; k < 3; ++k)
+		{
+			d[k] = A[k][0]*bc[0] + A[k][1]*bc[1] + A[k][2]*bc[2];
+			fs[k] = m*a[k];
+		}
+		#pragma omp simd reduction(+ : rf)
+		for (int k = 0; k < 3; ++k)
+		{
+			f[k] += fs[k];
+			rf += d[k]*fs[k];
+		}
+		tau[0] += d[1]*fs[2] - d[2]*fs[1];
+		tau[1] += d[2]*fs[0] - d[0]*fs[2];
+		tau[2] += d[0]*fs[1] - d[1]*fs[0];
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		r.force[3*b + k] = f[k];
+		r.torque[3*b + k] = tau[k];
+	}
+	return rf;
+}
+
+// Half kick of body b by dt/2 with its force and torque
+static void body_kick(System::simulation& sim, int b, double A[3][3], double dt)
+{
+	System::rigid_body_set& r = sim.rigid;
+	double tau_body[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		r.velocity[3*b + k] += 0.5*dt*r.force[3*b + k]/r.mass[b];
+		tau_body[k] = A[0][k]*r.torque[3*b] + A[1][k]*r.torque[3*b + 1] + A[2][k]*r.torque[3*b + 2];
+		if(r.inertia[3*b + k] <= 0)
+		{
+			tau_body[k] = 0;
+		}
+	}
+	momentum_add(&r.quaternion[4*b], tau_body, dt, &r.momentum[4*b]);
+}
+
+// Velocity and angular momentum of body b from the velocities of its sites
+static void body_from_sites(System::simulation& sim, int b)
+{
+	System::rigid_body_set& r = sim.rigid;
+	double A[3][3], v[3] = {0, 0, 0}, l[3] = {0, 0, 0}, j[3];
+	quaternion_matrix(&r.quaternion[4*b], A);
+	for (int s = r.body_site_start[b]; s < r.body_site_start[b+1]; ++s)
+	{
+		int t = r.site[2*s], i = r.site[2*s+1];
+		const double* bc = &r.body_coordinate[3*s];
+		const double* vs = sim.velocity[t][i].data();
+		double m = sim.mass[t];
+		double d[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			d[k] = A[k][0]*bc[0] + A[k][1]*bc[1] + A[k][2]*bc[2];
+			v[k] += m*vs[k];
+		}
+		l[0] += m*(d[1]*vs[2] - d[2]*vs[1]);
+		l[1] += m*(d[2]*vs[0] - d[0]*vs[2]);
+		l[2] += m*(d[0]*vs[1] - d[1]*vs[0]);
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		r.velocity[3*b + k] = v[k]/r.mass[b];
+		j[k] = (r.inertia[3*b + k] > 0) ? A[0][k]*l[0] + A[1][k]*l[1] + A[2][k]*l[2] : 0;
+	}
+	for (int m = 0; m < 4; ++m)
+	{
+		r.momentum[4*b + m] = 0;
+	}
+	momentum_add(&r.quaternion[4*b], j, 2, &r.momentum[4*b]);
+}
+
+// Eigenvalues (w) and eigenvectors (columns of V) of the symmetric 3x3 matrix T, by Jacobi rotations
+static void eigen_symmetric(double T[3][3], double w[3], double V[3][3])
+{
+	for (int a = 0; a < 3; ++a)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			V[a][c] = (a == c) ? 1 : 0;
+		}
+	}
+	for (int sweep = 0; sweep < 50; ++sweep)
+	{
+		double off = std::abs(T[0][1]) + std::abs(T[0][2]) + std::abs(T[1][2]);
+		if(off <= 1e-15*(std::abs(T[0][0]) + std::abs(T[1][1]) + std::abs(T[2][2])))
+		{
+			break;
+		}
+		for (int p = 0; p < 2; ++p)
+		{
+			for (int q = p + 1; q < 3; ++q)
+			{
+				if(T[p][q] == 0)
+				{
+					continue;
+				}
+				double theta = 0.5*(T[q][q] - T[p][p])/T[p][q];
+				double t = std::copysign(1.0, theta)/(std::abs(theta) + std::sqrt(theta*theta + 1));
+				double c = 1/std::sqrt(t*t + 1), s = t*c;
+				for (int k = 0; k < 3; ++k)
+				{
+					double tkp = T[k][p], tkq = T[k][q];
+					T[k][p] = c*tkp - s*tkq;
+					T[k][q] = s*tkp + c*tkq;
+				}
+				for (int k = 0; k < 3; ++k)
+				{
+					double tpk = T[p][k], tqk = T[q][k];
+					T[p][k] = c*tpk - s*tqk;
+					T[q][k] = s*tpk + c*tqk;
+				}
+				for (int k = 0; k < 3; ++k)
+				{
+					double vkp = V[k][p], vkq = V[k][q];
+					V[k][p] = c*vkp - s*vkq;
+					V[k][q] = s*vkp + c*vkq;
+				}
+			}
+		}
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		w[k] = T[k][k];
+	}
+}
+
+// Unit quaternion of the rotation matrix R
+static void matrix_quaternion(double R[3][3], double* q)
+{
+	double trace = R[0][0] + R[1][1] + R[2][2];
+	if(trace > 0)
+	{
+		double s = 2*std::sqrt(trace + 1);
+		q[0] = 0.25*s; q[1] = (R[2][1] - R[1][2])/s; q[2] = (R[0][2] - R[2][0])/s; q[3] = (R[1][0] - R[0][1])/s;
+	}
+	else if(R[0][0] > R[1][1] && R[0][0] > R[2][2])
+	{
+		double s = 2*std::sqrt(1 + R[0][0] - R[1][1] - R[2][2]);
+		q[0] = (R[2][1] - R[1][2])/s; q[1] = 0.25*s; q[2] = (R[0][1] + R[1][0])/s; q[3] = (R[0][2] + R[2][0])/s;
+	}
+	else if(R[1][1] > R[2][2])
+	{
+		double s = 2*std::sqrt(1 + R[1][1] - R[0][0] - R[2][2]);
+		q[0] = (R[0][2] - R[2][0])/s; q[1] = (R[0][1] + R[1][0])/s; q[2] = 0.25*s; q[3] = (R[1][2] + R[2][1])/s;
+	}
+	else
+	{
+		double s = 2*std::sqrt(1 + R[2][2] - R[0][0] - R[1][1]);
+		q[0] = (R[1][0] - R[0][1])/s; q[1] = (R[0][2] + R[2][0])/s; q[2] = (R[1][2] + R[2][1])/s; q[3] = 0.25*s;
+	}
+	double n = std::sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+	for (int m = 0; m < 4; ++m)
+	{
+		q[m] /= n;
+	}
+}
+
+void add_rigid_body(System::simulation& sim, const std::vector<int>& sites)
+{
+	System::rigid_body_set& r = sim.rigid;
+	if(sites.size()%2 != 0 || sites.size() < 4)
+	{
+		std::cerr<<"Error 0014"<<std::endl;
+		exit(14);
+	}
+	try{
+		r.site.insert(r.site.end(), sites.begin(), sites.end());
+		r.body_site_start.push_back(r.site.size()/2);
+		r.mass.push_back(0);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+}
+
+void initialize_rigid_bodies(System::simulation& sim)
+{
+	System::rigid_body_set& r = sim.rigid;
+	int n_bodies = r.n_bodies();
+	int n_sites = r.site.size()/2;
+	bool allowed = sim.n_dimensions == 3 && sim.periodic_boundary == 1 && sim.respa_steps == 1 && (sim.barostat == NULL || sim.barostat == no_barostat);
+#ifdef MDGEN_MPI
+	//The sites of a body could be owned by different ranks
+	allowed = false;
+#endif
+	if(n_bodies > 0 && !allowed)
+	{
+		std::cerr<<"Error 0014"<<std::endl;
+		exit(14);
+	}
+
+	//Every site must exist and be in only one body, and not be constrained otherwise
+	std::vector<std::vector<char>> used(sim.n_types);
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		used[i].assign(sim.n_particles[i], 0);
+	}
+	for (size_t a = 0; a < sim.constraints.atom.size(); a += 2)
+	{
+		int t = sim.constraints.atom[a], j = sim.constraints.atom[a+1];
+		if(t >= 0 && t < sim.n_types && j >= 0 && j < sim.n_particles[t])
+		{
+			used[t][j] = 1;
+		}
+	}
+	for (int s = 0; s < n_sites; ++s)
+	{
+		int t = r.site[2*s], j = r.site[2*s+1];
+		if(t < 0 || t >= sim.n_types || j < 0 || j >= sim.n_particles[t] || used[t][j])
+		{
+			std::cerr<<"Error 0014"<<std::endl;
+			exit(14);
+		}
+		used[t][j] = 1;
+	}
+
+	try{
+		r.body_coordinate.assign(3*n_sites, 0);
+		r.inertia.assign(3*n_bodies, 0);
+		r.position.assign(3*n_bodies, 0);
+		r.velocity.assign(3*n_bodies, 0);
+		r.quaternion.assign(4*n_bodies, 0);
+		r.momentum.assign(4*n_bodies, 0);
+		r.force.assign(3*n_bodies, 0);
+		r.torque.assign(3*n_bodies, 0);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+
+	for (int b = 0; b < n_bodies; ++b)
+	{
+		int first = r.body_site_start[b], last = r.body_site_start[b+1];
+		int n = last - first;
+
+		//Unwrapped positions of the sites, each the nearest image to the first one
+		std::vector<double> u(3*n);
+		const double* x0 = sim.position[r.site[2*first]][r.site[2*first+1]].data();
+		const int* img0 = sim.image[r.site[2*first]][r.site[2*first+1]].data();
+		double mass = 0, com[3] = {0, 0, 0};
+		for (int s = 0; s < n; ++s)
+		{
+			int t = r.site[2*(first + s)], j = r.site[2*(first + s)+1];
+			for (int k = 0; k < 3; ++k)
+			{
+				double box = sim.box_size_limits[k];
+				double d = sim.position[t][j][k] - x0[k];
+				d -= box*std::round(d/box);
+				u[3*s + k] = x0[k] + img0[k]*box + d;
+				com[k] += sim.mass[t]*u[3*s + k];
+			}
+			mass += sim.mass[t];
+		}
+		r.mass[b] = mass;
+
+		//Inertia tensor about the centre of mass, and its principal axes
+		double T[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+		for (int k = 0; k < 3; ++k)
+		{
+			com[k] /= mass;
+			r.position[3*b + k] = com[k];
+		}
+		for (int s = 0; s < n; ++s)
+		{
+			double m = sim.mass[r.site[2*(first + s)]];
+			double d[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				d[k] = u[3*s + k] - com[k];
+			}
+			double d2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+			for (int a = 0; a < 3; ++a)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					T[a][c] += m*(((a == c) ? d2 : 0) - d[a]*d[c]);
+				}
+			}
+		}
+		double w[3], R[3][3];
+		eigen_symmetric(T, w, R);
+		double det = R[0][0]*(R[1][1]*R[2][2] - R[1][2]*R[2][1]) - R[0][1]*(R[1][0]*R[2][2] - R[1][2]*R[2][0]) + R[0][2]*(R[1][0]*R[2][1] - R[1][1]*R[2][0]);
+		if(det < 0)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				R[k][2] = -R[k][2];
+			}
+		}
+		double largest = std::max(w[0], std::max(w[1], w[2]));
+		int linear = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			r.inertia[3*b + k] = (w[k] > 1e-10*largest) ? w[k] : 0;
+			linear += (r.inertia[3*b + k] == 0);
+		}
+		matrix_quaternion(R, &r.quaternion[4*b]);
+
+		//Positions of the sites in the principal axes
+		for (int s = 0; s < n; ++s)
+		{
+			for (int a = 0; a < 3; ++a)
+			{
+				double c = 0;
+				for (int k = 0; k < 3; ++k)
+				{
+					c += R[k][a]*(u[3*s + k] - com[k]);
+				}
+				r.body_coordinate[3*(first + s) + a] = c;
+			}
+		}
+
+		//3 degrees of freedom per site are replaced by 6 (5 for a linear body), taken evenly from the sites
+		double removed = (3.0*n - (6 - linear))/n;
+		for (int s = first; s < last; ++s)
+		{
+			sim.dof_removed[r.site[2*s]] += removed;
+		}
+
+		body_from_sites(sim, b);
+		place_sites(sim, b, true);
+	}
+
+	//The sites of a body do not interact with each other by the pair kernels
+	for (int b = 0; b < n_bodies; ++b)
+	{
+		for (int s = r.body_site_start[b]; s < r.body_site_start[b+1]; ++s)
+		{
+			for (int s2 = s + 1; s2 < r.body_site_start[b+1]; ++s2)
+			{
+				add_exclusion(sim, r.site[2*s], r.site[2*s+1], r.site[2*s2], r.site[2*s2+1]);
+			}
+		}
+	}
+	build_exclusions(sim);
+}
+
+void rigid_kick_drift(System::simulation& sim, double dt)
+{
+	System::rigid_body_set& r = sim.rigid;
+	#pragma omp parallel for schedule(static)
+	for (int b = 0; b < r.n_bodies(); ++b)
+	{
+		double A[3][3];
+		quaternion_matrix(&r.quaternion[4*b], A);
+		body_forces(sim, b, A);
+		body_kick(sim, b, A, dt);
+		for (int k = 0; k < 3; ++k)
+		{
+			r.position[3*b + k] += dt*r.velocity[3*b + k];
+		}
+		no_squish(&r.quaternion[4*b], &r.momentum[4*b], &r.inertia[3*b], dt);
+		place_sites(sim, b, true);
+	}
+}
+
+void rigid_kick(System::simulation& sim, double dt)
+{
+	System::rigid_body_set& r = sim.rigid;
+	const int energy = sim.energy_due;
+	double virial;
+	reduce_sum(r.n_bodies(), 1, &virial, [&](long b, double* sum)
+	{
+		double A[3][3];
+		quaternion_matrix(&r.quaternion[4*b], A);
+		double rf = body_forces(sim, b, A);
+		body_kick(sim, b, A, dt);
+		place_sites(sim, b, false);
+		if(energy)
+		{
+			//The rigid forces on the sites cancel r.F and provide the centripetal m|w x r|^2 (as v - V = w x r)
+			double centripetal = 0;
+			for (int s = r.body_site_start[b]; s < r.body_site_start[b+1]; ++s)
+			{
+				int t = r.site[2*s], i = r.site[2*s+1];
+				const double* v = sim.velocity[t][i].data();
+				for (int k = 0; k < 3; ++k)
+				{
+					double dv = v[k] - r.velocity[3*b + k];
+					centripetal += sim.mass[t]*dv*dv;
+				}
+			}
+			sum[0] -= rf + centripetal;
+		}
+	});
+	if(energy)
+	{
+		r.virial = virial;
+	}
+}
+
+void rigid_project(System::simulation& sim)
+{
+	System::rigid_body_set& r = sim.rigid;
+	#pragma omp parallel for schedule(static)
+	for (int b = 0; b < r.n_bodies(); ++b)
+	{
+		body_from_sites(sim, b);
+		place_sites(sim, b, false);
+	}
+}
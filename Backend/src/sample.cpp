@@ -0,0 +1,77 @@
+/** @file */
+#include "sample.h"
+#include "thermostat.h"
+#include "barostat.h"
+#include "timer.h"
+
+void register_observable(System::simulation& sim, void (*observable)(System::simulation&), int stride, int needs_energy)
+{
+	if(stride < 1)
+	{
+		std::cerr<<"Error 0007"<<std::endl;
+		exit(0007);
+	}
+	sim.observable.push_back(observable);
+	sim.observable_stride.push_back(stride);
+	sim.observable_energy.push_back(needs_energy);
+}
+
+int energy_due(System::simulation& sim, int state)
+{
+	if(sim.barostat != NULL && sim.barostat != no_barostat)
+	{
+		return 1;
+	}
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		if(sim.thermostat[i] == bussi)
+		{
+			return 1;
+		}
+	}
+	if(sim.adaptive.active && sim.adaptive.energy_tolerance > 0 && state % sim.adaptive.interval == 0)
+	{
+		return 1;
+	}
+	for (size_t o = 0; o < sim.observable.size(); ++o)
+	{
+		if(sim.observable_energy[o] == 1 && state % sim.observable_stride[o] == 0)
+		{
+			return 1;
+		}
+	}
+	for (size_t o = 0; o < sim.pipeline.observable.size(); ++o)
+	{
+		if(sim.pipeline.observable_energy[o] == 1 && state % sim.pipeline.observable_stride[o] == 0)
+		{
+			return 1;
+		}
+	}
+	if(sim.stream.active && (sim.stream.header()->fields & STREAM_ENERGIES) && state % sim.stream.stride == 0)
+	{
+#ifdef MDGEN_MPI
+		//The ranks would not agree on the wall-clock time, and the energies are summed over all of them
+		return 1;
+#else
+		//Only the frames which min_interval lets through
+		return stream_due(sim, state);
+#endif
+	}
+	return 0;
+}
+
+void sample(System::simulation& sim)
+{
+	TIME_PHASE(PHASE_SAMPLE);
+	for (size_t o = 0; o < sim.observable.size(); ++o)
+	{
+		if(sim.state % sim.observable_stride[o] == 0)
+		{
+			sim.observable[o](sim);
+		}
+	}
+	if(sim.pipeline.active)
+	{
+		pipeline_snapshot(sim);
+	}
+}
@@ -0,0 +1,141 @@
+/** @file */
+#include <algorithm>
+#include <omp.h>
+#include "step.h"
+#include "integrate.h"
+#include "thermostat.h"
+#include "barostat.h"
+#include "sample.h"
+#include "timer.h"
+#include "constraints.h"
+#include "rigid.h"
+#include "event.h"
+#include "pipeline.h"
+
+void md_step(System::simulation& sim)
+{
+	TIME_PHASE(PHASE_STEP);
+	sim.energy_due = energy_due(sim, sim.state + 1);
+
+	if(sim.events.active)
+	{
+		integrate_event_driven(sim);
+	}
+	else if(sim.respa_steps > 1)
+	{
+		integrate_respa(sim);
+	}
+	else if(sim.adaptive.active)
+	{
+		integrate_adaptive(sim);
+	}
+	else if(sim.periodic_boundary == 1)
+	{
+		integrate_verdet_periodic(sim);
+	}
+	else
+	{
+		integrate_verdet_box(sim);
+	}
+
+	call_thermostat(sim);
+	if(sim.constraints.n_groups() > 0)
+	{
+		//Velocities drawn by the thermostats (e.g. Andersen) are projected back onto the constraints
+		constrain_velocities(sim, 0);
+	}
+	if(sim.rigid.n_bodies() > 0)
+	{
+		rigid_project(sim);
+	}
+	if(sim.events.active)
+	{
+		//The events of particles whose velocities a thermostat may have changed are stale
+		for (int i = 0; i < sim.n_types; ++i)
+		{
+			if(sim.thermostat[i] != NULL && sim.thermostat[i] != no_thermostat)
+			{
+				event_predict_all(sim);
+				break;
+			}
+		}
+	}
+	call_barostat(sim);
+	sample(sim);
+}
+
+void md_steps(System::simulation& sim, int n)
+{
+	const int end = sim.state + n;
+	const int threads = omp_get_max_threads();
+	bool overlap = sim.pipeline.active && threads >= 2 && !omp_in_parallel();
+#ifdef MDGEN_MPI
+	//The observables would communicate from another thread than the timesteps
+	overlap = 0;
+#endif
+	if(!overlap)
+	{
+		while(sim.state < end)
+		{
+			md_step(sim);
+		}
+		pipeline_drain(sim);
+		return;
+	}
+
+	//Outer team of 2 : the master runs the timesteps (creating the tasks), the other thread runs the tasks from the barrier at the end of the region
+	const int analysis = std::min(std::max(1, sim.pipeline.threads), threads - 1);
+	const int levels = omp_get_max_active_levels();
+	omp_set_max_active_levels(2);
+	sim.pipeline.overlap = 1;
+	#pragma omp parallel num_threads(2)
+	{
+#ifdef MDGEN_NUMA
+		//The nested teams inherit the cores of the thread starting them : the first threads - 1 cores for the timesteps, the last analysis ones for the tasks
+		const int t = omp_get_thread_num();
+		numa_pin_block(t ? threads - analysis : 0, t ? analysis : threads - 1);
+#endif
+		#pragma omp master
+		{
+			const int pipeline_threads = sim.pipeline.threads;
+			sim.pipeline.threads = analysis;
+			while(sim.state < end)
+			{
+				//The threads of the observables are only taken from the timesteps while a snapshot is being sampled
+				int pending;
+				#pragma omp atomic read
+				pending = sim.pipeline.pending;
+				omp_set_num_threads(pending ? threads - analysis : threads - 1);
+				md_step(sim);
+			}
+			sim.pipeline.threads = pipeline_threads;
+		}
+#ifdef MDGEN_NUMA
+		#pragma omp barrier
+		numa_pin_block(t, 1);
+#endif
+	}
+	sim.pipeline.overlap = 0;
+	omp_set_max_active_levels(levels);
+	//The tasks are done (at the barrier of single), their output is still to be printed
+	pipeline_drain(sim);
+}
+
+void md_run(System::simulation& sim)
+{
+#ifdef MDGEN_PERF
+	perf_open();
+#endif
+	md_steps(sim, sim.total_steps - sim.state);
+
+#ifdef MDGEN_TIMING
+	timer_report(std::cerr);
+	timer_write_json(std::string(TIMER_REPORT_FILE) + ".json");
+	timer_write_csv(std::string(TIMER_REPORT_FILE) + ".csv");
+#endif
+#ifdef MDGEN_PERF
+	perf_report(sim, std::cerr);
+	perf_write_json(sim, PERF_REPORT_FILE);
+	perf_close();
+#endif
+}
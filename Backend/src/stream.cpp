@@ -0,0 +1,245 @@
+/** @file */
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "stream.h"
+#include "system.h"
+#include "sample.h"
+#include "timer.h"
+
+// Rounds bytes up to a multiple of ARENA_ALIGN, so that every slot starts on its own cache line
+static size_t stream_round(size_t bytes)
+{
+	return (bytes + ARENA_ALIGN - 1)/ARENA_ALIGN*ARENA_ALIGN;
+}
+
+void open_live_stream(System::simulation& sim, std::string name, int stride, double min_interval, int fields, int slots)
+{
+	const int n_types = sim.n_types;
+	const int dim = sim.n_dimensions;
+	bool allowed = stride >= 1 && slots >= 2 && min_interval >= 0 && !name.empty() && name.find('/') == std::string::npos;
+	allowed = allowed && (fields & (STREAM_POSITIONS | STREAM_VELOCITIES | STREAM_ENERGIES)) != 0 && !sim.stream.active;
+	if(!allowed)
+	{
+		std::cerr<<"Error 0018"<<std::endl;
+		exit(18);
+	}
+#ifdef MDGEN_MPI
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	name += "." + std::to_string(rank);
+#endif
+
+	//Layout of a slot : stream_slot, the per type scalars, the box, then the positions and velocities of each type
+	std::vector<uint64_t> capacity(n_types), offset_position(n_types, 0), offset_velocity(n_types, 0);
+	size_t offset = sizeof(System::stream_slot);
+	const size_t offset_n_particles = offset;
+	offset += n_types*sizeof(int64_t);
+	const size_t offset_energy_kinetic = offset;
+	offset += n_types*sizeof(double);
+	const size_t offset_temperature = offset;
+	offset += n_types*sizeof(double);
+	const size_t offset_box = offset;
+	offset += dim*sizeof(double);
+	for (int i = 0; i < n_types; ++i)
+	{
+		//With MDGEN_MPI the arrays keep the global size, the most particles a rank may own
+		capacity[i] = sim.position[i].size();
+		if(fields & STREAM_POSITIONS)
+		{
+			offset_position[i] = offset;
+			offset += capacity[i]*dim*sizeof(double);
+		}
+		if(fields & STREAM_VELOCITIES)
+		{
+			offset_velocity[i] = offset;
+			offset += capacity[i]*dim*sizeof(double);
+		}
+	}
+	const size_t slot_bytes = stream_round(offset);
+	const size_t header_bytes = stream_round(sizeof(System::stream_header) + 3*n_types*sizeof(uint64_t));
+	const size_t bytes = header_bytes + slots*slot_bytes;
+
+	//A stream of an earlier run is unlinked rather than truncated, so that its readers do not fault on their mapping
+	const std::string path = "/" + name;
+	shm_unlink(path.c_str());
+	int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if(fd < 0)
+	{
+		std::cerr<<"Error 0018"<<std::endl;
+		exit(18);
+	}
+	void* map = MAP_FAILED;
+	if(ftruncate(fd, bytes) == 0)
+	{
+		map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		shm_unlink(path.c_str());
+		std::cerr<<"Error 0018"<<std::endl;
+		exit(18);
+	}
+
+	System::live_stream& st = sim.stream;
+	st.name = name;
+	st.bytes = bytes;
+	st.memory = std::shared_ptr<char>((char*)map, [bytes, path](char* p){
+		munmap(p, bytes);
+		shm_unlink(path.c_str());
+	});
+
+	//The slots are zero (sequence 0 : never written) after ftruncate, only the header is filled in
+	System::stream_header* h = st.header();
+	h->magic = STREAM_MAGIC;
+	h->version = STREAM_VERSION;
+	h->n_types = n_types;
+	h->n_dimensions = dim;
+	h->fields = fields;
+	h->slots = slots;
+	h->header_bytes = header_bytes;
+	h->slot_bytes = slot_bytes;
+	h->offset_n_particles = offset_n_particles;
+	h->offset_energy_kinetic = offset_energy_kinetic;
+	h->offset_temperature = offset_temperature;
+	h->offset_box = offset_box;
+	uint64_t* arrays = (uint64_t*)(st.memory.get() + sizeof(System::stream_header));
+	for (int i = 0; i < n_types; ++i)
+	{
+		arrays[i] = capacity[i];
+		arrays[n_types + i] = offset_position[i];
+		arrays[2*n_types + i] = offset_velocity[i];
+	}
+	h->frames.store(0, std::memory_order_release);
+
+	st.stride = stride;
+	st.min_interval = min_interval;
+	st.last_publish = -1e300;
+	st.skipped = 0;
+	st.due_state = -1;
+	st.active = 1;
+	//The energies are asked for by energy_due() for the frames which are published only
+	register_observable(sim, publish_frame, stride, 0);
+}
+
+/*******************************************************************************
+ * Copies the rows of a particle array into n*dim doubles, in one memcpy per run of rows contiguous in the arena
+ *
+ * The rows are allocated in order, so the rows of a type are one run unless some of them were allocated again elsewhere (e.g. on the heap).
+ *
+ * @param to Destination
+ * @param rows Rows of the type
+ * @param n Number of rows copied
+ * @param dim Values in a row
+ ******************************************************************************/
+static void stream_copy(char* to, System::particle_array& rows, int n, int dim)
+{
+	if(n == 0)
+	{
+		return;
+	}
+	const size_t row_bytes = dim*sizeof(double);
+	int j = 0;
+	while(j < n)
+	{
+		const double* first = rows[j].data();
+		int end = j + 1;
+		while(end < n && rows[end].data() == first + (end - j)*dim)
+		{
+			end++;
+		}
+		std::memcpy(to + j*row_bytes, first, (end - j)*row_bytes);
+		j = end;
+	}
+}
+
+int stream_due(System::simulation& sim, int state)
+{
+	System::live_stream& st = sim.stream;
+	if(!st.active)
+	{
+		return 0;
+	}
+	if(st.due_state != state)
+	{
+		st.due_state = state;
+		st.due = (omp_get_wtime() - st.last_publish >= st.min_interval);
+	}
+	return st.due;
+}
+
+void publish_frame(System::simulation& sim)
+{
+	TIME_PHASE(PHASE_WRITE);
+	System::live_stream& st = sim.stream;
+	if(!st.active)
+	{
+		return;
+	}
+	if(!stream_due(sim, sim.state))
+	{
+		st.skipped++;
+		return;
+	}
+	st.last_publish = omp_get_wtime();
+
+	System::stream_header* h = st.header();
+	const int n_types = sim.n_types;
+	const int dim = sim.n_dimensions;
+	const uint64_t* arrays = (const uint64_t*)(st.memory.get() + sizeof(System::stream_header));
+	const uint64_t frame = h->frames.load(std::memory_order_relaxed);
+	char* slot = st.memory.get() + h->header_bytes + (frame % h->slots)*h->slot_bytes;
+	System::stream_slot* s = (System::stream_slot*)slot;
+
+	//Odd while the slot is written : a reader which copied any of it meanwhile sees the sequence change
+	s->sequence.store(2*frame + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	const bool energies = h->fields & STREAM_ENERGIES;
+	s->state = sim.state;
+	s->time = sim.time;
+	s->energy_potential = energies ? sim.energy_potential : 0;
+	s->energy_total = energies ? sim.energy_total : 0;
+	s->virial = energies ? sim.virial : 0;
+	for (int i = 0; i < n_types; ++i)
+	{
+		((int64_t*)(slot + h->offset_n_particles))[i] = sim.n_particles[i];
+		((double*)(slot + h->offset_energy_kinetic))[i] = energies ? sim.energy_kinetic[i] : 0;
+		((double*)(slot + h->offset_temperature))[i] = energies ? sim.temperature[i] : 0;
+	}
+	std::memcpy(slot + h->offset_box, sim.box_size_limits.data(), dim*sizeof(double));
+	for (int i = 0; i < n_types; ++i)
+	{
+		if(arrays[n_types + i] != 0)
+		{
+			stream_copy(slot + arrays[n_types + i], sim.position[i], sim.n_particles[i], dim);
+		}
+		if(arrays[2*n_types + i] != 0)
+		{
+			stream_copy(slot + arrays[2*n_types + i], sim.velocity[i], sim.n_particles[i], dim);
+		}
+	}
+
+	s->sequence.store(2*frame + 2, std::memory_order_release);
+	h->frames.store(frame + 1, std::memory_order_release);
+}
+
+void close_live_stream(System::simulation& sim)
+{
+	System::live_stream& st = sim.stream;
+	for (size_t k = 0; k < sim.observable.size(); ++k)
+	{
+		if(sim.observable[k] == publish_frame)
+		{
+			sim.observable.erase(sim.observable.begin() + k);
+			sim.observable_stride.erase(sim.observable_stride.begin() + k);
+			sim.observable_energy.erase(sim.observable_energy.begin() + k);
+			break;
+		}
+	}
+	st.memory.reset();
+	st.bytes = 0;
+	st.active = 0;
+}
@@ -0,0 +1,247 @@
+/** @file */
+#include <cmath>
+#include <algorithm>
+#include "structure_factor.h"
+
+void initialize_structure_factor(System::simulation& sim)
+{
+#ifdef MDGEN_MPI
+	//The density modes would only be summed over the particles of each rank
+	std::cerr<<"Error 0021"<<std::endl;
+	exit(21);
+#endif
+	int dim = sim.n_dimensions;
+
+	//Shells have the width of the smallest wave vector
+	double lmax = 0;
+	for (int k = 0; k < dim; ++k)
+	{
+		lmax = std::max(lmax, sim.box_size_limits[k]);
+	}
+	double dk = 2*M_PI/lmax;
+	if(sim.sk_kmax <= 0)
+	{
+		sim.sk_kmax = SK_SHELLS*dk;
+	}
+
+	sim.sk_nmax.resize(dim);
+	int nmaxmax = 1; //The n = 1 row is always built
+	for (int k = 0; k < dim; ++k)
+	{
+		sim.sk_nmax[k] = (int)(sim.sk_kmax*sim.box_size_limits[k]/(2*M_PI));
+		nmaxmax = std::max(nmaxmax, sim.sk_nmax[k]);
+	}
+
+	//Going over all the integer vectors in [-nmax,nmax] and keeping the ones in the half space with |k| <= kmax
+	std::vector<std::pair<double,std::vector<int>>> found;
+	int n[dim];
+	for (int k = 0; k < dim; ++k)
+	{
+		n[k] = -sim.sk_nmax[k];
+	}
+	while(true)
+	{
+		int first = 0;
+		double k2 = 0;
+		for (int k = 0; k < dim; ++k)
+		{
+			if(first == 0)
+			{
+				first = n[k];
+			}
+			double kk = 2*M_PI*n[k]/sim.box_size_limits[k];
+			k2 += kk*kk;
+		}
+		if(first > 0 && k2 <= sim.sk_kmax*sim.sk_kmax)
+		{
+			found.push_back(std::make_pair(std::sqrt(k2), std::vector<int>(n, n+dim)));
+		}
+
+		int k = 0;
+		while(k < dim && n[k] == sim.sk_nmax[k])
+		{
+			n[k] = -sim.sk_nmax[k];
+			k++;
+		}
+		if(k == dim)
+		{
+			break;
+		}
+		n[k]++;
+	}
+	std::sort(found.begin(), found.end());
+
+	//Grouping into shells
+	sim.sk_vectors.clear();
+	sim.sk_shell_start.clear();
+	sim.sk_shell_k.clear();
+	int shell = -1;
+	for (size_t v = 0; v < found.size(); ++v)
+	{
+		int s = (int)std::lround(found[v].first/dk);
+		if(s != shell)
+		{
+			shell = s;
+			sim.sk_shell_start.push_back(v);
+			sim.sk_shell_k.push_back(0);
+		}
+		sim.sk_shell_k.back() += found[v].first;
+		sim.sk_vectors.insert(sim.sk_vectors.end(), found[v].second.begin(), found[v].second.end());
+	}
+	int n_shells = sim.sk_shell_start.size();
+	sim.sk_shell_start.push_back(found.size());
+	for (int s = 0; s < n_shells; ++s)
+	{
+		sim.sk_shell_k[s] /= (sim.sk_shell_start[s+1] - sim.sk_shell_start[s]);
+	}
+
+	try
+	{
+		sim.sk_sum.assign(n_shells, std::vector<double>(sim.n_types*sim.n_types, 0));
+		sim.sk_rho_re.resize(found.size()*sim.n_types);
+		sim.sk_rho_im.resize(found.size()*sim.n_types);
+		sim.sk_table_re.resize(dim*(nmaxmax+1)*SK_BLOCK);
+		sim.sk_table_im.resize(dim*(nmaxmax+1)*SK_BLOCK);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	sim.sk_samples = 0;
+}
+
+void sample_structure_factor(System::simulation& sim)
+{
+	int dim = sim.n_dimensions;
+	int nt = sim.n_types;
+	int n_shells = sim.sk_shell_k.size();
+	int nmaxmax = sim.sk_table_re.size()/(dim*SK_BLOCK) - 1;
+
+	std::fill(sim.sk_rho_re.begin(), sim.sk_rho_re.end(), 0);
+	std::fill(sim.sk_rho_im.begin(), sim.sk_rho_im.end(), 0);
+
+	double* table_re = sim.sk_table_re.data();
+	double* table_im = sim.sk_table_im.data();
+
+	for (int a = 0; a < nt; ++a)
+	{
+		for (int b0 = 0; b0 < sim.n_particles[a]; b0 += SK_BLOCK)
+		{
+			int nb = std::min(SK_BLOCK, sim.n_particles[a] - b0);
+
+			#pragma omp parallel
+			{
+				//Building e^{i n k_d x_d} for n = 0..nmax by recurrence from n = 1
+				for (int d = 0; d < dim; ++d)
+				{
+					double* re = table_re + d*(nmaxmax+1)*SK_BLOCK;
+					double* im = table_im + d*(nmaxmax+1)*SK_BLOCK;
+					double k0 = 2*M_PI/sim.box_size_limits[d];
+
+					#pragma omp for simd schedule(static)
+					for (int j = 0; j < nb; ++j)
+					{
+						double theta = k0*sim.position[a][b0+j][d];
+						re[j] = 1;
+						im[j] = 0;
+						re[SK_BLOCK + j] = std::cos(theta);
+						im[SK_BLOCK + j] = std::sin(theta);
+					}
+					for (int n = 2; n <= sim.sk_nmax[d]; ++n)
+					{
+						double* re_n = re + n*SK_BLOCK;
+						double* im_n = im + n*SK_BLOCK;
+						const double* re_p = re_n - SK_BLOCK;
+						const double* im_p = im_n - SK_BLOCK;
+						const double* re_1 = re + SK_BLOCK;
+						const double* im_1 = im + SK_BLOCK;
+
+						#pragma omp for simd schedule(static)
+						for (int j = 0; j < nb; ++j)
+						{
+							re_n[j] = re_p[j]*re_1[j] - im_p[j]*im_1[j];
+							im_n[j] = re_p[j]*im_1[j] + im_p[j]*re_1[j];
+						}
+					}
+				}
+
+				//Summing over the particles of the block for all wave vectors of a shell
+				#pragma omp for schedule(dynamic)
+				for (int s = 0; s < n_shells; ++s)
+				{
+					for (int v = sim.sk_shell_start[s]; v < sim.sk_shell_start[s+1]; ++v)
+					{
+						const double* row_re[dim];
+						const double* row_im[dim];
+						double sign[dim];
+						for (int d = 0; d < dim; ++d)
+						{
+							int n = sim.sk_vectors[v*dim + d];
+							int an = std::abs(n);
+							row_re[d] = table_re + (d*(nmaxmax+1) + an)*SK_BLOCK;
+							row_im[d] = table_im + (d*(nmaxmax+1) + an)*SK_BLOCK;
+							sign[d] = (n < 0) ? -1 : 1;
+						}
+
+						double sr = 0, si = 0;
+						#pragma omp simd reduction(+ : sr, si)
+						for (int j = 0; j < nb; ++j)
+						{
+							double er = 1, ei = 0;
+							for (int d = 0; d < dim; ++d)
+							{
+								double c = row_re[d][j];
+								double sn = sign[d]*row_im[d][j];
+								double t = er*c - ei*sn;
+								ei = er*sn + ei*c;
+								er = t;
+							}
+							sr += er;
+							si += ei;
+						}
+						sim.sk_rho_re[v*nt + a] += sr;
+						sim.sk_rho_im[v*nt + a] += si;
+					}
+				}
+			}
+		}
+	}
+
+	//Adding Re(rho_a rho_b^*) to the shell sums
+	#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < n_shells; ++s)
+	{
+		for (int v = sim.sk_shell_start[s]; v < sim.sk_shell_start[s+1]; ++v)
+		{
+			for (int a = 0; a < nt; ++a)
+			{
+				for (int b = 0; b < nt; ++b)
+				{
+					//Partial structure factors of an empty type stay 0
+					if(sim.n_particles[a] == 0 || sim.n_particles[b] == 0)
+					{
+						continue;
+					}
+					double re = sim.sk_rho_re[v*nt + a]*sim.sk_rho_re[v*nt + b] + sim.sk_rho_im[v*nt + a]*sim.sk_rho_im[v*nt + b];
+					sim.sk_sum[s][a*nt + b] += re/std::sqrt((double)sim.n_particles[a]*sim.n_particles[b]);
+				}
+			}
+		}
+	}
+
+	sim.sk_samples++;
+}
+
+double structure_factor(System::simulation& sim, int shell, int type1, int type2)
+{
+	int count = sim.sk_shell_start[shell+1] - sim.sk_shell_start[shell];
+	if(sim.sk_samples == 0 || count == 0)
+	{
+		return 0;
+	}
+	return sim.sk_sum[shell][type1*sim.n_types + type2]/((double)sim.sk_samples*count);
+}
@@ -0,0 +1,150 @@
+/** @file */
+#include <algorithm>
+#include <cmath>
+#include "tempering.h"
+#include "constants.h"
+#include "sample.h"
+#include "thermostat.h"
+#include "trng/yarn5.hpp"
+#include "trng/uniform01_dist.hpp"
+
+// Registered so that the energies are computed every stride timesteps (see energy_due())
+static void tempering_energy(System::simulation& sim)
+{
+	//Nothing to be done here
+}
+
+// Moves a replica to the temperature t_new (thermostat constants and velocities)
+static void tempering_set_temperature(System::simulation& sim, double t_old, double t_new)
+{
+	//Velocities which have not been given a temperature yet are left as they are
+	double scale = (t_old > 0) ? std::sqrt(t_new/t_old) : 1;
+	for (int i = 0; i < sim.n_types; ++i)
+	{
+		sim.temperature_required[i] = t_new;
+		for (int j = 0; j < sim.n_particles[i]; ++j)
+		{
+			for (int k = 0; k < sim.n_dimensions; ++k)
+			{
+				sim.velocity[i][j][k] *= scale;
+			}
+		}
+		sim.energy_kinetic[i] *= scale*scale;
+		sim.temperature[i] *= scale*scale;
+	}
+	for (int k = 0; k < sim.n_dimensions; ++k)
+	{
+		sim.momentum[k] *= scale;
+	}
+	initialize_thermostats(sim);
+}
+
+void initialize_tempering(System::ensemble& ens, System::tempering& rex, std::vector<double> ladder, int stride, unsigned long seed)
+{
+	int n = ladder.size();
+	if(n != ens.size())
+	{
+		std::cerr<<"Error 0010"<<std::endl;
+		exit(10);
+	}
+	try{
+		rex.ladder = ladder;
+		rex.slot.resize(n);
+		rex.replica_at.resize(n);
+		rex.attempts.assign(std::max(n-1, 0), 0);
+		rex.accepted.assign(std::max(n-1, 0), 0);
+	}
+	catch(const std::length_error& le){
+		std::cerr<<"Error 0001"<<std::endl;
+		exit(0001);
+	}
+	catch(const std::bad_alloc& ba){
+		std::cerr<<"Error 0002"<<std::endl;
+		exit(0002);
+	}
+	rex.stride = stride;
+	rex.rounds = 0;
+	rex.seed = seed;
+
+	for (int r = 0; r < n; ++r)
+	{
+		System::simulation& sim = ens.replica[r];
+		rex.slot[r] = r;
+		rex.replica_at[r] = r;
+		tempering_set_temperature(sim, sim.temperature_required[0], ladder[r]);
+		register_observable(sim, tempering_energy, stride, 1);
+	}
+}
+
+void tempering_exchange(System::ensemble& ens, System::tempering& rex)
+{
+	int n = rex.ladder.size();
+	System::simulation& first = ens.replica[0];
+
+	//A stream of its own for every round (as for the thermostats)
+	trng::yarn5 R;
+	if(rex.seed != 0)
+	{
+		R.seed(rex.seed);
+	}
+	R.split(first.total_steps + 1, first.state);
+	trng::uniform01_dist<> unif;
+
+	for (int i = rex.rounds%2; i + 1 < n; i += 2)
+	{
+		int a = rex.replica_at[i];
+		int b = rex.replica_at[i+1];
+		System::simulation& sa = ens.replica[a];
+		System::simulation& sb = ens.replica[b];
+		double beta_i = 1/(BOLTZ_SI*rex.ladder[i]);
+		double beta_j = 1/(BOLTZ_SI*rex.ladder[i+1]);
+		double delta = (beta_i - beta_j)*(sa.energy_potential - sb.energy_potential);
+
+		rex.attempts[i]++;
+		if(delta >= 0 || unif(R) < std::exp(delta))
+		{
+			rex.accepted[i]++;
+			tempering_set_temperature(sa, rex.ladder[i], rex.ladder[i+1]);
+			tempering_set_temperature(sb, rex.ladder[i+1], rex.ladder[i]);
+			rex.slot[a] = i + 1;
+			rex.slot[b] = i;
+			rex.replica_at[i] = b;
+			rex.replica_at[i+1] = a;
+		}
+	}
+	rex.rounds++;
+}
+
+void tempering_run(System::ensemble& ens, System::tempering& rex)
+{
+	int n = ens.size();
+	while(true)
+	{
+		bool running = false;
+		for (int r = 0; r < n; ++r)
+		{
+			running = running || (ens.replica[r].state < ens.replica[r].total_steps);
+		}
+		if(!running)
+		{
+			break;
+		}
+		//Up to the next multiple of the stride, where the energies have been computed
+		int steps = rex.stride - ens.replica[0].state%rex.stride;
+		ensemble_advance(ens, steps);
+		if(ens.replica[0].state%rex.stride == 0)
+		{
+			tempering_exchange(ens, rex);
+		}
+	}
+}
+
+void tempering_report(System::tempering& rex, std::ostream& out)
+{
+	out<<"pair,T_low,T_high,attempts,accepted,rate"<<std::endl;
+	for (size_t i = 0; i < rex.attempts.size(); ++i)
+	{
+		double rate = (rex.attempts[i] > 0) ? (double)rex.accepted[i]/rex.attempts[i] : 0;
+		out<<i<<"-"<<i+1<<","<<rex.ladder[i]<<","<<rex.ladder[i+1]<<","<<rex.attempts[i]<<","<<rex.accepted[i]<<","<<rate<<std::endl;
+	}
+}
@@ -23,4 +23,37 @@ void trans_ke(System::simulation& sim)
     {
         std::cout<<"KE of type "<<i<<" is "<<vel2sum[i]<<std::endl;
     }
-}
\ No newline at end of file
+}
+
+double box_volume(System::simulation& sim)
+{
+    double vol = 1;
+    for(int k = 0; k < sim.n_dimensions;++k)
+    {
+        vol *= sim.box_size_limits[k];
+    }
+    return vol;
+}
+
+void compute_pressure(System::simulation& sim)
+{
+    double vol = box_volume(sim);
+    double sum = sim.virial;
+    for(int i = 0; i < sim.n_types;++i)
+    {
+        sum += sim.energy_kinetic[i];
+    }
+    sim.pressure = sum/(sim.n_dimensions*vol);
+
+    //Tail correction (interactions are only called for type1 <= type2)
+    for(int i = 0; i < sim.n_types;++i)
+    {
+        for(int j = i; j < sim.n_types;++j)
+        {
+            if(sim.interaction[i][j] == lj_periodic || sim.interaction[i][j] == lj_box)
+            {
+                sim.pressure += sim.interaction_const[i][j][6]/(vol*vol);
+            }
+        }
+    }
+}
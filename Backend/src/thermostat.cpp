@@ -1,11 +1,12 @@
 #include "thermostat.h"
+#include "timer.h"
 #include "trng/yarn5.hpp"
 #include "trng/normal_dist.hpp"
 #include "trng/uniform01_dist.hpp"
 #include "trng/gamma_dist.hpp"
 
 void initialize_thermostats(System::simulation& sim){
-	for (int i = 0; i < n_types; ++i)
+	for (int i = 0; i < sim.n_types; ++i)
 	{
 		if(sim.thermostat[i] == no_thermostat){
 			// Do nothing
@@ -19,12 +20,13 @@ void initialize_thermostats(System::simulation& sim){
 			double f1 = sim.timestep/sim.thermostat_const[i][0];
 			sim.thermostat_const[i][1] = 1 + f1 + (f1*f1/2) + (f1*f1*f1/6) + (f1*f1*f1*f1/24);
 			sim.thermostat_const[i][2] = (f1 + (f1*f1/2) + (f1*f1*f1/6) + (f1*f1*f1*f1/24))*std::sqrt(sim.temperature_required[i]/2);
-			sim.thermostat_const[i][3] = std::sqrt(a*b);
+			sim.thermostat_const[i][3] = 2*std::sqrt(sim.thermostat_const[i][1]*sim.thermostat_const[i][2]);
 		}
 	}
 }
 
 void call_thermostat(System::simulation& sim){
+	TIME_PHASE(PHASE_THERMOSTAT);
 	#pragma omp parallel for
 	for (int i = 0; i < sim.n_types; ++i)
 	{
@@ -37,26 +39,44 @@ void no_thermostat(System::simulation& sim, int type){
 }
 
 void anderson(System::simulation& sim, int type){
-	#pragma omp target teams distribute parallel for collapse(2)
+	int ranks = 1, rank = 0;
+	long streams = sim.n_particles[type];
+#ifdef MDGEN_MPI
+	//The particles are numbered per rank, so each rank draws from its own streams
+	if(sim.domain.comm != MPI_COMM_NULL)
+	{
+		ranks = sim.domain.size;
+		rank = sim.domain.rank;
+		streams = sim.domain.n_particles_global[type];
+	}
+#endif
+	#pragma omp target teams distribute parallel for collapse(2) schedule(static)
 	for (int j = 0; j < sim.n_particles[type]; ++j)
 	{
 		for (int k = 0; k < sim.n_dimensions; ++k)
 		{
 			trng::yarn5 R;
+			if(sim.seed != 0)
+			{
+				R.seed(sim.seed);
+			}
 
 			R.split(sim.total_steps,sim.state);
 
 			R.split(sim.n_types,type);
 			
 			trng::uniform01_dist<> unif;
-			trng::normal_dist<> norm(0,sim.thermostat_const[i][1]);
+			trng::normal_dist<> norm(0,sim.thermostat_const[type][1]);
 
-			int size = omp_get_num_threads();
-			int rank = omp_get_thread_num();
+			if(ranks > 1)
+			{
+				R.split(ranks, rank);
+			}
 
-			R.split(size,rank);
+			//One stream per particle and dimension, so that the draws do not depend on the threads
+			R.split(streams*sim.n_dimensions, j*sim.n_dimensions + k);
 
-			if(unif(R) <= sim.thermostat_const[j][0]*(sim.timestep)){
+			if(unif(R) <= sim.thermostat_const[type][0]*(sim.timestep)){
 				sim.velocity[type][j][k] = norm(R);
 			}
 		}
@@ -66,10 +86,15 @@ void anderson(System::simulation& sim, int type){
 void bussi(System::simulation& sim,int type){
 
 	trng::yarn5 rang;
+	if(sim.seed != 0)
+	{
+		rang.seed(sim.seed);
+	}
 
 	rang.split(sim.total_steps,sim.state);
 
 	rang.split(sim.n_types,type);
+	//With MDGEN_MPI, every rank draws the same numbers and energy_kinetic is the sum over the ranks, so they all scale by the same alpha
 	
 	trng::normal_dist<> norm(0,1);
 
@@ -88,15 +113,15 @@ void bussi(System::simulation& sim,int type){
  		r2sum += r[i]*r[i];
  	}
 
- 	alpha2 = thermostat_const[type][1] + thermostat_const[type][2]*r2sum/sim.energy_kinetic[type] + thermostat_const[type][3]*r[0]/std::sqrt(sim.energy_kinetic[type]);
+ 	alpha2 = sim.thermostat_const[type][1] + sim.thermostat_const[type][2]*r2sum/sim.energy_kinetic[type] + sim.thermostat_const[type][3]*r[0]/std::sqrt(sim.energy_kinetic[type]);
 
  	alpha = std::sqrt(alpha2);
-	#pragma omp target teams distribute parallel for collapse(2)
+	#pragma omp target teams distribute parallel for collapse(2) schedule(static)
 	for (int j = 0; j < sim.n_particles[type]; ++j)
 	{
 		for (int k = 0; k < sim.n_dimensions; ++k)
 		{
-			sim.velocity[type][k] *= alpha;
+			sim.velocity[type][j][k] *= alpha;
 		}
 	}
 }
\ No newline at end of file
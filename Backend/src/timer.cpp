@@ -0,0 +1,215 @@
+/** @file */
+#include <cmath>
+#include <vector>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+#include "timer.h"
+
+struct timer_stats
+{
+	long count;
+	double total;
+	double min;
+	double max;
+	long hist[TIMER_BINS];
+};
+
+static std::mutex timer_mutex;
+static std::vector<timer_stats*> timer_threads; // Statistics of every thread which has recorded anything
+
+// Returns the statistics of the calling thread (allocated on first use)
+static timer_stats* timer_thread_stats()
+{
+	thread_local timer_stats* stats = NULL;
+	if(stats == NULL)
+	{
+		stats = new timer_stats[TIMER_PHASES]();
+		std::lock_guard<std::mutex> lock(timer_mutex);
+		timer_threads.push_back(stats);
+	}
+	return stats;
+}
+
+static int timer_bin(double seconds)
+{
+	double ns = seconds*1e9;
+	if(ns < 1)
+	{
+		return 0;
+	}
+	int e;
+	double m = std::frexp(ns, &e); // ns = m*2^e with m in [0.5,1)
+	int bin = 8*(e-1) + (int)((m - 0.5)*16);
+	return std::min(bin, TIMER_BINS-1);
+}
+
+static double timer_bin_value(int bin)
+{
+	// Middle of the bin in seconds
+	return std::ldexp(1 + (bin%8 + 0.5)/8, bin/8)*1e-9;
+}
+
+void timer_record(int phase, double seconds)
+{
+	timer_stats& s = timer_thread_stats()[phase];
+	if(s.count == 0 || seconds < s.min)
+	{
+		s.min = seconds;
+	}
+	if(seconds > s.max)
+	{
+		s.max = seconds;
+	}
+	s.count++;
+	s.total += seconds;
+	s.hist[timer_bin(seconds)]++;
+}
+
+int timer_pair_phase(int type1, int type2)
+{
+	type1 = std::min(type1, TIMER_MAX_TYPES-1);
+	type2 = std::min(type2, TIMER_MAX_TYPES-1);
+	return PHASE_PAIR + type1*TIMER_MAX_TYPES + type2;
+}
+
+std::string timer_phase_name(int phase)
+{
+	switch(phase)
+	{
+		case PHASE_STEP : return "step";
+		case PHASE_INTEGRATE_FIRST : return "integrate_first";
+		case PHASE_INTERACT : return "interact";
+		case PHASE_INTEGRATE_SECOND : return "integrate_second";
+		case PHASE_THERMOSTAT : return "thermostat";
+		case PHASE_BAROSTAT : return "barostat";
+		case PHASE_SAMPLE : return "sample";
+		case PHASE_CORRELATE : return "correlate";
+		case PHASE_WRITE : return "write";
+		case PHASE_COMMUNICATE : return "communicate";
+		case PHASE_PME : return "pme";
+	}
+	int p = phase - PHASE_PAIR;
+	return "interaction(" + std::to_string(p/TIMER_MAX_TYPES) + "," + std::to_string(p%TIMER_MAX_TYPES) + ")";
+}
+
+void timer_reset()
+{
+	std::lock_guard<std::mutex> lock(timer_mutex);
+	for (size_t t = 0; t < timer_threads.size(); ++t)
+	{
+		std::fill(timer_threads[t], timer_threads[t] + TIMER_PHASES, timer_stats());
+	}
+}
+
+// Statistics of a phase merged over all threads
+struct timer_summary
+{
+	long count;
+	double total, min, max, p50, p90, p99;
+	std::vector<double> thread_total;
+};
+
+static timer_summary timer_merge(int phase)
+{
+	timer_summary r;
+	r.count = 0;
+	r.total = 0;
+	r.min = 0;
+	r.max = 0;
+	std::vector<long> hist(TIMER_BINS, 0);
+
+	std::lock_guard<std::mutex> lock(timer_mutex);
+	for (size_t t = 0; t < timer_threads.size(); ++t)
+	{
+		const timer_stats& s = timer_threads[t][phase];
+		r.thread_total.push_back(s.total);
+		if(s.count == 0)
+		{
+			continue;
+		}
+		r.min = (r.count == 0) ? s.min : std::min(r.min, s.min);
+		r.max = std::max(r.max, s.max);
+		r.count += s.count;
+		r.total += s.total;
+		for (int b = 0; b < TIMER_BINS; ++b)
+		{
+			hist[b] += s.hist[b];
+		}
+	}
+
+	double* p[3] = {&r.p50, &r.p90, &r.p99};
+	double frac[3] = {0.5, 0.9, 0.99};
+	for (int q = 0; q < 3; ++q)
+	{
+		long target = (long)std::ceil(frac[q]*r.count);
+		long sum = 0;
+		*p[q] = 0;
+		for (int b = 0; b < TIMER_BINS; ++b)
+		{
+			sum += hist[b];
+			if(sum >= target && sum > 0)
+			{
+				*p[q] = std::min(std::max(timer_bin_value(b), r.min), r.max);
+				break;
+			}
+		}
+	}
+	return r;
+}
+
+void timer_report(std::ostream& out)
+{
+	double step = timer_merge(PHASE_STEP).total;
+	out<<"phase,calls,total(s),mean(s),p50(s),p90(s),p99(s),%step"<<std::endl;
+	for (int phase = 0; phase < TIMER_PHASES; ++phase)
+	{
+		timer_summary r = timer_merge(phase);
+		if(r.count == 0)
+		{
+			continue;
+		}
+		out<<timer_phase_name(phase)<<","<<r.count<<","<<r.total<<","<<r.total/r.count<<","<<r.p50<<","<<r.p90<<","<<r.p99<<",";
+		out<<((step > 0) ? 100*r.total/step : 0)<<std::endl;
+	}
+}
+
+void timer_write_json(std::string filename)
+{
+	std::ofstream out(filename);
+	out<<"{\"phases\":[";
+	bool first = true;
+	for (int phase = 0; phase < TIMER_PHASES; ++phase)
+	{
+		timer_summary r = timer_merge(phase);
+		if(r.count == 0)
+		{
+			continue;
+		}
+		out<<(first ? "" : ",")<<"\n{\"name\":\""<<timer_phase_name(phase)<<"\",\"calls\":"<<r.count;
+		out<<",\"total\":"<<r.total<<",\"mean\":"<<r.total/r.count<<",\"min\":"<<r.min<<",\"max\":"<<r.max;
+		out<<",\"p50\":"<<r.p50<<",\"p90\":"<<r.p90<<",\"p99\":"<<r.p99<<",\"thread_total\":[";
+		for (size_t t = 0; t < r.thread_total.size(); ++t)
+		{
+			out<<(t ? "," : "")<<r.thread_total[t];
+		}
+		out<<"]}";
+		first = false;
+	}
+	out<<"\n]}"<<std::endl;
+}
+
+void timer_write_csv(std::string filename)
+{
+	std::ofstream out(filename);
+	out<<"phase,calls,total,mean,min,max,p50,p90,p99"<<std::endl;
+	for (int phase = 0; phase < TIMER_PHASES; ++phase)
+	{
+		timer_summary r = timer_merge(phase);
+		if(r.count == 0)
+		{
+			continue;
+		}
+		out<<timer_phase_name(phase)<<","<<r.count<<","<<r.total<<","<<r.total/r.count<<","<<r.min<<","<<r.max<<","<<r.p50<<","<<r.p90<<","<<r.p99<<std::endl;
+	}
+}
@@ -1,27 +1,57 @@
 #include"write.h"
+#include"thermo.h"
+#include"timer.h"
 
-// for now this just dumps positions and velocities on the screen on the screen. later we can use it to write onto a file.
+// Dumps positions, velocities and accelerations on sim.output (the screen unless the simulation is a replica of an ensemble)
 void write_traj(System::simulation& sim)
 {
+    TIME_PHASE(PHASE_WRITE);
     for(int i = 0; i < sim.n_types;++i)
     {
         for(int j = 0; j < sim.n_particles[i];++j)
         {
-            std::cout<<sim.state<<","<<i<<","<<j<<",";
+            (*sim.output)<<sim.state<<","<<i<<","<<j<<",";
             for(int k = 0; k < sim.n_dimensions;++k)
             {
-               std::cout<<sim.position[i][j][k]<<",";
+               (*sim.output)<<sim.position[i][j][k]<<",";
             }
             for(int k = 0; k < sim.n_dimensions;++k)
             {
-               std::cout<<sim.velocity[i][j][k]<<",";
+               (*sim.output)<<sim.velocity[i][j][k]<<",";
             }
             for(int k = 0; k < sim.n_dimensions;++k)
             {
-               std::cout<<sim.acceleration[i][j][k]<<",";
+               (*sim.output)<<sim.acceleration[i][j][k]<<",";
             }
-            std::cout<<std::endl;
+            (*sim.output)<<std::endl;
         }   
     
     }
-}
\ No newline at end of file
+}
+
+void write_energy(System::simulation& sim)
+{
+    (*sim.output)<<sim.state<<","<<sim.time<<","<<sim.energy_total<<","<<sim.energy_potential;
+    for(int i = 0; i < sim.n_types;++i)
+    {
+        (*sim.output)<<","<<sim.energy_kinetic[i];
+    }
+    (*sim.output)<<std::endl;
+}
+
+void write_temperature(System::simulation& sim)
+{
+    (*sim.output)<<sim.state<<","<<sim.time;
+    for(int i = 0; i < sim.n_types;++i)
+    {
+        (*sim.output)<<","<<sim.temperature[i];
+    }
+    (*sim.output)<<std::endl;
+}
+
+
+void write_pressure(System::simulation& sim)
+{
+    compute_pressure(sim);
+    (*sim.output)<<sim.state<<","<<sim.time<<","<<sim.pressure<<","<<box_volume(sim)<<std::endl;
+}
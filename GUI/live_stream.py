@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Reader of the live stream a simulation publishes into POSIX shared memory (see open_live_stream() in stream.h).
+
+The engine writes each frame into the next slot of a ring under a seqlock and never waits for the readers. A reader maps
+the shared memory read-only, takes the latest frame and copies it; if the engine rewrote the slot meanwhile (the sequence
+of the slot changed), the copy is thrown away and the latest frame is taken again. Reading therefore never blocks the
+simulation, and a frame is never seen half written.
+
+Example (monitor the stream "mdgen" twice a second) :
+    python3 live_stream.py mdgen --interval 0.5
+
+In a visualizer :
+    stream = LiveStream("mdgen")
+    frame = stream.latest()
+    if frame is not None:
+        draw(frame.position[0])
+"""
+
+import argparse
+import mmap
+import os
+import struct
+import time
+
+import numpy as np
+
+# Must match STREAM_MAGIC and STREAM_VERSION in algorithm_constants.h
+STREAM_MAGIC = int.from_bytes(b"MDGSTRM1", "little")
+STREAM_VERSION = 1
+
+# Fields of the frames (STREAM_ in algorithm_constants.h)
+STREAM_POSITIONS = 1
+STREAM_VELOCITIES = 2
+STREAM_ENERGIES = 4
+
+# stream_header (13 fields of 8 bytes, frames last) and the fixed part of stream_slot (sequence first)
+HEADER = struct.Struct("<13Q")
+SLOT = struct.Struct("<Qqdddd")
+
+# Attempts at copying a consistent frame before giving up (the engine would have to rewrite the slot every time)
+RETRIES = 100
+
+
+class Frame:
+    """One frame of the stream : timestep, time, energies and the per type arrays (copies, not views)"""
+
+    def __init__(self, frame, state, time, energy_potential, energy_total, virial, n_particles, energy_kinetic,
+                 temperature, box, position, velocity):
+        self.frame = frame
+        self.state = state
+        self.time = time
+        self.energy_potential = energy_potential
+        self.energy_total = energy_total
+        self.virial = virial
+        self.n_particles = n_particles
+        self.energy_kinetic = energy_kinetic
+        self.temperature = temperature
+        self.box = box
+        self.position = position  # One (n_particles, n_dimensions) array per type (None without STREAM_POSITIONS)
+        self.velocity = velocity  # Same, None without STREAM_VELOCITIES
+
+
+class LiveStream:
+    """Read-only mapping of the stream name (the file /dev/shm/name on Linux)"""
+
+    def __init__(self, name, directory="/dev/shm"):
+        fd = os.open(os.path.join(directory, name), os.O_RDONLY)
+        try:
+            self.map = mmap.mmap(fd, 0, prot=mmap.PROT_READ)
+        finally:
+            os.close(fd)
+        header = HEADER.unpack_from(self.map, 0)
+        (magic, version, self.n_types, self.n_dimensions, self.fields, self.slots, self.header_bytes, self.slot_bytes,
+         self.offset_n_particles, self.offset_energy_kinetic, self.offset_temperature, self.offset_box, _) = header
+        if magic != STREAM_MAGIC or version != STREAM_VERSION:
+            raise ValueError("%s is not a live stream of version %d" % (name, STREAM_VERSION))
+        arrays = struct.unpack_from("<%dQ" % (3*self.n_types), self.map, HEADER.size)
+        self.capacity = arrays[:self.n_types]
+        self.offset_position = arrays[self.n_types:2*self.n_types]
+        self.offset_velocity = arrays[2*self.n_types:]
+
+    def close(self):
+        self.map.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def frames(self):
+        """Number of frames published so far"""
+        return struct.unpack_from("<Q", self.map, HEADER.size - 8)[0]
+
+    def latest(self):
+        """Copy of the latest complete frame, or None if nothing has been published yet"""
+        for _ in range(RETRIES):
+            frames = self.frames()
+            if frames == 0:
+                return None
+            frame = frames - 1
+            start = self.header_bytes + (frame % self.slots)*self.slot_bytes
+            sequence = struct.unpack_from("<Q", self.map, start)[0]
+            if sequence != 2*frame + 2:
+                continue
+            data = self.map[start:start + self.slot_bytes]
+            if struct.unpack_from("<Q", self.map, start)[0] != sequence:
+                continue
+            return self._frame(frame, data)
+        return None
+
+    def _frame(self, frame, data):
+        _, state, time_, energy_potential, energy_total, virial = SLOT.unpack_from(data, 0)
+        n = np.frombuffer(data, np.int64, self.n_types, self.offset_n_particles)
+        dim = self.n_dimensions
+        position, velocity = None, None
+        if self.fields & STREAM_POSITIONS:
+            position = [np.frombuffer(data, np.float64, n[t]*dim, self.offset_position[t]).reshape(n[t], dim)
+                        for t in range(self.n_types)]
+        if self.fields & STREAM_VELOCITIES:
+            velocity = [np.frombuffer(data, np.float64, n[t]*dim, self.offset_velocity[t]).reshape(n[t], dim)
+                        for t in range(self.n_types)]
+        return Frame(frame, state, time_, energy_potential, energy_total, virial, n.copy(),
+                     np.frombuffer(data, np.float64, self.n_types, self.offset_energy_kinetic).copy(),
+                     np.frombuffer(data, np.float64, self.n_types, self.offset_temperature).copy(),
+                     np.frombuffer(data, np.float64, dim, self.offset_box).copy(), position, velocity)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Prints the latest frame of a live stream at regular intervals")
+    parser.add_argument("name", help="name of the stream (as given to open_live_stream)")
+    parser.add_argument("--interval", type=float, default=1.0, help="seconds between two lines")
+    args = parser.parse_args()
+
+    with LiveStream(args.name) as stream:
+        print("frame,state,time,energy_total,energy_potential," +
+              ",".join("temperature_%d" % t for t in range(stream.n_types)))
+        last = None
+        while True:
+            frame = stream.latest()
+            if frame is not None and frame.frame != last:
+                last = frame.frame
+                print("%d,%d,%g,%g,%g,%s" % (frame.frame, frame.state, frame.time, frame.energy_total,
+                                             frame.energy_potential, ",".join("%g" % x for x in frame.temperature)),
+                      flush=True)
+            time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    main()